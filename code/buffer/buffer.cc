@@ -29,9 +29,32 @@ const char* Buffer::Peek() const {
     return &buffer_[readPos_];
 }
 
+const char* Buffer::Linearize() {
+    if(readPos_ > writePos_) {
+        size_t readable = ReadableBytes();
+        size_t firLen = size() - readPos_;
+        if(firLen <= readPos_ - writePos_) {
+            // 中间的空闲区放得下第一段：第二段[0, writePos_)后移firLen，再把第一段搬到开头，只拷贝可读数据
+            memmove(BeginPtr_() + firLen, BeginPtr_(), writePos_);
+            memcpy(BeginPtr_(), BeginPtr_() + readPos_, firLen);
+        }
+        else {
+            // 缓冲区接近满，原地旋转整个缓冲区，不分配临时内存
+            std::rotate(BeginPtr_(), BeginPtr_() + readPos_, BeginPtr_() + size());
+        }
+        readPos_ = 0;
+        writePos_ = readable;
+    }
+    return Peek();
+}
+
 void Buffer::Retrieve(size_t len) {
     // assert(len <= ReadableBytes());
     readPos_ = (readPos_ + len) % size();
+    if(readPos_ == writePos_) {
+        // 读空了就回到开头，下一批数据从头写，尽量不回绕，解析时也就不用Linearize搬数据
+        readPos_ = writePos_ = 0;
+    }
 }
 
 void Buffer::RetrieveUntil(const char* end) {
@@ -81,8 +104,8 @@ void Buffer::HasWritten(size_t len) {
     writePos_ = (writePos_ + len)%size();
 } 
 
-void Buffer::Append(const std::string& str) {
-    Append(str.data(), str.length());
+void Buffer::Append(std::string_view str) {
+    Append(str.data(), str.size());
 }
 
 void Buffer::Append(const void* data, size_t len) {
@@ -98,7 +121,7 @@ void Buffer::Append(const char* str, size_t len) {
         size_t firLen = std::min(len, size() - writePos_);
         std::copy(str, str + firLen, BeginWrite());
         if(firLen < len) {
-            std::copy(str + firLen + 1, str + len, BeginPtr_());
+            std::copy(str + firLen, str + len, BeginPtr_());
         }
     }
     else {
@@ -120,29 +143,25 @@ void Buffer::EnsureWriteable(size_t len) {
 }
 
 void Buffer::MakeSpace_(size_t len) {
-    if(WritableBytes()  < len) {
-        // assert(writePos_ + len + 1 < buffer_.max_size());
-        buffer_.resize(writePos_ + len + 1);
-    } 
-    else {
-        size_t readable = ReadableBytes();
-        /* 
-            如果readPos_ <= writePos_,那就不用修改
-            否则我们需要拷贝两次
-        */
-        if(readPos_ <= writePos_) {
-            std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
-        }
-        else {
-            std::string s = "";
-            if(writePos_ != 0) s.append(BeginPtr_(), BeginPtr_() + writePos_);
-            std::copy(BeginPtr_() + readPos_, BeginPtr_() + size(), BeginPtr_());
-            std::copy(s.begin(), s.end(), BeginPtr_() + size() - readPos_);
-        } 
-        readPos_ = 0;
-        writePos_ = readPos_ + readable;
-        // assert(readable == ReadableBytes());
+    /*
+        回绕时可读数据分成[readPos_, size())和[0, writePos_)两段，直接resize会把新空间插在两段中间，
+        所以先把可读数据搬到开头再扩容
+    */
+    size_t readable = ReadableBytes();
+    if(readPos_ > writePos_) {
+        std::rotate(BeginPtr_(), BeginPtr_() + readPos_, BeginPtr_() + size());
+    }
+    else if(readPos_ > 0) {
+        std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
+    }
+    readPos_ = 0;
+    writePos_ = readable;
+    if(WritableBytes() < len) {
+        // assert(readable + len + 1 < buffer_.max_size());
+        // 至少翻倍：慢速客户端一点点发来的大请求头，扩容搬数据的总开销才和字节数成正比
+        buffer_.resize(std::max(readable + len + 1, size() * 2));
     }
+    // assert(readable == ReadableBytes());
 }
 
 ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
@@ -168,10 +187,11 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
         cnt = 2;
     }
     else {
+        // 总共只能写writable个字节（要留一个空位区分空和满），末尾一段写不下的部分回绕到开头
         iov[0].iov_base = BeginPtr_() + writePos_;
-        iov[0].iov_len = size() - writePos_;
+        iov[0].iov_len = std::min(writable, size() - writePos_);
         iov[1].iov_base = BeginPtr_();
-        iov[1].iov_len = readPos_;
+        iov[1].iov_len = writable - iov[0].iov_len;
         
         iov[2].iov_base = buff;
         iov[2].iov_len = sizeof(buff);
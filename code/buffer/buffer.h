@@ -5,7 +5,10 @@
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
 #include <vector> //readv
+#include <algorithm> // rotate
 #include <atomic>
+#include <string>
+#include <string_view>
 #include <assert.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -20,6 +23,8 @@ public:
     size_t PrependableBytes() const;
 
     const char* Peek() const;
+    // 让可读数据在内存中连续（环形缓冲区回绕时搬一次），返回Peek()；解析器据此直接在缓冲区上取string_view
+    const char* Linearize();
     void EnsureWriteable(size_t len);
     void HasWritten(size_t len);
 
@@ -32,7 +37,7 @@ public:
     const char* BeginWriteConst() const;
     char* BeginWrite();
 
-    void Append(const std::string& str);
+    void Append(std::string_view str);     // 字符串字面量也走这里，不构造临时std::string
     void Append(const char* str, size_t len);
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
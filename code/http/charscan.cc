@@ -0,0 +1,79 @@
+#include "charscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHAR_SCAN_X86
+#endif
+
+static const char* FindEitherScalar_(const char* p, const char* end, char a, char b) {
+    for(; p < end; p++) {
+        if(*p == a || *p == b) { return p; }
+    }
+    return end;
+}
+
+#ifdef CHAR_SCAN_X86
+__attribute__((target("sse2")))
+static const char* FindEitherSse2_(const char* p, const char* end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for(; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if(mask) { return p + __builtin_ctz(mask); }
+    }
+    return FindEitherScalar_(p, end, a, b);     // 不足16字节的尾部，不越界读
+}
+
+__attribute__((target("avx2")))
+static const char* FindEitherAvx2_(const char* p, const char* end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    for(; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if(mask) { return p + __builtin_ctz(mask); }
+    }
+    // 尾部在这里用VEX编码的16字节比较，不调用SSE2版本，避免AVX和传统SSE指令混用的切换开销
+    if(end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(va)),
+                                                       _mm_cmpeq_epi8(v, _mm256_castsi256_si128(vb))));
+        if(mask) { return p + __builtin_ctz(mask); }
+        p += 16;
+    }
+    return FindEitherScalar_(p, end, a, b);
+}
+#endif
+
+CharScan::Level CharScan::MaxLevel() {
+#ifdef CHAR_SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) { return AVX2; }
+    if(__builtin_cpu_supports("sse2")) { return SSE2; }
+#endif
+    return SCALAR;
+}
+
+CharScan::Level CharScan::SetLevel(Level level) {
+    Level max = MaxLevel();
+    if(level > max) { level = max; }
+    switch(level) {
+#ifdef CHAR_SCAN_X86
+        case AVX2: findEither_ = FindEitherAvx2_; break;
+        case SSE2: findEither_ = FindEitherSse2_; break;
+#endif
+        default: findEither_ = FindEitherScalar_; break;
+    }
+    level_ = level;
+    return level;
+}
+
+const char* CharScan::LevelName(Level level) {
+    switch(level) {
+        case AVX2: return "avx2";
+        case SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+CharScan::FindFunc CharScan::findEither_ = FindEitherScalar_;
+CharScan::Level CharScan::level_ = CharScan::SetLevel(CharScan::MaxLevel());
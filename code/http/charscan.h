@@ -0,0 +1,36 @@
+#ifndef CHAR_SCAN_H
+#define CHAR_SCAN_H
+
+#include <stddef.h>
+
+/*
+    请求解析用的分隔符扫描：一次比较16（SSE2）或32（AVX2）个字节，找行尾'\n'和请求头里的':'
+    启动时按CPU支持的指令集选一个实现（AVX2 > SSE2 > 逐字节），之后通过函数指针调用
+    只扫描连续内存；环形缓冲区回绕时解析器先Buffer::Linearize()把数据转成连续的再扫描
+*/
+class CharScan {
+public:
+    enum Level { SCALAR, SSE2, AVX2 };
+
+    // [p, end)中第一个等于a或b的字节，找不到返回end
+    static const char* FindEither(const char* p, const char* end, char a, char b) {
+        return findEither_(p, end, a, b);
+    }
+    static const char* Find(const char* p, const char* end, char c) {
+        return findEither_(p, end, c, c);
+    }
+
+    static Level GetLevel() { return level_; }
+    // 指定实现（用于测试和基准），超过CPU支持的级别时降到能用的最高级别，返回实际使用的级别
+    static Level SetLevel(Level level);
+    static Level MaxLevel();
+    static const char* LevelName(Level level);
+
+private:
+    typedef const char* (*FindFunc)(const char* p, const char* end, char a, char b);
+
+    static FindFunc findEither_;
+    static Level level_;
+};
+
+#endif //CHAR_SCAN_H
@@ -0,0 +1,218 @@
+#include "filecache.h"
+
+#include <fcntl.h>       // open
+#include <unistd.h>      // close
+#include <sys/mman.h>    // mmap, munmap
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../log/log.h"
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+FileCache::~FileCache() {
+    Clear();
+}
+
+void FileCache::SetCapacity(size_t entries) {
+    capacity_.store(entries, std::memory_order_relaxed);
+    if(entries == 0) {
+        Clear();
+    }
+}
+
+void FileCache::Clear() {
+    for(Shard& s: shards_) {
+        std::lock_guard<std::mutex> lock(s.mtx);
+        for(auto& kv: s.map) {
+            Release(kv.second);
+        }
+        s.map.clear();
+    }
+}
+
+size_t FileCache::Hits() const {
+    size_t n = 0;
+    for(const Shard& s: shards_) { n += s.hits.load(std::memory_order_relaxed); }
+    return n;
+}
+
+size_t FileCache::Misses() const {
+    size_t n = 0;
+    for(const Shard& s: shards_) { n += s.misses.load(std::memory_order_relaxed); }
+    return n;
+}
+
+size_t FileCache::Invalidations() const {
+    size_t n = 0;
+    for(const Shard& s: shards_) { n += s.invalidations.load(std::memory_order_relaxed); }
+    return n;
+}
+
+// 粗粒度的单调时钟走vDSO，不进内核，每次查找都可以调用
+int64_t FileCache::NowMs_() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+bool FileCache::Same_(const Entry* e, const struct stat& st) {
+    return S_ISREG(st.st_mode) && (st.st_mode & S_IROTH) && size_t(st.st_size) == e->size &&
+           st.st_ino == e->ino && st.st_dev == e->dev &&
+           st.st_mtim.tv_sec == e->mtime.tv_sec && st.st_mtim.tv_nsec == e->mtime.tv_nsec;
+}
+
+void FileCache::Release(const Entry* entry) {
+    Entry* e = const_cast<Entry*>(entry);
+    if(e->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if(e->data) {
+            munmap(const_cast<char*>(e->data), e->size);
+        }
+        delete e;
+    }
+}
+
+// 打开并映射文件，返回的条目有一个引用（属于调用者）；空文件不映射（长度0的mmap会返回EINVAL）
+FileCache::Entry* FileCache::Load_(const char* path, const struct stat& st, std::string_view type, int64_t now) {
+    char* data = nullptr;
+    size_t size = st.st_size;
+    if(size > 0) {
+        int fd = open(path, O_RDONLY);
+        if(fd < 0) {
+            LOG_WARN("open %s error: %s", path, strerror(errno));
+            return nullptr;
+        }
+        void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED) {
+            LOG_WARN("mmap %s error: %s", path, strerror(errno));
+            return nullptr;
+        }
+        data = static_cast<char*>(map);
+    }
+    Entry* e = new Entry;
+    e->data = data;
+    e->size = size;
+    e->path = path;
+    e->headerBuf = "Content-type: ";
+    e->headerBuf.append(type.data(), type.size());
+    char len[48];
+    int n = snprintf(len, sizeof(len), "\r\nContent-length: %zu\r\n\r\n", size);
+    e->headerBuf.append(len, n);
+    e->header = e->headerBuf;
+    e->type = e->header.substr(strlen("Content-type: "), type.size());
+    e->mtime = st.st_mtim;
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->refs.store(1, std::memory_order_relaxed);
+    e->checked.store(now, std::memory_order_relaxed);
+    e->used.store(now, std::memory_order_relaxed);
+    return e;
+}
+
+// 条目还在表里时拿掉它并释放缓存的引用；别的线程已经换成新条目时不动
+void FileCache::Remove_(Shard& s, Entry* e) {
+    std::lock_guard<std::mutex> lock(s.mtx);
+    auto it = s.map.find(e->path);
+    if(it != s.map.end() && it->second == e) {
+        s.map.erase(it);
+        Release(e);
+    }
+}
+
+// 分片满了：淘汰最久没有命中的条目，调用时持有分片的锁；插入只发生在未命中时，扫描整个分片不要紧
+void FileCache::Evict_(Shard& s) {
+    auto victim = s.map.end();
+    int64_t oldest = INT64_MAX;
+    for(auto it = s.map.begin(); it != s.map.end(); ++it) {
+        int64_t used = it->second->used.load(std::memory_order_relaxed);
+        if(used < oldest) {
+            oldest = used;
+            victim = it;
+        }
+    }
+    if(victim != s.map.end()) {
+        Entry* e = victim->second;
+        s.map.erase(victim);
+        Release(e);
+    }
+}
+
+/*
+    命中：锁里查表并加引用，锁外检查要不要重新stat（每个条目每REVALIDATE_MS最多一个线程去做）；
+    没命中或文件变了：锁外stat、open、mmap，再加锁放进表里，别的线程已经先放进去时用它的
+*/
+int FileCache::Acquire(const char* path, std::string_view type, const Entry** entry) {
+    *entry = nullptr;
+    std::string_view key(path);
+    Shard& s = shards_[std::hash<std::string_view>()(key) % SHARDS];
+    size_t capacity = capacity_.load(std::memory_order_relaxed);
+    int64_t now = NowMs_();
+    struct stat st;
+    Entry* e = nullptr;
+    if(capacity > 0) {
+        std::lock_guard<std::mutex> lock(s.mtx);
+        auto it = s.map.find(key);
+        if(it != s.map.end()) {
+            e = it->second;
+            e->refs.fetch_add(1, std::memory_order_relaxed);
+            s.hits.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if(e) {
+        e->used.store(now, std::memory_order_relaxed);
+        int64_t checked = e->checked.load(std::memory_order_relaxed);
+        if(now - checked < REVALIDATE_MS ||
+            !e->checked.compare_exchange_strong(checked, now, std::memory_order_relaxed)) {
+            *entry = e;
+            return 200;
+        }
+        if(stat(path, &st) == 0 && Same_(e, st)) {
+            *entry = e;
+            return 200;
+        }
+        LOG_DEBUG("file cache: %s changed", path);
+        s.invalidations.fetch_add(1, std::memory_order_relaxed);
+        Remove_(s, e);
+        Release(e);
+        e = nullptr;
+    }
+
+    s.misses.fetch_add(1, std::memory_order_relaxed);
+    if(stat(path, &st) < 0 || S_ISDIR(st.st_mode)) {
+        return 404;
+    }
+    if(!(st.st_mode & S_IROTH)) {
+        return 403;
+    }
+    Entry* fresh = Load_(path, st, type, now);
+    if(!fresh) {
+        return 404;
+    }
+    if(capacity > 0) {
+        std::lock_guard<std::mutex> lock(s.mtx);
+        auto it = s.map.find(key);
+        if(it != s.map.end()) {
+            // 别的线程同时加载了同一个文件
+            e = it->second;
+            e->refs.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            if(s.map.size() >= (capacity + SHARDS - 1) / SHARDS) {
+                Evict_(s);
+            }
+            fresh->refs.fetch_add(1, std::memory_order_relaxed);   // 缓存的引用
+            s.map.emplace(fresh->path, fresh);
+        }
+    }
+    if(e && e != fresh) {
+        Release(fresh);
+        fresh = e;
+    }
+    *entry = fresh;
+    return 200;
+}
@@ -0,0 +1,84 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/*
+    进程内共享的静态文件缓存：按完整路径缓存文件的映射、大小、修改时间、MIME类型和拼好的
+    "Content-type/Content-length"响应头，命中时不再stat/open/mmap/close/munmap
+    条目带引用计数：缓存自己持有一个引用，每个响应在发送完之前也持有一个，
+    文件被改动或条目被淘汰后，正在writev的响应仍然指向有效的映射，最后一个引用释放时才munmap
+    文件改动靠修改时间检查：条目每隔REVALIDATE_MS最多stat一次，修改时间、大小或inode变了就换成新的
+    更新资源请写新文件再rename过去：原地截断一个正在被映射的文件，读到截掉部分的一方会收到SIGBUS
+    分成SHARDS个分片各自加锁，锁里只做一次哈希表查找和引用计数加一
+*/
+class FileCache {
+public:
+    static const size_t SHARDS = 16;
+    static const int64_t REVALIDATE_MS = 1000;
+
+    struct Entry {
+        const char* data;           // 文件内容，空文件为nullptr
+        size_t size;
+        std::string_view type;      // MIME类型，指向header里
+        std::string_view header;    // "Content-type: ...\r\nContent-length: N\r\n\r\n"
+
+        std::string path;           // 哈希表的键指向这里
+        std::string headerBuf;
+        struct timespec mtime;
+        dev_t dev;
+        ino_t ino;
+        std::atomic<int> refs;
+        std::atomic<int64_t> checked;   // 上一次确认文件没变的时间（毫秒）
+        std::atomic<int64_t> used;      // 上一次命中的时间，淘汰时用
+    };
+
+    static FileCache* Instance();
+
+    // 最多缓存的条目数，0表示不缓存（每次都打开映射，最后一个引用释放时munmap）；启动时设置
+    void SetCapacity(size_t entries);
+    // 可读的普通文件返回200，*entry是持有一个引用的条目，用完调用Release；
+    // 不存在或是目录返回404，其他人没有读权限返回403，这两种情况*entry为nullptr
+    // type是这个路径的MIME类型，只在需要重新加载时使用
+    int Acquire(const char* path, std::string_view type, const Entry** entry);
+    static void Release(const Entry* entry);
+    // 丢掉所有缓存的条目（还在用的要等引用释放）
+    void Clear();
+
+    // 计数：在表里找到的、需要打开文件的、发现文件变了而丢掉的
+    size_t Hits() const;
+    size_t Misses() const;
+    size_t Invalidations() const;
+
+private:
+    FileCache() : capacity_(1024) {}
+    ~FileCache();
+    FileCache(const FileCache&) = delete;
+    FileCache& operator=(const FileCache&) = delete;
+
+    // 计数器放在分片里，和锁在同一处更新，不另外争用一个全局的缓存行；分片按缓存行对齐
+    struct alignas(64) Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string_view, Entry*> map;
+        std::atomic<size_t> hits{0};
+        std::atomic<size_t> misses{0};
+        std::atomic<size_t> invalidations{0};
+    };
+
+    static int64_t NowMs_();
+    static bool Same_(const Entry* e, const struct stat& st);
+    static Entry* Load_(const char* path, const struct stat& st, std::string_view type, int64_t now);
+    void Remove_(Shard& s, Entry* e);
+    void Evict_(Shard& s);
+
+    Shard shards_[SHARDS];
+    std::atomic<size_t> capacity_;
+};
+
+#endif //FILE_CACHE_H
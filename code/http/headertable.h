@@ -0,0 +1,99 @@
+#ifndef HEADER_TABLE_H
+#define HEADER_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <string_view>
+
+/*
+    服务器关心的请求头名字的完美哈希表：编译期从候选种子里找一个让所有名字落到不同槽位的，
+    运行时对名字算一次哈希（不区分大小写）、再比一次名字，就能知道是哪一个已知请求头
+    HttpRequest按Id把这些请求头放在固定槽位里，查找不用逐个比较名字
+*/
+class HeaderTable {
+public:
+    enum Id {
+        HOST,
+        CONNECTION,
+        KEEP_ALIVE,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        TRANSFER_ENCODING,
+        ACCEPT_ENCODING,
+        IF_NONE_MATCH,
+        IF_MODIFIED_SINCE,
+        RANGE,
+        COOKIE,
+        EXPECT,
+        UPGRADE,
+        COUNT,
+        UNKNOWN = COUNT,
+    };
+
+    // 名字里的字母按小写给出，和上面的Id一一对应
+    static constexpr std::string_view NAMES[COUNT] = {
+        "host", "connection", "keep-alive", "content-length", "content-type", "transfer-encoding",
+        "accept-encoding", "if-none-match", "if-modified-since", "range", "cookie", "expect", "upgrade",
+    };
+
+    static const uint32_t SEED;     // 编译期找到的哈希种子
+
+    // name必须已经检查过是token（HttpRequest::ParseHeader_里做），这样|0x20的比较才等价于不区分大小写
+    static Id Lookup(std::string_view name) {
+        if(name.empty()) { return UNKNOWN; }
+        Id id = Id(SLOT_ID[Hash_(name, SEED)]);
+        if(id == UNKNOWN || NAMES[id].size() != name.size()) { return UNKNOWN; }
+        for(size_t i = 0; i < name.size(); i++) {
+            if((name[i] | 0x20) != NAMES[id][i]) { return UNKNOWN; }
+        }
+        return id;
+    }
+
+private:
+    static const int SLOT_BITS = 5;
+    static const size_t SLOTS = 1 << SLOT_BITS;
+
+    // 只看长度和首尾两个字节（|0x20转小写），不用扫描整个名字；已知名字的这三项两两不同
+    static constexpr uint32_t Hash_(std::string_view name, uint32_t seed) {
+        uint32_t h = static_cast<uint32_t>(name.size()) * 0x9E3779B1u ^
+                     static_cast<uint8_t>(name.front() | 0x20) * 0x85EBCA6Bu ^
+                     static_cast<uint8_t>(name.back() | 0x20) * 0xC2B2AE35u;
+        return (h * seed) >> (32 - SLOT_BITS);
+    }
+
+    static constexpr bool Distinct_(uint32_t seed) {
+        bool used[SLOTS] = {};
+        for(std::string_view name: NAMES) {
+            size_t slot = Hash_(name, seed);
+            if(used[slot]) { return false; }
+            used[slot] = true;
+        }
+        return true;
+    }
+
+    static constexpr uint32_t FindSeed_() {
+        for(uint32_t seed = 1; seed < 1000000; seed += 2) {
+            if(Distinct_(seed)) { return seed; }
+        }
+        return 0;
+    }
+
+    static constexpr std::array<uint8_t, SLOTS> BuildSlots_() {
+        std::array<uint8_t, SLOTS> slots = {};
+        for(size_t i = 0; i < SLOTS; i++) { slots[i] = UNKNOWN; }
+        for(size_t id = 0; id < COUNT; id++) {
+            slots[Hash_(NAMES[id], SEED)] = static_cast<uint8_t>(id);
+        }
+        return slots;
+    }
+
+    static const std::array<uint8_t, SLOTS> SLOT_ID;   // 槽位 -> Id，空槽是UNKNOWN
+};
+
+// 类定义完整之后才能在常量表达式里调用上面的constexpr函数
+inline constexpr uint32_t HeaderTable::SEED = HeaderTable::FindSeed_();
+static_assert(HeaderTable::SEED != 0, "no perfect hash seed for the known header names");
+inline constexpr std::array<uint8_t, HeaderTable::SLOTS> HeaderTable::SLOT_ID = HeaderTable::BuildSlots_();
+
+#endif //HEADER_TABLE_H
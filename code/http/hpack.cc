@@ -0,0 +1,478 @@
+#include "hpack.h"
+
+#include <string.h>
+
+// RFC 7541 附录A，下标0对应索引1
+static const std::pair<std::string_view, std::string_view> STATIC_TABLE[HpackTable::STATIC_COUNT] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+// RFC 7541 附录B，每个字节的Huffman码（右对齐）和码长；EOS是30位的全1
+static const uint32_t HUFFMAN_CODES[256] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+};
+
+static const uint8_t HUFFMAN_LENS[256] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+};
+
+static const uint32_t HUFFMAN_EOS = 0x3fffffff;
+static const int HUFFMAN_EOS_LEN = 30;
+
+/*
+    Huffman解码表：按码字建二叉树，256个内部节点作为状态，每次吃进4位查表得到下一个状态，
+    最短的码字有5位，4位之内最多解出一个字节
+    结束时状态必须是根，或者从根出发走的全是1且不超过7位（填充）
+*/
+namespace {
+
+struct HuffmanDecodeTable {
+    enum { EMIT = 1, FAIL = 2, ACCEPT = 4 };
+    struct Entry {
+        uint8_t next;
+        uint8_t flags;
+        uint8_t sym;
+    };
+    Entry table[256][16];
+
+    HuffmanDecodeTable() {
+        // 先建树：节点0是根，内部节点编号0~255，叶子记在child里为-1-sym（EOS是-1-256）
+        int child[256][2];
+        int allOnes[256];       // 从根到这个节点全是1时的深度，否则-1
+        memset(child, 0, sizeof(child));
+        int nodes = 1;
+        allOnes[0] = 0;
+        for(int sym = 0; sym <= 256; sym++) {
+            uint32_t code = sym < 256 ? HUFFMAN_CODES[sym] : HUFFMAN_EOS;
+            int len = sym < 256 ? HUFFMAN_LENS[sym] : HUFFMAN_EOS_LEN;
+            int cur = 0;
+            for(int i = len - 1; i > 0; i--) {
+                int bit = (code >> i) & 1;
+                if(child[cur][bit] == 0) {
+                    child[cur][bit] = nodes;
+                    allOnes[nodes] = (bit && allOnes[cur] >= 0) ? allOnes[cur] + 1 : -1;
+                    nodes++;
+                }
+                cur = child[cur][bit];
+            }
+            child[cur][code & 1] = -1 - sym;
+        }
+        for(int state = 0; state < nodes; state++) {
+            for(int nibble = 0; nibble < 16; nibble++) {
+                Entry e = {0, 0, 0};
+                int cur = state;
+                for(int i = 3; i >= 0; i--) {
+                    int next = child[cur][(nibble >> i) & 1];
+                    if(next < 0) {
+                        if(next == -1 - 256) {
+                            e.flags |= FAIL;
+                            break;
+                        }
+                        e.flags |= EMIT;
+                        e.sym = static_cast<uint8_t>(-1 - next);
+                        cur = 0;
+                    }
+                    else {
+                        cur = next;
+                    }
+                }
+                e.next = static_cast<uint8_t>(cur);
+                if(cur == 0 || (allOnes[cur] >= 0 && allOnes[cur] <= 7)) {
+                    e.flags |= ACCEPT;
+                }
+                table[state][nibble] = e;
+            }
+        }
+    }
+};
+
+}
+
+static const HuffmanDecodeTable& DecodeTable_() {
+    static const HuffmanDecodeTable table;
+    return table;
+}
+
+void HpackTable::SetMaxSize(size_t maxSize) {
+    maxSize_ = maxSize;
+    Evict_(maxSize_);
+}
+
+void HpackTable::Add(std::string_view name, std::string_view value) {
+    size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+    if(size > maxSize_) {
+        Evict_(0);
+        return;
+    }
+    Evict_(maxSize_ - size);
+    entries_.emplace_front(std::string(name), std::string(value));
+    size_ += size;
+}
+
+void HpackTable::Evict_(size_t limit) {
+    while(size_ > limit && !entries_.empty()) {
+        size_ -= entries_.back().first.size() + entries_.back().second.size() + ENTRY_OVERHEAD;
+        entries_.pop_back();
+    }
+}
+
+bool HpackTable::Get(size_t index, std::string_view* name, std::string_view* value) const {
+    if(index == 0) {
+        return false;
+    }
+    if(index <= STATIC_COUNT) {
+        *name = STATIC_TABLE[index - 1].first;
+        *value = STATIC_TABLE[index - 1].second;
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if(index >= entries_.size()) {
+        return false;
+    }
+    *name = entries_[index].first;
+    *value = entries_[index].second;
+    return true;
+}
+
+size_t HpackTable::Find(std::string_view name, std::string_view value, bool* exact) const {
+    size_t nameIndex = 0;
+    *exact = false;
+    for(size_t i = 0; i < STATIC_COUNT; i++) {
+        if(STATIC_TABLE[i].first == name) {
+            if(STATIC_TABLE[i].second == value) {
+                *exact = true;
+                return i + 1;
+            }
+            if(!nameIndex) { nameIndex = i + 1; }
+        }
+    }
+    for(size_t i = 0; i < entries_.size(); i++) {
+        if(entries_[i].first == name) {
+            if(entries_[i].second == value) {
+                *exact = true;
+                return STATIC_COUNT + 1 + i;
+            }
+            if(!nameIndex) { nameIndex = STATIC_COUNT + 1 + i; }
+        }
+    }
+    return nameIndex;
+}
+
+void HpackCodec::EncodeInt(uint64_t value, int prefixBits, uint8_t first, std::string& out) {
+    uint64_t max = (1u << prefixBits) - 1;
+    if(value < max) {
+        out += static_cast<char>(first | value);
+        return;
+    }
+    out += static_cast<char>(first | max);
+    value -= max;
+    while(value >= 128) {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool HpackCodec::DecodeInt(const uint8_t** p, const uint8_t* end, int prefixBits, uint64_t* value) {
+    const uint8_t* q = *p;
+    if(q >= end) { return false; }
+    uint64_t max = (1u << prefixBits) - 1;
+    uint64_t v = *q++ & max;
+    if(v == max) {
+        for(int shift = 0; ; shift += 7) {
+            // 合法的值都远小于2^32，更长的编码按错误处理，防止移位溢出
+            if(q >= end || shift > 28) { return false; }
+            uint8_t b = *q++;
+            v += static_cast<uint64_t>(b & 0x7f) << shift;
+            if(!(b & 0x80)) { break; }
+        }
+        if(v > 0xffffffffu) { return false; }
+    }
+    *value = v;
+    *p = q;
+    return true;
+}
+
+size_t HpackCodec::HuffmanLength(std::string_view s) {
+    size_t bits = 0;
+    for(unsigned char ch: s) {
+        bits += HUFFMAN_LENS[ch];
+    }
+    return (bits + 7) / 8;
+}
+
+void HpackCodec::HuffmanEncode(std::string_view s, std::string& out) {
+    uint64_t acc = 0;
+    int bits = 0;
+    for(unsigned char ch: s) {
+        acc = (acc << HUFFMAN_LENS[ch]) | HUFFMAN_CODES[ch];
+        bits += HUFFMAN_LENS[ch];
+        while(bits >= 8) {
+            bits -= 8;
+            out += static_cast<char>(acc >> bits);
+        }
+    }
+    if(bits > 0) {
+        // 用EOS的前缀（全1）补齐最后一个字节
+        out += static_cast<char>((acc << (8 - bits)) | (0xff >> bits));
+    }
+}
+
+bool HpackCodec::HuffmanDecode(const uint8_t* p, size_t len, std::string& out) {
+    const HuffmanDecodeTable& t = DecodeTable_();
+    uint8_t state = 0;
+    bool accept = true;
+    for(size_t i = 0; i < len; i++) {
+        for(int shift = 4; shift >= 0; shift -= 4) {
+            const HuffmanDecodeTable::Entry& e = t.table[state][(p[i] >> shift) & 0xf];
+            if(e.flags & HuffmanDecodeTable::FAIL) { return false; }
+            if(e.flags & HuffmanDecodeTable::EMIT) { out += static_cast<char>(e.sym); }
+            state = e.next;
+            accept = e.flags & HuffmanDecodeTable::ACCEPT;
+        }
+    }
+    return accept;
+}
+
+void HpackCodec::EncodeString(std::string_view s, std::string& out) {
+    size_t huffLen = HuffmanLength(s);
+    if(huffLen < s.size()) {
+        EncodeInt(huffLen, 7, 0x80, out);
+        HuffmanEncode(s, out);
+    }
+    else {
+        EncodeInt(s.size(), 7, 0, out);
+        out.append(s.data(), s.size());
+    }
+}
+
+bool HpackDecoder::ReadString_(const uint8_t** p, const uint8_t* end, std::string& scratch, std::string_view* out) {
+    if(*p >= end) { return false; }
+    bool huffman = **p & 0x80;
+    uint64_t len;
+    if(!HpackCodec::DecodeInt(p, end, 7, &len) || len > static_cast<size_t>(end - *p)) {
+        return false;
+    }
+    const uint8_t* s = *p;
+    *p += len;
+    if(!huffman) {
+        *out = std::string_view(reinterpret_cast<const char*>(s), len);
+        return true;
+    }
+    scratch.clear();
+    if(!HpackCodec::HuffmanDecode(s, len, scratch)) {
+        return false;
+    }
+    *out = scratch;
+    return true;
+}
+
+/*
+    头部块里的一项（RFC 7541 6）：
+    1xxxxxxx 索引；01xxxxxx 字面量并加入动态表；001xxxxx 动态表大小更新；
+    0000xxxx 字面量不加入动态表；0001xxxx 字面量且永不索引（对我们和上一种一样）
+*/
+HpackDecoder::NEXT HpackDecoder::Next_(const uint8_t** p, const uint8_t* end, bool allowSizeUpdate,
+                                       std::string_view* name, std::string_view* value) {
+    uint8_t b = **p;
+    uint64_t index;
+    if(b & 0x80) {
+        if(!HpackCodec::DecodeInt(p, end, 7, &index) || !table_.Get(index, name, value)) {
+            return NEXT_ERROR;
+        }
+        return NEXT_HEADER;
+    }
+    if((b & 0xe0) == 0x20) {
+        // 表大小更新只能出现在头部块开头，且不能超过我们在SETTINGS里给的上限
+        if(!allowSizeUpdate || !HpackCodec::DecodeInt(p, end, 5, &index) || index > maxTableSize_) {
+            return NEXT_ERROR;
+        }
+        table_.SetMaxSize(index);
+        return NEXT_SIZE_UPDATE;
+    }
+    bool indexing = (b & 0xc0) == 0x40;
+    if(!HpackCodec::DecodeInt(p, end, indexing ? 6 : 4, &index)) {
+        return NEXT_ERROR;
+    }
+    if(index > 0) {
+        std::string_view unused;
+        if(!table_.Get(index, name, &unused)) {
+            return NEXT_ERROR;
+        }
+        if(indexing && index > HpackTable::STATIC_COUNT) {
+            // 名字指向动态表时，下面的Add可能把它淘汰掉，先拷出来
+            nameBuf_.assign(name->data(), name->size());
+            *name = nameBuf_;
+        }
+    }
+    else if(!ReadString_(p, end, nameBuf_, name)) {
+        return NEXT_ERROR;
+    }
+    if(!ReadString_(p, end, valueBuf_, value)) {
+        return NEXT_ERROR;
+    }
+    if(indexing) {
+        table_.Add(*name, *value);
+    }
+    return NEXT_HEADER;
+}
+
+void HpackEncoder::SetPeerMaxTableSize(size_t size) {
+    size_t maxSize = size < HpackTable::DEFAULT_SIZE ? size : HpackTable::DEFAULT_SIZE;
+    if(maxSize != table_.MaxSize()) {
+        table_.SetMaxSize(maxSize);
+        sizeUpdate_ = true;
+    }
+}
+
+void HpackEncoder::Begin(std::string& out) {
+    if(sizeUpdate_) {
+        HpackCodec::EncodeInt(table_.MaxSize(), 5, 0x20, out);
+        sizeUpdate_ = false;
+    }
+}
+
+void HpackEncoder::EncodeStatus(int code, std::string& out) {
+    // 静态表里有值的状态码：200 204 206 304 400 404 500 → 索引8~14
+    static const int STATUS_INDEX[][2] = {
+        {200, 8}, {204, 9}, {206, 10}, {304, 11}, {400, 12}, {404, 13}, {500, 14},
+    };
+    for(const auto& s: STATUS_INDEX) {
+        if(s[0] == code) {
+            HpackCodec::EncodeInt(s[1], 7, 0x80, out);
+            return;
+        }
+    }
+    char buf[3] = {
+        static_cast<char>('0' + code / 100 % 10), static_cast<char>('0' + code / 10 % 10), static_cast<char>('0' + code % 10),
+    };
+    Encode(":status", std::string_view(buf, sizeof(buf)), true, out);
+}
+
+void HpackEncoder::Encode(std::string_view name, std::string_view value, bool index, std::string& out) {
+    bool exact;
+    size_t i = table_.Find(name, value, &exact);
+    if(exact) {
+        HpackCodec::EncodeInt(i, 7, 0x80, out);
+        return;
+    }
+    if(index) {
+        HpackCodec::EncodeInt(i, 6, 0x40, out);
+    }
+    else {
+        HpackCodec::EncodeInt(i, 4, 0x00, out);
+    }
+    if(i == 0) {
+        HpackCodec::EncodeString(name, out);
+    }
+    HpackCodec::EncodeString(value, out);
+    if(index) {
+        table_.Add(name, value);
+    }
+}
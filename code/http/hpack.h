@@ -0,0 +1,121 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/*
+    HPACK（RFC 7541）：HTTP/2的头部压缩
+    头部用静态表（61个常见头部）和动态表（双方各维护一份，按头部块的顺序同步更新）的索引表示，
+    字符串可以用固定的Huffman码压缩
+    解码器和编码器各自一张动态表：解码器的表跟着对端的编码器，编码器的表由我们自己决定加入哪些头部
+*/
+class HpackTable {
+public:
+    static const size_t DEFAULT_SIZE = 4096;    // SETTINGS_HEADER_TABLE_SIZE的初始值
+    static const size_t STATIC_COUNT = 61;
+    static const size_t ENTRY_OVERHEAD = 32;    // 每个条目的大小是名字+值+32
+
+    explicit HpackTable(size_t maxSize = DEFAULT_SIZE) : size_(0), maxSize_(maxSize) {}
+
+    void SetMaxSize(size_t maxSize);
+    size_t MaxSize() const { return maxSize_; }
+    size_t Size() const { return size_; }
+    size_t DynamicCount() const { return entries_.size(); }
+
+    // 加入动态表，放不下时先淘汰最早加入的条目；比上限还大的条目清空表且不加入
+    void Add(std::string_view name, std::string_view value);
+    // 索引从1开始：1~61是静态表，62起是动态表（最新加入的在前），越界返回false
+    // 返回的视图在下一次Add之前有效
+    bool Get(size_t index, std::string_view* name, std::string_view* value) const;
+    // 完全匹配返回索引并把*exact置true；只有名字匹配时返回名字的索引；都没有返回0
+    size_t Find(std::string_view name, std::string_view value, bool* exact) const;
+
+private:
+    void Evict_(size_t limit);
+
+    std::deque<std::pair<std::string, std::string>> entries_;
+    size_t size_;
+    size_t maxSize_;
+};
+
+class HpackDecoder {
+public:
+    // maxTableSize：我们通过SETTINGS_HEADER_TABLE_SIZE允许对端使用的动态表上限
+    explicit HpackDecoder(size_t maxTableSize = HpackTable::DEFAULT_SIZE)
+        : table_(maxTableSize), maxTableSize_(maxTableSize) {}
+
+    // 解码一个完整的头部块，每个头部调用一次onHeader(name, value)，视图只在回调里有效
+    // 格式错误返回false，这时动态表已经和对端不同步，连接只能以COMPRESSION_ERROR关闭
+    template<class F>
+    bool Decode(const uint8_t* p, size_t len, F&& onHeader) {
+        const uint8_t* end = p + len;
+        bool headerSeen = false;
+        while(p < end) {
+            std::string_view name, value;
+            NEXT next = Next_(&p, end, !headerSeen, &name, &value);
+            if(next == NEXT_ERROR) { return false; }
+            if(next == NEXT_HEADER) {
+                headerSeen = true;
+                onHeader(name, value);
+            }
+        }
+        return true;
+    }
+
+    const HpackTable& Table() const { return table_; }
+
+private:
+    enum NEXT { NEXT_HEADER, NEXT_SIZE_UPDATE, NEXT_ERROR };
+
+    NEXT Next_(const uint8_t** p, const uint8_t* end, bool allowSizeUpdate,
+               std::string_view* name, std::string_view* value);
+    bool ReadString_(const uint8_t** p, const uint8_t* end, std::string& scratch, std::string_view* out);
+
+    HpackTable table_;
+    size_t maxTableSize_;
+    std::string nameBuf_;       // Huffman解码出来的名字和值
+    std::string valueBuf_;
+};
+
+class HpackEncoder {
+public:
+    HpackEncoder() : table_(HpackTable::DEFAULT_SIZE), sizeUpdate_(false) {}
+
+    // 对端SETTINGS_HEADER_TABLE_SIZE变化：动态表取它和DEFAULT_SIZE中较小的，下一个头部块开头告诉对端
+    void SetPeerMaxTableSize(size_t size);
+
+    // 开始一个头部块：有待发送的表大小更新时先写进去
+    void Begin(std::string& out);
+    void EncodeStatus(int code, std::string& out);
+    // name必须是小写；index为true时加入动态表，之后同样的头部只用一个字节（Content-Type这类重复率高的值）
+    void Encode(std::string_view name, std::string_view value, bool index, std::string& out);
+
+    const HpackTable& Table() const { return table_; }
+
+private:
+    HpackTable table_;
+    bool sizeUpdate_;
+};
+
+// 整数和Huffman编码（RFC 7541 5.1、5.2），编码器和解码器共用，也供测试使用
+class HpackCodec {
+public:
+    // 整数放在第一个字节的低prefixBits位，first是第一个字节的高位标志
+    static void EncodeInt(uint64_t value, int prefixBits, uint8_t first, std::string& out);
+    // 读不完整或超过2^32返回false
+    static bool DecodeInt(const uint8_t** p, const uint8_t* end, int prefixBits, uint64_t* value);
+    // 字符串字面量：Huffman编码更短时用Huffman
+    static void EncodeString(std::string_view s, std::string& out);
+
+    static size_t HuffmanLength(std::string_view s);
+    static void HuffmanEncode(std::string_view s, std::string& out);
+    // 追加到out；出现EOS、填充超过7位或填充不全是1时返回false
+    static bool HuffmanDecode(const uint8_t* p, size_t len, std::string& out);
+};
+
+#endif //HPACK_H
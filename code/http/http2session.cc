@@ -0,0 +1,919 @@
+#include "http2session.h"
+
+#include <string.h>
+#include <strings.h>    // strncasecmp
+#include <algorithm>
+#include <errno.h>
+#include <unistd.h>     // pread, write, close
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t FRAME_HEADER_LEN = 9;
+static const int64_t MAX_WINDOW = 0x7fffffff;
+
+enum FLAG {
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20,
+};
+
+enum SETTING {
+    SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+};
+
+static uint32_t Read24_(const uint8_t* p) {
+    return (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+}
+
+static uint32_t Read32_(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static void Write32_(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static bool EqualsIgnoreCase_(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// 逗号分隔的列表里有没有token（不区分大小写）
+static bool HasToken_(std::string_view list, std::string_view token) {
+    while(!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        while(!item.empty() && (item.front() == ' ' || item.front() == '\t')) { item.remove_prefix(1); }
+        while(!item.empty() && (item.back() == ' ' || item.back() == '\t')) { item.remove_suffix(1); }
+        if(EqualsIgnoreCase_(item, token)) { return true; }
+        if(comma == std::string_view::npos) { break; }
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// 拼进HTTP/1.1报文的字段不能带控制字符，否则可以借换行伪造出额外的请求头
+static bool SafeValue_(std::string_view v) {
+    for(unsigned char ch: v) {
+        if(ch == '\r' || ch == '\n' || ch == '\0') { return false; }
+    }
+    return true;
+}
+
+// 方法、路径和请求头名字：不能有空白、控制字符，名字里不能有':'
+static bool SafeToken_(std::string_view v, bool allowColon) {
+    if(v.empty()) { return false; }
+    for(unsigned char ch: v) {
+        if(ch <= 0x20 || ch == 0x7f || (ch == ':' && !allowColon)) { return false; }
+    }
+    return true;
+}
+
+// HTTP2-Settings是base64url编码（不带填充）的SETTINGS帧负载
+static bool Base64UrlDecode_(std::string_view in, std::string& out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for(char ch: in) {
+        int v;
+        if(ch >= 'A' && ch <= 'Z') { v = ch - 'A'; }
+        else if(ch >= 'a' && ch <= 'z') { v = ch - 'a' + 26; }
+        else if(ch >= '0' && ch <= '9') { v = ch - '0' + 52; }
+        else if(ch == '-' || ch == '+') { v = 62; }
+        else if(ch == '_' || ch == '/') { v = 63; }
+        else if(ch == '=') { break; }
+        else { return false; }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            out += static_cast<char>(acc >> bits);
+        }
+    }
+    return true;
+}
+
+Http2Session::Http2Session(HttpRequest& request, HttpResponse& response, const char* srcDir)
+    : request_(request), response_(response), srcDir_(srcDir),
+      out_(nullptr), segs_(nullptr), maxSegs_(0), segCnt_(0) {
+    Init();
+}
+
+Http2Session::~Http2Session() {
+    Init();
+}
+
+void Http2Session::Init() {
+    for(auto& it: streams_) {
+        if(it.second.file) {
+            FileCache::Release(it.second.file);
+        }
+        ReleaseBody_(it.second);
+    }
+    streams_.clear();
+    ready_.clear();
+    sending_.clear();
+    blockingReady_ = 0;
+    bodyBytes_ = 0;
+    decoder_ = HpackDecoder();
+    encoder_ = HpackEncoder();
+    prefaceDone_ = false;
+    settingsSent_ = false;
+    fatal_ = false;
+    goawaySent_ = false;
+    goawayReceived_ = false;
+    lastStreamId_ = 0;
+    headerStream_ = 0;
+    headerFlags_ = 0;
+    headerBlock_.clear();
+    connSendWindow_ = DEFAULT_WINDOW;
+    connRecvWindow_ = DEFAULT_WINDOW;
+    connConsumed_ = 0;
+    peerInitialWindow_ = DEFAULT_WINDOW;
+    peerMaxFrame_ = MAX_FRAME_SIZE;
+    reqBuff_.RetrieveAll();
+    respBuff_.RetrieveAll();
+}
+
+int Http2Session::MatchPreface(const Buffer& buff) {
+    size_t n = buff.ReadableBytes() < PREFACE_LEN ? buff.ReadableBytes() : PREFACE_LEN;
+    const char* p = buff.Peek();
+    for(size_t i = 0; i < n; i++, p++) {
+        if(p == buff.End()) { p = buff.Begin(); }    // 环形缓冲区回绕
+        if(*p != PREFACE[i]) { return 0; }
+    }
+    return n == PREFACE_LEN ? 1 : -1;
+}
+
+// RFC 7540 3.2：请求头里要有且只有一个HTTP2-Settings；带请求体的请求不升级，按HTTP/1.1回应
+bool Http2Session::WantsUpgrade(const HttpRequest& request) {
+    if(request.version() != "1.1" || !HasToken_(request.GetHeader(HeaderTable::UPGRADE), "h2c") ||
+       request.BodyLength() > 0 || request.BodyFd() >= 0) {
+        return false;
+    }
+    int settings = 0;
+    for(size_t i = 0; i < request.HeaderCount(); i++) {
+        if(EqualsIgnoreCase_(request.HeaderAt(i).first, "HTTP2-Settings")) { settings++; }
+    }
+    return settings == 1;
+}
+
+void Http2Session::Start() {
+    Init();
+}
+
+bool Http2Session::StartUpgrade(const HttpRequest& request, Buffer& out) {
+    Init();
+    std::string settings;
+    if(!Base64UrlDecode_(request.GetHeader("HTTP2-Settings"), settings) || settings.size() % 6 != 0 ||
+       !ApplySettings_(reinterpret_cast<const uint8_t*>(settings.data()), settings.size())) {
+        Init();
+        return false;
+    }
+    out.Append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    out_ = &out;
+    SendSettings_();
+    out_ = nullptr;
+    // 升级的请求是流1，已经收齐（半关闭），响应在下一次Process里最先生成
+    Stream& s = streams_[1];
+    s.id = 1;
+    s.endStream = true;
+    s.upgraded = true;
+    s.headOnly = request.method() == "HEAD";
+    s.sendWindow = peerInitialWindow_;
+    s.ready = true;
+    ready_.push_back(1);
+    lastStreamId_ = 1;
+    return true;
+}
+
+int Http2Session::Process(Buffer& in, Buffer& out, OutSegment* segs, int maxSegs, int* segCnt,
+                          bool inlineOnly, bool draining) {
+    out_ = &out;
+    segs_ = segs;
+    maxSegs_ = maxSegs;
+    segCnt_ = 0;
+    if(!settingsSent_) {
+        SendSettings_();    // 服务器的连接前言：先发SETTINGS
+    }
+    if(!fatal_) {
+        ReadFrames_(in);
+    }
+    if(fatal_) {
+        in.RetrieveAll();   // 已经发了GOAWAY，之后的帧不再处理
+    }
+    if(draining && !goawaySent_ && !fatal_) {
+        SendGoaway_(NO_ERROR);
+    }
+    // 升级的流1等收到客户端的连接前言再回应，101和响应不会一起到达客户端：
+    // 有的客户端只能在读101的那块缓冲区里接住有限的HTTP/2数据
+    int n = 0;
+    for(size_t i = 0; !fatal_ && prefaceDone_ && i < ready_.size();) {
+        Stream& s = streams_.find(ready_[i])->second;
+        // 升级的流1的请求还在HttpRequest里，不能让给后面的流先解析
+        if(inlineOnly && s.blocking && !s.upgraded) {
+            i++;
+            continue;
+        }
+        ready_.erase(ready_.begin() + i);
+        s.ready = false;
+        if(s.blocking) { blockingReady_--; }
+        Respond_(s);
+        n++;
+    }
+    if(!fatal_) {
+        ScheduleData_();
+    }
+    *segCnt = segCnt_;
+    out_ = nullptr;
+    segs_ = nullptr;
+    return n;
+}
+
+bool Http2Session::ReadFrames_(Buffer& in) {
+    if(!prefaceDone_) {
+        int match = MatchPreface(in);
+        if(match < 0) { return true; }
+        if(match == 0) { return ConnError_(PROTOCOL_ERROR, "bad connection preface"); }
+        in.Retrieve(PREFACE_LEN);
+        prefaceDone_ = true;
+    }
+    while(in.ReadableBytes() >= FRAME_HEADER_LEN) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(in.Linearize());
+        uint32_t len = Read24_(p);
+        if(len > MAX_FRAME_SIZE) {
+            return ConnError_(FRAME_SIZE_ERROR, "frame too large");
+        }
+        if(in.ReadableBytes() < FRAME_HEADER_LEN + len) {
+            break;      // 帧还不完整
+        }
+        bool ok = OnFrame_(p[3], p[4], Read32_(p + 5) & 0x7fffffff, p + FRAME_HEADER_LEN, len);
+        in.Retrieve(FRAME_HEADER_LEN + len);
+        if(!ok) { return false; }
+    }
+    return true;
+}
+
+bool Http2Session::OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    // 头部块的HEADERS和CONTINUATION之间不能插入其他帧
+    if(headerStream_ && (type != CONTINUATION || id != headerStream_)) {
+        return ConnError_(PROTOCOL_ERROR, "expected CONTINUATION");
+    }
+    switch(type) {
+        case DATA:
+            return OnData_(flags, id, p, len);
+        case HEADERS:
+            return OnHeaders_(flags, id, p, len);
+        case PRIORITY:
+            if(id == 0) { return ConnError_(PROTOCOL_ERROR, "PRIORITY on stream 0"); }
+            if(len != 5) { ResetStream_(id, FRAME_SIZE_ERROR); }
+            return true;
+        case RST_STREAM:
+            if(id == 0 || id > lastStreamId_) { return ConnError_(PROTOCOL_ERROR, "RST_STREAM on idle stream"); }
+            if(len != 4) { return ConnError_(FRAME_SIZE_ERROR, "bad RST_STREAM"); }
+            CloseStream_(id);
+            return true;
+        case SETTINGS:
+            return OnSettings_(flags, id, p, len);
+        case PUSH_PROMISE:
+            return ConnError_(PROTOCOL_ERROR, "PUSH_PROMISE from client");
+        case PING:
+            if(id != 0) { return ConnError_(PROTOCOL_ERROR, "PING on stream"); }
+            if(len != 8) { return ConnError_(FRAME_SIZE_ERROR, "bad PING"); }
+            if(!(flags & FLAG_ACK)) {
+                WriteFrameHeader_(8, PING, FLAG_ACK, 0);
+                out_->Append(p, 8);
+            }
+            return true;
+        case GOAWAY:
+            if(id != 0) { return ConnError_(PROTOCOL_ERROR, "GOAWAY on stream"); }
+            if(len < 8) { return ConnError_(FRAME_SIZE_ERROR, "bad GOAWAY"); }
+            goawayReceived_ = true;
+            LOG_DEBUG("HTTP/2 GOAWAY received, error %u", Read32_(p + 4));
+            return true;
+        case WINDOW_UPDATE:
+            return OnWindowUpdate_(id, p, len);
+        case CONTINUATION:
+            if(!headerStream_) { return ConnError_(PROTOCOL_ERROR, "unexpected CONTINUATION"); }
+            headerBlock_.append(reinterpret_cast<const char*>(p), len);
+            if(headerBlock_.size() > MAX_HEADER_BLOCK) {
+                return ConnError_(ENHANCE_YOUR_CALM, "header block too large");
+            }
+            headerFlags_ |= flags & FLAG_END_HEADERS;
+            return (flags & FLAG_END_HEADERS) ? OnHeaderBlock_() : true;
+        default:
+            return true;    // 未知的帧类型忽略
+    }
+}
+
+bool Http2Session::OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if(id == 0 || !(id & 1)) {
+        return ConnError_(PROTOCOL_ERROR, "bad stream id");
+    }
+    size_t pad = 0;
+    if(flags & FLAG_PADDED) {
+        if(len < 1) { return ConnError_(PROTOCOL_ERROR, "bad padding"); }
+        pad = p[0];
+        p++;
+        len--;
+    }
+    if(flags & FLAG_PRIORITY) {
+        if(len < 5) { return ConnError_(PROTOCOL_ERROR, "bad priority"); }
+        p += 5;
+        len -= 5;
+    }
+    if(pad > len) {
+        return ConnError_(PROTOCOL_ERROR, "bad padding");
+    }
+    headerBlock_.assign(reinterpret_cast<const char*>(p), len - pad);
+    headerStream_ = id;
+    headerFlags_ = flags;
+    return (flags & FLAG_END_HEADERS) ? OnHeaderBlock_() : true;
+}
+
+/*
+    一个完整的头部块：不管流最后是否被拒绝，都要解码以保持HPACK动态表同步
+    新流的请求头拼成HTTP/1.1的请求行和请求头；已有的流上再来的头部块是trailer，忽略内容
+*/
+bool Http2Session::OnHeaderBlock_() {
+    uint32_t id = headerStream_;
+    bool endStream = headerFlags_ & FLAG_END_STREAM;
+    headerStream_ = 0;
+
+    HeaderState hs;
+    hs.trailer = false;
+    hs.regularSeen = false;
+    hs.malformed = false;
+    hs.hostSeen = false;
+    Stream* s = nullptr;
+    bool refuse = false;
+    auto it = streams_.find(id);
+    if(it != streams_.end()) {
+        s = &it->second;
+        hs.trailer = true;
+    }
+    else if(id <= lastStreamId_) {
+        return ConnError_(STREAM_CLOSED, "HEADERS on closed stream");
+    }
+    else {
+        lastStreamId_ = id;
+        // 发了GOAWAY之后的新流不处理；超过并发上限的拒绝，客户端可以重试
+        refuse = goawaySent_ || streams_.size() >= MAX_CONCURRENT_STREAMS;
+    }
+    bool ok = decoder_.Decode(reinterpret_cast<const uint8_t*>(headerBlock_.data()), headerBlock_.size(),
+                              [&](std::string_view name, std::string_view value) {
+                                  if(!refuse) { OnHeader_(hs, name, value); }
+                              });
+    if(!ok) {
+        return ConnError_(COMPRESSION_ERROR, "bad header block");
+    }
+    if(refuse) {
+        if(!goawaySent_) { ResetStream_(id, REFUSED_STREAM); }
+        return true;
+    }
+    if(hs.trailer) {
+        if(s->endStream || !endStream) {
+            // 半关闭的流上又来HEADERS，或者trailer没有结束流
+            ResetStream_(id, s->endStream ? STREAM_CLOSED : PROTOCOL_ERROR);
+            CloseStream_(id);
+            return true;
+        }
+        EndRequest_(*s);
+        return true;
+    }
+
+    Stream& stream = streams_[id];
+    stream.id = id;
+    stream.sendWindow = peerInitialWindow_;
+    if(hs.method == "CONNECT") {
+        stream.code = 501;      // 不做隧道
+    }
+    else if(hs.malformed || hs.method.empty() || hs.path.empty() ||
+            !SafeToken_(hs.method, false) || !SafeToken_(hs.path, true)) {
+        ResetStream_(id, PROTOCOL_ERROR);
+        CloseStream_(id);
+        return true;
+    }
+    else {
+        stream.head.reserve(hs.method.size() + hs.path.size() + hs.headers.size() + hs.authority.size() + 32);
+        stream.head.append(hs.method).append(" ").append(hs.path).append(" HTTP/1.1\r\n");
+        if(!hs.hostSeen && !hs.authority.empty()) {
+            stream.head.append("Host: ").append(hs.authority).append("\r\n");
+        }
+        stream.head.append(hs.headers);
+        if(!hs.cookie.empty()) {
+            stream.head.append("Cookie: ").append(hs.cookie).append("\r\n");
+        }
+        stream.headOnly = hs.method == "HEAD";
+        stream.blocking = hs.method == "POST";
+    }
+    if(endStream) {
+        EndRequest_(stream);
+    }
+    return true;
+}
+
+// RFC 9113 8.2、8.3：伪头部在前、名字小写、没有连接相关的头部，否则是格式错误的请求
+void Http2Session::OnHeader_(HeaderState& hs, std::string_view name, std::string_view value) {
+    if(hs.trailer || hs.malformed) {
+        return;
+    }
+    if(!SafeValue_(value)) {
+        hs.malformed = true;
+        return;
+    }
+    if(!name.empty() && name[0] == ':') {
+        if(hs.regularSeen) { hs.malformed = true; }
+        else if(name == ":method") { hs.method.assign(value); }
+        else if(name == ":path") { hs.path.assign(value); }
+        else if(name == ":authority") { hs.authority.assign(value); }
+        else if(name != ":scheme") { hs.malformed = true; }
+        return;
+    }
+    hs.regularSeen = true;
+    if(!SafeToken_(name, false)) {
+        hs.malformed = true;
+        return;
+    }
+    for(char ch: name) {
+        if(ch >= 'A' && ch <= 'Z') {
+            hs.malformed = true;
+            return;
+        }
+    }
+    if(name == "connection" || name == "keep-alive" || name == "proxy-connection" ||
+       name == "transfer-encoding" || name == "upgrade" || (name == "te" && value != "trailers")) {
+        hs.malformed = true;
+        return;
+    }
+    if(name == "cookie") {
+        // HTTP/2里Cookie可以拆成多个头部，合回一个
+        if(!hs.cookie.empty()) { hs.cookie.append("; "); }
+        hs.cookie.append(value);
+        return;
+    }
+    if(name == "content-length") {
+        return;     // 请求体收齐后按实际长度写Content-Length
+    }
+    if(name == "host") {
+        hs.hostSeen = true;
+    }
+    hs.headers.append(name).append(": ").append(value).append("\r\n");
+}
+
+bool Http2Session::OnData_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if(id == 0) {
+        return ConnError_(PROTOCOL_ERROR, "DATA on stream 0");
+    }
+    // 填充也计入流量控制
+    size_t frameLen = len;
+    connRecvWindow_ -= frameLen;
+    if(connRecvWindow_ < 0) {
+        return ConnError_(FLOW_CONTROL_ERROR, "connection window exceeded");
+    }
+    connConsumed_ += frameLen;
+    if(connConsumed_ >= DEFAULT_WINDOW / 2) {
+        SendWindowUpdate_(0, connConsumed_);
+        connRecvWindow_ += connConsumed_;
+        connConsumed_ = 0;
+    }
+    size_t pad = 0;
+    if(flags & FLAG_PADDED) {
+        if(len < 1) { return ConnError_(PROTOCOL_ERROR, "bad padding"); }
+        pad = p[0];
+        p++;
+        len--;
+        if(pad > len) { return ConnError_(PROTOCOL_ERROR, "bad padding"); }
+        len -= pad;
+    }
+    auto it = streams_.find(id);
+    if(it == streams_.end()) {
+        if(id > lastStreamId_) {
+            return ConnError_(PROTOCOL_ERROR, "DATA on idle stream");
+        }
+        ResetStream_(id, STREAM_CLOSED);
+        return true;
+    }
+    Stream& s = it->second;
+    if(s.endStream) {
+        ResetStream_(id, STREAM_CLOSED);
+        CloseStream_(id);
+        return true;
+    }
+    s.recvWindow -= frameLen;
+    if(s.recvWindow < 0) {
+        ResetStream_(id, FLOW_CONTROL_ERROR);
+        CloseStream_(id);
+        return true;
+    }
+    if(s.code == 0) {
+        if(s.bodyLen + len > HttpRequest::maxBodyBytes) {
+            // 超过上限：继续收完丢掉，最后回413
+            s.code = 413;
+            ReleaseBody_(s);
+        }
+        else if(!AppendBody_(s, p, len)) {
+            s.code = 500;
+            ReleaseBody_(s);
+        }
+    }
+    if(flags & FLAG_END_STREAM) {
+        EndRequest_(s);
+        return true;
+    }
+    s.recvConsumed += frameLen;
+    if(s.recvConsumed >= DEFAULT_WINDOW / 2) {
+        SendWindowUpdate_(id, s.recvConsumed);
+        s.recvWindow += s.recvConsumed;
+        s.recvConsumed = 0;
+    }
+    return true;
+}
+
+bool Http2Session::OnSettings_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len) {
+    if(id != 0) {
+        return ConnError_(PROTOCOL_ERROR, "SETTINGS on stream");
+    }
+    if(flags & FLAG_ACK) {
+        return len == 0 ? true : ConnError_(FRAME_SIZE_ERROR, "SETTINGS ack with payload");
+    }
+    if(len % 6 != 0) {
+        return ConnError_(FRAME_SIZE_ERROR, "bad SETTINGS length");
+    }
+    if(!ApplySettings_(p, len)) {
+        return false;
+    }
+    WriteFrameHeader_(0, SETTINGS, FLAG_ACK, 0);
+    return true;
+}
+
+bool Http2Session::ApplySettings_(const uint8_t* p, size_t len) {
+    for(size_t i = 0; i + 6 <= len; i += 6) {
+        uint16_t key = (uint16_t(p[i]) << 8) | p[i + 1];
+        uint32_t value = Read32_(p + i + 2);
+        switch(key) {
+            case SETTINGS_HEADER_TABLE_SIZE:
+                encoder_.SetPeerMaxTableSize(value);
+                break;
+            case SETTINGS_ENABLE_PUSH:
+                if(value > 1) { return ConnError_(PROTOCOL_ERROR, "bad ENABLE_PUSH"); }
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE: {
+                if(value > MAX_WINDOW) { return ConnError_(FLOW_CONTROL_ERROR, "bad INITIAL_WINDOW_SIZE"); }
+                // 已有的流的发送窗口一起按差值调整，可能变成负数
+                int64_t delta = int64_t(value) - peerInitialWindow_;
+                peerInitialWindow_ = value;
+                for(auto& it: streams_) {
+                    Stream& s = it.second;
+                    s.sendWindow += delta;
+                    if(s.sendWindow > MAX_WINDOW) { return ConnError_(FLOW_CONTROL_ERROR, "stream window overflow"); }
+                    if(s.blocked && s.sendWindow > 0) {
+                        s.blocked = false;
+                        sending_.push_back(s.id);
+                    }
+                }
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if(value < MAX_FRAME_SIZE || value > 0xffffff) { return ConnError_(PROTOCOL_ERROR, "bad MAX_FRAME_SIZE"); }
+                peerMaxFrame_ = value;
+                break;
+            default:
+                break;      // MAX_CONCURRENT_STREAMS限制的是服务器开的流，我们不开；其余的忽略
+        }
+    }
+    return true;
+}
+
+bool Http2Session::OnWindowUpdate_(uint32_t id, const uint8_t* p, size_t len) {
+    if(len != 4) {
+        return ConnError_(FRAME_SIZE_ERROR, "bad WINDOW_UPDATE");
+    }
+    uint32_t increment = Read32_(p) & 0x7fffffff;
+    if(id == 0) {
+        if(increment == 0) { return ConnError_(PROTOCOL_ERROR, "zero WINDOW_UPDATE"); }
+        connSendWindow_ += increment;
+        if(connSendWindow_ > MAX_WINDOW) { return ConnError_(FLOW_CONTROL_ERROR, "connection window overflow"); }
+        return true;
+    }
+    auto it = streams_.find(id);
+    if(it == streams_.end()) {
+        // 已经发完关闭的流上迟到的WINDOW_UPDATE是正常的
+        return id > lastStreamId_ ? ConnError_(PROTOCOL_ERROR, "WINDOW_UPDATE on idle stream") : true;
+    }
+    Stream& s = it->second;
+    if(increment == 0 || s.sendWindow + increment > MAX_WINDOW) {
+        ResetStream_(id, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        CloseStream_(id);
+        return true;
+    }
+    s.sendWindow += increment;
+    if(s.blocked && s.sendWindow > 0) {
+        s.blocked = false;
+        sending_.push_back(id);
+    }
+    return true;
+}
+
+static bool WriteAll_(int fd, const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("Write h2 request body to temp file failed, errno:%d", errno);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+    流的请求体先放内存，这个流超过HttpRequest::bodyMemBytes、或者整个连接放在内存里的超过MAX_BODY_BUFFER时
+    改写临时文件：窗口照常归还，客户端不用等，但一个连接占的内存有上限，不随并发的流数和请求体大小增长
+*/
+bool Http2Session::AppendBody_(Stream& s, const uint8_t* p, size_t len) {
+    if(s.bodyFd < 0 && (s.body.size() + len > HttpRequest::bodyMemBytes || bodyBytes_ + len > MAX_BODY_BUFFER)) {
+        s.bodyFd = HttpRequest::OpenSpillFile();
+        if(s.bodyFd < 0 || !WriteAll_(s.bodyFd, s.body.data(), s.body.size())) { return false; }
+        LOG_DEBUG("h2 stream %u body spilled to temp file, fd:%d", s.id, s.bodyFd);
+        bodyBytes_ -= s.body.size();
+        std::string().swap(s.body);
+    }
+    s.bodyLen += len;
+    if(s.bodyFd >= 0) {
+        return WriteAll_(s.bodyFd, reinterpret_cast<const char*>(p), len);
+    }
+    s.body.append(reinterpret_cast<const char*>(p), len);
+    bodyBytes_ += len;
+    return true;
+}
+
+void Http2Session::ReleaseBody_(Stream& s) {
+    bodyBytes_ -= s.body.size();
+    std::string().swap(s.body);
+    if(s.bodyFd >= 0) {
+        close(s.bodyFd);
+        s.bodyFd = -1;
+    }
+}
+
+// 临时文件里的请求体分段读进reqBuff_交给解析器，HttpRequest照常决定放内存还是写它自己的临时文件
+bool Http2Session::FeedBody_(Stream& s, HttpRequest::PARSE_RESULT* ret) {
+    static const size_t FEED_BYTES = 64 * 1024;
+    off_t off = 0;
+    while(*ret == HttpRequest::PARSE_AGAIN && size_t(off) < s.bodyLen) {
+        size_t want = std::min(FEED_BYTES, s.bodyLen - size_t(off));
+        reqBuff_.EnsureWriteable(want);
+        ssize_t n = pread(s.bodyFd, reqBuff_.BeginWrite(), want, off);
+        if(n <= 0) {
+            if(n < 0 && errno == EINTR) { continue; }
+            LOG_ERROR("Read h2 request body from temp file failed, errno:%d", errno);
+            return false;
+        }
+        reqBuff_.HasWritten(n);
+        off += n;
+        *ret = request_.parse(reqBuff_);
+    }
+    return true;
+}
+
+void Http2Session::EndRequest_(Stream& s) {
+    s.endStream = true;
+    s.ready = true;
+    ready_.push_back(s.id);
+    if(s.blocking) { blockingReady_++; }
+}
+
+/*
+    生成一个流的响应：请求拼成HTTP/1.1报文交给HttpRequest解析，HttpResponse照常生成响应，
+    再把它的状态行和响应头换成HPACK编码的HEADERS帧，响应体留到ScheduleData_按窗口发送
+*/
+void Http2Session::Respond_(Stream& s) {
+    int code = s.code;
+    if(code == 0 && !s.upgraded) {
+        reqBuff_.RetrieveAll();
+        reqBuff_.Append(s.head);
+        char length[48];
+        int n = snprintf(length, sizeof(length), "Content-Length: %zu\r\n\r\n", s.bodyLen);
+        reqBuff_.Append(length, n);
+        reqBuff_.Append(s.body);
+        std::string().swap(s.head);
+        request_.Init();
+        HttpRequest::PARSE_RESULT ret = request_.parse(reqBuff_);
+        bool fed = s.bodyFd < 0 || FeedBody_(s, &ret);
+        ReleaseBody_(s);
+        code = !fed ? 500 : (ret == HttpRequest::PARSE_OK ? 200 : (ret == HttpRequest::PARSE_ERROR ? request_.ErrorCode() : 400));
+    }
+    if(code == 0) {
+        code = 200;
+    }
+    response_.Init(srcDir_, code == 200 ? std::string_view(request_.path()) : std::string_view(), true, code);
+    if(code == 200) {
+        Router::Dispatch(request_, response_);
+    }
+    respBuff_.RetrieveAll();
+    response_.MakeResponse(respBuff_);
+
+    std::string_view resp(respBuff_.Linearize(), respBuff_.ReadableBytes());
+    size_t headEnd = resp.find("\r\n\r\n");
+    if(headEnd == std::string_view::npos) { headEnd = resp.size(); }
+    block_.clear();
+    encoder_.Begin(block_);
+    encoder_.EncodeStatus(response_.Code(), block_);
+    // 跳过状态行，其余每行"名字: 值"换成小写名字；连接相关的头部在HTTP/2里不允许出现
+    size_t pos = resp.find("\r\n");
+    while(pos != std::string_view::npos && pos < headEnd) {
+        pos += 2;
+        size_t eol = std::min(resp.find("\r\n", pos), headEnd);
+        std::string_view line = resp.substr(pos, eol - pos);
+        pos = eol;
+        size_t colon = line.find(':');
+        if(colon == std::string_view::npos) { continue; }
+        char name[64];
+        if(colon >= sizeof(name)) { continue; }
+        for(size_t i = 0; i < colon; i++) { name[i] = tolower(static_cast<unsigned char>(line[i])); }
+        std::string_view lower(name, colon);
+        if(lower == "connection" || lower == "keep-alive" || lower == "transfer-encoding") { continue; }
+        std::string_view value = line.substr(colon + 1);
+        while(!value.empty() && (value.front() == ' ' || value.front() == '\t')) { value.remove_prefix(1); }
+        while(!value.empty() && (value.back() == ' ' || value.back() == '\t')) { value.remove_suffix(1); }
+        // 每个响应都不同的长度不进动态表，Content-Type等重复的值进表后只占一个字节
+        encoder_.Encode(lower, value, lower != "content-length", block_);
+    }
+
+    std::string_view inlineBody = headEnd + 4 <= resp.size() ? resp.substr(headEnd + 4) : std::string_view();
+    if(s.headOnly) {
+        response_.CloseFile();
+    }
+    else if(response_.IsStreaming()) {
+        s.source = response_.ReleaseStream();
+    }
+    else if(response_.FileLen() > 0) {
+        s.file = response_.ReleaseFile();
+        s.data = s.file->data;
+        s.left = s.file->size;
+    }
+    else if(!inlineBody.empty()) {
+        s.inlineBody.assign(inlineBody.data(), inlineBody.size());
+        s.data = s.inlineBody.data();
+        s.left = s.inlineBody.size();
+    }
+    LOG_DEBUG("HTTP/2 stream %u: %d, body %zu", s.id, response_.Code(), s.left);
+    bool noBody = s.left == 0 && !s.source;
+    SendHeaders_(s.id, block_, noBody);
+    if(noBody) {
+        CloseStream_(s.id);
+    }
+    else {
+        sending_.push_back(s.id);
+    }
+}
+
+void Http2Session::SendHeaders_(uint32_t id, const std::string& block, bool endStream) {
+    size_t off = 0;
+    bool first = true;
+    do {
+        size_t n = std::min<size_t>(block.size() - off, peerMaxFrame_);
+        bool last = off + n == block.size();
+        uint8_t flags = (last ? FLAG_END_HEADERS : 0) | (first && endStream ? FLAG_END_STREAM : 0);
+        WriteFrameHeader_(n, first ? HEADERS : CONTINUATION, flags, id);
+        out_->Append(block.data() + off, n);
+        off += n;
+        first = false;
+    } while(off < block.size());
+}
+
+// 有响应体要发的流轮流各发一帧，直到连接窗口或这一批的切片用完；流窗口用完的先移出，等WINDOW_UPDATE
+void Http2Session::ScheduleData_() {
+    while(!sending_.empty() && connSendWindow_ > 0 && out_->ReadableBytes() < MAX_OUT_BYTES) {
+        uint32_t id = sending_.front();
+        Stream& s = streams_.find(id)->second;
+        if(s.sendWindow <= 0) {
+            sending_.pop_front();
+            s.blocked = true;
+            continue;
+        }
+        if(s.file && segCnt_ >= maxSegs_) {
+            break;
+        }
+        sending_.pop_front();
+        if(s.left == 0 && s.source) {
+            NextChunk_(s);
+        }
+        size_t n = std::min<size_t>({s.left, peerMaxFrame_, size_t(connSendWindow_), size_t(s.sendWindow)});
+        bool last = n == s.left && !s.source;
+        WriteFrameHeader_(n, DATA, last ? FLAG_END_STREAM : 0, id);
+        if(s.file) {
+            // 文件切片不拷贝；最后一片带上文件的引用，这一批发完后由连接释放
+            segs_[segCnt_++] = OutSegment{out_->ReadableBytes(), s.data, n, last ? s.file : nullptr};
+            if(last) { s.file = nullptr; }
+        }
+        else {
+            out_->Append(s.data, n);
+        }
+        s.data += n;
+        s.left -= n;
+        s.sendWindow -= n;
+        connSendWindow_ -= n;
+        if(last) {
+            CloseStream_(id);
+        }
+        else {
+            sending_.push_back(id);
+        }
+    }
+}
+
+// 流式响应体的下一段拷贝到inlineBody，和普通的响应体一样按窗口分帧；最后一段取完后source置空
+void Http2Session::NextChunk_(Stream& s) {
+    chunk_.RetrieveAll();
+    bool more;
+    do {
+        more = s.source->Next(chunk_, MAX_FRAME_SIZE);
+    } while(more && chunk_.ReadableBytes() == 0);
+    s.inlineBody.assign(chunk_.Linearize(), chunk_.ReadableBytes());
+    s.data = s.inlineBody.data();
+    s.left = s.inlineBody.size();
+    if(!more) {
+        s.source.reset();
+    }
+}
+
+void Http2Session::WriteFrameHeader_(uint32_t len, uint8_t type, uint8_t flags, uint32_t id) {
+    uint8_t h[FRAME_HEADER_LEN] = {
+        uint8_t(len >> 16), uint8_t(len >> 8), uint8_t(len), type, flags,
+    };
+    Write32_(h + 5, id);
+    out_->Append(h, sizeof(h));
+}
+
+void Http2Session::SendSettings_() {
+    uint8_t payload[6] = {0, SETTINGS_MAX_CONCURRENT_STREAMS};
+    Write32_(payload + 2, MAX_CONCURRENT_STREAMS);
+    WriteFrameHeader_(sizeof(payload), SETTINGS, 0, 0);
+    out_->Append(payload, sizeof(payload));
+    settingsSent_ = true;
+}
+
+void Http2Session::SendWindowUpdate_(uint32_t id, uint32_t increment) {
+    uint8_t payload[4];
+    Write32_(payload, increment);
+    WriteFrameHeader_(sizeof(payload), WINDOW_UPDATE, 0, id);
+    out_->Append(payload, sizeof(payload));
+}
+
+void Http2Session::ResetStream_(uint32_t id, ERROR_CODE code) {
+    uint8_t payload[4];
+    Write32_(payload, code);
+    WriteFrameHeader_(sizeof(payload), RST_STREAM, 0, id);
+    out_->Append(payload, sizeof(payload));
+}
+
+void Http2Session::SendGoaway_(ERROR_CODE code) {
+    uint8_t payload[8];
+    Write32_(payload, lastStreamId_);
+    Write32_(payload + 4, code);
+    WriteFrameHeader_(sizeof(payload), GOAWAY, 0, 0);
+    out_->Append(payload, sizeof(payload));
+    goawaySent_ = true;
+}
+
+// 连接错误：发GOAWAY后不再处理任何帧，发完就关闭连接
+bool Http2Session::ConnError_(ERROR_CODE code, const char* msg) {
+    LOG_WARN("HTTP/2 connection error %d: %s", code, msg);
+    if(out_) {
+        SendGoaway_(code);
+    }
+    fatal_ = true;
+    return false;
+}
+
+void Http2Session::CloseStream_(uint32_t id) {
+    auto it = streams_.find(id);
+    if(it == streams_.end()) {
+        return;
+    }
+    Stream& s = it->second;
+    if(s.ready) {
+        ready_.erase(std::find(ready_.begin(), ready_.end(), id));
+        if(s.blocking) { blockingReady_--; }
+    }
+    auto pos = std::find(sending_.begin(), sending_.end(), id);
+    if(pos != sending_.end()) {
+        sending_.erase(pos);
+    }
+    // 之前批次里这个文件的切片都已经发完（上一批没发完不会调用Process）
+    if(s.file) {
+        FileCache::Release(s.file);
+    }
+    ReleaseBody_(s);
+    streams_.erase(it);
+}
@@ -0,0 +1,199 @@
+#ifndef HTTP2_SESSION_H
+#define HTTP2_SESSION_H
+
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "../buffer/buffer.h"
+#include "../log/log.h"
+#include "hpack.h"
+#include "httprequest.h"
+#include "httprespon.h"
+
+// 一批输出里引用的外部数据：输出缓冲区里前headerEnd个字节发完后接着发[data, data + len)，
+// file非空时这一批发送完由连接FileCache::Release(file)
+struct OutSegment {
+    size_t headerEnd;
+    const char* data;
+    size_t len;
+    const FileCache::Entry* file;
+};
+
+/*
+    明文HTTP/2（h2c，RFC 9113）的一个连接：帧的收发、流的多路复用、HPACK和流量控制
+    每个流收齐请求（END_STREAM）后拼成HTTP/1.1报文交给连接的HttpRequest解析，
+    再用HttpResponse生成响应，把响应头换成HPACK编码的HEADERS帧，文件按DATA帧切片，
+    切片直接指向mmap的文件，和帧头一起由连接writev发出，不拷贝文件内容
+    发送按流量控制窗口在各流之间轮转，每批最多maxSegs个文件切片，窗口用完的流等WINDOW_UPDATE
+    两种进入方式：连接一开始就是HTTP/2的连接前言（prior knowledge），或者HTTP/1.1请求带Upgrade: h2c
+    不支持的部分：服务器推送、优先级（RFC 9113已经弃用，PRIORITY帧收下后忽略）
+*/
+class Http2Session {
+public:
+    static const size_t PREFACE_LEN = 24;
+    static const uint32_t MAX_CONCURRENT_STREAMS = 100;
+    static const uint32_t DEFAULT_WINDOW = 65535;
+    static const uint32_t MAX_FRAME_SIZE = 16384;       // 我们接收的帧上限（SETTINGS_MAX_FRAME_SIZE初始值）
+    static const size_t MAX_HEADER_BLOCK = 64 * 1024;   // HEADERS加CONTINUATION累计的上限
+    // 一次Process里拷贝进输出缓冲区的响应体上限：对端的窗口很大时流式响应体也要等套接字写完再生成
+    static const size_t MAX_OUT_BYTES = 256 * 1024;
+    // 一个连接上所有流放在内存里的请求体合计上限，超过后新到的请求体写临时文件；
+    // 单个流超过HttpRequest::bodyMemBytes时也写临时文件
+    static const size_t MAX_BODY_BUFFER = 1024 * 1024;
+
+    enum FRAME_TYPE {
+        DATA = 0x0, HEADERS = 0x1, PRIORITY = 0x2, RST_STREAM = 0x3, SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5, PING = 0x6, GOAWAY = 0x7, WINDOW_UPDATE = 0x8, CONTINUATION = 0x9,
+    };
+
+    enum ERROR_CODE {
+        NO_ERROR = 0x0, PROTOCOL_ERROR = 0x1, INTERNAL_ERROR = 0x2, FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED = 0x5, FRAME_SIZE_ERROR = 0x6, REFUSED_STREAM = 0x7, COMPRESSION_ERROR = 0x9,
+        ENHANCE_YOUR_CALM = 0xb,
+    };
+
+    Http2Session(HttpRequest& request, HttpResponse& response, const char* srcDir);
+    ~Http2Session();
+    Http2Session(const Http2Session&) = delete;
+    Http2Session& operator=(const Http2Session&) = delete;
+
+    // 连接槽复用时清空所有流
+    void Init();
+
+    // buff开头是不是连接前言：1是，0不是，-1目前是前言的前缀，要等更多数据
+    static int MatchPreface(const Buffer& buff);
+    // 这个HTTP/1.1请求是否请求升级到h2c（Upgrade: h2c且带HTTP2-Settings，没有请求体）
+    static bool WantsUpgrade(const HttpRequest& request);
+
+    // 以prior knowledge开始：前言还在in里，由Process检查
+    void Start();
+    // 以Upgrade: h2c开始：往out里写101响应和服务器的SETTINGS，request里已经解析好的请求作为流1，
+    // 在下一次Process时生成响应；HTTP2-Settings格式错误返回false（这时按HTTP/1.1处理）
+    bool StartUpgrade(const HttpRequest& request, Buffer& out);
+
+    // 处理in里完整的帧，生成的帧追加到out，文件切片记到segs里（最多maxSegs个）
+    // inlineOnly时跳过会阻塞的流（POST），留给线程池；draining时发GOAWAY，处理完已有的流后关闭
+    // 返回这次完成的请求数
+    int Process(Buffer& in, Buffer& out, OutSegment* segs, int maxSegs, int* segCnt,
+                bool inlineOnly, bool draining);
+
+    // 还有没做完的事：收齐了还没处理的请求，或者窗口允许发送的响应体
+    size_t PendingWork() const {
+        return (prefaceDone_ ? ready_.size() : 0) + (!sending_.empty() && connSendWindow_ > 0 ? 1 : 0);
+    }
+    // 收齐的请求里有会阻塞的
+    bool HasBlocking() const { return blockingReady_ > 0; }
+    // 各个流放在内存里还没处理的请求体合计，不超过MAX_BODY_BUFFER
+    size_t BufferedBodyBytes() const { return bodyBytes_; }
+    // 连接还要保持：没有出错，也没有在双方不再开新流后把流都处理完
+    bool IsAlive() const {
+        return !fatal_ && !((goawaySent_ || goawayReceived_) && streams_.empty());
+    }
+
+private:
+    struct Stream {
+        uint32_t id = 0;
+        bool endStream = false;     // 请求已经收齐
+        bool ready = false;         // 在ready_里
+        bool blocking = false;      // POST：可能查数据库
+        bool upgraded = false;      // Upgrade: h2c的流1，请求在HttpRequest里
+        bool headOnly = false;      // HEAD请求，不发响应体
+        int code = 0;               // 非0时不解析请求，直接回这个错误码
+        std::string head;           // 拼好的HTTP/1.1请求行和请求头（不含Content-Length和结尾的空行）
+        std::string body;           // 放在内存里的请求体
+        int bodyFd = -1;            // 请求体较大时写到临时文件，body不再使用
+        size_t bodyLen = 0;         // 收到的请求体总长度
+        int64_t recvWindow = DEFAULT_WINDOW;
+        uint32_t recvConsumed = 0;  // 已经收下还没通过WINDOW_UPDATE归还的
+        int64_t sendWindow = 0;
+        // 待发的响应体：缓存的文件（持有一个引用），或者HttpResponse生成的小段内容（拷贝到输出缓冲区发送）
+        const FileCache::Entry* file = nullptr;
+        const char* data = nullptr;
+        size_t left = 0;
+        std::string inlineBody;
+        std::unique_ptr<StreamBody> source;     // 流式响应体，inlineBody发完再取下一段
+        bool blocked = false;       // 流的发送窗口用完，不在sending_里
+    };
+
+    // 解析请求头块时的状态
+    struct HeaderState {
+        bool trailer;
+        bool regularSeen;       // 普通头部之后不能再有伪头部
+        bool malformed;
+        bool hostSeen;
+        std::string method, path, authority, cookie;
+        std::string headers;    // 普通头部，已经是"名字: 值\r\n"的形式
+    };
+
+    bool ReadFrames_(Buffer& in);
+    bool OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, size_t len);
+    bool OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len);
+    bool OnHeaderBlock_();
+    void OnHeader_(HeaderState& hs, std::string_view name, std::string_view value);
+    bool OnData_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len);
+    bool OnSettings_(uint8_t flags, uint32_t id, const uint8_t* p, size_t len);
+    bool OnWindowUpdate_(uint32_t id, const uint8_t* p, size_t len);
+    bool ApplySettings_(const uint8_t* p, size_t len);
+
+    bool AppendBody_(Stream& s, const uint8_t* p, size_t len);
+    void ReleaseBody_(Stream& s);
+    bool FeedBody_(Stream& s, HttpRequest::PARSE_RESULT* ret);
+    void EndRequest_(Stream& s);
+    void Respond_(Stream& s);
+    void SendHeaders_(uint32_t id, const std::string& block, bool endStream);
+    void NextChunk_(Stream& s);
+    void ScheduleData_();
+
+    void WriteFrameHeader_(uint32_t len, uint8_t type, uint8_t flags, uint32_t id);
+    void SendSettings_();
+    void SendWindowUpdate_(uint32_t id, uint32_t increment);
+    void ResetStream_(uint32_t id, ERROR_CODE code);
+    void SendGoaway_(ERROR_CODE code);
+    bool ConnError_(ERROR_CODE code, const char* msg);
+    void CloseStream_(uint32_t id);
+
+    HttpRequest& request_;
+    HttpResponse& response_;
+    const char* srcDir_;
+
+    // 本次Process的输出
+    Buffer* out_;
+    OutSegment* segs_;
+    int maxSegs_;
+    int segCnt_;
+
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+    std::unordered_map<uint32_t, Stream> streams_;
+    std::deque<uint32_t> ready_;        // 请求收齐、等待生成响应的流
+    std::deque<uint32_t> sending_;      // 有响应体要发且流窗口没用完的流，轮流发一帧
+    size_t blockingReady_;
+    size_t bodyBytes_;                  // 各个流放在内存里的请求体合计
+
+    bool prefaceDone_;
+    bool settingsSent_;
+    bool fatal_;
+    bool goawaySent_;
+    bool goawayReceived_;
+    uint32_t lastStreamId_;             // 处理过的最大的客户端流id
+    uint32_t headerStream_;             // 正在接收CONTINUATION的流，0表示没有
+    uint8_t headerFlags_;
+    std::string headerBlock_;
+
+    int64_t connSendWindow_;
+    int64_t connRecvWindow_;
+    uint32_t connConsumed_;
+    uint32_t peerInitialWindow_;
+    uint32_t peerMaxFrame_;
+
+    Buffer reqBuff_;                    // 拼出来的HTTP/1.1请求
+    Buffer respBuff_;                   // HttpResponse生成的HTTP/1.1响应头
+    std::string block_;                 // 编码好的响应头块
+    Buffer chunk_;                      // 流式响应体的一段
+};
+
+#endif //HTTP2_SESSION_H
@@ -2,32 +2,60 @@
 
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
+std::atomic<bool> HttpConn::isDraining(false);
 bool HttpConn::isET;
+bool HttpConn::enableH2c = true;
+int HttpConn::maxRequests = 0;
+int HttpConn::keepAliveTimeoutSec = 0;
 
 HttpConn::HttpConn() {
     fd_ = -1;
     addr_ = {0};
+    ip_[0] = '\0';
+    port_ = 0;
     isClose_ = false;
+    keepAlive_ = false;
+    requests_ = 0;
+    iovCnt_ = iovIdx_ = fileCnt_ = 0;
+    toWrite_ = 0;
+    isH2_ = false;
+    streamChunked_ = false;
+    request_.SetArena(&arena_);
+    response_.SetArena(&arena_);
 }
 
 HttpConn::~HttpConn() {
     Close();
 }
 
-void HttpConn::init(int sockFd, const sockaddr_in &addr) {
+void HttpConn::init(int sockFd, const sockaddr_storage &addr) {
     fd_ = sockFd;
     userCount++;
     addr_ = addr;
+    port_ = -1;
+    if(addr_.ss_family != AF_UNSPEC) {
+        ResolvePeer_();
+    }
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    request_.Init();
+    ReleaseFiles_();    // 槽位复用时清掉上一个连接没发完的响应
+    if(h2_) { h2_->Init(); }
+    isH2_ = false;
+    stream_.reset();
+    chunkBuff_.RetrieveAll();
+    iovCnt_ = iovIdx_ = 0;
+    toWrite_ = 0;
+    keepAlive_ = false;
+    requests_ = 0;
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
-ssize_t HttpConn::read(int *saveErrno) {
+ssize_t HttpConn::read(int *saveErrno, const ReadFn& readFn) {
     ssize_t len = -1;
     do {
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        len = readFn ? readFn(fd_, &readBuff_, saveErrno) : readBuff_.ReadFd(fd_, saveErrno);
         if (len <= 0) {
             break;
         }
@@ -37,39 +65,61 @@ ssize_t HttpConn::read(int *saveErrno) {
 
 ssize_t HttpConn::write(int *saveErrno)
 {
-    // 如果
-    ssize_t len = -1;
-    do {
-        len = writev(fd_, iov_, iovCnt_);
+    // 一直写到发完或EAGAIN：LT下中途返回会被当成出错关闭连接
+    ssize_t len = 0;
+    while(toWrite_ > 0) {
+        len = writev(fd_, iov_ + iovIdx_, iovCnt_ - iovIdx_);
         if(len <= 0) {
             *saveErrno = errno;
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; }
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
+        toWrite_ -= len;
+        // 跳过已经发完的iov，停在第一个没发完的上面并调整它的起点
+        size_t left = len;
+        while(iovIdx_ < iovCnt_ && left >= iov_[iovIdx_].iov_len) {
+            left -= iov_[iovIdx_].iov_len;
+            iov_[iovIdx_++].iov_len = 0;
         }
-        else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            iov_[0].iov_len -= len; 
-            writeBuff_.Retrieve(len);
+        if(iovIdx_ < iovCnt_) {
+            iov_[iovIdx_].iov_base = (uint8_t*)iov_[iovIdx_].iov_base + left;
+            iov_[iovIdx_].iov_len -= left;
         }
-    }while(isET || ToWriteBytes() > 10240); // 如果数据很多的话，就接着写，不然会一直切换写状态
+        if(toWrite_ == 0 && stream_) {
+            // 上一段已经全部写进套接字，接着生成下一段；EAGAIN时停在上面，可写了再回到这里
+            writeBuff_.Retrieve(writeBuff_.ReadableBytes());
+            ReleaseFiles_();
+            OutSegment seg;
+            int segCnt = 0;
+            NextChunk_(&seg, &segCnt);
+            BuildIov_(&seg, segCnt);
+        }
+    }
+    if(toWrite_ == 0) {
+        // 整批发完：响应头全部取走（缓冲区读空后回到开头），释放文件的引用
+        writeBuff_.Retrieve(writeBuff_.ReadableBytes());
+        ReleaseFiles_();
+    }
     return len;
 }
 
+void HttpConn::ReleaseFiles_() {
+    for(int i = 0; i < fileCnt_; i++) {
+        FileCache::Release(files_[i]);
+    }
+    fileCnt_ = 0;
+}
+
 void HttpConn::Close() {
-    response_.UnmapFile();
+    response_.CloseFile();
+    request_.Init();    // 关掉可能还开着的请求体临时文件
+    ReleaseFiles_();
+    if(h2_) { h2_->Init(); }    // 释放各个流还没发完的文件
+    stream_.reset();
     if(isClose_ == false) {
         isClose_ = true; 
         userCount--;
-        close(fd_);
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        close(fd_);     // 最后再close，close之后fd可能立即被其他连接复用
     }
 }
 
@@ -77,42 +127,192 @@ int HttpConn::GetFd() const {
     return fd_;
 }
 
-struct sockaddr_in HttpConn::GetAddr() const {
+const struct sockaddr_storage& HttpConn::GetAddr() const {
+    if(port_ < 0) { ResolvePeer_(); }
     return addr_;
 }
 
-bool HttpConn::process() {
-    request_.Init();
-    if(readBuff_.ReadableBytes() <= 0) return false;
-    else if(request_.parse(readBuff_)) {
-        LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+int HttpConn::process(bool inlineOnly) {
+    // 上一批响应还没发完，新请求先留在读缓冲区，发完后再处理
+    if(toWrite_ > 0) return 0;
+    if(isH2_) return ProcessH2_(inlineOnly);
+    if(readBuff_.ReadableBytes() <= 0) return 0;
+
+    // 连接以HTTP/2前言开头（prior knowledge）；前言还没收全时先不当HTTP/1.1请求解析
+    if(enableH2c && !request_.InBody()) {
+        int preface = Http2Session::MatchPreface(readBuff_);
+        if(preface < 0) return 0;
+        if(preface > 0) {
+            if(!h2_) { h2_.reset(new Http2Session(request_, response_, srcDir)); }
+            h2_->Start();
+            isH2_ = true;
+            LOG_DEBUG("Client[%d] http/2 with prior knowledge", fd_);
+            return ProcessH2_(inlineOnly);
+        }
+    }
+
+    // writeBuff_此时是空的（读空后位置回到开头），这一批的响应头依次追加在里面不会回绕，
+    // 中途可能扩容，所以先记偏移，整批生成完再换成地址
+    OutSegment segs[MAX_PIPELINE];
+    int segCnt = 0;
+    int n = 0;
+    while(n < MAX_PIPELINE && readBuff_.ReadableBytes() > 0) {
+        if(n > 0 && inlineOnly && IsBlocking()) { break; }
+        // 不在这里Init：请求不完整时解析器保留进度，下次只处理新读到的数据
+        HttpRequest::PARSE_RESULT ret = request_.parse(readBuff_);
+        if(ret == HttpRequest::PARSE_AGAIN) {
+            break;      // 请求还不完整，等更多数据
+        }
+        else if(ret == HttpRequest::PARSE_OK) {
+            LOG_DEBUG("%s", request_.path().c_str());
+            // Upgrade: h2c只在批次的第一个请求上接受，101之后这个请求的响应走流1
+            if(n == 0 && enableH2c && !isDraining && Http2Session::WantsUpgrade(request_)) {
+                if(!h2_) { h2_.reset(new Http2Session(request_, response_, srcDir)); }
+                if(h2_->StartUpgrade(request_, writeBuff_)) {
+                    isH2_ = true;
+                    LOG_DEBUG("Client[%d] upgrade to h2c", fd_);
+                    return ProcessH2_(inlineOnly);
+                }
+            }
+            // 达到每连接的请求数上限时这个响应告诉客户端关闭，流水线里后面的请求不再处理
+            requests_++;
+            keepAlive_ = request_.IsKeepAlive() && !isDraining && (maxRequests <= 0 || requests_ < uint32_t(maxRequests));
+            response_.Init(srcDir, request_.path(), keepAlive_, 200, request_.version() == "1.1");
+            response_.SetKeepAliveLimits(keepAliveTimeoutSec, maxRequests > 0 ? maxRequests - int(requests_) : 0);
+            // HEAD也按GET的路由处理，只是不发响应体，否则流水线里后面的响应会错位
+            response_.SetHeadOnly(request_.method() == "HEAD");
+            Router::Dispatch(request_, response_);
+        }
+        else {
+            keepAlive_ = false;
+            requests_++;
+            response_.Init(srcDir, request_.path(), false, request_.ErrorCode());
+            readBuff_.RetrieveAll();    // 出错的请求之后的数据无法定界，回错误响应后关闭连接
+        }
+        // 响应报文放到输出缓冲区，文件的引用交给连接保管到发送完
+        response_.MakeResponse(writeBuff_);
+        if(response_.IsStreaming()) {
+            // 响应体边生成边发，这一批到此为止；先带上第一段，和响应头一起发出
+            stream_ = response_.ReleaseStream();
+            streamChunked_ = response_.IsChunked();
+            keepAlive_ = keepAlive_ && response_.IsKeepAlive();
+            chunkBuff_.RetrieveAll();
+            NextChunk_(segs, &segCnt);
+            n++;
+            break;
+        }
+        if(response_.FileLen() > 0) {
+            const FileCache::Entry* file = response_.ReleaseFile();
+            segs[segCnt++] = OutSegment{writeBuff_.ReadableBytes(), file->data, file->size, file};
+        }
+        keepAlive_ = keepAlive_ && response_.IsKeepAlive();    // HTTP/1.0的流式响应的HEAD也回了Connection: close
+        n++;
+        if(!keepAlive_) { break; }      // 这个响应之后关闭连接，后面的请求不再处理
+    }
+    if(n == 0) return 0;
+    BuildIov_(segs, segCnt);
+    LOG_DEBUG("%d responses, %d iovs, %zu bytes to write", n, iovCnt_, toWrite_);
+    return n;
+}
+
+int HttpConn::ProcessH2_(bool inlineOnly) {
+    OutSegment segs[MAX_PIPELINE];
+    int segCnt = 0;
+    int n = h2_->Process(readBuff_, writeBuff_, segs, MAX_PIPELINE, &segCnt, inlineOnly, isDraining);
+    requests_ += n;
+    keepAlive_ = h2_->IsAlive();
+    // 只收到WINDOW_UPDATE、PING这类帧时也可能有要发的帧
+    if(writeBuff_.ReadableBytes() > 0 || segCnt > 0) {
+        BuildIov_(segs, segCnt);
+        LOG_DEBUG("h2: %d responses, %d iovs, %zu bytes to write", n, iovCnt_, toWrite_);
+    }
+    return n;
+}
+
+// 向流式响应体要下一段：chunked时长度行和段尾的CRLF追加在writeBuff_里，内容直接引用chunkBuff_，不拷贝
+void HttpConn::NextChunk_(OutSegment* segs, int* segCnt) {
+    chunkBuff_.RetrieveAll();
+    bool more;
+    do {
+        more = stream_->Next(chunkBuff_, STREAM_CHUNK);
+    } while(more && chunkBuff_.ReadableBytes() == 0);
+    size_t len = chunkBuff_.ReadableBytes();
+    if(len > 0) {
+        if(streamChunked_) {
+            char line[24];
+            int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+            writeBuff_.Append(line, n);
+        }
+        segs[(*segCnt)++] = OutSegment{writeBuff_.ReadableBytes(), chunkBuff_.Linearize(), len, nullptr};
+        if(streamChunked_) { writeBuff_.Append("\r\n"); }
     }
-    else {
-        response_.Init(srcDir, request_.path(), false, 400);
+    if(!more) {
+        if(streamChunked_) { writeBuff_.Append("0\r\n\r\n"); }
+        stream_.reset();
     }
-    // 响应报文放到输出缓冲区
-    response_.MakeResponse(writeBuff_); 
-
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
-
-    // 文件
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+}
+
+// writeBuff_里的内容和各段外部数据交替排成iov：每段数据前是writeBuff_里到它的headerEnd为止的部分，
+// 相邻的没有外部数据的部分自然合并成一段
+void HttpConn::BuildIov_(const OutSegment* segs, int segCnt) {
+    const char* headers = writeBuff_.Peek();
+    size_t begin = 0;
+    iovCnt_ = iovIdx_ = 0;
+    toWrite_ = writeBuff_.ReadableBytes();
+    for(int i = 0; i < segCnt; i++) {
+        if(segs[i].headerEnd > begin) {
+            iov_[iovCnt_].iov_base = const_cast<char*>(headers + begin);
+            iov_[iovCnt_++].iov_len = segs[i].headerEnd - begin;
+            begin = segs[i].headerEnd;
+        }
+        iov_[iovCnt_].iov_base = const_cast<char*>(segs[i].data);
+        iov_[iovCnt_++].iov_len = segs[i].len;
+        toWrite_ += segs[i].len;
+        if(segs[i].file) {
+            files_[fileCnt_++] = segs[i].file;
+        }
+    }
+    if(begin < writeBuff_.ReadableBytes()) {
+        iov_[iovCnt_].iov_base = const_cast<char*>(headers + begin);
+        iov_[iovCnt_++].iov_len = writeBuff_.ReadableBytes() - begin;
+    }
+}
+
+// 格式化对端地址；addr_还是空的就先getpeername
+void HttpConn::ResolvePeer_() const {
+    if(addr_.ss_family == AF_UNSPEC) {
+        socklen_t len = sizeof(addr_);
+        if(getpeername(fd_, (struct sockaddr *)&addr_, &len) < 0) {
+            addr_.ss_family = AF_UNSPEC;
+        }
+    }
+    port_ = 0;
+    if(addr_.ss_family == AF_INET) {
+        const sockaddr_in* in = reinterpret_cast<const sockaddr_in*>(&addr_);
+        inet_ntop(AF_INET, &in->sin_addr, ip_, sizeof(ip_));
+        port_ = ntohs(in->sin_port);
+    } else if(addr_.ss_family == AF_INET6) {
+        const sockaddr_in6* in6 = reinterpret_cast<const sockaddr_in6*>(&addr_);
+        if(IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {    // 双栈监听收到的IPv4连接
+            inet_ntop(AF_INET, &in6->sin6_addr.s6_addr[12], ip_, sizeof(ip_));
+        } else {
+            inet_ntop(AF_INET6, &in6->sin6_addr, ip_, sizeof(ip_));
+        }
+        port_ = ntohs(in6->sin6_port);
+    } else if(addr_.ss_family == AF_UNIX) {
+        snprintf(ip_, sizeof(ip_), "unix");    // UNIX域套接字的客户端一般没有绑定地址
+    } else {
+        snprintf(ip_, sizeof(ip_), "unknown");
     }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
 }
 
 const char* HttpConn::GetIP() const {
-    return inet_ntoa(addr_.sin_addr);
+    if(port_ < 0) { ResolvePeer_(); }
+    return ip_;
 }
 
 int HttpConn::GetPort() const {
-    return addr_.sin_port;
+    if(port_ < 0) { ResolvePeer_(); }
+    return port_;
 }
 	
\ No newline at end of file
@@ -3,63 +3,143 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
-#include <arpa/inet.h>   // sockaddr_in
+#include <sys/socket.h>  // sockaddr_storage
+#include <arpa/inet.h>   // inet_ntop
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
 #include <atomic>
+#include <functional>
+#include <memory>
 
 #include "../log/log.h"
 #include "../buffer/buffer.h"
 #include "httprequest.h"
 #include "httprespon.h"
+#include "http2session.h"
 /*
 进行读写数据并调用httprequest 来解析数据以及httpresponse来生成响应
+支持HTTP/1.1流水线：一次process()把读缓冲区里所有完整的请求（最多MAX_PIPELINE个）依次生成响应，
+响应头都追加在writeBuff_里，和各自的文件交替排成iov，一次writev发出
+连接以HTTP/2前言开头或请求Upgrade: h2c时切换到HTTP/2，之后process()交给Http2Session，
+帧头在writeBuff_里、文件切片作为iov，发送方式不变
+流式响应（StreamBody）是批里的最后一个：write()每把一段全部写进套接字才生成下一段，
+EAGAIN时停下等EPOLLOUT，后面的流水线请求等它发完再处理
 */
 class HttpConn {
 public:
     HttpConn();
     ~HttpConn();
     
-    void init(int sockFd, const sockaddr_in& addr);
-    ssize_t read(int* saveErrno);
+    // 从套接字读数据的方式，返回值和saveErrno的约定同Buffer::ReadFd
+    typedef std::function<ssize_t(int fd, Buffer* buff, int* saveErrno)> ReadFn;
+
+    // addr->ss_family为AF_UNSPEC时对端地址等到第一次用到时再getpeername
+    void init(int sockFd, const sockaddr_storage& addr);
+    // readFn为空时直接readv
+    ssize_t read(int* saveErrno, const ReadFn& readFn = ReadFn());
     ssize_t write(int* saveErrno);
     void Close();
     int GetFd() const;
     int GetPort() const;
     const char* GetIP() const;
-    sockaddr_in GetAddr() const;
-    bool process();
+    const sockaddr_storage& GetAddr() const;
+    // 返回这一批生成的响应数，0表示没有完整的请求（或上一批还没发完）
+    // inlineOnly：在Reactor线程上调用，批里第二个起遇到可能阻塞的请求就停下，留给线程池
+    int process(bool inlineOnly = false);
 
     // 写的总长度
-    int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+    size_t ToWriteBytes() const {
+        return toWrite_;
+    }
+
+    // 读缓冲区里还没处理的字节数；HTTP/2时再加上已经收齐但还没处理的请求和可以继续发送的响应体，
+    // 调用者据此判断还要不要再调用process()
+    size_t ToReadBytes() const {
+        return readBuff_.ReadableBytes() + (isH2_ ? h2_->PendingWork() : 0);
     }
 
+    bool IsClosed() const {
+        return isClose_;
+    }
+
+    // 最近一个响应是否告诉了客户端保持连接
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return keepAlive_;
+    }
+
+    bool IsHttp2() const {
+        return isH2_;
+    }
+
+    // 这个连接上已经生成响应的请求数（HTTP/2按流计）
+    uint32_t Requests() const {
+        return requests_;
+    }
+
+    // 读缓冲区里的请求是否可能阻塞（需要查数据库），这类请求交给线程池
+    bool IsBlocking() const {
+        if(isH2_) { return h2_->HasBlocking(); }
+        // 请求体分几次收时缓冲区开头已经不是请求行，按正在收的请求的方法判断
+        return request_.InBody() ? request_.method() == "POST" : HttpRequest::IsBlocking(readBuff_);
     }
 
     static bool isET;
     static const char* srcDir;
     // 设置为原子量，因为可能多个线程让他变化
     static std::atomic<int> userCount;
+    // 排空中（平滑升级/退出）：之后的响应都带Connection: close，发完即关闭
+    static std::atomic<bool> isDraining;
+    // 接受明文HTTP/2（prior knowledge和Upgrade: h2c）
+    static bool enableH2c;
+    // 每个连接最多处理的HTTP/1.x请求数，最后一个响应带Connection: close，0不限
+    static int maxRequests;
+    // 连接的空闲超时（秒），写进Keep-Alive头；由WebServer的定时器执行，0不写
+    static int keepAliveTimeoutSec;
+
+    // 一次process()最多批量处理的流水线请求数
+    static const int MAX_PIPELINE = 16;
+    // 每次向流式响应体要的一段的大小
+    static const size_t STREAM_CHUNK = 16 * 1024;
     
 private:
+    int ProcessH2_(bool inlineOnly);
+    void BuildIov_(const OutSegment* segs, int segCnt);
+    void NextChunk_(OutSegment* segs, int* segCnt);
+    void ReleaseFiles_();
+    void ResolvePeer_() const;
    
     int fd_;
-    struct  sockaddr_in addr_;
+    // 对端地址只在日志里用，accept时没有拿到的（io_uring的multishot accept）延后到用的时候再取
+    mutable struct sockaddr_storage addr_;      // IPv4/IPv6/UNIX域套接字的对端地址
+    mutable char ip_[INET6_ADDRSTRLEN];         // 对端地址的可读形式，IPv4映射的IPv6地址按IPv4显示
+    mutable int port_;                          // -1：还没有解析
 
     bool isClose_;
+    bool keepAlive_;
+    uint32_t requests_;
     
     int iovCnt_;
-    struct iovec iov_[2];
+    int iovIdx_;                            // 第一个还没发完的iov
+    size_t toWrite_;
+    // 每个文件切片前一段writeBuff_里的响应头（HTTP/2是帧头），最后可能还有一段
+    struct iovec iov_[2 * MAX_PIPELINE + 1];
+    const FileCache::Entry* files_[MAX_PIPELINE];   // 这一批响应引用的文件，发送完再释放
+    int fileCnt_;
     // 读缓冲区
     Buffer readBuff_;
     // 写缓冲区
     Buffer writeBuff_;
 
+    Arena arena_;           // 请求和响应共用，每个请求开始时由request_.Init()回收
     HttpRequest request_;
     HttpResponse response_;
+
+    bool isH2_;
+    std::unique_ptr<Http2Session> h2_;     // 第一次切换到HTTP/2时创建，连接槽复用时保留
+
+    std::unique_ptr<StreamBody> stream_;   // 正在发送的流式响应体
+    bool streamChunked_;
+    Buffer chunkBuff_;                      // 当前这一段，发送完才取下一段
 };
 
 #endif
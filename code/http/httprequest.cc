@@ -1,11 +1,12 @@
 #include "httprequest.h"
 
-const std::unordered_set<std::string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
+size_t HttpRequest::maxBodyBytes = 8 * 1024 * 1024;
+size_t HttpRequest::bodyMemBytes = 64 * 1024;
+const char* HttpRequest::spillDir = "/tmp";
 
-const std::unordered_map<std::string, int> HttpRequest::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
+HttpRequest::~HttpRequest() {
+    if(bodyFd_ >= 0) { close(bodyFd_); }
+}
 
 
 std::string HttpRequest::path() const {
@@ -16,236 +17,695 @@ std::string& HttpRequest::path() {
     return path_;
 }
 
-std::string HttpRequest::method() const{
-    return method_;
+std::string_view HttpRequest::method() const{
+    return View_(method_);
 }
 
-std::string HttpRequest::version() const {
-    return version_;
+std::string_view HttpRequest::version() const {
+    return View_(version_);
 }
 
-std::string HttpRequest::GetPost(const std::string& key) const {
-    if(!post_.count(key)) {
-        return "";
+// 两个字符串是否相等（ASCII不区分大小写）
+static bool EqualsIgnoreCase_(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// RFC 7230 token字符：方法名和请求头名只能由这些字符组成
+static bool IsTokenChar_(unsigned char ch) {
+    if(isalnum(ch)) { return true; }
+    switch(ch) {
+    case '!': case '#': case '$': case '%': case '&': case '\'': case '*': case '+':
+    case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::string_view HttpRequest::GetHeader(std::string_view name) const {
+    HeaderTable::Id id = HeaderTable::Lookup(name);
+    if(id != HeaderTable::UNKNOWN) {
+        return GetHeader(id);
+    }
+    for(const auto& h: other_) {
+        if(EqualsIgnoreCase_(View_(h.first), name)) { return View_(h.second); }
+    }
+    return std::string_view();
+}
+
+HttpRequest::Header HttpRequest::HeaderAt(size_t i) const {
+    for(int id = 0; id < HeaderTable::COUNT; id++) {
+        if(!((knownMask_ >> id) & 1)) { continue; }
+        if(i-- == 0) {
+            return Header(View_(known_[id].first), View_(known_[id].second));
+        }
     }
-    return post_.find(key) -> second;
+    return Header(View_(other_[i].first), View_(other_[i].second));
+}
+
+std::string HttpRequest::GetPost(const std::string& key) const {
+    const std::string_view* value = FindPost_(key);
+    return value ? std::string(*value) : "";
 }
 
 std::string HttpRequest::GetPost(const char* key) const {
-    if(!post_.count(key)) {
-        return "";
+    const std::string_view* value = FindPost_(key);
+    return value ? std::string(*value) : "";
+}
+
+std::string_view HttpRequest::Param(std::string_view name) const {
+    if(!route_) { return std::string_view(); }
+    for(size_t i = 0; i < paramCnt_; i++) {
+        if(route_->params[i] == name) { return params_[i]; }
+    }
+    return std::string_view();
+}
+
+const std::string_view* HttpRequest::FindPost_(std::string_view key) const {
+    for(const auto& kv: post_) {
+        if(kv.first == key) { return &kv.second; }
     }
-    return post_.find(key) -> second;
+    return nullptr;
 }
 
+// 同名字段后出现的覆盖前面的
+void HttpRequest::SetPost_(std::string_view key, std::string_view value) {
+    for(auto& kv: post_) {
+        if(kv.first == key) {
+            kv.second = value;
+            return;
+        }
+    }
+    post_.emplace_back(key, value);
+}
+
+// Connection是逗号分隔的选项列表（RFC 9112 9.3）：有close就关闭；
+// HTTP/1.1起默认保持连接，HTTP/1.0要明确带keep-alive
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection") -> second == "keep-alive" && version_ == "1.1";
+    std::string_view v = version();
+    bool keepAlive = v.size() == 3 && (v[0] > '1' || (v[0] == '1' && v[2] >= '1'));
+    std::string_view options = GetHeader(HeaderTable::CONNECTION);
+    while(!options.empty()) {
+        size_t comma = std::min(options.find(','), options.size());
+        std::string_view token = options.substr(0, comma);
+        options.remove_prefix(comma < options.size() ? comma + 1 : comma);
+        while(!token.empty() && (token.front() == ' ' || token.front() == '\t')) { token.remove_prefix(1); }
+        while(!token.empty() && (token.back() == ' ' || token.back() == '\t')) { token.remove_suffix(1); }
+        if(EqualsIgnoreCase_(token, "close")) { return false; }
+        if(EqualsIgnoreCase_(token, "keep-alive")) { keepAlive = true; }
     }
-    return false;
+    return keepAlive;
+}
+
+// 只看请求方法：只有POST可能走到UserVerify查数据库，GET等都是纯内存/文件操作
+bool HttpRequest::IsBlocking(const Buffer& buff) {
+    static const char POST[] = "POST ";
+    if(buff.ReadableBytes() < sizeof(POST) - 1) {
+        return false;
+    }
+    const char* p = buff.Peek();
+    for(size_t i = 0; i < sizeof(POST) - 1; i++, p++) {
+        if(p == buff.End()) { p = buff.Begin(); }    // 环形缓冲区回绕
+        if(*p != POST[i]) { return false; }
+    }
+    return true;
 }
 
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
+    method_ = version_ = Span{0, 0};
+    path_.clear();
+    body_.clear();
+    head_.clear();
     state_ = REQUEST_LINE;
-    header_.clear();
+    bodyState_ = BODY_LENGTH;
+    base_ = nullptr;
+    pos_ = scanned_ = bodyLen_ = received_ = chunkLeft_ = trailerBytes_ = 0;
+    colon_ = std::string_view::npos;
+    if(bodyFd_ >= 0) {
+        close(bodyFd_);
+        bodyFd_ = -1;
+    }
+    errorCode_ = 400;
+    knownMask_ = dupMask_ = 0;
+    other_.clear();
     post_.clear();
+    route_ = nullptr;
+    paramCnt_ = 0;
+    isMultipart_ = false;
+    partMode_ = PART_SKIP;
+    fieldBytes_ = 0;
+    arena_->Reset();    // 上一个请求和它的响应用过的临时数据
 }
 
-std::string  HttpRequest::search(Buffer& buff, const char* &line) {
-    const char CRLF[] = "\r\n";
-    if(buff.Asc()) {
-        line = std::search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        // assert(line >= buff.Peek());
-        if(buff.Peek() == line) return "";
-        std::string s(buff.Peek(), line);
-        return s;
+/*
+    一次解析一个完整请求：在连续化后的缓冲区上按行（以\n结尾，容忍没有\r）走状态机，
+    请求行和请求头全部到齐之前不从缓冲区取走任何数据，返回PARSE_AGAIN原样保留，
+    下次调用从上次停下的地方继续；请求体见ParseBody_
+*/
+HttpRequest::PARSE_RESULT HttpRequest::parse(Buffer& buff) {
+    if(state_ == FINISH) {
+        Init();     // 上一个请求已经完成，开始解析下一个
     }
-    else {
-        line = std::search(buff.Peek(), buff.End(), CRLF, CRLF + 2);
-        if(line == buff.End()) line = std::search(buff.Begin(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        // assert(line >= buff.Begin());
-        if(line == buff.BeginWrite()) return "";
-
-        if(line >= buff.Peek()) {
-            std::string s(buff.Peek(), line);
-            return s;
-        }
-        else {
-            std::string s(buff.Peek(), buff.End()), 
-                    s2(buff.Begin(), line);
-            s += s2;
-            return s;
-        }
+    if(state_ == BODY) {
+        return ParseBody_(buff);    // 请求头已经拷出，缓冲区开头就是请求体
     }
-}
-
-bool HttpRequest::parse(Buffer& buff) {
-    const char CRLF[] = "\r\n";
     if(buff.ReadableBytes() <= 0) {
-        return false;
+        return PARSE_AGAIN;
     }
+    // 两次调用之间缓冲区只会在末尾追加数据（可能整体搬动），已解析部分的偏移不变，只需要重新取起始地址
+    base_ = buff.Linearize();
+    const char* end = base_ + buff.ReadableBytes();
+
+    while(state_ == REQUEST_LINE || state_ == HEADERS) {
+        // 请求头行一次扫描同时找':'和'\n'，冒号之后再接着找行尾，名字部分不用再扫第二遍
+        const char* lf;
+        if(state_ == HEADERS && colon_ == std::string_view::npos) {
+            lf = CharScan::FindEither(base_ + scanned_, end, ':', '\n');
+            if(lf != end && *lf == ':') {
+                colon_ = lf - base_;
+                lf = CharScan::Find(lf + 1, end, '\n');
+            }
+        } else {
+            lf = CharScan::Find(base_ + scanned_, end, '\n');
+        }
+        if(lf == end) {
+            scanned_ = end - base_;     // 这一行还没收完，下次只扫描新到的字节
+            if(scanned_ > MAX_HEADER_BYTES) {
+                return Fail_(400, "Request header too large");
+            }
+            return PARSE_AGAIN;
+        }
+        std::string_view line(base_ + pos_, lf - (base_ + pos_));
+        if(!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+        size_t colon = colon_ == std::string_view::npos ? colon_ : colon_ - pos_;
+        pos_ = scanned_ = lf - base_ + 1;
+        colon_ = std::string_view::npos;
 
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        const char* lastEnd = nullptr;
-        std::string s = search(buff, lastEnd);
-        // const char* lastEnd = std::search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        // std::string s(buff.Peek(), lastEnd);
-        LOG_DEBUG("%s",s.c_str());
-        // std::cerr << "string is " << s.c_str() << '\n';
+        bool ok = true;
         switch(state_) {
             case REQUEST_LINE:
-                if(!ParseRequestLine_(s)) {
-                    return false;
+                if(line.empty()) { break; }     // 请求行之前的空行忽略（RFC 7230 3.5）
+                ok = ParseRequestLine_(line);
+                if(!ok) {
+                    LOG_ERROR("ParseRequestLine_ Error");
+                    break;
                 }
                 ParsePath_();   // 解析路径
-                break;    
+                break;
             case HEADERS:
-                ParseHeader_(s);
-                if(buff.ReadableBytes() <= 2) { 
-                    state_ = FINISH;
+                if(line.empty()) {
+                    if(!ParseFraming_()) {
+                        return PARSE_ERROR;     // ParseFraming_已经设置好错误码
+                    }
+                    state_ = BODY;
+                }
+                else if(!(ok = ParseHeader_(line, colon))) {
+                    LOG_ERROR("ParseHeader_ Error");
                 }
-                break;
-            case BODY:
-                ParseBody_(s);
                 break;
             default:
                 break;
         }
-        if(lastEnd == buff.BeginWrite()) { break; } 
-        buff.RetrieveUntil(lastEnd + 2);    
+        if(ok && pos_ > MAX_HEADER_BYTES) {
+            return Fail_(400, "Request header too large");
+        }
+        if(!ok) {
+            state_ = FINISH;
+            return PARSE_ERROR;
+        }
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
-    return true;
+
+    // 常见情况：请求体不大且已经和请求头一起到了，直接取出，请求头不用拷贝
+    if(bodyState_ == BODY_LENGTH && bodyLen_ <= bodyMemBytes &&
+        static_cast<size_t>(end - base_) - pos_ >= bodyLen_) {
+        if(bodyLen_ > 0 && !AppendBody_(base_ + pos_, bodyLen_)) {
+            return PARSE_ERROR;
+        }
+        buff.Retrieve(pos_ + bodyLen_);
+        return FinishBody_();
+    }
+    // 请求体要分几次收：请求行和请求头拷出来，缓冲区里只留请求体，收到多少取走多少
+    head_.assign(base_, pos_);
+    buff.Retrieve(pos_);
+    base_ = head_.data();
+    if(bodyState_ == BODY_LENGTH && bodyLen_ > bodyMemBytes && !Spill_()) {
+        return Fail_(500, "Spill request body failed");
+    }
+    return ParseBody_(buff);
 }
 
+// 请求头结束时确定请求体的定界方式：Transfer-Encoding: chunked 或 Content-Length，都没有就是没有请求体
+bool HttpRequest::ParseFraming_() {
+    std::string_view contentLen = GetHeader(HeaderTable::CONTENT_LENGTH);
+    std::string_view transferEncoding = GetHeader(HeaderTable::TRANSFER_ENCODING);
+    if(dupMask_ & (1u << HeaderTable::TRANSFER_ENCODING)) {
+        Fail_(501, "Multiple Transfer-Encoding");
+        return false;
+    }
+    if(dupMask_ & (1u << HeaderTable::CONTENT_LENGTH)) {
+        // 多个Content-Length只接受值完全相同的，重复的在other_里
+        for(const auto& h: other_) {
+            if(EqualsIgnoreCase_(View_(h.first), "Content-Length") && View_(h.second) != contentLen) {
+                Fail_(400, "Conflicting Content-Length");
+                return false;
+            }
+        }
+    }
+    if(!transferEncoding.empty()) {
+        // 两个同时出现是请求走私的典型手法，直接拒绝（RFC 7230 3.3.3）
+        if(!contentLen.empty()) {
+            Fail_(400, "Both Transfer-Encoding and Content-Length");
+            return false;
+        }
+        if(!EqualsIgnoreCase_(transferEncoding, "chunked")) {
+            Fail_(501, "Unsupported Transfer-Encoding");
+            return false;
+        }
+        bodyState_ = CHUNK_SIZE;
+        return ParseMultipart_();
+    }
+    bodyLen_ = 0;
+    for(char ch: contentLen) {
+        if(ch < '0' || ch > '9') {
+            Fail_(400, "Bad Content-Length");
+            return false;
+        }
+        if(bodyLen_ > maxBodyBytes) { break; }
+        bodyLen_ = bodyLen_ * 10 + (ch - '0');
+    }
+    if(bodyLen_ > maxBodyBytes) {
+        Fail_(413, "Request body too large");
+        return false;
+    }
+    bodyState_ = BODY_LENGTH;
+    return ParseMultipart_();
+}
 
+// Content-Type的媒体类型（';'之前的部分）是否是type，不区分大小写
+static bool MediaTypeIs_(std::string_view contentType, std::string_view type) {
+    std::string_view media = contentType.substr(0, contentType.find(';'));
+    while(!media.empty() && (media.back() == ' ' || media.back() == '\t')) { media.remove_suffix(1); }
+    return EqualsIgnoreCase_(media, type);
+}
 
-void HttpRequest::ParsePath_() {
-    if(path_ == "/") {
-        path_ = "/index.html";
+// multipart/form-data的请求体在接收时就逐块解析，不等整个请求体到齐
+bool HttpRequest::ParseMultipart_() {
+    std::string_view contentType = GetHeader(HeaderTable::CONTENT_TYPE);
+    if(!MediaTypeIs_(contentType, "multipart/form-data")) {
+        return true;
     }
-    else {
-       for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
+    if(!multipart_.Init(MultipartParser::Boundary(contentType), this)) {
+        Fail_(400, "Bad multipart boundary");
+        return false;
+    }
+    isMultipart_ = true;
+    return true;
+}
+
+/*
+    请求体：缓冲区开头就是请求体，到了多少处理多少并取走，返回PARSE_AGAIN等剩下的；
+    chunked的大小行、CRLF和trailer都不大，不完整时留在缓冲区里等下次
+*/
+HttpRequest::PARSE_RESULT HttpRequest::ParseBody_(Buffer& buff) {
+    while(true) {
+        size_t readable = buff.ReadableBytes();
+        const char* p = readable > 0 ? buff.Linearize() : nullptr;
+        switch(bodyState_) {
+            case BODY_LENGTH: {
+                size_t n = std::min(bodyLen_ - received_, readable);
+                if(n > 0 && !AppendBody_(p, n)) {
+                    return PARSE_ERROR;
+                }
+                buff.Retrieve(n);
+                if(received_ < bodyLen_) {
+                    return PARSE_AGAIN;
+                }
+                return FinishBody_();
+            }
+            case CHUNK_SIZE:
+            case CHUNK_TRAILER: {
+                const char* lf = readable > 0 ? CharScan::Find(p, p + readable, '\n') : p;
+                if(lf == p + readable) {
+                    if(readable > MAX_CHUNK_LINE) {
+                        return Fail_(400, "Chunk line too long");
+                    }
+                    return PARSE_AGAIN;
+                }
+                std::string_view line(p, lf - p);
+                if(!line.empty() && line.back() == '\r') { line.remove_suffix(1); }
+                size_t used = lf - p + 1;
+                if(bodyState_ == CHUNK_SIZE) {
+                    if(!ParseChunkSize_(line)) {
+                        return PARSE_ERROR;
+                    }
+                    bodyState_ = chunkLeft_ > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+                }
+                else if(line.empty()) {
+                    buff.Retrieve(used);
+                    return FinishBody_();
+                }
+                else {
+                    // trailer字段不合并进请求头，只限制总长度
+                    trailerBytes_ += used;
+                    if(used > MAX_CHUNK_LINE || trailerBytes_ > MAX_HEADER_BYTES) {
+                        return Fail_(400, "Chunked trailer too large");
+                    }
+                }
+                buff.Retrieve(used);
+                break;
+            }
+            case CHUNK_DATA: {
+                size_t n = std::min(chunkLeft_, readable);
+                if(n == 0) {
+                    return PARSE_AGAIN;
+                }
+                if(!AppendBody_(p, n)) {
+                    return PARSE_ERROR;
+                }
+                buff.Retrieve(n);
+                chunkLeft_ -= n;
+                if(chunkLeft_ == 0) { bodyState_ = CHUNK_CRLF; }
+                break;
+            }
+            case CHUNK_CRLF: {
+                if(readable == 0 || (p[0] == '\r' && readable < 2)) {
+                    return PARSE_AGAIN;
+                }
+                size_t used = p[0] == '\r' ? 2 : 1;
+                if(p[used - 1] != '\n') {
+                    return Fail_(400, "Missing CRLF after chunk data");
+                }
+                buff.Retrieve(used);
+                bodyState_ = CHUNK_SIZE;
                 break;
             }
         }
     }
 }
 
-bool HttpRequest::ParseRequestLine_(const std::string& line) {
-    std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    // 正则匹配成功后的传出参数
-    std::smatch subMatch;
+// 十六进制数字的值，不是十六进制数字返回-1
+static int HexValue_(char ch) {
+    if(ch >= '0' && ch <= '9') return ch - '0';
+    if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+// chunk大小行：1*HEXDIG [ BWS ";" 扩展 ]，扩展忽略
+bool HttpRequest::ParseChunkSize_(std::string_view line) {
+    size_t i = 0, size = 0;
+    for(int d; i < line.size() && (d = HexValue_(line[i])) >= 0; i++) {
+        if(size <= maxBodyBytes) { size = size * 16 + d; }     // 超限后不再累加，避免溢出
+    }
+    if(i == 0) {
+        Fail_(400, "Bad chunk size");
+        return false;
+    }
+    if(size > maxBodyBytes - received_) {
+        Fail_(413, "Request body too large");
+        return false;
+    }
+    while(i < line.size() && (line[i] == ' ' || line[i] == '\t')) { i++; }
+    if(i < line.size() && line[i] != ';') {
+        Fail_(400, "Bad chunk size");
+        return false;
+    }
+    chunkLeft_ = size;
+    return true;
+}
 
-    if(std::regex_match(line, subMatch, patten)) {
-         method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;   // 状态转换为下一个状态
+bool HttpRequest::AppendBody_(const char* data, size_t len) {
+    if(len > maxBodyBytes - received_) {
+        Fail_(413, "Request body too large");
+        return false;
+    }
+    received_ += len;
+    if(isMultipart_) {
+        if(!multipart_.Feed(data, len)) {
+            Fail_(errorCode_, "Bad multipart body");    // 字段超限时回调里已经把错误码改成413
+            return false;
+        }
+        if(uploadSink_) {
+            return true;    // 文件部分已经交给uploadSink_，请求体不再保存
+        }
+    }
+    if(bodyFd_ < 0 && body_.size() + len > bodyMemBytes && !Spill_()) {
+        Fail_(500, "Spill request body failed");
+        return false;
+    }
+    if(bodyFd_ < 0) {
+        body_.append(data, len);
         return true;
     }
-    LOG_ERROR("ParseRequestLine_ Error");
-    return false;
+    while(len > 0) {
+        ssize_t n = write(bodyFd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("Write request body to temp file failed, errno:%d", errno);
+            Fail_(500, "Spill request body failed");
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
 }
 
-void HttpRequest::ParseHeader_(const std::string& line) {
-    std::regex patten("^([^:]*): ?(.*)$");
-    std::smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
+// O_TMPFILE的文件没有名字，关闭后自动删除
+int HttpRequest::OpenSpillFile() {
+    int fd = open(spillDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        // 文件系统不支持O_TMPFILE时退回mkstemp后立即unlink
+        std::string tmpl = std::string(spillDir) + "/blogbody.XXXXXX";
+        fd = mkostemp(&tmpl[0], O_CLOEXEC);
+        if(fd < 0) {
+            LOG_ERROR("Open temp file in %s failed, errno:%d", spillDir, errno);
+            return -1;
+        }
+        unlink(tmpl.c_str());
     }
-    else {
-        state_ = BODY;  // 状态转换为下一个状态
+    return fd;
+}
+
+// 请求体改写到临时文件，已经收在内存里的部分先写进去
+bool HttpRequest::Spill_() {
+    bodyFd_ = OpenSpillFile();
+    if(bodyFd_ < 0) {
+        return false;
+    }
+    LOG_DEBUG("Request body spilled to temp file, fd:%d", bodyFd_);
+    std::string mem;
+    mem.swap(body_);
+    const char* data = mem.data();
+    size_t len = mem.size();
+    while(len > 0) {
+        ssize_t n = write(bodyFd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            return false;
+        }
+        data += n;
+        len -= n;
     }
+    return true;
 }
 
+HttpRequest::PARSE_RESULT HttpRequest::Fail_(int code, const char* msg) {
+    LOG_WARN("%s", msg);
+    errorCode_ = code;
+    state_ = FINISH;
+    return PARSE_ERROR;
+}
 
-void HttpRequest::ParseBody_(const std::string& line) {
-    body_ = line;
-    // get请求一般没有请求体 
+HttpRequest::PARSE_RESULT HttpRequest::FinishBody_() {
+    if(isMultipart_ && !multipart_.Done()) {
+        return Fail_(400, "Multipart body without closing boundary");
+    }
     ParsePost_();
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("[%.*s], [%s], [%.*s], body len:%zu", (int)method_.len, base_ + method_.off, path_.c_str(),
+                (int)version_.len, base_ + version_.off, received_);
+    return PARSE_OK;
 }
 
-void HttpRequest::ParsePost_() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
-        ParseFromUrlencoded_();  
-        // 如果是登录或者注册，需要通过数据库来验证
-        if(DEFAULT_HTML_TAG.count(path_)) {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second; 
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
+// multipart表单：文本字段攒齐后放进post_，文件部分交给uploadSink_（没有设置时跳过，数据留在请求体里）
+bool HttpRequest::OnPartBegin(const MultipartPart& part) {
+    if(!part.filename.empty()) {
+        partMode_ = uploadSink_ ? PART_UPLOAD : PART_SKIP;
+        return !uploadSink_ || uploadSink_->OnPartBegin(part);
+    }
+    // 名字拷进arena：解析器里的部分头在下一个部分开始时就被覆盖
+    partMode_ = PART_FIELD;
+    partName_ = std::string_view(arena_->Copy(part.name.data(), part.name.size()), part.name.size());
+    fieldBuf_.clear();
+    return true;
+}
+
+bool HttpRequest::OnPartData(const char* data, size_t len) {
+    switch(partMode_) {
+        case PART_UPLOAD:
+            return uploadSink_->OnPartData(data, len);
+        case PART_FIELD:
+            fieldBytes_ += len;
+            if(fieldBytes_ > bodyMemBytes) {
+                errorCode_ = 413;   // 文本字段总长超过内存上限
+                return false;
             }
-        }
+            fieldBuf_.append(data, len);
+            return true;
+        default:
+            return true;
+    }
+}
+
+bool HttpRequest::OnPartEnd() {
+    if(partMode_ == PART_UPLOAD) {
+        return uploadSink_->OnPartEnd();
+    }
+    if(partMode_ == PART_FIELD) {
+        SetPost_(partName_, std::string_view(arena_->Copy(fieldBuf_.data(), fieldBuf_.size()), fieldBuf_.size()));
+    }
+    return true;
+}
+
+// 查询串不参与匹配；改写成静态文件之前先把捕获的参数拷出来，它们指向改写前的path_
+void HttpRequest::ParsePath_() {
+    std::string_view path(path_.data(), std::min(path_.find('?'), path_.size()));
+    route_ = Router::Instance()->Match(method(), path, params_, &paramCnt_);
+    if(!route_) { return; }
+    for(size_t i = 0; i < paramCnt_; i++) {
+        params_[i] = std::string_view(arena_->Copy(params_[i].data(), params_[i].size()), params_[i].size());
+    }
+    if(!route_->file.empty()) {
+        path_.assign(route_->file);
+    }
+}
+
+// 请求行：方法 SP 请求目标 SP HTTP/x.y
+bool HttpRequest::ParseRequestLine_(std::string_view line) {
+    size_t sp1 = line.find(' ');
+    if(sp1 == std::string_view::npos || sp1 == 0) { return false; }
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if(sp2 == std::string_view::npos || sp2 == sp1 + 1) { return false; }
+
+    std::string_view method = line.substr(0, sp1);
+    for(char ch: method) {
+        if(!IsTokenChar_(ch)) { return false; }
     }
+    std::string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    for(char ch: target) {
+        if(static_cast<unsigned char>(ch) <= ' ' || ch == 0x7f) { return false; }
+    }
+    std::string_view version = line.substr(sp2 + 1);
+    if(version.size() != 8 || version.compare(0, 5, "HTTP/") != 0 || !isdigit(version[5]) ||
+        version[6] != '.' || !isdigit(version[7])) {
+        return false;
+    }
+
+    method_ = ToSpan_(method);
+    path_.assign(target.data(), target.size());
+    version_ = ToSpan_(version.substr(5));
+    state_ = HEADERS;   // 状态转换为下一个状态
+    return true;
 }
 
+// 请求头：名字 ":" OWS 值 OWS；名字前后不能有空白，不支持已废弃的折行（以空白开头的续行）
+bool HttpRequest::ParseHeader_(std::string_view line, size_t colon) {
+    if(colon == std::string_view::npos || colon == 0) { return false; }
+    std::string_view name = line.substr(0, colon);
+    for(char ch: name) {
+        if(!IsTokenChar_(ch)) { return false; }
+    }
+    size_t begin = colon + 1, end = line.size();
+    while(begin < end && (line[begin] == ' ' || line[begin] == '\t')) { begin++; }
+    while(end > begin && (line[end - 1] == ' ' || line[end - 1] == '\t')) { end--; }
+    std::pair<Span, Span> header(ToSpan_(name), ToSpan_(line.substr(begin, end - begin)));
+    HeaderTable::Id id = HeaderTable::Lookup(name);
+    if(id == HeaderTable::UNKNOWN) {
+        other_.push_back(header);
+    }
+    else if((knownMask_ >> id) & 1) {
+        dupMask_ |= 1u << id;
+        other_.push_back(header);
+    }
+    else {
+        knownMask_ |= 1u << id;
+        known_[id] = header;
+    }
+    return true;
+}
+
+void HttpRequest::ParsePost_() {
+    if(method() != "POST") { return; }
+    // multipart表单的字段在接收请求体时已经放进post_；写到临时文件的请求体很大，不当urlencoded表单解析
+    if(bodyFd_ < 0 && MediaTypeIs_(GetHeader(HeaderTable::CONTENT_TYPE), "application/x-www-form-urlencoded")) {
+        ParseFromUrlencoded_();
+    }
+}
+
+/*
+    application/x-www-form-urlencoded：字段用'&'分开，名字和值用第一个'='分开
+    没有'%'和'+'的名字/值直接是指向body_的视图，不拷贝；需要解码的才在arena里放一份解码结果
+*/
 void HttpRequest::ParseFromUrlencoded_() {
-    /*
-        = 用来分隔key和value
-        + 空格
-        & 连接符
-    */
-    if(body_.size() == 0) { return; }
-
-    std::string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-
-    for(; i < n; i++) {
-        char ch = body_[i];
-        switch (ch) {
-        case '=':
-            key = body_.substr(j, i - j);
-            j = i + 1;
-            break;
-        case '+':
-            body_[i] = ' ';
-            break;
-        case '%':
-            num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            body_[i + 2] = num % 10 + '0';
-            body_[i + 1] = num / 10 + '0';
-            i += 2;
-            break;
-        case '&':
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-            break;
-        default:
-            break;
+    const char* p = body_.data();
+    const char* end = p + body_.size();
+    while(p < end) {
+        const char* amp = CharScan::Find(p, end, '&');
+        const char* eq = CharScan::Find(p, amp, '=');
+        if(amp > p) {
+            std::string_view key = DecodeField_(std::string_view(p, eq - p));
+            std::string_view value = eq < amp ? DecodeField_(std::string_view(eq + 1, amp - eq - 1)) : std::string_view();
+            SetPost_(key, value);
+            LOG_DEBUG("%.*s = %.*s", (int)key.size(), key.data(), (int)value.size(), value.data());
         }
+        p = amp == end ? end : amp + 1;
     }
-    if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+}
+
+std::string_view HttpRequest::DecodeField_(std::string_view field) {
+    if(CharScan::FindEither(field.data(), field.data() + field.size(), '%', '+') == field.data() + field.size()) {
+        return field;
     }
+    char* out = static_cast<char*>(arena_->Allocate(field.size(), 1));
+    return std::string_view(out, UrlDecode(field, out));
 }
 
-// 16进制转化为10进制
-int HttpRequest::ConverHex(char ch) {
-    if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
-    if(ch >= 'a' && ch <= 'f') return ch -'a' + 10;
-    return ch;
+/*
+    解码'+'和%XX，不合法的'%'原样保留；两个特殊字符之间的普通字节用CharScan一次跳过再整段拷贝
+    结果不会比输入长，out可以就是in.data()（原地解码）
+*/
+size_t HttpRequest::UrlDecode(std::string_view in, char* out) {
+    const char* p = in.data();
+    const char* end = p + in.size();
+    char* o = out;
+    while(p < end) {
+        const char* q = CharScan::FindEither(p, end, '%', '+');
+        if(q > p) {
+            memmove(o, p, q - p);
+            o += q - p;
+            p = q;
+        }
+        if(p == end) { break; }
+        int hi, lo;
+        if(*p == '+') {
+            *o++ = ' ';
+            p++;
+        }
+        else if(end - p >= 3 && (hi = HexValue_(p[1])) >= 0 && (lo = HexValue_(p[2])) >= 0) {
+            *o++ = static_cast<char>(hi * 16 + lo);
+            p += 3;
+        }
+        else {
+            *o++ = *p++;
+        }
+    }
+    return o - out;
 }
 
-bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bool isLogin) {
-    if(name == "" || pwd == "") { return false; }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+bool HttpRequest::UserVerify(std::string_view name, std::string_view pwd, bool isLogin) {
+    if(name.empty() || pwd.empty()) { return false; }
+    LOG_INFO("Verify name:%.*s pwd:%.*s", (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
     MYSQL* sql;
     SqlConnRAII(&sql,  SqlConnPool::Instance());
     // assert(sql);
@@ -258,7 +718,8 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bo
     
     if(!isLogin) { flag = true; }
     // 查询密码是否正确
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
+    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%.*s' LIMIT 1",
+                (int)name.size(), name.data());
     LOG_DEBUG("%s", order);
 
     if(mysql_query(sql, order)) { 
@@ -271,10 +732,9 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bo
 
     while(MYSQL_ROW row = mysql_fetch_row(res)) {
         LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        std::string password(row[1]);
         // 注册且用户名未被使用
         if(isLogin) {
-            if(pwd == password) { flag = true; }
+            if(pwd == row[1]) { flag = true; }
             else {
                 flag = false;
                 LOG_INFO("pwd error!");
@@ -291,7 +751,8 @@ bool HttpRequest::UserVerify(const std::string& name, const std::string& pwd, bo
     if(!isLogin && flag == true) {
         LOG_DEBUG("regirster!");
         bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
+        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%.*s','%.*s')",
+                    (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
         LOG_DEBUG( "%s", order);
         if(mysql_query(sql, order)) { 
             LOG_DEBUG( "Insert error!");
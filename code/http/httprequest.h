@@ -4,16 +4,48 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
-#include <regex>    // 正则表达式
+#include <string_view>
+#include <vector>
 #include <errno.h>     
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <strings.h>    // strncasecmp
 #include <mysql/mysql.h>  //mysql
 #include <algorithm>
 
 #include "../buffer/buffer.h"
+#include "charscan.h"
+#include "headertable.h"
+#include "multipart.h"
+#include "router.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
+#include "../pool/arena.h"
 
-class HttpRequest {
+/*
+    手写的状态机解析器，直接在读缓冲区上解析，不用正则也不拷贝每一行：
+    method、version和请求头都是指向读缓冲区的string_view，在下一次往读缓冲区读数据之前有效；
+    path要经过改写（/ -> /index.html 等），存在复用容量的std::string里
+    请求行解析完时按方法和路径在Router里匹配一次：路由指定了静态文件时改写path，
+    路径参数拷进arena，处理函数留到生成响应时由Router::Dispatch调用
+    HeaderTable里的已知请求头按Id放在固定槽位，其余的（和已知请求头的重复出现）放在复用的溢出数组里，
+    连接稳定后解析一个请求不再分配堆内存
+
+    解析可以续传：数据不完整时返回PARSE_AGAIN，状态和已解析到的位置都保留，下次只扫描新到的字节，
+    慢速客户端分很多次发来的请求总开销也只和字节数成正比。解析过程中只记录相对缓冲区可读数据开头的偏移，
+    所以两次调用之间缓冲区扩容搬家不影响已解析的部分。上一个请求完成（或出错）后再调用parse()自动开始下一个
+
+    请求体按Content-Length或chunked传输编码定界。整个请求体已经在缓冲区里且不超过bodyMemBytes时直接取出；
+    否则把请求行和请求头拷出来（之后的string_view指向这份拷贝），请求体边到边从缓冲区取走，
+    读缓冲区不会涨到请求体那么大。累计超过bodyMemBytes的请求体写到spillDir下的匿名临时文件，
+    用BodyFd()读取，body()只放内存里的请求体
+
+    表单解码结果等请求内的临时数据从arena分配（默认用自带的，HttpConn换成连接的arena，响应也用它），
+    Init()开始下一个请求时整体Reset
+*/
+class HttpRequest : private MultipartSink {
 public:
     enum PARSE_STATE {
         REQUEST_LINE,
@@ -21,43 +53,146 @@ public:
         BODY,
         FINISH,        
     };
-    
-    HttpRequest() { Init(); }
-    ~HttpRequest() = default;
+
+    enum PARSE_RESULT {
+        PARSE_OK,       // 解析出一个完整请求，已从缓冲区取走
+        PARSE_AGAIN,    // 数据还不完整，缓冲区原样保留，等更多数据
+        PARSE_ERROR,    // 格式错误或超限，按ErrorCode()回错误响应并关闭连接
+    };
+
+    typedef std::pair<std::string_view, std::string_view> Header;
+
+    static const size_t MAX_HEADER_BYTES = 64 * 1024;  // 请求行加请求头的上限，超过还不完整按错误处理
+    static const size_t MAX_CHUNK_LINE = 1024;         // chunk大小行（含扩展）和每行trailer的上限
+
+    static size_t maxBodyBytes;     // 请求体上限，超过回413
+    static size_t bodyMemBytes;     // 请求体放在内存里的上限，超过写临时文件
+    static const char* spillDir;    // 请求体临时文件所在目录
+
+    HttpRequest() : bodyFd_(-1) { Init(); }
+    ~HttpRequest();
+    HttpRequest(const HttpRequest&) = delete;
+    HttpRequest& operator=(const HttpRequest&) = delete;
 
     void Init();
-    bool parse(Buffer& buff);   
+    PARSE_RESULT parse(Buffer& buff);
+    void SetArena(Arena* arena) { arena_ = arena; }
+    // multipart/form-data请求里的文件部分边收边交给sink，请求体不再保存（BodyFd()和body()都没有内容）；
+    // 不设置时文件部分只留在请求体里。文本字段总是解析到GetPost()
+    void SetUploadSink(MultipartSink* sink) { uploadSink_ = sink; }
 
     std::string path() const;
     std::string& path();
-    std::string method() const;
-    std::string version() const;
+    std::string_view method() const;
+    std::string_view version() const;
+    // 按名字查请求头（不区分大小写），没有时返回空；同名的有多个时返回第一个
+    std::string_view GetHeader(std::string_view name) const;
+    std::string_view GetHeader(HeaderTable::Id id) const {
+        return (knownMask_ >> id) & 1 ? View_(known_[id].second) : std::string_view();
+    }
+    // 遍历全部请求头：先是已知请求头（按Id顺序），再是其余的（按到达顺序）
+    size_t HeaderCount() const { return __builtin_popcount(knownMask_) + other_.size(); }
+    Header HeaderAt(size_t i) const;
+    const std::string& body() const { return body_; }
+    size_t BodyLength() const { return received_; }
+    // 请求体写到临时文件时返回它的fd（从偏移0开始pread），在内存里返回-1；下一个请求开始时关闭
+    int BodyFd() const { return bodyFd_; }
+    // PARSE_ERROR时应回的状态码
+    int ErrorCode() const { return errorCode_; }
+    // 正在接收请求体（请求头已经拷出来，缓冲区里不再有请求行）
+    bool InBody() const { return state_ == BODY; }
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
-
-    std::string search(Buffer& buff, const char* &line);
+    // 匹配到的路由，没有时为nullptr（按路径找静态文件）
+    const Router::Route* GetRoute() const { return route_; }
+    // 路由模式里":name"或"*name"捕获的值，没有这个参数时返回空
+    std::string_view Param(std::string_view name) const;
 
     bool IsKeepAlive() const;
 
+    static bool IsBlocking(const Buffer& buff);
+    static bool UserVerify(std::string_view name, std::string_view pwd, bool isLogin);  // 用户验证
+    // 解码application/x-www-form-urlencoded的一段（'+'和%XX），返回写到out的长度，out可以等于in.data()
+    static size_t UrlDecode(std::string_view in, char* out);
+    // 在spillDir下打开一个匿名临时文件（关闭后自动删除），失败返回-1；HTTP/2暂存大请求体也用它
+    static int OpenSpillFile();
+
 private:
-    bool ParseRequestLine_(const std::string& line);    // 处理请求行
-    void ParseHeader_(const std::string& line);         // 处理请求头
-    void ParseBody_(const std::string& line);           // 处理请求体
+    // 请求里的一段，用相对缓冲区可读数据开头的偏移表示
+    struct Span {
+        uint32_t off, len;
+    };
+    Span ToSpan_(std::string_view v) const { return Span{uint32_t(v.data() - base_), uint32_t(v.size())}; }
+    std::string_view View_(Span s) const { return std::string_view(base_ + s.off, s.len); }
+
+    bool ParseRequestLine_(std::string_view line);      // 处理请求行
+    bool ParseHeader_(std::string_view line, size_t colon); // 处理请求头，colon是第一个':'的位置
+    bool ParseFraming_();                               // 请求头结束时确定请求体的定界方式和长度
+    PARSE_RESULT ParseBody_(Buffer& buff);              // 边收边取走请求体，收完时处理
+    bool ParseChunkSize_(std::string_view line);        // chunk大小行：十六进制长度[;扩展]
+    bool AppendBody_(const char* data, size_t len);     // 收到的一段请求体放进内存或临时文件
+    bool Spill_();                                      // 请求体改为写临时文件
+    bool ParseMultipart_();                             // Content-Type是multipart/form-data时准备逐块解析
+    PARSE_RESULT Fail_(int code, const char* msg);
+    PARSE_RESULT FinishBody_();
+
+    bool OnPartBegin(const MultipartPart& part) override;
+    bool OnPartData(const char* data, size_t len) override;
+    bool OnPartEnd() override;
 
-    void ParsePath_();                                  // 处理请求路径
-    void ParsePost_();                                  // 处理Post事件
-    void ParseFromUrlencoded_();                        // 从url种解析编码
+    void ParsePath_();                                  // 按路由表匹配请求路径
+    void ParsePost_();                                  // POST的表单解析到post_
+    void ParseFromUrlencoded_();                        // 解析urlencoded表单
+    std::string_view DecodeField_(std::string_view field);  // 需要解码时解码到arena里
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);  // 用户验证
+    void SetPost_(std::string_view key, std::string_view value);
+    const std::string_view* FindPost_(std::string_view key) const;
+
+
+    // 请求体的接收进度
+    enum BODY_STATE {
+        BODY_LENGTH,    // 按Content-Length收
+        CHUNK_SIZE,     // 等chunk大小行
+        CHUNK_DATA,     // chunk数据，还差chunkLeft_字节
+        CHUNK_CRLF,     // chunk数据后的CRLF
+        CHUNK_TRAILER,  // 最后一个chunk之后的trailer，到空行结束
+    };
 
     PARSE_STATE state_;
-    std::string method_, path_, version_, body_;
-    std::unordered_map<std::string, std::string> header_;
-    std::unordered_map<std::string, std::string> post_;
+    BODY_STATE bodyState_;
+    const char* base_;      // 最近一次parse时缓冲区可读数据的起始地址，请求头拷出后指向head_
+    size_t pos_;            // 下一行的起始偏移
+    size_t scanned_;        // 当前行已经扫描过的位置，续传时从这里接着扫
+    size_t colon_;          // 当前行第一个':'的偏移，npos表示还没遇到
+    size_t bodyLen_;        // Content-Length
+    size_t received_;       // 已经收到的请求体字节数（chunked时是解码后的）
+    size_t chunkLeft_;
+    size_t trailerBytes_;
+    int bodyFd_;
+    int errorCode_;
+    Span method_, version_;
+    std::string path_, body_, head_;
+    std::pair<Span, Span> known_[HeaderTable::COUNT];   // 已知请求头，knownMask_里对应位为1时有效
+    uint32_t knownMask_;
+    uint32_t dupMask_;                              // 出现了不止一次的已知请求头，重复的在other_里
+    std::vector<std::pair<Span, Span>> other_;      // 其余请求头的名字和值
+    std::vector<std::pair<std::string_view, std::string_view>> post_;  // 表单字段，指向arena里解码后的副本
+    const Router::Route* route_;
+    std::string_view params_[Router::MAX_PARAMS];   // 路径参数，在arena里
+    size_t paramCnt_;
+    Arena ownArena_;
+    Arena* arena_ = &ownArena_;
+
+    // multipart/form-data
+    enum PART_MODE { PART_FIELD, PART_UPLOAD, PART_SKIP };
+    MultipartParser multipart_;
+    bool isMultipart_;
+    MultipartSink* uploadSink_ = nullptr;
+    PART_MODE partMode_;
+    std::string_view partName_;
+    std::string fieldBuf_;      // 正在接收的文本字段，复用容量
+    size_t fieldBytes_;
 
-    static const std::unordered_set<std::string> DEFAULT_HTML;
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
-    static int ConverHex(char ch);  // 16进制转换为10进制
 };
 
 #endif
@@ -27,6 +27,9 @@ const std::unordered_map<int, std::string> HttpResponse::CODE_STATUS = {
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 413, "Payload Too Large" },
+    { 500, "Internal Server Error" },
+    { 501, "Not Implemented" },
 };
 
 const std::unordered_map<int, std::string> HttpResponse::CODE_PATH = {
@@ -38,34 +41,74 @@ const std::unordered_map<int, std::string> HttpResponse::CODE_PATH = {
 HttpResponse::HttpResponse() {
     code_ = -1;
     isKeepAlive_ = false;
-    path_ = srcDir_ = "";
-    mmFile_ = nullptr;
-    mmFileStat_ = {0};
+    headOnly_ = false;
+    keepAliveTimeout_ = keepAliveMax_ = 0;
+    path_ = "";
+    srcDir_ = "";
+    fullPath_ = nullptr;
+    arena_ = &ownArena_;
+    file_ = nullptr;
+    chunked_ = false;
 }
 
 HttpResponse::~HttpResponse() {
-    UnmapFile();
+    CloseFile();
 }
 
-void HttpResponse::Init(const std::string &srcDir, std::string &path, bool isKeepAlive, int code) {
-    UnmapFile();
-
+void HttpResponse::Init(const char* srcDir, std::string_view path, bool isKeepAlive, int code, bool chunked) {
+    CloseFile();
+    if(arena_ == &ownArena_) {
+        ownArena_.Reset();      // 单独使用时自己回收，用连接的arena时由HttpRequest::Init回收
+    }
     srcDir_ = srcDir;
     path_ = path;
+    fullPath_ = nullptr;
     isKeepAlive_ = isKeepAlive;
+    headOnly_ = false;
+    keepAliveTimeout_ = keepAliveMax_ = 0;
     code_ = code;
+    stream_.reset();
+    contentType_ = std::string_view();
+    chunked_ = chunked;
+}
+
+void HttpResponse::SetStream(std::unique_ptr<StreamBody> body, std::string_view contentType) {
+    stream_ = std::move(body);
+    contentType_ = std::string_view(arena_->Copy(contentType.data(), contentType.size()), contentType.size());
+    if(!chunked_) {
+        isKeepAlive_ = false;   // 没有长度也没有chunked，只能靠关闭连接标出响应体的结尾
+    }
 }
 
 void HttpResponse::MakeResponse(Buffer &buff) {
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || 
-        S_ISDIR(mmFileStat_.st_mode)) { 
-        code_ = 404; 
+    if(stream_ && code_ < 400) {
+        if(code_ == -1) { code_ = 200; }
+        AddStateLine_(buff);
+        AddHeader_(buff);
+        buff.Append(chunked_ ? "Transfer-Encoding: chunked\r\n\r\n" : "\r\n");
+        if(headOnly_) {
+            stream_.reset();    // 不生成响应体，连接按普通响应处理
+        }
+        return;
     }
-    else if(!(mmFileStat_.st_mode & S_IROTH)){
-        code_ = 403;
+    stream_.reset();    // 出错时回错误页，不用生成的内容
+    contentType_ = std::string_view();
+    if(code_ >= 400 && CODE_PATH.count(code_) == 0) {
+        // 没有错误页的状态码（413、500、501）：不看请求路径，回一段生成的错误说明；
+        // path_只用来让Content-type取text/html，不会去打开
+        path_ = arena_->Printf("/%d.html", code_);
+        fullPath_ = nullptr;
+        AddStateLine_(buff);
+        AddHeader_(buff);
+        ErrorContent(buff, CODE_STATUS.find(code_)->second);
+        return;
     }
-    else if(code_ == -1) {
-        code_ = 200;
+    // 调用方已经定了错误码（如请求格式错误）时直接用错误页，不再按请求路径改成404
+    if(code_ < 400) {
+        int code = FileCache::Instance()->Acquire(FullPath_(), GetFileType_(), &file_);
+        if(code != 200 || code_ == -1) {
+            code_ = code;
+        }
     }
     ErrorHtml_();
     AddStateLine_(buff);
@@ -73,100 +116,108 @@ void HttpResponse::MakeResponse(Buffer &buff) {
     AddContent_(buff);
 }
 
-void HttpResponse::UnmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
+void HttpResponse::CloseFile() {
+    if(file_) {
+        FileCache::Release(file_);
+        file_ = nullptr;
     }
 }
 
-char *HttpResponse::File() {
-    return mmFile_;
-}
-
-size_t HttpResponse::FileLen() const {
-    return mmFileStat_.st_size;
+const FileCache::Entry* HttpResponse::ReleaseFile() {
+    const FileCache::Entry* file = file_;
+    file_ = nullptr;
+    return file;
 }
 
-void HttpResponse::ErrorContent(Buffer &buff, std::string message) {
-    std::string body;
-    std::string status;
-    body += "<html><title>Error</title>";
-    body += "<body bgcolor=\"ffffff\">";
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    } else {
-        status = "Bad Request";
-    }
-    body += std::to_string(code_) + " : " + status  + "\n";
-    body += "<p>" + message + "</p>";
-    body += "<hr><em>TinyWebServer</em></body></html>";
-
-    buff.Append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
-    buff.Append(body);
+void HttpResponse::ErrorContent(Buffer &buff, std::string_view message) {
+    auto it = CODE_STATUS.find(code_);
+    const char* status = it != CODE_STATUS.end() ? it->second.c_str() : "Bad Request";
+    std::string_view body = arena_->Printf("<html><title>Error</title><body bgcolor=\"ffffff\">%d : %s\n"
+                                           "<p>%.*s</p><hr><em>TinyWebServer</em></body></html>",
+                                           code_, status, (int)message.size(), message.data());
+    std::string_view len = arena_->Printf("Content-length: %zu\r\n\r\n", body.size());
+    buff.Append(len);
+    if(!headOnly_) {
+        buff.Append(body);
+    }
 }
 
 void HttpResponse::AddStateLine_(Buffer &buff) {
-    std::string date = "";
-     if(CODE_STATUS.count(code_) == 1) {
-        date = CODE_STATUS.find(code_)->second;
-    }
-    else {
+    auto it = CODE_STATUS.find(code_);
+    if(it == CODE_STATUS.end()) {
         code_ = 400;
-        date = CODE_STATUS.find(400)->second;
+        it = CODE_STATUS.find(400);
     }
-    buff.Append("HTTP/1.1 " + std::to_string(code_) + " " + date + "\r\n");
+    std::string_view line = arena_->Printf("HTTP/1.1 %d %s\r\n", code_, it->second.c_str());
+    buff.Append(line);
 }
 
 void HttpResponse::AddHeader_(Buffer &buff) {
-    std::string date = "";
     if(isKeepAlive_) {
-        buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
+        buff.Append("Connection: keep-alive\r\n");
+        if(keepAliveTimeout_ > 0 && keepAliveMax_ > 0) {
+            buff.Append(arena_->Printf("Keep-Alive: timeout=%d, max=%d\r\n", keepAliveTimeout_, keepAliveMax_));
+        } else if(keepAliveTimeout_ > 0) {
+            buff.Append(arena_->Printf("Keep-Alive: timeout=%d\r\n", keepAliveTimeout_));
+        } else if(keepAliveMax_ > 0) {
+            buff.Append(arena_->Printf("Keep-Alive: max=%d\r\n", keepAliveMax_));
+        }
     } else{
-        buff.Append("close\r\n");
+        buff.Append("Connection: close\r\n");
+    }
+    if(file_) {
+        return;     // Content-type和Content-length一起在条目里拼好了，由AddContent_写
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    std::string_view type = GetFileType_();
+    std::string_view line = arena_->Printf("Content-type: %.*s\r\n", (int)type.size(), type.data());
+    buff.Append(line);
 }
 
 /*
     我们没必要把文件内容输入到缓冲区
-    我们采取mmap文件映射方式，后续再通过writev方法来进行集中写即可
+    文件已经在FileCache里映射好了，后续再通过writev方法来进行集中写即可
 */
 void HttpResponse::AddContent_(Buffer &buff) {
-    int fd = open((srcDir_ + path_).data(), O_RDONLY);
-    if(fd < 0) {
+    if(!file_) {
         ErrorContent(buff, "File NotFound!");
-        return; 
+        return;
     }
-
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    void* mmFile = mmap(NULL, FileLen(), PROT_READ, MAP_PRIVATE, fd, 0);
-    if(mmFile_ == MAP_FAILED) {
-        ErrorContent(buff, "File NOT Found");
-        return ;
+    LOG_DEBUG("file path %s", FullPath_());
+    buff.Append(file_->header);
+    if(headOnly_) {
+        CloseFile();
     }
-
-    mmFile_ = (char *)mmFile;
-    close(fd);
-    buff.Append("Content-length: " + std::to_string(mmFileStat_.st_size) + "\r\n\r\n");
 }
 
 void HttpResponse::ErrorHtml_() {
-    if(CODE_PATH.count(code_) == 1) {
-        path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+    auto it = CODE_PATH.find(code_);
+    if(it != CODE_PATH.end()) {
+        CloseFile();
+        path_ = it->second;
+        fullPath_ = nullptr;
+        FileCache::Instance()->Acquire(FullPath_(), GetFileType_(), &file_);
     }
 }
 
-std::string HttpResponse::GetFileType_() {
-    std::string::size_type idx = path_.find_last_of('.');
-    if(idx == std::string::npos) {
+const char* HttpResponse::FullPath_() {
+    if(!fullPath_) {
+        fullPath_ = arena_->Printf("%s%.*s", srcDir_, (int)path_.size(), path_.data()).data();
+    }
+    return fullPath_;
+}
+
+std::string_view HttpResponse::GetFileType_() const {
+    if(!contentType_.empty()) {
+        return contentType_;
+    }
+    std::string_view::size_type idx = path_.find_last_of('.');
+    if(idx == std::string_view::npos) {
         return "text/plain";
     }
-    std::string suffix = path_.substr(idx);
-    if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix) -> second;
+    // 后缀都很短，临时std::string落在短字符串优化里，不分配堆内存
+    auto it = SUFFIX_TYPE.find(std::string(path_.substr(idx)));
+    if(it != SUFFIX_TYPE.end()) {
+        return it->second;
     }
     return "text/plain";
 }
@@ -2,26 +2,70 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
-#include <fcntl.h>       // open
-#include <unistd.h>      // close
-#include <sys/stat.h>    // stat
-#include <sys/mman.h>    // mmap, munmap
+#include <memory>
+#include <string_view>
 
+#include "filecache.h"
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../pool/arena.h"
 
+/*
+    流式响应体：内容在发送过程中分段生成，事先不知道总长度（文章列表、订阅源这类生成的页面）
+    连接只在上一段全部写进套接字后才要下一段，生成的速度跟着套接字的可写状态走，内存里只有一段
+*/
+class StreamBody {
+public:
+    virtual ~StreamBody() = default;
+    // 往chunk里追加下一段（尽量不超过hint字节），返回false表示这是最后一段（可以为空）
+    // 返回true时至少要追加一个字节
+    virtual bool Next(Buffer& chunk, size_t hint) = 0;
+};
+
+/*
+    响应行、响应头和拼出来的文件路径都从arena分配（默认用自带的，HttpConn换成连接的arena，
+    由HttpRequest::Init在请求之间统一Reset），生成一个响应不创建std::string临时对象
+    静态文件从FileCache取，响应持有条目的一个引用，直到CloseFile或者用ReleaseFile交给连接
+*/
 class HttpResponse {
 public:
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    void SetArena(Arena* arena) { arena_ = arena; }
+    // srcDir和path只保存指针，要保持有效到MakeResponse返回
+    // chunked：客户端能接收Transfer-Encoding: chunked（HTTP/1.1），只影响流式响应
+    void Init(const char* srcDir, std::string_view path, bool isKeepAlive = false, int code = -1,
+              bool chunked = true);
+    // 在Init之后调用，响应体改由body分段生成，长度事先不知道：能用chunked时用chunked，
+    // 否则（HTTP/1.0）不带长度、发完关闭连接；contentType会拷贝
+    void SetStream(std::unique_ptr<StreamBody> body, std::string_view contentType);
+    // 在Init之后调用，改成回另一个文件（路由的处理函数用）；path要保持有效到MakeResponse返回
+    void SetPath(std::string_view path) {
+        path_ = path;
+        fullPath_ = nullptr;
+    }
+    // 在Init之后调用：保持连接时在Keep-Alive头里告诉客户端空闲超时（秒）和这个连接还能发几个请求，
+    // 0表示不写这一项；不调用时只有Connection头
+    void SetKeepAliveLimits(int timeoutSec, int maxLeft) {
+        keepAliveTimeout_ = timeoutSec;
+        keepAliveMax_ = maxLeft;
+    }
+    // 在Init之后调用：HEAD请求，响应头照常生成（Content-length是GET时的长度），不带响应体
+    void SetHeadOnly(bool headOnly) { headOnly_ = headOnly; }
     void MakeResponse(Buffer& buff);
-    void UnmapFile();
-    char* File();
-    size_t FileLen() const;
-    void ErrorContent(Buffer& buff, std::string message);
+    void CloseFile();
+    // 交出文件条目的引用，之后由调用者FileCache::Release：流水线批量响应时多个文件要一直有效到发送完
+    const FileCache::Entry* ReleaseFile();
+    const char* File() const { return file_ ? file_->data : nullptr; }
+    size_t FileLen() const { return file_ ? file_->size : 0; }
+    void ErrorContent(Buffer& buff, std::string_view message);
     int Code() const { return code_; }
+    bool IsKeepAlive() const { return isKeepAlive_; }
+    // MakeResponse之后：响应头已经生成，交出响应体的生产者，由连接按套接字的可写状态分段取用
+    std::unique_ptr<StreamBody> ReleaseStream() { return std::move(stream_); }
+    bool IsStreaming() const { return stream_ != nullptr; }
+    bool IsChunked() const { return chunked_; }    // 流式响应体用chunked编码，否则发完关闭连接
 
 private:
     void AddStateLine_(Buffer &buff);
@@ -29,16 +73,26 @@ private:
     void AddContent_(Buffer &buff);
 
     void ErrorHtml_();
-    std::string GetFileType_();
+    std::string_view GetFileType_() const;
+    const char* FullPath_();                // srcDir_ + path_，放在arena里
 
     int code_;
     bool isKeepAlive_;
+    bool headOnly_;
+    int keepAliveTimeout_;
+    int keepAliveMax_;
+
+    std::string_view path_;
+    const char* srcDir_;
+    const char* fullPath_;                  // FullPath_()的缓存，path_改变时清空
+    Arena ownArena_;
+    Arena* arena_;
+
+    const FileCache::Entry* file_;          // 要发送的文件，持有一个引用
 
-    std::string path_;
-    std::string srcDir_;
-    
-    char* mmFile_; 
-    struct stat mmFileStat_;
+    std::unique_ptr<StreamBody> stream_;
+    std::string_view contentType_;          // 流式响应的Content-type，在arena里
+    bool chunked_;
 
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;  // 后缀类型集
     static const std::unordered_map<int, std::string> CODE_STATUS;          // 编码状态集
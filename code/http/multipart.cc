@@ -0,0 +1,162 @@
+#include "multipart.h"
+
+#include <strings.h>    // strncasecmp
+#include <algorithm>
+
+static bool EqualsIgnoreCase_(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+static std::string_view Trim_(std::string_view s) {
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) { s.remove_prefix(1); }
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) { s.remove_suffix(1); }
+    return s;
+}
+
+/*
+    从"类型; a=1; b=\"x;y\""形式的头部值里取参数key的值，值是带引号的字符串时去掉引号
+    （转义的\"保留原样，表单里的名字和文件名基本不会用到），没有时返回空
+*/
+static std::string_view Param_(std::string_view value, std::string_view key) {
+    size_t i = value.find(';');
+    while(i != std::string_view::npos) {
+        size_t eq = value.find_first_of("=;", i + 1);
+        if(eq == std::string_view::npos || value[eq] == ';') {
+            i = eq;     // 没有'='的参数跳过
+            continue;
+        }
+        std::string_view name = Trim_(value.substr(i + 1, eq - i - 1));
+        size_t j = eq + 1;
+        while(j < value.size() && (value[j] == ' ' || value[j] == '\t')) { j++; }
+        std::string_view v;
+        if(j < value.size() && value[j] == '"') {
+            size_t k = j + 1;
+            while(k < value.size() && value[k] != '"') { k += value[k] == '\\' ? 2 : 1; }
+            k = std::min(k, value.size());
+            v = value.substr(j + 1, k - j - 1);
+            i = value.find(';', k);
+        }
+        else {
+            i = value.find(';', j);
+            v = Trim_(value.substr(j, i == std::string_view::npos ? i : i - j));
+        }
+        if(EqualsIgnoreCase_(name, key)) { return v; }
+    }
+    return std::string_view();
+}
+
+std::string_view MultipartParser::Boundary(std::string_view contentType) {
+    if(!EqualsIgnoreCase_(Trim_(contentType.substr(0, contentType.find(';'))), "multipart/form-data")) {
+        return std::string_view();
+    }
+    return Param_(contentType, "boundary");
+}
+
+bool MultipartParser::Init(std::string_view boundary, MultipartSink* sink) {
+    state_ = DONE;
+    if(boundary.empty() || boundary.size() > MAX_BOUNDARY || !sink) {
+        return false;
+    }
+    sink_ = sink;
+    delim_.assign("\r\n--");
+    delim_.append(boundary.data(), boundary.size());
+    header_.clear();
+    // 第一个分隔符前面可以没有CRLF，当作已经匹配了"\r\n"
+    matched_ = 2;
+    state_ = PREAMBLE;
+    return true;
+}
+
+bool MultipartParser::Feed(const char* data, size_t len) {
+    const char* p = data;
+    const char* end = data + len;
+    while(p < end) {
+        switch(state_) {
+            case PREAMBLE:
+            case DATA: {
+                if(matched_ == 0) {
+                    // 到下一个'\r'之前都是数据
+                    const char* cr = CharScan::Find(p, end, '\r');
+                    if(state_ == DATA && cr > p && !sink_->OnPartData(p, cr - p)) { return Fail_(); }
+                    p = cr;
+                    if(p == end) { break; }
+                }
+                while(p < end && matched_ < delim_.size() && *p == delim_[matched_]) {
+                    p++;
+                    matched_++;
+                }
+                if(matched_ == delim_.size()) {
+                    if(state_ == DATA && !sink_->OnPartEnd()) { return Fail_(); }
+                    matched_ = 0;
+                    state_ = AFTER_BOUNDARY;
+                }
+                else if(p < end) {
+                    // 匹配到一半失败：已匹配的是分隔符的前缀，原样作为数据，当前字节重新开始匹配
+                    if(state_ == DATA && !sink_->OnPartData(delim_.data(), matched_)) { return Fail_(); }
+                    matched_ = 0;
+                }
+                break;      // p == end时部分匹配的长度留到下一块接着比
+            }
+            case AFTER_BOUNDARY: {
+                char ch = *p++;
+                if(ch == '-') { state_ = CLOSE_DASH; }
+                else if(ch == '\r') { state_ = AFTER_BOUNDARY_LF; }
+                else if(ch != ' ' && ch != '\t') { return Fail_(); }     // 分隔符后可以有空白
+                break;
+            }
+            case AFTER_BOUNDARY_LF:
+                if(*p++ != '\n') { return Fail_(); }
+                header_.clear();
+                state_ = HEADERS;
+                break;
+            case CLOSE_DASH:
+                if(*p++ != '-') { return Fail_(); }
+                state_ = EPILOGUE;
+                break;
+            case HEADERS: {
+                const char* lf = CharScan::Find(p, end, '\n');
+                const char* next = lf == end ? end : lf + 1;
+                header_.append(p, next - p);
+                p = next;
+                if(header_.size() > MAX_PART_HEADER_BYTES) { return Fail_(); }
+                // 部分头到空行结束；没有头的部分只有一个空行
+                size_t n = header_.size();
+                if(lf != end && (header_ == "\r\n" || (n >= 4 && header_.compare(n - 4, 4, "\r\n\r\n") == 0))) {
+                    if(!ParsePartHeaders_()) { return Fail_(); }
+                    state_ = DATA;
+                }
+                break;
+            }
+            case EPILOGUE:
+                p = end;
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+bool MultipartParser::ParsePartHeaders_() {
+    MultipartPart part;
+    std::string_view headers(header_);
+    while(!headers.empty()) {
+        size_t eol = headers.find("\r\n");
+        if(eol == std::string_view::npos) { return false; }
+        std::string_view line = headers.substr(0, eol);
+        headers.remove_prefix(eol + 2);
+        if(line.empty()) { break; }
+        size_t colon = line.find(':');
+        if(colon == std::string_view::npos || colon == 0) { return false; }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = Trim_(line.substr(colon + 1));
+        if(EqualsIgnoreCase_(name, "Content-Disposition")) {
+            part.name = Param_(value, "name");
+            part.filename = Param_(value, "filename");
+        }
+        else if(EqualsIgnoreCase_(name, "Content-Type")) {
+            part.contentType = value;
+        }
+    }
+    return sink_->OnPartBegin(part);
+}
@@ -0,0 +1,71 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include <string>
+#include <string_view>
+
+#include "charscan.h"
+
+// 一个部分的头里关心的字段，都是指向解析器内部的视图，在这个部分结束前有效
+struct MultipartPart {
+    std::string_view name;          // Content-Disposition的name
+    std::string_view filename;      // Content-Disposition的filename，不是文件时为空
+    std::string_view contentType;
+};
+
+// 接收multipart各部分的回调，返回false中止解析（请求按出错处理）
+class MultipartSink {
+public:
+    virtual ~MultipartSink() = default;
+    virtual bool OnPartBegin(const MultipartPart& part) = 0;
+    // 部分的数据分多次给出，不会把整个部分攒在内存里
+    virtual bool OnPartData(const char* data, size_t len) = 0;
+    virtual bool OnPartEnd() = 0;
+};
+
+/*
+    流式的multipart/form-data解析器（RFC 7578 / RFC 2046）：请求体按到达的块喂进来，
+    每个部分的数据一边找分隔符一边交给sink，只在内存里保留部分头（有上限），文件部分不缓存
+    分隔符"\r\n--boundary"里只有开头一个'\r'，匹配到一半失败时已匹配的部分一定是数据，
+    不需要回溯：先用CharScan一次跳到下一个'\r'，再逐字节比较，跨块的部分匹配只记匹配长度
+*/
+class MultipartParser {
+public:
+    static const size_t MAX_BOUNDARY = 70;              // RFC 2046规定的boundary最大长度
+    static const size_t MAX_PART_HEADER_BYTES = 8 * 1024;
+
+    MultipartParser() : sink_(nullptr), state_(DONE), matched_(0) {}
+
+    // boundary为空或太长返回false
+    bool Init(std::string_view boundary, MultipartSink* sink);
+    // 喂一块请求体，格式错误或sink中止返回false，之后不能再喂
+    bool Feed(const char* data, size_t len);
+    // 结束分隔符已经出现
+    bool Done() const { return state_ == EPILOGUE; }
+
+    // Content-Type是multipart/form-data时返回boundary参数（去掉引号），否则返回空
+    static std::string_view Boundary(std::string_view contentType);
+
+private:
+    enum STATE {
+        PREAMBLE,           // 第一个分隔符之前，数据丢弃
+        DATA,               // 部分的数据，同时找分隔符
+        AFTER_BOUNDARY,     // 分隔符之后：可选空白再CRLF，或者"--"表示结束
+        AFTER_BOUNDARY_LF,
+        CLOSE_DASH,
+        HEADERS,            // 部分头，到空行结束
+        EPILOGUE,           // 结束分隔符之后，数据丢弃
+        DONE,               // 出错或未初始化
+    };
+
+    bool Fail_() { state_ = DONE; return false; }
+    bool ParsePartHeaders_();
+
+    MultipartSink* sink_;
+    STATE state_;
+    std::string delim_;     // "\r\n--" + boundary
+    size_t matched_;        // delim_已经匹配的长度
+    std::string header_;    // 当前部分的头，MultipartPart里的视图指向这里
+};
+
+#endif //MULTIPART_H
@@ -0,0 +1,256 @@
+#include "router.h"
+
+#include <algorithm>
+
+#include "httprequest.h"
+#include "httprespon.h"
+
+// 编译时的节点，编译完就丢掉
+struct Router::BuildNode {
+    std::string label;
+    std::vector<std::unique_ptr<BuildNode>> children;
+    std::unique_ptr<BuildNode> param;
+    std::unique_ptr<BuildNode> wildcard;
+    std::vector<uint32_t> routes;
+};
+
+namespace {
+
+// 模式拆成的一段：字面量、":名字"或"*名字"
+struct Token {
+    char kind;      // 0字面量，':'参数，'*'通配
+    std::string_view text;
+};
+
+// 模式以'/'开头；参数和通配要占满一段，通配只能是最后一段，名字不能为空
+bool SplitPattern_(std::string_view pattern, std::vector<Token>& tokens) {
+    tokens.clear();
+    if(pattern.empty() || pattern[0] != '/') { return false; }
+    size_t pos = 0, literal = 0;
+    while(pos < pattern.size()) {
+        char ch = pattern[pos];
+        if((ch != ':' && ch != '*') || pattern[pos - 1] != '/') {
+            pos++;
+            continue;
+        }
+        if(pos > literal) { tokens.push_back(Token{0, pattern.substr(literal, pos - literal)}); }
+        size_t end = pattern.find('/', pos);
+        if(end == std::string_view::npos) { end = pattern.size(); }
+        if(end == pos + 1 || (ch == '*' && end != pattern.size())) { return false; }
+        tokens.push_back(Token{ch, pattern.substr(pos + 1, end - pos - 1)});
+        pos = literal = end;
+    }
+    if(pos > literal) { tokens.push_back(Token{0, pattern.substr(literal, pos - literal)}); }
+    return true;
+}
+
+// 登录和注册表单：用户名密码都没有时按原路径回表单页，否则按验证结果回欢迎页或错误页
+Router::Handler UserForm_(bool isLogin) {
+    return [isLogin](HttpRequest& request, HttpResponse& response) {
+        std::string name = request.GetPost("username");
+        std::string pwd = request.GetPost("password");
+        if(name.empty() && pwd.empty()) { return; }
+        response.SetPath(HttpRequest::UserVerify(name, pwd, isLogin) ? "/welcome.html" : "/error.html");
+    };
+}
+
+}
+
+Router* Router::Instance() {
+    static Router router;
+    return &router;
+}
+
+// 博客自带的页面：不带后缀的路径改写成对应的html，登录和注册的表单提交要查数据库
+Router::Router() {
+    static const char* PAGES[] = {"/index", "/register", "/login", "/welcome", "/video", "/picture"};
+    Alias("/", "/index.html");
+    for(const char* page: PAGES) {
+        Alias(page, std::string(page) + ".html");
+    }
+    Add("POST", "/register", "/register.html", UserForm_(false));
+    Handle("POST", "/register.html", UserForm_(false));
+    Add("POST", "/login", "/login.html", UserForm_(true));
+    Handle("POST", "/login.html", UserForm_(true));
+}
+
+bool Router::Add(std::string_view method, std::string_view pattern, std::string_view file, Handler handler) {
+    std::vector<Token> tokens;
+    if(!SplitPattern_(pattern, tokens)) {
+        LOG_ERROR("Bad route pattern: %.*s", (int)pattern.size(), pattern.data());
+        return false;
+    }
+    Route route{std::string(method), std::string(file), std::move(handler), {}};
+    for(const Token& t: tokens) {
+        if(t.kind != 0) { route.params.emplace_back(t.text); }
+    }
+    if(route.params.size() > MAX_PARAMS) {
+        LOG_ERROR("Too many route params: %.*s", (int)pattern.size(), pattern.data());
+        return false;
+    }
+    for(size_t i = 0; i < routes_.size(); i++) {
+        if(patterns_[i] == pattern && routes_[i].method == method) {
+            routes_[i] = std::move(route);
+            return true;        // 树的结构不变，不用重新编译
+        }
+    }
+    routes_.push_back(std::move(route));
+    patterns_.emplace_back(pattern);
+    Build_();
+    return true;
+}
+
+// 在b下面插入字面量s，和已有的边有公共前缀时把边拆开，返回s的终点
+Router::BuildNode* Router::InsertLiteral_(BuildNode* b, std::string_view s) {
+    while(!s.empty()) {
+        std::unique_ptr<BuildNode>* slot = nullptr;
+        for(auto& child: b->children) {
+            if(child->label[0] == s[0]) {
+                slot = &child;
+                break;
+            }
+        }
+        if(!slot) {
+            b->children.emplace_back(new BuildNode);
+            b->children.back()->label.assign(s.data(), s.size());
+            return b->children.back().get();
+        }
+        BuildNode* c = slot->get();
+        size_t k = 1;
+        while(k < c->label.size() && k < s.size() && c->label[k] == s[k]) { k++; }
+        if(k < c->label.size()) {
+            std::unique_ptr<BuildNode> mid(new BuildNode);
+            mid->label = c->label.substr(0, k);
+            c->label.erase(0, k);
+            mid->children.push_back(std::move(*slot));
+            *slot = std::move(mid);
+            c = slot->get();
+        }
+        b = c;
+        s.remove_prefix(k);
+    }
+    return b;
+}
+
+// 先按登记的模式建一棵指针树，再展开成连续的数组，匹配时只按下标访问
+void Router::Build_() {
+    BuildNode root;
+    std::vector<Token> tokens;
+    for(size_t i = 0; i < patterns_.size(); i++) {
+        SplitPattern_(patterns_[i], tokens);
+        BuildNode* b = &root;
+        for(const Token& t: tokens) {
+            if(t.kind == 0) {
+                b = InsertLiteral_(b, t.text);
+                continue;
+            }
+            std::unique_ptr<BuildNode>& next = t.kind == ':' ? b->param : b->wildcard;
+            if(!next) { next.reset(new BuildNode); }
+            b = next.get();
+        }
+        b->routes.push_back(i);
+    }
+    nodes_.clear();
+    labels_.clear();
+    routeRefs_.clear();
+    nodes_.emplace_back();
+    Flatten_(root, 0);
+}
+
+void Router::Flatten_(const BuildNode& b, uint32_t idx) {
+    Node node;
+    node.label = labels_.size();
+    node.labelLen = b.label.size();
+    labels_ += b.label;
+    node.route = routeRefs_.size();
+    node.routeCount = b.routes.size();
+    routeRefs_.insert(routeRefs_.end(), b.routes.begin(), b.routes.end());
+    node.child = nodes_.size();
+    node.childCount = b.children.size();
+    nodes_.resize(nodes_.size() + b.children.size());
+    node.param = node.wildcard = -1;
+    if(b.param) {
+        node.param = nodes_.size();
+        nodes_.emplace_back();
+    }
+    if(b.wildcard) {
+        node.wildcard = nodes_.size();
+        nodes_.emplace_back();
+    }
+    nodes_[idx] = node;     // 先占好位置再展开子节点，子节点的展开会让nodes_扩容
+    for(size_t i = 0; i < b.children.size(); i++) {
+        Flatten_(*b.children[i], node.child + i);
+    }
+    if(b.param) { Flatten_(*b.param, node.param); }
+    if(b.wildcard) { Flatten_(*b.wildcard, node.wildcard); }
+}
+
+const Router::Route* Router::Match(std::string_view method, std::string_view path,
+                                   std::string_view* values, size_t* count) const {
+    *count = 0;
+    if(routes_.empty()) { return nullptr; }
+    return Match_(0, path, method, values, 0, count);
+}
+
+// rest是走到节点n（已经匹配完n的边）之后剩下的路径；参数和通配匹配失败时回退到上一层试下一种
+const Router::Route* Router::Match_(uint32_t n, std::string_view rest, std::string_view method,
+                                    std::string_view* values, size_t depth, size_t* count) const {
+    const Node& node = nodes_[n];
+    const Route* route = nullptr;
+    if(rest.empty()) {
+        route = Pick_(node, method);
+        if(route) {
+            *count = depth;
+            return route;
+        }
+    }
+    else {
+        // 子节点的边首字符各不相同，最多一个能走
+        for(uint32_t i = node.child; i < node.child + node.childCount; i++) {
+            const Node& c = nodes_[i];
+            if(labels_[c.label] != rest[0]) { continue; }
+            if(rest.compare(0, c.labelLen, labels_, c.label, c.labelLen) == 0) {
+                route = Match_(i, rest.substr(c.labelLen), method, values, depth, count);
+            }
+            break;
+        }
+        if(!route && node.param >= 0 && depth < MAX_PARAMS) {
+            size_t end = std::min(rest.find('/'), rest.size());
+            if(end > 0) {
+                values[depth] = rest.substr(0, end);
+                route = Match_(node.param, rest.substr(end), method, values, depth + 1, count);
+            }
+        }
+    }
+    if(route) {
+        return route;
+    }
+    if(node.wildcard >= 0 && depth < MAX_PARAMS) {
+        route = Pick_(nodes_[node.wildcard], method);
+        if(route) {
+            values[depth] = rest;
+            *count = depth + 1;
+        }
+    }
+    return route;
+}
+
+// 同一个终点上按方法挑：方法相同的优先，HEAD可以用GET的，最后是不限方法的
+const Router::Route* Router::Pick_(const Node& node, std::string_view method) const {
+    const Route* get = nullptr;
+    const Route* any = nullptr;
+    for(uint32_t i = node.route; i < node.route + node.routeCount; i++) {
+        const Route& r = routes_[routeRefs_[i]];
+        if(r.method == method) { return &r; }
+        if(r.method.empty()) { any = &r; }
+        else if(r.method == "GET" && method == "HEAD") { get = &r; }
+    }
+    return get ? get : any;
+}
+
+void Router::Dispatch(HttpRequest& request, HttpResponse& response) {
+    const Route* route = request.GetRoute();
+    if(route && route->handler) {
+        route->handler(request, response);
+    }
+}
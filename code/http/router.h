@@ -0,0 +1,88 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class HttpRequest;
+class HttpResponse;
+
+/*
+    路由表：按方法和路径模式登记，启动时编译成一棵压缩的前缀树（radix trie），
+    每个请求在请求行解析完时匹配一次，只沿着路径走一遍，不再逐个比较登记过的路径
+    模式里一段是":名字"时匹配这一段（到下一个'/'为止），最后一段是"*名字"时匹配剩下的全部，
+    匹配到的值按出现顺序捕获，用HttpRequest::Param(名字)取；优先级是字面量 > 参数 > 通配
+    一条路由可以指定静态文件（请求路径改写成它，/login -> /login.html）、处理函数，或者两者都有；
+    处理函数在生成响应时调用，可以改用别的文件（HttpResponse::SetPath）或者生成响应体（SetStream）
+    没有匹配到的请求按路径找静态文件，静态文件和动态处理走同一个分发步骤
+    只在启动时登记（单线程），之后只读，多个线程同时Match不用加锁
+*/
+class Router {
+public:
+    using Handler = std::function<void(HttpRequest& request, HttpResponse& response)>;
+
+    static const size_t MAX_PARAMS = 8;     // 一条路由最多捕获的参数个数
+
+    struct Route {
+        std::string method;                 // 空表示任何方法
+        std::string file;                   // 非空时请求路径改写成这个静态文件
+        Handler handler;                    // 非空时在生成响应时调用
+        std::vector<std::string> params;    // 参数名，和捕获的值一一对应
+    };
+
+    static Router* Instance();
+
+    // 登记一条路由，pattern格式不对时返回false；同一方法同一模式重复登记时后登记的替换先登记的
+    // 登记后立即重新编译，之前Match返回的Route指针仍然有效
+    bool Add(std::string_view method, std::string_view pattern, std::string_view file, Handler handler);
+    bool Handle(std::string_view method, std::string_view pattern, Handler handler) {
+        return Add(method, pattern, std::string_view(), std::move(handler));
+    }
+    // 任何方法都改写到静态文件
+    bool Alias(std::string_view pattern, std::string_view file) {
+        return Add(std::string_view(), pattern, file, nullptr);
+    }
+
+    // 按方法和路径（不含查询串）找路由，没有返回nullptr；values至少要有MAX_PARAMS个，
+    // 捕获的值是指向path的视图；HEAD请求也匹配GET的路由
+    const Route* Match(std::string_view method, std::string_view path,
+                       std::string_view* values, size_t* count) const;
+
+    // 请求匹配到了带处理函数的路由时调用它，response已经按请求路径Init
+    static void Dispatch(HttpRequest& request, HttpResponse& response);
+
+private:
+    Router();
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    // 编译后的节点：字面量子节点在nodes_里连续存放，边上的字符串在labels_里
+    struct Node {
+        uint32_t label, labelLen;
+        uint32_t child, childCount;
+        int32_t param;                  // 参数子节点，-1表示没有
+        int32_t wildcard;               // 通配子节点（终点），-1表示没有
+        uint32_t route, routeCount;     // 以这里结尾的路由在routeRefs_里的位置
+    };
+    struct BuildNode;
+
+    static BuildNode* InsertLiteral_(BuildNode* b, std::string_view s);
+    void Build_();
+    void Flatten_(const BuildNode& b, uint32_t idx);
+    const Route* Match_(uint32_t n, std::string_view rest, std::string_view method,
+                        std::string_view* values, size_t depth, size_t* count) const;
+    const Route* Pick_(const Node& node, std::string_view method) const;
+
+    std::deque<Route> routes_;          // deque：追加时已有的Route不搬家
+    std::vector<std::string> patterns_; // 和routes_一一对应
+    std::vector<Node> nodes_;
+    std::string labels_;
+    std::vector<uint32_t> routeRefs_;
+};
+
+#endif //ROUTER_H
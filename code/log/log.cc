@@ -26,14 +26,17 @@ Log::Log() {
 }
 
 Log::~Log() {
-    // 把阻塞队列中的任务都取出来做完
-    while(!deque_ -> empty()) {
-        deque_ -> flush();
-    }
+    // 同步方式（包括prefork的master）没有队列和写线程
+    if(deque_) {
+        // 把阻塞队列中的任务都取出来做完
+        while(!deque_ -> empty()) {
+            deque_ -> flush();
+        }
 
-    // 关闭阻塞队列
-    deque_ -> Close();
-    writeThread_ -> join();
+        // 关闭阻塞队列
+        deque_ -> Close();
+        writeThread_ -> join();
+    }
 
     if(fp_) {
         std::lock_guard<std::mutex> locker(mtx_);
@@ -94,7 +97,7 @@ void Log::write(int level, const char *format,...) {
         locker.lock();
         flush();
         fclose(fp_);
-        fp_ = fopen(newFile, "a");
+        fp_ = fopen(newFile, "ae");    // e：O_CLOEXEC，平滑升级exec新进程时不带过去
         // assert(fp_ != nullptr);
     }
 
@@ -138,6 +141,11 @@ void Log::write(int level, const char *format,...) {
     }
 }
 
+bool Log::SetAffinity(const std::vector<int>& cpus) {
+    if(!writeThread_) { return false; }
+    return CpuAffinity::Pin(writeThread_->native_handle(), cpus);
+}
+
 // 写线程真正的执行函数
 void Log::AsyncWrite_() {
     std::string str = "";
@@ -182,10 +190,10 @@ void Log::init(int level, const char* path, const char* suffix, int maxQueCapaci
             flush();
             fclose(fp_);
         }
-        fp_ = fopen(fileName, "a"); // 打开文件读取并附加写入
+        fp_ = fopen(fileName, "ae"); // 打开文件读取并附加写入，exec时关闭
         if(fp_ == nullptr) {
             mkdir(fileName, 0777);
-            fp_ = fopen(fileName, "a"); // 生成目录文件（最大权限）
+            fp_ = fopen(fileName, "ae"); // 生成目录文件（最大权限）
         }
         // printf("path_: %s\n", path_);
         // printf("fileName: %s\n", fileName);
@@ -13,6 +13,7 @@
 #include <memory>  
 #include "blockqueue.h"
 #include "../buffer/buffer.h"
+#include "../pool/affinity.h"
 
 class Log {
 public:
@@ -33,6 +34,8 @@ public:
     int GetLevel();
     void SetLevel(int level);
     bool IsOpen() { return isOpen_; }
+    // 异步写线程绑核，cpus为空不绑
+    bool SetAffinity(const std::vector<int>& cpus);
     virtual ~Log();
 
 private:
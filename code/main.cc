@@ -1,12 +1,68 @@
 #include <unistd.h>
+#include <string.h>
 #include "server/webserver.h"
+#include "server/master.h"
 
-int main() {
+int main(int argc, char* argv[]) {
     // 守护进程 后台运行 
-    WebServer server(
-        1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
-        3306, "root", "123456", "webserver", /* Mysql配置 */
-        12, 6, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
-    server.Start();
-} 
+    ServerOptions options;
+    options.reactorNum = 1;     /* Reactor线程数，>1 时每线程一个Epoller并用SO_REUSEPORT分担accept */
+    options.reusePort = true;   /* 多Reactor监听方式：SO_REUSEPORT / 共享fd+EPOLLEXCLUSIVE */
+    options.ioBackend = Epoller::EPOLL;     /* 事件后端，-b uring 切换到io_uring */
+    options.dispatch = ServerOptions::DISPATCH_ADAPTIVE;    /* 请求分发：线程池 / 自适应 / 全部在Reactor线程 */
+    options.maxBodyBytes = 8 * 1024 * 1024; /* 请求体上限，超过回413 */
+    options.bodyMemBytes = 64 * 1024;       /* 请求体超过该值时写临时文件，不在内存里整块保存 */
+    options.bodySpillDir = "/tmp";          /* 请求体临时文件目录 */
+    options.h2c = true;         /* 明文HTTP/2：prior knowledge和Upgrade: h2c */
+    options.maxKeepAliveRequests = 1000;    /* 每个连接最多处理的HTTP/1.x请求数，0不限；空闲超时见下面的timeoutMs */
+    options.fileCacheEntries = 1024;        /* 静态文件缓存的条目数，文件改动后最多1秒内生效，0不缓存 */
+    options.listenBacklog = SOMAXCONN;      /* 监听队列长度 */
+    options.acceptBudget = 64;  /* 每次唤醒最多accept的连接数 */
+    options.deferAcceptSec = 0; /* TCP_DEFER_ACCEPT秒数，0关闭 */
+    options.statsIntervalMs = 0;            /* 计数器写日志的间隔，0关闭 */
+    options.maxEvents = 1024;   /* 每次epoll_wait最多取回的事件数，实际批大小随负载伸缩 */
+    options.spinUs = 0;         /* 低延迟模式：阻塞前先自旋轮询的微秒数，0关闭 */
+    options.busyPollUs = 0;     /* 新连接的SO_BUSY_POLL微秒数，0关闭 */
+    options.drainTimeoutMs = 30000;         /* kill -USR2 平滑升级、kill -QUIT 退出时等待在途请求的最长时间 */
+    options.maxConns = 0;       /* 最大连接数，达到后暂停accept并对超出的连接回503，0只受连接表大小限制 */
+    options.maxInflight = 0;    /* 交给线程池的在途请求上限，超过回503，0不限制 */
+    options.retryAfterSec = 1;  /* 503响应的Retry-After秒数 */
+    options.reactorCpus = "";   /* 绑核：Reactor依次绑定到列表里的CPU，如"0-3"，空串不绑 */
+    options.workerCpus = "";    /* 线程池工作线程绑定的CPU */
+    options.logCpus = "";       /* 异步日志写线程绑定的CPU */
+    options.incomingCpu = false;            /* SO_REUSEPORT时按SO_INCOMING_CPU把连接分给同CPU上的Reactor */
+    options.listen = "";        /* 监听地址列表，如"1316,[::]:8080,unix:/run/blog.sock"，空串监听下面的端口，-l 指定 */
+    options.workerProcesses = 0;            /* prefork：>0 时master绑定端口并监督这么多个worker进程，-p 指定 */
+
+    int opt;
+    while((opt = getopt(argc, argv, "b:l:p:")) != -1) {
+        switch(opt) {
+        case 'b':
+            options.ioBackend = strcmp(optarg, "uring") == 0 ? Epoller::IO_URING : Epoller::EPOLL;
+            break;
+        case 'l':
+            options.listen = optarg;
+            break;
+        case 'p':
+            options.workerProcesses = atoi(optarg);
+            break;
+        default:
+            break;
+        }
+    }
 
+    auto runServer = [](const ServerOptions& serverOptions) {
+        WebServer server(
+            1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
+            3306, "root", "123456", "webserver", /* Mysql配置 */
+            12, 6, true, 1, 1024,              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+            serverOptions);
+        server.Start();
+    };
+    if(options.workerProcesses > 0) {
+        // 端口、优雅退出、日志开关、日志等级与上面WebServer的参数一致
+        Master master(1316, false, true, 1, options);
+        return master.Run(runServer);
+    }
+    runServer(options);
+} 
@@ -0,0 +1,74 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*
+    线程绑核和NUMA节点查询
+    CPU列表使用和taskset/cpuset相同的写法，例如 "0-3,8,10-11"
+*/
+class CpuAffinity {
+public:
+    // 解析CPU列表，格式错误或为空时返回空数组（即不绑核）
+    static std::vector<int> Parse(const std::string& list) {
+        std::vector<int> cpus;
+        const char* p = list.c_str();
+        while(*p) {
+            char* end = nullptr;
+            long first = strtol(p, &end, 10);
+            if(end == p || first < 0) { return std::vector<int>(); }
+            long last = first;
+            p = end;
+            if(*p == '-') {
+                last = strtol(p + 1, &end, 10);
+                if(end == p + 1 || last < first) { return std::vector<int>(); }
+                p = end;
+            }
+            for(long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+            if(*p == ',') { p++; }
+            else if(*p) { return std::vector<int>(); }
+        }
+        return cpus;
+    }
+
+    // 把线程绑定到cpus里的任意CPU上，cpus为空时不做任何事
+    static bool Pin(pthread_t thread, const std::vector<int>& cpus) {
+        if(cpus.empty()) { return true; }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu: cpus) { CPU_SET(cpu, &set); }
+        return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+    }
+
+    static bool PinSelf(const std::vector<int>& cpus) {
+        return Pin(pthread_self(), cpus);
+    }
+
+    // CPU所在的NUMA节点，查不到（单节点机器没有导出，或者CPU不存在）返回-1
+    static int NodeOf(int cpu) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR* dir = opendir(path);
+        if(!dir) { return -1; }
+        int node = -1;
+        while(struct dirent* entry = readdir(dir)) {
+            if(strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                node = atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+        return node;
+    }
+};
+
+#endif // AFFINITY_H
@@ -0,0 +1,148 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>     // malloc, free
+#include <stdio.h>      // vsnprintf
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <new>          // std::bad_alloc
+#include <string_view>
+
+/*
+    按连接的单调分配器：一个请求里的临时数据（表单解码结果、拼出来的文件路径、响应头行）都从这里分配，
+    只移动指针不单独释放，请求结束时Reset()整体回收
+    1. 第一次分配时才向malloc要主块，没处理过请求的连接槽不占内存
+    2. 主块放不下时临时malloc溢出块；Reset时把主块一次扩到这个请求的总用量再释放溢出块，
+       之后同样大小的请求只在主块里分配，稳态下每个请求不调用malloc，线程池各线程也就不争malloc的锁
+    3. 主块超过MAX_KEEP_BYTES时Reset直接释放，偶尔的大请求不会让连接槽一直占着大块内存
+    不是线程安全的：同一时刻只有处理这个连接的那一个线程使用
+*/
+class Arena {
+public:
+    static const size_t MIN_BLOCK_BYTES = 4 * 1024;
+    static const size_t MAX_KEEP_BYTES = 64 * 1024;
+
+    Arena() : block_(nullptr), cap_(0), used_(0), overflow_(nullptr), overflowBytes_(0), blockAllocs_(0) {}
+    ~Arena() {
+        FreeOverflow_();
+        free(block_);
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t n, size_t align = alignof(max_align_t)) {
+        size_t begin = (used_ + align - 1) & ~(align - 1);
+        if(block_ && begin + n <= cap_) {
+            used_ = begin + n;
+            return block_ + begin;
+        }
+        return AllocateSlow_(n, align);
+    }
+
+    // 拷贝一段字节，末尾补'\0'
+    char* Copy(const char* data, size_t len) {
+        char* p = static_cast<char*>(Allocate(len + 1, 1));
+        memcpy(p, data, len);
+        p[len] = '\0';
+        return p;
+    }
+
+    // 格式化到分配器里，返回的结果以'\0'结尾
+    std::string_view Printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list ap, ap2;
+        va_start(ap, fmt);
+        va_copy(ap2, ap);
+        // 先直接写进主块剩余的空间，放不下再按实际长度分配后重写一次
+        size_t room = block_ && cap_ > used_ ? cap_ - used_ : 0;
+        int len = vsnprintf(room ? block_ + used_ : nullptr, room, fmt, ap);
+        va_end(ap);
+        char* p;
+        if(len < 0) {
+            len = 0;
+            p = static_cast<char*>(Allocate(1, 1));
+            *p = '\0';
+        }
+        else if(static_cast<size_t>(len) < room) {
+            p = block_ + used_;
+            used_ += len + 1;
+        }
+        else {
+            p = static_cast<char*>(Allocate(len + 1, 1));
+            vsnprintf(p, len + 1, fmt, ap2);
+        }
+        va_end(ap2);
+        return std::string_view(p, len);
+    }
+
+    void Reset() {
+        if(overflow_) {
+            size_t need = used_ + overflowBytes_;
+            FreeOverflow_();
+            size_t cap = cap_ * 2 > need ? cap_ * 2 : need;
+            free(block_);
+            block_ = nullptr;
+            cap_ = 0;
+            if(cap <= MAX_KEEP_BYTES) { Grow_(cap); }
+        }
+        else if(cap_ > MAX_KEEP_BYTES) {
+            free(block_);
+            block_ = nullptr;
+            cap_ = 0;
+        }
+        used_ = 0;
+    }
+
+    size_t Used() const { return used_ + overflowBytes_; }
+    size_t Capacity() const { return cap_; }
+    // 累计向malloc要内存的次数，稳态下不再增长
+    size_t BlockAllocs() const { return blockAllocs_; }
+
+private:
+    struct Overflow {
+        Overflow* next;
+    };
+
+    void* AllocateSlow_(size_t n, size_t align) {
+        if(!block_) {
+            Grow_(n + align > MIN_BLOCK_BYTES ? n + align : MIN_BLOCK_BYTES);
+            return Allocate(n, align);
+        }
+        // 溢出块单独malloc，头部之后按对齐放数据
+        size_t header = (sizeof(Overflow) + align - 1) & ~(align - 1);
+        Overflow* o = static_cast<Overflow*>(malloc(header + n));
+        if(!o) { throw std::bad_alloc(); }
+        blockAllocs_++;
+        o->next = overflow_;
+        overflow_ = o;
+        overflowBytes_ += n + align;
+        return reinterpret_cast<char*>(o) + header;
+    }
+
+    void Grow_(size_t cap) {
+        if(cap < MIN_BLOCK_BYTES) { cap = MIN_BLOCK_BYTES; }
+        block_ = static_cast<char*>(malloc(cap));
+        if(!block_) { throw std::bad_alloc(); }
+        blockAllocs_++;
+        cap_ = cap;
+        used_ = 0;
+    }
+
+    void FreeOverflow_() {
+        while(overflow_) {
+            Overflow* next = overflow_->next;
+            free(overflow_);
+            overflow_ = next;
+        }
+        overflowBytes_ = 0;
+    }
+
+    char* block_;
+    size_t cap_;
+    size_t used_;
+    Overflow* overflow_;
+    size_t overflowBytes_;
+    size_t blockAllocs_;
+};
+
+#endif //ARENA_H
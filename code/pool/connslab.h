@@ -0,0 +1,102 @@
+#ifndef CONNSLAB_H
+#define CONNSLAB_H
+
+#include <sys/mman.h>   // mmap, munmap
+#include <atomic>
+#include <new>
+#include <cstdint>
+#include <type_traits>
+#include <assert.h>
+
+/*
+    以fd为下标的连接槽数组，容量固定为maxFd
+    1. 整块内存用匿名mmap预留，没有访问过的槽不占物理内存，槽内对象第一次使用时才构造
+    2. 槽不会移动，指针在整个进程生命周期内稳定，不会因为扩容/rehash而失效
+    3. 每次fd被重新分配给新连接时代数(generation)加一，
+       定时器回调和epoll事件带着代数，代数对不上说明fd已被复用，直接丢弃
+    fd在进程内唯一，多个Reactor共用一个ConnSlab，各自只访问自己accept到的fd
+*/
+template<class T>
+class ConnSlab {
+public:
+    explicit ConnSlab(size_t maxFd) : maxFd_(maxFd) {
+        void* mem = mmap(nullptr, maxFd_ * sizeof(Slot), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(mem != MAP_FAILED);
+        slots_ = static_cast<Slot*>(mem);   // 匿名映射全为0，即 gen == 0 且 constructed == false
+    }
+
+    ~ConnSlab() {
+        for(size_t i = 0; i < maxFd_; i++) {
+            if(slots_[i].constructed) {
+                Object_(i)->~T();
+            }
+        }
+        munmap(slots_, maxFd_ * sizeof(Slot));
+    }
+
+    ConnSlab(const ConnSlab&) = delete;
+    ConnSlab& operator=(const ConnSlab&) = delete;
+
+    // 新连接占用fd槽：必要时构造对象，代数加一，返回新代数
+    // rebuild为true时先析构旧对象再重新构造，对象自己申请的内存（缓冲区等）由当前线程重新分配
+    uint32_t Acquire(int fd, bool rebuild = false) {
+        assert(Valid(fd));
+        Slot& slot = slots_[fd];
+        if(slot.constructed && rebuild) {
+            Object_(fd)->~T();
+            slot.constructed = false;
+        }
+        if(!slot.constructed) {
+            new (&slot.storage) T();
+            slot.constructed = true;
+        }
+        uint32_t gen = slot.gen.load(std::memory_order_relaxed) + 1;
+        if(gen == 0) { gen = 1; }   // 0 保留给监听套接字等非连接fd
+        slot.gen.store(gen, std::memory_order_release);
+        return gen;
+    }
+
+    // 按fd取对象，不校验代数（调用方确定fd属于当前连接）
+    T* Get(int fd) {
+        assert(Valid(fd) && slots_[fd].constructed);
+        return Object_(fd);
+    }
+
+    // 按fd和代数取对象，fd已被复用或从未使用时返回nullptr
+    T* Get(int fd, uint32_t gen) {
+        if(!Valid(fd) || !slots_[fd].constructed ||
+            slots_[fd].gen.load(std::memory_order_acquire) != gen) {
+            return nullptr;
+        }
+        return Object_(fd);
+    }
+
+    uint32_t Generation(int fd) const {
+        assert(Valid(fd));
+        return slots_[fd].gen.load(std::memory_order_acquire);
+    }
+
+    bool Valid(int fd) const {
+        return fd >= 0 && static_cast<size_t>(fd) < maxFd_;
+    }
+
+    size_t Capacity() const { return maxFd_; }
+
+private:
+    // 按cache line对齐，相邻fd的连接不会落在同一cache line上互相干扰
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> gen;
+        bool constructed;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    T* Object_(size_t i) {
+        return reinterpret_cast<T*>(&slots_[i].storage);
+    }
+
+    size_t maxFd_;
+    Slot* slots_;
+};
+
+#endif // CONNSLAB_H
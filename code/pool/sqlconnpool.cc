@@ -1,5 +1,7 @@
 #include "./sqlconnpool.h"
 
+#include <fcntl.h>
+
 SqlConnPool* SqlConnPool::Instance() {
     static SqlConnPool sqlconnpol;
     return &sqlconnpol;
@@ -39,6 +41,10 @@ void SqlConnPool::Init(const char* host, int port,
             LOG_ERROR("MYSQL INIT ERROR");
         }
         conn = mysql_real_connect(conn, host, user, pwd, dbName, port, nullptr, 0);
+        if(conn) {
+            // 客户端库建的套接字不带CLOEXEC，平滑升级exec新进程时不能漏过去
+            fcntl(conn->net.fd, F_SETFD, FD_CLOEXEC);
+        }
         connQue_.emplace(conn);
     }
     MAX_CONN_ = connSize;
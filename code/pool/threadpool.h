@@ -7,13 +7,18 @@
 #include <functional>
 #include <thread>
 #include <assert.h>
+#include <vector>
+#include "affinity.h"
 
 class ThreadPool {
 
 public:
-    ThreadPool(int threadNumber = 8) : pool_(std::make_shared<Pool>()) {
+    // cpus非空时每个工作线程都绑定到这组CPU上
+    ThreadPool(int threadNumber = 8, const std::vector<int>& cpus = std::vector<int>())
+        : pool_(std::make_shared<Pool>()) {
         for(int i = 0; i < threadNumber; i++) {
-            std::thread([this]{
+            std::thread([this, cpus]{
+                CpuAffinity::PinSelf(cpus);
                 std::unique_lock<std::mutex> lock_(pool_ -> mtx_);
                 while(true) {
                     auto& tasks = pool_ -> tasks;
@@ -0,0 +1,104 @@
+#include "endpoint.h"
+
+#include <arpa/inet.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+Endpoint Endpoint::Any(int port) {
+    Endpoint ep;
+    memset(&ep.addr, 0, sizeof(ep.addr));
+    struct sockaddr_in* in = reinterpret_cast<struct sockaddr_in*>(&ep.addr);
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_ANY);
+    in->sin_port = htons(port);
+    ep.len = sizeof(struct sockaddr_in);
+    ep.text = ":" + std::to_string(port);
+    return ep;
+}
+
+static bool ParsePort_(const std::string& s, int* port) {
+    if(s.empty() || s.size() > 5 || s.find_first_not_of("0123456789") != std::string::npos) { return false; }
+    *port = atoi(s.c_str());
+    return *port > 0 && *port <= 65535;
+}
+
+bool Endpoint::Parse(const std::string& s, Endpoint* ep) {
+    memset(&ep->addr, 0, sizeof(ep->addr));
+    ep->text = s;
+    if(s.compare(0, 5, "unix:") == 0) {
+        std::string path = s.substr(5);
+        struct sockaddr_un* un = reinterpret_cast<struct sockaddr_un*>(&ep->addr);
+        if(path.empty() || path.size() >= sizeof(un->sun_path)) { return false; }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path.data(), path.size());
+        if(path[0] == '@') {
+            // 抽象命名空间：sun_path以'\0'开头，长度精确到名字结尾，不带结尾的'\0'
+            un->sun_path[0] = '\0';
+            ep->len = offsetof(struct sockaddr_un, sun_path) + path.size();
+        } else {
+            ep->len = sizeof(struct sockaddr_un);
+        }
+        return true;
+    }
+
+    int port;
+    if(s[0] == '[') {
+        size_t close = s.find("]:");
+        if(close == std::string::npos || !ParsePort_(s.substr(close + 2), &port)) { return false; }
+        struct sockaddr_in6* in6 = reinterpret_cast<struct sockaddr_in6*>(&ep->addr);
+        if(inet_pton(AF_INET6, s.substr(1, close - 1).c_str(), &in6->sin6_addr) != 1) { return false; }
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        ep->len = sizeof(struct sockaddr_in6);
+        return true;
+    }
+
+    size_t colon = s.rfind(':');
+    std::string host = colon == std::string::npos ? "" : s.substr(0, colon);
+    if(!ParsePort_(colon == std::string::npos ? s : s.substr(colon + 1), &port)) { return false; }
+    struct sockaddr_in* in = reinterpret_cast<struct sockaddr_in*>(&ep->addr);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    in->sin_addr.s_addr = htonl(INADDR_ANY);
+    if(!host.empty() && inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1) { return false; }
+    ep->len = sizeof(struct sockaddr_in);
+    return true;
+}
+
+bool Endpoint::ParseList(const std::string& list, int defaultPort, std::vector<Endpoint>* eps) {
+    eps->clear();
+    if(list.empty()) {
+        eps->push_back(Any(defaultPort));
+        return true;
+    }
+    size_t pos = 0;
+    while(pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if(end == std::string::npos) { end = list.size(); }
+        Endpoint ep;
+        if(!Parse(list.substr(pos, end - pos), &ep)) { return false; }
+        eps->push_back(ep);
+        pos = end + 1;
+    }
+    return true;
+}
+
+std::vector<std::vector<int>> Endpoint::GroupByAddress(const std::vector<int>& fds) {
+    std::vector<std::vector<int>> groups;
+    std::vector<std::pair<struct sockaddr_storage, socklen_t>> keys;
+    for(int fd: fds) {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+        if(getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len) < 0) { len = 0; }
+        size_t i = 0;
+        while(i < keys.size() && !(keys[i].second == len && memcmp(&keys[i].first, &addr, len) == 0)) { i++; }
+        if(i == keys.size()) {
+            keys.push_back(std::make_pair(addr, len));
+            groups.push_back(std::vector<int>());
+        }
+        groups[i].push_back(fd);
+    }
+    return groups;
+}
@@ -0,0 +1,37 @@
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+
+/*
+    监听地址，ServerOptions::listen里逗号分隔的每一项
+        1316 / :1316            IPv4任意地址（不配置时的默认行为）
+        127.0.0.1:1316          IPv4指定地址
+        [::]:1316               IPv6，关闭IPV6_V6ONLY即双栈，同一个套接字也接受IPv4连接
+        [::1]:1316              IPv6指定地址
+        unix:/run/blog.sock     UNIX域套接字，本机的负载均衡转发过来省掉回环TCP协议栈
+        unix:@blog              抽象命名空间的UNIX域套接字，不落盘，套接字关闭即消失
+*/
+struct Endpoint {
+    struct sockaddr_storage addr;
+    socklen_t len;
+    std::string text;       // 配置里的原始写法，用于日志
+
+    int Family() const { return addr.ss_family; }
+    bool IsUnix() const { return addr.ss_family == AF_UNIX; }
+
+    // IPv4任意地址上的port
+    static Endpoint Any(int port);
+    static bool Parse(const std::string& s, Endpoint* ep);
+    // 解析逗号分隔的列表，list为空时只有Any(defaultPort)
+    static bool ParseList(const std::string& list, int defaultPort, std::vector<Endpoint>* eps);
+
+    // 把继承来的监听fd按绑定的地址分组（同一地址的多个SO_REUSEPORT套接字在一组），保持原有顺序
+    static std::vector<std::vector<int>> GroupByAddress(const std::vector<int>& fds);
+};
+
+#endif //ENDPOINT_H
@@ -1,43 +1,96 @@
 #include "epoller.h"
 
-Epoller::Epoller(int maxEvent):epollFd_(epoll_create(512)), events_(maxEvent){
+Epoller::Epoller(int maxEvent, Backend backend):epollFd_(-1), maxEvents_(std::max(maxEvent, 1)),
+            batch_(std::min(maxEvents_, MIN_BATCH * 4)), shrinkCnt_(0), events_(batch_) {
+    if(backend == IO_URING) {
+        uring_.reset(new UringPoller(maxEvent));
+        if(!uring_->Init()) { uring_.reset(); }
+    }
+    if(!uring_) { epollFd_ = epoll_create1(EPOLL_CLOEXEC); }
     // assert(epollFd_ >= 0 && events_.size() > 0);
 }
 
 Epoller::~Epoller() {
-    close(epollFd_);
+    if(epollFd_ >= 0) { close(epollFd_); }
 }
 
-bool Epoller::AddFd(int fd, uint32_t events) {
+bool Epoller::AddFd(int fd, uint32_t events, uint32_t tag) {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = (static_cast<uint64_t>(tag) << 32) | static_cast<uint32_t>(fd);
+    if(uring_) { return uring_->AddFd(fd, events, ev.data.u64); }
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
 }
 
-bool Epoller::ModFd(int fd, uint32_t events) {
+bool Epoller::ModFd(int fd, uint32_t events, uint32_t tag) {
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = (static_cast<uint64_t>(tag) << 32) | static_cast<uint32_t>(fd);
+    if(uring_) { return uring_->ModFd(fd, events, ev.data.u64); }
     ev.events = events;
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
 
-bool Epoller::DelFd(int fd) {
+bool Epoller::DelFd(int fd, bool closing) {
     if(fd < 0) return false;
+    if(uring_) { return uring_->DelFd(fd, closing); }
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, 0);
 }
 
+bool Epoller::AddListenFd(int fd, uint32_t events) {
+    if(fd < 0) return false;
+    if(uring_) { return uring_->AddListenFd(fd, events, static_cast<uint32_t>(fd)); }
+    return AddFd(fd, events);
+}
+
+int Epoller::Accept(int listenFd, struct sockaddr_storage* addr) {
+    if(uring_) { return uring_->Accept(listenFd, addr); }
+    socklen_t len = sizeof(*addr);
+    return accept4(listenFd, reinterpret_cast<struct sockaddr*>(addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+ssize_t Epoller::Read(int fd, Buffer* buff, int* saveErrno) {
+    if(uring_) { return uring_->Read(fd, buff, saveErrno); }
+    return buff->ReadFd(fd, saveErrno);
+}
+
 // 返回事件数量
 int Epoller::Wait(int timeoutMs) {
-    return epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMs);
+    int n;
+    if(uring_) { n = uring_->Wait(&events_[0], batch_, timeoutMs); }
+    else { n = epoll_wait(epollFd_, &events_[0], batch_, timeoutMs); }
+    if(n > 0) { AdjustBatch_(n); }
+    return n;
+}
+
+// 批太小时高负载下一次唤醒处理不完就绪事件，要多进出内核几次；批太大则每次拷贝和遍历的数组变长
+void Epoller::AdjustBatch_(int n) {
+    if(n == batch_ && batch_ < maxEvents_) {
+        batch_ = std::min(batch_ * 2, maxEvents_);
+        if(events_.size() < static_cast<size_t>(batch_)) { events_.resize(batch_); }
+        shrinkCnt_ = 0;
+    }
+    else if(n < batch_ / 4 && batch_ > MIN_BATCH) {
+        if(++shrinkCnt_ >= SHRINK_AFTER) {
+            batch_ = std::max(batch_ / 2, MIN_BATCH);
+            shrinkCnt_ = 0;
+        }
+    }
+    else {
+        shrinkCnt_ = 0;
+    }
 }
 
 // 获取事件的fd
 int Epoller::GetEventFd(size_t i) const {
     // assert(i < events_.size() && i >= 0);
-    return events_[i].data.fd;
+    return static_cast<int>(events_[i].data.u64 & 0xffffffff);
+}
+
+// 获取事件的tag
+uint32_t Epoller::GetEventTag(size_t i) const {
+    return static_cast<uint32_t>(events_[i].data.u64 >> 32);
 }
 
 // 获取事件属性
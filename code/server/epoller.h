@@ -2,26 +2,56 @@
 #define EPOLLER_H
 
 #include <sys/epoll.h> //epoll_ctl()
+#include <sys/socket.h> // accept4()
 #include <unistd.h> // close()
 #include <assert.h> // close()
 #include <vector>
+#include <memory>
 #include <errno.h>
+#include <algorithm>
+
+#include "uringpoller.h"
 
 class Epoller {
 public:
-    explicit Epoller(int maxEvent = 1024);
+    // 事件后端：epoll，或基于io_uring的poll（内核不支持时自动退回epoll）
+    enum Backend { EPOLL, IO_URING };
+
+    // 每次Wait取回的事件数（批大小）随负载在[MIN_BATCH, maxEvent]之间调整：
+    // 一次取满就翻倍；连续SHRINK_AFTER次有事件的等待都不到四分之一就减半
+    explicit Epoller(int maxEvent = 1024, Backend backend = EPOLL);
     ~Epoller();
 
-    bool AddFd(int fd, uint32_t events);
-    bool ModFd(int fd, uint32_t events);
-    bool DelFd(int fd);
+    // tag随事件一起返回（存放在epoll_event.data的高32位），用于识别fd是否已被复用
+    bool AddFd(int fd, uint32_t events, uint32_t tag = 0);
+    bool ModFd(int fd, uint32_t events, uint32_t tag = 0);
+    // closing：fd接着就要关闭，io_uring后端同时丢掉已经收下但还没读走的数据
+    bool DelFd(int fd, bool closing = false);
     int Wait(int timeoutMs = -1);
+    // 监听套接字：io_uring后端用multishot accept，连接由Accept()从内核已经accept好的队列里取
+    bool AddListenFd(int fd, uint32_t events);
+    // 同accept4(SOCK_NONBLOCK | SOCK_CLOEXEC)；io_uring后端取到的连接addr->ss_family为AF_UNSPEC（没有对端地址）
+    int Accept(int listenFd, struct sockaddr_storage* addr);
+    // 读连接数据，约定同Buffer::ReadFd；io_uring后端从multishot recv收下的数据里取
+    ssize_t Read(int fd, Buffer* buff, int* saveErrno);
     int GetEventFd(size_t i) const;
+    uint32_t GetEventTag(size_t i) const;
     uint32_t GetEvents(size_t i) const;
+    Backend GetBackend() const { return uring_ ? IO_URING : EPOLL; }
+    int GetBatch() const { return batch_; }
         
 private:
+    void AdjustBatch_(int n);
+
+    static const int MIN_BATCH = 16;
+    static const int SHRINK_AFTER = 64;
+
     int epollFd_;
+    int maxEvents_;
+    int batch_;
+    int shrinkCnt_;
     std::vector<struct epoll_event> events_;    
+    std::unique_ptr<UringPoller> uring_;        // 非空时所有操作转给io_uring后端
 };
 
 #endif //EPOLLER_H
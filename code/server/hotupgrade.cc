@@ -0,0 +1,119 @@
+#include "hotupgrade.h"
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <fstream>
+#include <iterator>
+
+extern char** environ;
+
+static const unsigned int CLOSE_RANGE_CLOEXEC_ = 1u << 2;   // linux/close_range.h，旧的头文件里没有
+
+const char* HotUpgrade::LISTEN_FDS_ENV = "WEBSERVER_LISTEN_FDS";
+const char* HotUpgrade::READY_FD_ENV = "WEBSERVER_READY_FD";
+
+std::string HotUpgrade::ExePath() {
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if(len <= 0) { return std::string(); }
+    return std::string(path, len);
+}
+
+std::vector<int> HotUpgrade::InheritedListenFds() {
+    std::vector<int> fds;
+    const char* env = getenv(LISTEN_FDS_ENV);
+    if(!env) { return fds; }
+    const char* p = env;
+    while(*p) {
+        char* end = nullptr;
+        long fd = strtol(p, &end, 10);
+        if(end == p) { break; }
+        int listening = 0;
+        socklen_t len = sizeof(listening);
+        // 只接受确实处于监听状态的套接字
+        if(fd >= 0 && getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == 0 && listening) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fds.push_back(static_cast<int>(fd));
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    unsetenv(LISTEN_FDS_ENV);
+    return fds;
+}
+
+void HotUpgrade::NotifyReady() {
+    const char* env = getenv(READY_FD_ENV);
+    if(!env) { return; }
+    int fd = atoi(env);
+    unsetenv(READY_FD_ENV);
+    if(fd < 0) { return; }
+    char c = 1;
+    ssize_t ret = write(fd, &c, 1);
+    (void)ret;
+    close(fd);
+}
+
+pid_t HotUpgrade::Spawn(const std::string& exe, const std::vector<int>& listenFds, int* readyFd) {
+    // fork之后子进程只能调用async-signal-safe的函数，参数和环境变量都在fork之前准备好
+    std::vector<std::string> args;
+    std::ifstream cmdline("/proc/self/cmdline", std::ios::binary);
+    std::string raw((std::istreambuf_iterator<char>(cmdline)), std::istreambuf_iterator<char>());
+    for(size_t pos = 0; pos < raw.size(); ) {
+        size_t end = raw.find('\0', pos);
+        if(end == std::string::npos) { end = raw.size(); }
+        args.push_back(raw.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    if(args.empty()) { args.push_back(exe); }
+
+    int pipeFd[2];
+    if(pipe2(pipeFd, O_CLOEXEC) < 0) { return -1; }
+
+    std::vector<std::string> envs;
+    size_t listenLen = strlen(LISTEN_FDS_ENV), readyLen = strlen(READY_FD_ENV);
+    for(char** e = environ; *e; e++) {
+        if((strncmp(*e, LISTEN_FDS_ENV, listenLen) == 0 && (*e)[listenLen] == '=') ||
+            (strncmp(*e, READY_FD_ENV, readyLen) == 0 && (*e)[readyLen] == '=')) {
+            continue;
+        }
+        envs.push_back(*e);
+    }
+    std::string fdList;
+    for(int fd: listenFds) {
+        if(!fdList.empty()) { fdList += ","; }
+        fdList += std::to_string(fd);
+    }
+    envs.push_back(std::string(LISTEN_FDS_ENV) + "=" + fdList);
+    envs.push_back(std::string(READY_FD_ENV) + "=" + std::to_string(pipeFd[1]));
+
+    std::vector<char*> argv, envp;
+    for(auto& s: args) { argv.push_back(&s[0]); }
+    argv.push_back(nullptr);
+    for(auto& s: envs) { envp.push_back(&s[0]); }
+    envp.push_back(nullptr);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        // 子进程：监听fd和就绪管道写端去掉CLOEXEC，其余fd（包括所有客户端连接）exec时自动关闭
+        // 第三方库打开时没带CLOEXEC的fd也一起标上，只有监听fd和就绪管道带到新进程
+#ifdef SYS_close_range
+        syscall(SYS_close_range, 3u, ~0u, CLOSE_RANGE_CLOEXEC_);
+#endif
+        for(int fd: listenFds) { fcntl(fd, F_SETFD, 0); }
+        fcntl(pipeFd[1], F_SETFD, 0);
+        execve(exe.c_str(), argv.data(), envp.data());
+        _exit(127);
+    }
+    close(pipeFd[1]);
+    if(pid < 0) {
+        close(pipeFd[0]);
+        return -1;
+    }
+    *readyFd = pipeFd[0];
+    return pid;
+}
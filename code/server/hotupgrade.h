@@ -0,0 +1,34 @@
+#ifndef HOTUPGRADE_H
+#define HOTUPGRADE_H
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+/*
+    平滑升级（不停机替换二进制）
+    1. 旧进程收到SIGUSR2后fork+exec可执行文件，监听fd直接继承给新进程，
+       fd列表放在环境变量WEBSERVER_LISTEN_FDS里（逗号分隔）
+    2. 新进程沿用继承来的监听套接字，不重新bind，accept队列里的连接不会丢
+    3. 新进程开始事件循环前往WEBSERVER_READY_FD写一个字节，旧进程收到后才停止accept并排空连接；
+       新进程启动失败（exec失败、初始化出错）时管道直接EOF，旧进程继续服务
+*/
+class HotUpgrade {
+public:
+    static const char* LISTEN_FDS_ENV;
+    static const char* READY_FD_ENV;
+
+    // 当前可执行文件的绝对路径，启动时解析；升级时按路径exec，拿到的是替换后的新文件
+    static std::string ExePath();
+
+    // 新进程：取出继承来的监听fd（不是升级启动则为空），并清掉环境变量
+    static std::vector<int> InheritedListenFds();
+
+    // 新进程：通知旧进程已经就绪
+    static void NotifyReady();
+
+    // 旧进程：启动新进程，返回子进程pid，失败返回-1；*readyFd为就绪管道的读端
+    static pid_t Spawn(const std::string& exe, const std::vector<int>& listenFds, int* readyFd);
+};
+
+#endif //HOTUPGRADE_H
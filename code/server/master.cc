@@ -0,0 +1,357 @@
+#include "master.h"
+
+#include <sys/signalfd.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <algorithm>
+#include <new>
+
+Master::Master(int port, bool OptLinger, bool openLog, int logLevel, const ServerOptions& options):
+            port_(port), openLinger_(OptLinger), openLog_(openLog), logLevel_(logLevel), options_(options),
+            slots_(nullptr), signalFd_(-1), stopping_(false), stopSignal_(0),
+            exePath_(HotUpgrade::ExePath()), upgradePid_(-1), upgradeReadyFd_(-1)
+{
+    sigemptyset(&oldMask_);
+    if(options_.workerProcesses < 1) { options_.workerProcesses = 1; }
+    if(options_.reactorNum < 1) { options_.reactorNum = 1; }
+}
+
+Master::~Master() {
+    for(int fd: listenFds_) { close(fd); }
+    if(signalFd_ >= 0) { close(signalFd_); }
+    if(upgradeReadyFd_ >= 0) { close(upgradeReadyFd_); }
+    if(slots_) { munmap(slots_, sizeof(StatsSlot) * workers_.size()); }
+}
+
+int Master::Run(const WorkerMain& workerMain) {
+    workerMain_ = workerMain;
+    // master不创建日志线程：fork时只有一个线程，worker里的锁和单例都是干净的
+    if(openLog_) {
+        Log::Instance()->init(logLevel_, "./log", ".log", 0);
+    }
+    LOG_INFO("========== Master init ==========");
+    LOG_INFO("Master pid: %d, worker processes: %d, reactor num: %d",
+                    getpid(), options_.workerProcesses, options_.reactorNum);
+
+    // 信号全部通过signalfd同步处理；worker恢复成不屏蔽
+    // （平滑升级启动的新master是从屏蔽了这些信号的旧master exec来的，不能直接沿用继承的屏蔽字）
+    sigset_t mask;
+    sigemptyset(&mask);
+    for(int sig: {SIGCHLD, SIGQUIT, SIGTERM, SIGINT, SIGUSR2}) { sigaddset(&mask, sig); }
+    sigprocmask(SIG_BLOCK, &mask, &oldMask_);
+    for(int sig: {SIGCHLD, SIGQUIT, SIGTERM, SIGINT, SIGUSR2}) { sigdelset(&oldMask_, sig); }
+    signalFd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(signalFd_ < 0) {
+        LOG_ERROR("Master signalfd error: %s", strerror(errno));
+        return 1;
+    }
+
+    workers_.resize(options_.workerProcesses);
+    for(auto& w: workers_) {
+        w.pid = -1;
+        w.failures = 0;
+    }
+    if(!InitListen_()) {
+        LOG_ERROR("========== Master init error! ==========");
+        return 1;
+    }
+
+    void* shm = mmap(nullptr, sizeof(StatsSlot) * workers_.size(), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shm == MAP_FAILED) {
+        LOG_WARN("Master stats mmap error: %s, stats disabled", strerror(errno));
+    } else {
+        slots_ = static_cast<StatsSlot*>(shm);
+        for(size_t i = 0; i < workers_.size(); i++) { new (&slots_[i]) StatsSlot(); }
+    }
+
+    for(size_t i = 0; i < workers_.size(); i++) {
+        Spawn_(i);
+    }
+    HotUpgrade::NotifyReady();  // 由旧master平滑升级启动时，通知它可以让旧worker排空了
+    nextStats_ = Clock::now() + MS(options_.statsIntervalMs);
+
+    while(!stopping_ || AliveWorkers_() > 0) {
+        struct pollfd fds[2] = {{signalFd_, POLLIN, 0}, {upgradeReadyFd_, POLLIN, 0}};
+        int nfds = upgradeReadyFd_ >= 0 ? 2 : 1;
+        int ret = poll(fds, nfds, NextTimeout_());
+        if(ret < 0 && errno != EINTR) {
+            LOG_ERROR("Master poll error: %s", strerror(errno));
+            break;
+        }
+        if(ret > 0 && (fds[0].revents & POLLIN)) {
+            struct signalfd_siginfo info;
+            while(read(signalFd_, &info, sizeof(info)) == sizeof(info)) {
+                switch(info.ssi_signo) {
+                case SIGCHLD:
+                    Reap_();
+                    break;
+                case SIGUSR2:
+                    StartUpgrade_();
+                    break;
+                default:
+                    Stop_(info.ssi_signo);
+                    break;
+                }
+            }
+        }
+        if(ret > 0 && nfds > 1 && fds[1].revents) {
+            OnUpgradeReady_();
+        }
+        if(!stopping_) {
+            TimeStamp now = Clock::now();
+            for(size_t i = 0; i < workers_.size(); i++) {
+                if(workers_[i].pid < 0 && now >= workers_[i].respawnTime) { Spawn_(i); }
+            }
+        }
+        if(options_.statsIntervalMs > 0 && Clock::now() >= nextStats_) {
+            LogStats_();
+            nextStats_ = Clock::now() + MS(options_.statsIntervalMs);
+        }
+    }
+    if(options_.statsIntervalMs > 0) { LogStats_(); }
+    LOG_INFO("========== Master exit ==========");
+    return 0;
+}
+
+/* 创建监听套接字并分给各worker */
+bool Master::InitListen_() {
+    std::vector<Endpoint> endpoints;
+    if(!Endpoint::ParseList(options_.listen, port_, &endpoints)) {
+        LOG_ERROR("Listen \"%s\" error!", options_.listen.c_str());
+        return false;
+    }
+    if(options_.listen.empty() && (port_ > 65535 || port_ < 1024)) {
+        LOG_ERROR("Port:%d error!",  port_);
+        return false;
+    }
+    size_t n = workers_.size();
+
+    // 平滑升级启动：沿用旧master的监听套接字，按绑定地址分组，每组按原样轮流分给各worker
+    std::vector<int> inherited = HotUpgrade::InheritedListenFds();
+    if(!inherited.empty()) {
+        listenFds_ = inherited;
+        for(auto& group: Endpoint::GroupByAddress(inherited)) {
+            if(group.size() > 1 && group.size() % n != 0) {
+                LOG_WARN("Inherited %zu listen fds of one address for %zu workers", group.size(), n);
+            }
+            for(size_t i = 0; i < n; i++) {
+                if(group.size() < n) {
+                    workers_[i].listenFds.push_back(group[i % group.size()]);
+                    continue;
+                }
+                for(size_t j = i; j < group.size(); j += n) {
+                    workers_[i].listenFds.push_back(group[j]);
+                }
+            }
+        }
+        LOG_INFO("Master %zu listen fds inherited", inherited.size());
+        return true;
+    }
+
+    for(const Endpoint& ep: endpoints) {
+        if(options_.reusePort && !ep.IsUnix()) {
+            // 每个worker的每个Reactor一个SO_REUSEPORT套接字，内核按四元组哈希分配连接
+            for(size_t i = 0; i < n; i++) {
+                for(int j = 0; j < options_.reactorNum; j++) {
+                    int fd = WebServer::CreateListenFd(ep, openLinger_, true, options_);
+                    if(fd < 0) { return false; }
+                    listenFds_.push_back(fd);
+                    workers_[i].listenFds.push_back(fd);
+                }
+            }
+        } else {
+            // 所有worker共享一个fd，worker里发现不是SO_REUSEPORT会用EPOLLEXCLUSIVE注册
+            int fd = WebServer::CreateListenFd(ep, openLinger_, false, options_);
+            if(fd < 0) { return false; }
+            listenFds_.push_back(fd);
+            for(auto& w: workers_) { w.listenFds.push_back(fd); }
+        }
+        LOG_INFO("Master listen on %s, %s", ep.text.c_str(),
+                        options_.reusePort && !ep.IsUnix() ? "SO_REUSEPORT" : "shared");
+    }
+    return true;
+}
+
+bool Master::Spawn_(size_t idx) {
+    Worker& w = workers_[idx];
+    pid_t pid = fork();
+    if(pid < 0) {
+        LOG_ERROR("Fork worker %zu error: %s", idx, strerror(errno));
+        w.respawnTime = Clock::now() + MS(RESPAWN_MIN_MS);
+        return false;
+    }
+    if(pid == 0) {
+        RunWorker_(idx);    // 不返回
+    }
+    w.pid = pid;
+    w.startTime = Clock::now();
+    LOG_INFO("Worker %zu started, pid %d", idx, pid);
+    return true;
+}
+
+// worker进程：整理好继承来的状态后运行WebServer
+void Master::RunWorker_(size_t idx) {
+    const Worker& w = workers_[idx];
+    close(signalFd_);
+    if(upgradeReadyFd_ >= 0) { close(upgradeReadyFd_); }
+    if(const char* ready = getenv(HotUpgrade::READY_FD_ENV)) {
+        close(atoi(ready));     // 旧master的就绪管道只能由master写
+        unsetenv(HotUpgrade::READY_FD_ENV);
+    }
+    for(int fd: listenFds_) {
+        if(std::find(w.listenFds.begin(), w.listenFds.end(), fd) == w.listenFds.end()) { close(fd); }
+    }
+    std::string fdList;
+    for(int fd: w.listenFds) {
+        if(!fdList.empty()) { fdList += ","; }
+        fdList += std::to_string(fd);
+    }
+    setenv(HotUpgrade::LISTEN_FDS_ENV, fdList.c_str(), 1);
+
+    sigprocmask(SIG_SETMASK, &oldMask_, nullptr);
+    prctl(PR_SET_PDEATHSIG, SIGQUIT);   // master意外退出时worker排空后跟着退出
+
+    ServerOptions options = options_;
+    options.workerProcesses = 0;
+    options.hotUpgrade = false;
+    options.workerIndex = static_cast<int>(idx);
+    options.statsSlot = slots_ ? &slots_[idx] : nullptr;
+    workerMain_(options);
+    exit(0);
+}
+
+// 回收退出的子进程，worker按退避间隔安排重启
+void Master::Reap_() {
+    int status;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if(pid == upgradePid_) {
+            LOG_ERROR("Hot upgrade: new master %d exited, keep serving", pid);
+            upgradePid_ = -1;
+            continue;
+        }
+        size_t idx = 0;
+        while(idx < workers_.size() && workers_[idx].pid != pid) { idx++; }
+        if(idx == workers_.size()) { continue; }
+
+        Worker& w = workers_[idx];
+        w.pid = -1;
+        if(slots_) {
+            retired_.Merge(slots_[idx].Read());
+            slots_[idx].Publish(StatsSnapshot());
+        }
+        if(WIFSIGNALED(status)) {
+            LOG_ERROR("Worker %zu (pid %d) killed by signal %d", idx, pid, WTERMSIG(status));
+        } else if(!stopping_ || WEXITSTATUS(status) != 0) {
+            LOG_WARN("Worker %zu (pid %d) exited, status %d", idx, pid, WEXITSTATUS(status));
+        } else {
+            LOG_INFO("Worker %zu (pid %d) exited", idx, pid);
+        }
+        if(stopping_) { continue; }
+
+        TimeStamp now = Clock::now();
+        w.failures = (now - w.startTime < MS(RESPAWN_MIN_MS)) ? w.failures + 1 : 0;
+        int delay = 0;
+        if(w.failures > 0) {
+            delay = std::min(RESPAWN_MIN_MS << std::min(w.failures - 1, 5), RESPAWN_MAX_MS);
+        }
+        w.respawnTime = now + MS(delay);
+        LOG_INFO("Worker %zu respawn in %d ms", idx, delay);
+    }
+}
+
+// SIGQUIT让worker排空退出，SIGTERM/SIGINT直接结束worker；排空过程中再收到TERM可以升级为立即结束
+void Master::Stop_(int sig) {
+    int forward = (sig == SIGQUIT) ? SIGQUIT : SIGTERM;
+    if(stopping_ && stopSignal_ == forward) { return; }
+    LOG_INFO("Master got signal %d, %s workers", sig, forward == SIGQUIT ? "draining" : "stopping");
+    stopping_ = true;
+    stopSignal_ = forward;
+    for(auto& w: workers_) {
+        if(w.pid > 0) { kill(w.pid, forward); }
+    }
+    if(upgradeReadyFd_ >= 0) {
+        // 升级还没就绪就要退出：新master也一起结束
+        kill(upgradePid_, SIGTERM);
+        close(upgradeReadyFd_);
+        upgradeReadyFd_ = -1;
+    }
+    // worker各自持有监听fd，master这份不再需要
+    for(int fd: listenFds_) { close(fd); }
+    listenFds_.clear();
+}
+
+void Master::StartUpgrade_() {
+    if(stopping_ || upgradePid_ > 0) {
+        LOG_WARN("Hot upgrade already in progress");
+        return;
+    }
+    if(exePath_.empty()) {
+        LOG_ERROR("Hot upgrade: executable path unknown");
+        return;
+    }
+    int readyFd = -1;
+    pid_t pid = HotUpgrade::Spawn(exePath_, listenFds_, &readyFd);
+    if(pid < 0) {
+        LOG_ERROR("Hot upgrade: spawn %s error: %s", exePath_.c_str(), strerror(errno));
+        return;
+    }
+    upgradePid_ = pid;
+    upgradeReadyFd_ = readyFd;
+    LOG_INFO("Hot upgrade: new master %d started, waiting for ready", pid);
+}
+
+void Master::OnUpgradeReady_() {
+    char c;
+    ssize_t n = read(upgradeReadyFd_, &c, 1);
+    close(upgradeReadyFd_);
+    upgradeReadyFd_ = -1;
+    if(n != 1) {
+        LOG_ERROR("Hot upgrade: new master %d failed, keep serving", upgradePid_);
+        return;     // 子进程由Reap_回收
+    }
+    LOG_INFO("Hot upgrade: new master %d ready, draining workers", upgradePid_);
+    upgradePid_ = -1;
+    Stop_(SIGQUIT);
+}
+
+// 汇总各worker共享内存里的计数器，加上已退出worker的部分
+void Master::LogStats_() {
+    StatsSnapshot total = retired_;
+    if(slots_) {
+        for(size_t i = 0; i < workers_.size(); i++) {
+            if(workers_[i].pid > 0) { total.Merge(slots_[i].Read()); }
+        }
+    }
+    LOG_INFO("Stats: workers %d/%zu alive", AliveWorkers_(), workers_.size());
+    WebServer::LogStats(total);
+}
+
+// poll的超时：最近一个待重启的worker或下一次写统计日志，向上取整到毫秒
+int Master::NextTimeout_() const {
+    int timeout = -1;
+    TimeStamp now = Clock::now();
+    auto until = [&](const TimeStamp& t) {
+        long long us = std::chrono::duration_cast<std::chrono::microseconds>(t - now).count();
+        int ms = us > 0 ? static_cast<int>((us + 999) / 1000) : 0;
+        if(timeout < 0 || ms < timeout) { timeout = ms; }
+    };
+    if(!stopping_) {
+        for(const auto& w: workers_) {
+            if(w.pid < 0) { until(w.respawnTime); }
+        }
+    }
+    if(options_.statsIntervalMs > 0) { until(nextStats_); }
+    return timeout;
+}
+
+int Master::AliveWorkers_() const {
+    int alive = 0;
+    for(const auto& w: workers_) {
+        if(w.pid > 0) { alive++; }
+    }
+    return alive;
+}
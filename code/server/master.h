@@ -0,0 +1,82 @@
+#ifndef MASTER_H
+#define MASTER_H
+
+#include <sys/types.h>
+#include <signal.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "webserver.h"
+
+/*
+    prefork多进程模式的master进程
+    1. master绑定监听端口，fork出workerProcesses个worker进程，每个worker运行一个完整的WebServer，
+       监听fd通过WEBSERVER_LISTEN_FDS交给worker（和平滑升级同一条路径），worker不重新bind
+       reusePort时每个worker一组SO_REUSEPORT套接字，否则所有worker共享一个fd并用EPOLLEXCLUSIVE
+       监听地址和单进程一样由ServerOptions::listen配置，UNIX域套接字总是所有worker共享
+    2. worker异常退出（崩溃、被kill）后自动重启，启动不到1秒就退出的按退避间隔重启，避免疯狂fork
+    3. 各worker把计数器发布到共享内存，master按statsIntervalMs汇总写日志，已退出worker的计数累计保留
+    4. 信号：kill -QUIT 各worker排空后退出；kill -TERM/-INT 立即停止；
+       kill -USR2 启动新的master（带着监听fd），新master的worker就绪后旧worker排空退出
+    master本身不处理连接，也不创建线程，日志用同步方式，fork出的worker再按自己的配置重新初始化日志
+*/
+class Master {
+public:
+    // 在worker进程里运行的函数：用传入的选项构造WebServer并Start()
+    typedef std::function<void(const ServerOptions&)> WorkerMain;
+
+    Master(int port, bool OptLinger, bool openLog, int logLevel, const ServerOptions& options);
+    ~Master();
+
+    // 运行到所有worker退出为止，返回进程退出码
+    int Run(const WorkerMain& workerMain);
+
+private:
+    struct Worker {
+        pid_t pid;
+        std::vector<int> listenFds;
+        TimeStamp startTime;
+        TimeStamp respawnTime;  // pid < 0 时，到这个时间重启
+        int failures;           // 连续快速退出的次数，决定退避间隔
+    };
+
+    bool InitListen_();
+    bool Spawn_(size_t idx);
+    void RunWorker_(size_t idx);
+    void Reap_();
+    void Stop_(int sig);
+    void StartUpgrade_();
+    void OnUpgradeReady_();
+    void LogStats_();
+    int NextTimeout_() const;
+    int AliveWorkers_() const;
+
+    static const int RESPAWN_MIN_MS = 1000;     // 存活不到这个时间就退出算一次快速失败
+    static const int RESPAWN_MAX_MS = 30000;    // 退避间隔上限
+
+    int port_;
+    bool openLinger_;
+    bool openLog_;
+    int logLevel_;
+    ServerOptions options_;
+    WorkerMain workerMain_;
+
+    std::vector<Worker> workers_;
+    std::vector<int> listenFds_;    // 所有worker的监听fd，平滑升级时整体交给新master
+
+    StatsSlot* slots_;              // 共享内存，每个worker一个槽
+    StatsSnapshot retired_;         // 已退出worker最后一次发布的计数
+    TimeStamp nextStats_;
+
+    int signalFd_;
+    sigset_t oldMask_;
+    bool stopping_;
+    int stopSignal_;
+
+    std::string exePath_;
+    pid_t upgradePid_;
+    int upgradeReadyFd_;
+};
+
+#endif //MASTER_H
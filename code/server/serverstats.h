@@ -0,0 +1,130 @@
+#ifndef SERVERSTATS_H
+#define SERVERSTATS_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+    服务器运行计数器
+    每个Reactor一份ServerStats，只由处理该Reactor连接的线程relaxed累加，互不争用
+    需要汇总时把各Reactor的计数累加到StatsSnapshot里
+    新增计数器只需要在SERVER_STATS_FIELDS里加一行
+*/
+#define SERVER_STATS_FIELDS(X) \
+    X(acceptWakeups,    "监听套接字就绪处理次数") \
+    X(accepted,         "accept成功的连接数") \
+    X(acceptBudgetHits, "单次唤醒用完accept预算") \
+    X(acceptQueueFull,  "用完预算时accept队列已满") \
+    X(acceptErrors,     "accept失败(EMFILE等)") \
+    X(incomingCpuMiss,  "开启incomingCpu时，网卡软中断CPU与Reactor所在CPU不一致的新连接") \
+    X(connRebuilt,      "fd槽跨NUMA节点复用时重新构造的连接对象") \
+    X(acceptPauses,     "连接数达到上限，监听fd移出Epoller的次数") \
+    X(shedConns,        "连接数超限时回503关闭的新连接") \
+    X(shedRequests,     "在途请求超限时回503的请求") \
+    X(inlineProcess,    "在Reactor线程上直接处理的请求") \
+    X(poolProcess,      "交给线程池处理的请求") \
+    X(poolWrite,        "交给线程池发送的大响应") \
+    X(requests,         "处理的请求数") \
+    X(responseBatches,  "一次writev发出的响应批数，requests/responseBatches为平均流水线深度") \
+    X(reusedRequests,   "在已经处理过请求的连接上的请求，reusedRequests/requests为连接复用率") \
+    X(maxRequestCloses, "达到每连接请求数上限后关闭的连接") \
+    X(idleCloses,       "空闲超时关闭的连接") \
+    X(wakeups,          "取到事件的Wait次数") \
+    X(events,           "取到的事件总数") \
+    X(spinWaits,        "低延迟模式下先自旋再阻塞的等待次数") \
+    X(spinHits,         "自旋期间就等到了事件的次数") \
+    X(rearms,           "连接建立后重新注册事件的次数(epoll_ctl/POLL_ADD)")
+
+// 只取最大值的计数器
+#define SERVER_STATS_MAX_FIELDS(X) \
+    X(acceptMaxBatch,   "单次唤醒accept的最大连接数") \
+    X(eventBatchMax,    "Epoller事件批大小达到的最大值")
+
+struct StatsSnapshot {
+#define STATS_DECLARE_(name, desc) uint64_t name = 0;
+    SERVER_STATS_FIELDS(STATS_DECLARE_)
+    SERVER_STATS_MAX_FIELDS(STATS_DECLARE_)
+#undef STATS_DECLARE_
+
+    // 生成 name=value 形式的一行，用于日志
+    std::string ToString() const {
+        std::string s;
+        char buf[64];
+#define STATS_FORMAT_(name, desc) \
+        snprintf(buf, sizeof(buf), "%s=%llu ", #name, (unsigned long long)name); \
+        s += buf;
+        SERVER_STATS_FIELDS(STATS_FORMAT_)
+        SERVER_STATS_MAX_FIELDS(STATS_FORMAT_)
+#undef STATS_FORMAT_
+        return s;
+    }
+
+    // 合并另一个快照（prefork时master汇总各worker）
+    void Merge(const StatsSnapshot& other) {
+#define STATS_MERGE_(name, desc) name += other.name;
+        SERVER_STATS_FIELDS(STATS_MERGE_)
+#undef STATS_MERGE_
+#define STATS_MERGE_MAX_(name, desc) if(other.name > name) { name = other.name; }
+        SERVER_STATS_MAX_FIELDS(STATS_MERGE_MAX_)
+#undef STATS_MERGE_MAX_
+    }
+};
+
+/*
+    放在进程间共享内存里的计数器槽（prefork模式每个worker一个）
+    worker单写、master只读，用seqlock：写之前序号变奇数，写完变偶数，读到奇数或前后不一致就重读
+*/
+struct StatsSlot {
+    std::atomic<uint32_t> seq{0};
+    StatsSnapshot snap;
+
+    void Publish(const StatsSnapshot& s) {
+        seq.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        snap = s;
+        seq.fetch_add(1, std::memory_order_release);
+    }
+
+    StatsSnapshot Read() const {
+        StatsSnapshot s;
+        uint32_t begin, end;
+        do {
+            begin = seq.load(std::memory_order_acquire);
+            s = snap;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            end = seq.load(std::memory_order_relaxed);
+        } while((begin & 1) || begin != end);
+        return s;
+    }
+};
+
+struct ServerStats {
+#define STATS_DECLARE_(name, desc) std::atomic<uint64_t> name{0};
+    SERVER_STATS_FIELDS(STATS_DECLARE_)
+    SERVER_STATS_MAX_FIELDS(STATS_DECLARE_)
+#undef STATS_DECLARE_
+
+    static void Add(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void Max(std::atomic<uint64_t>& counter, uint64_t n) {
+        uint64_t cur = counter.load(std::memory_order_relaxed);
+        while(n > cur && !counter.compare_exchange_weak(cur, n, std::memory_order_relaxed)) {}
+    }
+
+    // 累加到快照
+    void MergeInto(StatsSnapshot& snap) const {
+#define STATS_MERGE_(name, desc) snap.name += name.load(std::memory_order_relaxed);
+        SERVER_STATS_FIELDS(STATS_MERGE_)
+#undef STATS_MERGE_
+#define STATS_MERGE_MAX_(name, desc) \
+        if(name.load(std::memory_order_relaxed) > snap.name) { snap.name = name.load(std::memory_order_relaxed); }
+        SERVER_STATS_MAX_FIELDS(STATS_MERGE_MAX_)
+#undef STATS_MERGE_MAX_
+    }
+};
+
+#endif //SERVERSTATS_H
@@ -0,0 +1,684 @@
+#include "uringpoller.h"
+
+#include <string.h>     // memset
+#include <fcntl.h>      // FD_CLOEXEC
+#include <time.h>
+#include <algorithm>
+
+#include "../log/log.h"
+
+static const uint32_t POLL_MASK = EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+
+UringPoller::UringPoller(unsigned entries)
+    : ringFd_(-1), entries_(entries), sqRing_(MAP_FAILED), sqRingSize_(0), sqes_(nullptr),
+      sqesSize_(0), sqLocalTail_(0), pending_(0), cqRing_(MAP_FAILED), cqRingSize_(0),
+      bufRing_(nullptr), bufBase_(nullptr), bufMemSize_(0), bufTail_(0), recvOk_(false), waitGen_(0) {}
+
+UringPoller::~UringPoller() {
+    for(Acceptor& acc: acceptors_) {
+        for(int fd: acc.accepted) { close(fd); }
+    }
+    if(sqes_) { munmap(sqes_, sqesSize_); }
+    if(cqRing_ != MAP_FAILED && cqRing_ != sqRing_) { munmap(cqRing_, cqRingSize_); }
+    if(sqRing_ != MAP_FAILED) { munmap(sqRing_, sqRingSize_); }
+    if(ringFd_ >= 0) { close(ringFd_); }
+    if(bufRing_) { munmap(bufRing_, bufMemSize_); }
+}
+
+bool UringPoller::Init() {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringFd_ = syscall(__NR_io_uring_setup, entries_, &p);
+    if(ringFd_ < 0) {
+        return false;
+    }
+    fcntl(ringFd_, F_SETFD, FD_CLOEXEC);
+    // 需要：等待时带超时参数(EXT_ARG)、CQ不丢事件(NODROP)
+    if(!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+        return false;
+    }
+
+    sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(singleMmap) {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ringFd_, IORING_OFF_SQ_RING);
+    if(sqRing_ == MAP_FAILED) { return false; }
+    if(singleMmap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ringFd_, IORING_OFF_CQ_RING);
+        if(cqRing_ == MAP_FAILED) { return false; }
+    }
+
+    sqesSize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ringFd_, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) { return false; }
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    sqLocalTail_ = *sqTail_;
+    entries_ = p.sq_entries;
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    recvOk_ = InitBufRing_();
+    return true;
+}
+
+// provided buffer ring和multishot accept都是5.19加入的，注册失败就都不用，只做poll
+bool UringPoller::InitBufRing_() {
+    size_t ringSize = RECV_BUFS * sizeof(struct io_uring_buf);
+    bufMemSize_ = ringSize + RECV_BUFS * RECV_BUF_SIZE;
+    void* mem = mmap(nullptr, bufMemSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) { return false; }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(mem);
+    reg.ring_entries = RECV_BUFS;
+    reg.bgid = BUF_GROUP;
+    if(syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(mem, bufMemSize_);
+        return false;
+    }
+    bufRing_ = static_cast<struct io_uring_buf_ring*>(mem);
+    bufBase_ = static_cast<char*>(mem) + ringSize;
+    for(unsigned i = 0; i < RECV_BUFS; i++) {
+        Recycle_(static_cast<uint16_t>(i));
+    }
+    return true;
+}
+
+bool UringPoller::AddFd(int fd, uint32_t events, uint64_t data) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    return Register_(fd, events, data);
+}
+
+bool UringPoller::ModFd(int fd, uint32_t events, uint64_t data) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    return Register_(fd, events, data);
+}
+
+// 持有mtx_时调用
+bool UringPoller::Register_(int fd, uint32_t events, uint64_t data) {
+    // fd已经换成了另一个连接（调用者没有用closing摘下旧连接），旧连接收下的数据不能交给它
+    if(static_cast<size_t>(fd) < fds_.size() && fds_[fd].recvOn && fds_[fd].data != data) {
+        DropRecv_(fd);
+    }
+    Disarm_(fd);
+    Arm_(fd, events, data);     // 拿不到SQE时注册仍然有效，下一次Wait补提交
+    // 摘下期间recv收到的数据不会再有完成事件，直接报告（相当于EPOLL_CTL_ADD检查当前就绪状态）
+    if((events & EPOLLIN) && InputPending_(fds_[fd])) {
+        ready_.push_back(fd);
+        if(!FromLoopThread_()) { Nop_(); }
+    }
+    if(!FromLoopThread_()) { return Flush_(); }
+    return true;
+}
+
+bool UringPoller::DelFd(int fd, bool closing) {
+    if(fd < 0) return false;
+    std::lock_guard<std::mutex> locker(mtx_);
+    int idx = FindAcceptor_(fd);
+    if(idx >= 0 && acceptors_[idx].registered) {
+        // 取消前已经accept的连接留在队列里，重新注册时报告
+        Acceptor& acc = acceptors_[idx];
+        acc.registered = false;
+        if(acc.armed) {
+            Cancel_(ACCEPT_DATA | (static_cast<uint64_t>(acc.seq) << 32) | static_cast<uint32_t>(idx));
+            acc.armed = false;
+        }
+        acc.seq = (acc.seq + 1) & SEQ_MASK;
+    } else {
+        Disarm_(fd);
+        if(closing) { DropRecv_(fd); }
+    }
+    if(!FromLoopThread_()) { return Flush_(); }
+    return true;
+}
+
+bool UringPoller::AddListenFd(int fd, uint32_t events, uint64_t data) {
+    if(fd < 0) return false;
+    if(!bufRing_) { return AddFd(fd, events, data); }
+    std::lock_guard<std::mutex> locker(mtx_);
+    int idx = FindAcceptor_(fd);
+    if(idx < 0) {
+        idx = acceptors_.size();
+        acceptors_.emplace_back();
+        acceptors_[idx].fd = fd;
+    }
+    Acceptor& acc = acceptors_[idx];
+    acc.data = data;
+    acc.registered = true;
+    acc.err = 0;
+    if(!acc.armed) { ArmAccept_(idx); }
+    if(!acc.accepted.empty()) {
+        ready_.push_back(ACCEPT_DATA | static_cast<uint32_t>(idx));
+    }
+    if(!FromLoopThread_()) { return Flush_(); }
+    return true;
+}
+
+int UringPoller::Accept(int listenFd, struct sockaddr_storage* addr) {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        int idx = FindAcceptor_(listenFd);
+        if(idx >= 0) {
+            Acceptor& acc = acceptors_[idx];
+            if(!acc.accepted.empty()) {
+                int fd = acc.accepted.front();
+                acc.accepted.pop_front();
+                memset(addr, 0, sizeof(*addr));
+                addr->ss_family = AF_UNSPEC;
+                return fd;
+            }
+            int err = EAGAIN;
+            if(acc.err) {
+                // 错误（如EMFILE）报告一次；调用者没有因此摘下监听fd就重新注册
+                err = acc.err;
+                acc.err = 0;
+                if(acc.registered && !acc.armed) { ArmAccept_(idx); }
+            }
+            errno = err;
+            return -1;
+        }
+    }
+    socklen_t len = sizeof(*addr);
+    return accept4(listenFd, reinterpret_cast<struct sockaddr*>(addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+/*
+    已改用recv：把收下的数据拷进buff并归还buffer，没有数据时按recv的结果返回EAGAIN/0/错误，不进内核
+    还没改用recv或者recv被内核结束了（buffer用完等）：readv，读到EAGAIN时套接字已经读空，这时注册recv
+    不会和readv争抢同一段数据
+*/
+ssize_t UringPoller::Read(int fd, Buffer* buff, int* saveErrno) {
+    if(fd < 0) {
+        *saveErrno = EBADF;
+        return -1;
+    }
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(static_cast<size_t>(fd) < fds_.size() && fds_[fd].recvOn) {
+            FdState& st = fds_[fd];
+            if(!st.chunks.empty()) {
+                size_t len = 0;
+                for(const Chunk& c: st.chunks) {
+                    buff->Append(bufBase_ + static_cast<size_t>(c.bid) * RECV_BUF_SIZE, c.len);
+                    Recycle_(c.bid);
+                    len += c.len;
+                }
+                st.chunks.clear();
+                return static_cast<ssize_t>(len);
+            }
+            if(st.err) {
+                *saveErrno = st.err;
+                return -1;
+            }
+            if(st.eof) { return 0; }
+            if(st.recvArmed) {
+                *saveErrno = EAGAIN;
+                return -1;
+            }
+        }
+    }
+    ssize_t len = buff->ReadFd(fd, saveErrno);
+    if(len < 0 && *saveErrno == EAGAIN) {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(recvOk_) {
+            ArmRecv_(fd);
+            if(!FromLoopThread_()) { Flush_(); }
+        }
+    }
+    return len;
+}
+
+// 提交攒下的SQE并等待事件，一次io_uring_enter完成原来的多次epoll_ctl + epoll_wait
+int UringPoller::Wait(struct epoll_event* events, int maxEvents, int timeoutMs) {
+    unsigned toSubmit;
+    bool ready;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        loopThread_ = std::this_thread::get_id();
+        Retry_();
+        // pending_在调用返回后按实际提交数扣减，期间工作线程Flush_也只扣自己提交的
+        toSubmit = pending_;
+        ready = !ready_.empty();
+        if((!retry_.empty() || !cancels_.empty()) && (timeoutMs < 0 || timeoutMs > RETRY_MS)) {
+            timeoutMs = RETRY_MS;
+        }
+    }
+
+    // CQ里已有事件就不再阻塞
+    ready = ready || *cqHead_ != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    bool block = !ready && timeoutMs != 0;
+    int ret = 0;
+    if(block) {
+        struct timespec ts;
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        ret = Submit_(toSubmit, 1, IORING_ENTER_GETEVENTS, timeoutMs > 0 ? &ts : nullptr);
+    }
+    else if(toSubmit > 0) {
+        ret = Submit_(toSubmit, 0, 0, nullptr);
+    }
+    // 返回值是内核取走的SQE数，没取走的（出错或只提交了一部分）留在SQ里，下一次Wait再交
+    int err = ret < 0 ? errno : 0;
+    if(err == EBUSY) {
+        // CQ溢出的事件还在内核里时拒绝提交：只收割，把溢出的事件搬进CQ，本轮处理完再提交
+        Submit_(0, 0, IORING_ENTER_GETEVENTS, nullptr);
+    } else if(err == EINTR) {
+        if(block) { return -1; }    // 与epoll_wait一致返回-1
+    } else if(err && err != ETIME) {
+        LOG_WARN("io_uring_enter error: %s, %u sqes left for next wait", strerror(err), toSubmit);
+    }
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(ret > 0) { pending_ -= std::min(static_cast<unsigned>(ret), pending_); }
+    if(++waitGen_ == 0) { waitGen_ = 1; }     // batch初值0表示从未报告过
+    int cnt = 0;
+    size_t done = 0;
+    for(; done < ready_.size() && cnt < maxEvents; done++) {
+        uint64_t key = ready_[done];
+        if(key & ACCEPT_DATA) {
+            Acceptor& acc = acceptors_[key & 0xffffffff];
+            if(!acc.accepted.empty()) { ReportAccept_(acc, events, &cnt); }
+        } else if(InputPending_(fds_[key]) && (fds_[key].events & EPOLLIN)) {
+            Report_(static_cast<int>(key), EPOLLIN, events, &cnt);
+        }
+    }
+    ready_.erase(ready_.begin(), ready_.begin() + done);
+
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    while(head != tail && cnt < maxEvents) {
+        struct io_uring_cqe* cqe = &cqes_[head & *cqMask_];
+        head++;
+        uint64_t userData = cqe->user_data;
+        if(userData & IGNORE_DATA) { continue; }
+        if(userData & RECV_DATA) {
+            OnRecv_(cqe, events, &cnt);
+            continue;
+        }
+        if(userData & ACCEPT_DATA) {
+            OnAccept_(cqe, events, &cnt);
+            continue;
+        }
+
+        int fd = static_cast<int>(userData & 0xffffffff);
+        uint32_t seq = static_cast<uint32_t>(userData >> 32) & SEQ_MASK;
+        if(static_cast<size_t>(fd) >= fds_.size() || fds_[fd].seq != seq) {
+            continue;   // fd已经被ModFd/DelFd，这是旧注册的事件
+        }
+        FdState& st = fds_[fd];
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+        if(!more) { st.armed = false; }
+        if(cqe->res == -ECANCELED) { continue; }
+
+        Report_(fd, cqe->res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe->res), events, &cnt);
+
+        // multishot被内核提前终止（例如CQ溢出），重新注册保持持久语义；拿不到SQE时Arm_排进retry_
+        if(!more && st.multishot && st.registered && cqe->res >= 0) {
+            Arm_(fd, st.events, st.data);
+        }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return cnt;
+}
+
+// 同一轮Wait里同一个fd只占一个事件，poll和recv的完成事件合并；EPOLLONESHOT报告一次后摘下
+void UringPoller::Report_(int fd, uint32_t ev, struct epoll_event* events, int* cnt) {
+    FdState& st = fds_[fd];
+    if(st.batch == waitGen_) {
+        events[st.eventIdx].events |= ev;
+        return;
+    }
+    if(!st.registered) return;
+    st.batch = waitGen_;
+    st.eventIdx = *cnt;
+    events[*cnt].events = ev;
+    events[*cnt].data.u64 = st.data;
+    (*cnt)++;
+    if(!st.multishot) { Disarm_(fd); }
+}
+
+void UringPoller::ReportAccept_(Acceptor& acc, struct epoll_event* events, int* cnt) {
+    if(!acc.registered || acc.batch == waitGen_) return;
+    acc.batch = waitGen_;
+    acc.eventIdx = *cnt;
+    events[*cnt].events = EPOLLIN;
+    events[*cnt].data.u64 = acc.data;
+    (*cnt)++;
+}
+
+void UringPoller::OnRecv_(const struct io_uring_cqe* cqe, struct epoll_event* events, int* cnt) {
+    int fd = static_cast<int>(cqe->user_data & 0xffffffff);
+    uint32_t rseq = static_cast<uint32_t>(cqe->user_data >> 32) & SEQ_MASK;
+    bool hasBuf = cqe->flags & IORING_CQE_F_BUFFER;
+    uint16_t bid = static_cast<uint16_t>(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if(static_cast<size_t>(fd) >= fds_.size() || !fds_[fd].recvOn || fds_[fd].rseq != rseq) {
+        if(hasBuf) { Recycle_(bid); }   // 连接已经关闭，取消生效前这次recv收下的数据
+        return;
+    }
+    FdState& st = fds_[fd];
+    if(!(cqe->flags & IORING_CQE_F_MORE)) { st.recvArmed = false; }
+    int res = cqe->res;
+    if(res > 0 && hasBuf) {
+        st.chunks.push_back({bid, static_cast<uint32_t>(res)});
+    } else {
+        if(hasBuf) { Recycle_(bid); }
+        if(res == -ECANCELED) { return; }
+        if(res == 0) {
+            st.eof = true;
+        } else if(res == -EINVAL) {
+            // 内核不支持multishot recv：这个连接和以后的连接都只用poll + readv
+            recvOk_ = false;
+            st.recvOn = false;
+            if(st.armed && (st.events & EPOLLIN)) {
+                uint32_t ev = st.events;
+                uint64_t data = st.data;
+                Disarm_(fd);
+                Arm_(fd, ev, data);
+            }
+        } else if(res != -ENOBUFS && res != -EAGAIN && res != -EINTR) {
+            st.err = -res;
+        }
+        // ENOBUFS等：recv结束了但套接字里可能还有数据，报告可读，Read()退回readv
+    }
+    if(st.events & EPOLLIN) { Report_(fd, EPOLLIN, events, cnt); }
+}
+
+void UringPoller::OnAccept_(const struct io_uring_cqe* cqe, struct epoll_event* events, int* cnt) {
+    size_t idx = cqe->user_data & 0xffffffff;
+    uint32_t seq = static_cast<uint32_t>(cqe->user_data >> 32) & SEQ_MASK;
+    if(idx >= acceptors_.size()) {
+        if(cqe->res >= 0) { close(cqe->res); }
+        return;
+    }
+    Acceptor& acc = acceptors_[idx];
+    bool current = acc.seq == seq;
+    if(current && !(cqe->flags & IORING_CQE_F_MORE)) { acc.armed = false; }
+    int res = cqe->res;
+    if(res >= 0) {
+        acc.accepted.push_back(res);    // 取消的注册在取消生效前accept的连接也留着
+    } else if(!current || res == -ECANCELED) {
+        return;
+    } else if(res != -EINTR && res != -ECONNABORTED && res != -EPROTO && res != -EAGAIN) {
+        acc.err = -res;
+    }
+    // 内核提前结束了multishot（CQ溢出、对端在accept前断开等），重新注册；出错时等调用者取走错误再说
+    if(current && !acc.armed && acc.registered && !acc.err) {
+        ArmAccept_(idx);
+    }
+    if(res >= 0 || acc.err) { ReportAccept_(acc, events, cnt); }
+}
+
+// SQ满且提交失败时注册照样记下，fd排进retry_，下一次Wait开头重新POLL_ADD
+void UringPoller::Arm_(int fd, uint32_t events, uint64_t data) {
+    if(static_cast<size_t>(fd) >= fds_.size()) {
+        fds_.resize(fd + 1);
+    }
+    FdState& st = fds_[fd];
+    st.seq = (st.seq + 1) & SEQ_MASK;
+    st.data = data;
+    st.events = events;
+    st.registered = true;
+    st.multishot = !(events & EPOLLONESHOT);
+    struct io_uring_sqe* sqe = GetSqe_();
+    if(!sqe) {
+        st.armed = false;
+        if(!st.deferred) {
+            st.deferred = true;
+            retry_.push_back(fd);
+            LOG_WARN("io_uring sq full, poll on fd %d deferred", fd);
+        }
+        return;
+    }
+    st.armed = true;
+    st.deferred = false;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events & POLL_MASK & ~(st.recvOn ? EPOLLIN : 0);
+    sqe->len = st.multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = (static_cast<uint64_t>(st.seq) << 32) | static_cast<uint32_t>(fd);
+}
+
+void UringPoller::Disarm_(int fd) {
+    if(static_cast<size_t>(fd) >= fds_.size()) return;
+    FdState& st = fds_[fd];
+    if(st.armed) {
+        uint64_t userData = (static_cast<uint64_t>(st.seq) << 32) | static_cast<uint32_t>(fd);
+        struct io_uring_sqe* sqe = GetSqe_();
+        if(sqe) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = userData;
+            sqe->user_data = IGNORE_DATA;
+        } else {
+            // 留在内核里的poll持有套接字的引用，close之后连接也不会断开，必须补发取消
+            cancels_.push_back(userData);
+        }
+        st.armed = false;
+    }
+    st.registered = false;
+    st.deferred = false;
+    st.seq = (st.seq + 1) & SEQ_MASK;
+}
+
+// 持有mtx_、套接字刚读到EAGAIN时调用
+void UringPoller::ArmRecv_(int fd) {
+    if(static_cast<size_t>(fd) >= fds_.size()) {
+        fds_.resize(fd + 1);
+    }
+    FdState& st = fds_[fd];
+    struct io_uring_sqe* sqe = GetSqe_();
+    if(!sqe) {
+        // 这次不用recv：数据到达仍由poll的EPOLLIN报告，下一次读到EAGAIN时再试
+        LOG_WARN("io_uring sq full, recv on fd %d falls back to poll", fd);
+        if(st.recvOn) {
+            // 走到readv说明chunks已经读完、recv已经结束，poll要重新关心EPOLLIN
+            st.recvOn = false;
+            st.rseq = (st.rseq + 1) & SEQ_MASK;
+            if(st.registered && (st.events & EPOLLIN)) {
+                uint32_t events = st.events;
+                uint64_t data = st.data;
+                Disarm_(fd);
+                Arm_(fd, events, data);
+            }
+        }
+        return;
+    }
+    st.rseq = (st.rseq + 1) & SEQ_MASK;
+    st.recvOn = true;
+    st.recvArmed = true;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->user_data = RECV_DATA | (static_cast<uint64_t>(st.rseq) << 32) | static_cast<uint32_t>(fd);
+
+    // 数据到达改由recv的完成事件报告，poll去掉EPOLLIN，否则每个请求都多一个事件
+    if(st.armed && (st.events & EPOLLIN)) {
+        uint32_t events = st.events;
+        uint64_t data = st.data;
+        Disarm_(fd);
+        Arm_(fd, events, data);
+    }
+}
+
+// 连接关闭：取消recv，还没读走的数据所在的buffer还给内核
+void UringPoller::DropRecv_(int fd) {
+    if(static_cast<size_t>(fd) >= fds_.size()) return;
+    FdState& st = fds_[fd];
+    if(st.recvArmed) {
+        Cancel_(RECV_DATA | (static_cast<uint64_t>(st.rseq) << 32) | static_cast<uint32_t>(fd));
+    }
+    for(const Chunk& c: st.chunks) {
+        Recycle_(c.bid);
+    }
+    st.chunks.clear();
+    st.recvOn = st.recvArmed = st.eof = false;
+    st.err = 0;
+    st.rseq = (st.rseq + 1) & SEQ_MASK;
+}
+
+// 拿不到SQE时排进retry_：multishot accept丢了这个Reactor就再也收不到新连接
+void UringPoller::ArmAccept_(size_t idx) {
+    Acceptor& acc = acceptors_[idx];
+    struct io_uring_sqe* sqe = GetSqe_();
+    if(!sqe) {
+        if(!acc.deferred) {
+            acc.deferred = true;
+            retry_.push_back(ACCEPT_DATA | static_cast<uint32_t>(idx));
+            LOG_WARN("io_uring sq full, accept on fd %d deferred", acc.fd);
+        }
+        return;
+    }
+    acc.seq = (acc.seq + 1) & SEQ_MASK;
+    acc.armed = true;
+    acc.deferred = false;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = acc.fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = ACCEPT_DATA | (static_cast<uint64_t>(acc.seq) << 32) | static_cast<uint32_t>(idx);
+}
+
+int UringPoller::FindAcceptor_(int fd) const {
+    for(size_t i = 0; i < acceptors_.size(); i++) {
+        if(acceptors_[i].fd == fd) { return static_cast<int>(i); }
+    }
+    return -1;
+}
+
+// 已改用recv的连接有没有要Read()处理的东西；recv被内核结束时套接字里可能还有数据
+bool UringPoller::InputPending_(const FdState& st) const {
+    return st.recvOn && (!st.chunks.empty() || st.eof || st.err || !st.recvArmed);
+}
+
+// 按user_data取消multishot recv/accept
+void UringPoller::Cancel_(uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    if(sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = userData;
+        sqe->user_data = IGNORE_DATA;
+    } else {
+        cancels_.push_back(userData);
+    }
+}
+
+// 工作线程重新注册时已经有数据在等：产生一个完成事件把阻塞在Wait里的Reactor叫醒
+void UringPoller::Nop_() {
+    struct io_uring_sqe* sqe = GetSqe_();
+    if(sqe) {
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = IGNORE_DATA;
+    } else {
+        // ready_里的事件由Reactor下一次Wait报告，只是不能马上叫醒它
+        LOG_WARN("io_uring sq full, reactor not woken");
+    }
+}
+
+// 在Wait开头、持有mtx_时调用：补提交之前拿不到SQE的取消和注册，这次还失败的重新排进去
+void UringPoller::Retry_() {
+    if(retry_.empty() && cancels_.empty()) return;
+    std::vector<uint64_t> cancels;
+    cancels.swap(cancels_);
+    for(uint64_t userData: cancels) {
+        Cancel_(userData);
+    }
+    std::vector<uint64_t> keys;
+    keys.swap(retry_);
+    for(uint64_t key: keys) {
+        if(key & ACCEPT_DATA) {
+            size_t idx = key & 0xffffffff;
+            Acceptor& acc = acceptors_[idx];
+            if(!acc.deferred) continue;
+            acc.deferred = false;
+            if(acc.registered && !acc.armed && !acc.err) { ArmAccept_(idx); }
+        } else {
+            FdState& st = fds_[key];
+            if(!st.deferred) continue;     // 期间已经重新注册或者摘下
+            st.deferred = false;
+            if(st.registered && !st.armed) { Arm_(static_cast<int>(key), st.events, st.data); }
+        }
+    }
+}
+
+// 把buffer放回ring的尾部；ring[0]的resv和tail重叠，只写addr/len/bid
+// 不用bufRing_->bufs：C++里__DECLARE_FLEX_ARRAY的空结构体占一个字节，bufs会错开8字节
+void UringPoller::Recycle_(uint16_t bid) {
+    struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(bufRing_) + (bufTail_ & (RECV_BUFS - 1));
+    buf->addr = reinterpret_cast<uint64_t>(bufBase_ + static_cast<size_t>(bid) * RECV_BUF_SIZE);
+    buf->len = RECV_BUF_SIZE;
+    buf->bid = bid;
+    bufTail_++;
+    __atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* UringPoller::GetSqe_() {
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if(sqLocalTail_ - head >= entries_) {
+        // SQ满了先提交一批
+        if(!Flush_()) return nullptr;
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if(sqLocalTail_ - head >= entries_) return nullptr;
+    }
+    unsigned idx = sqLocalTail_ & *sqMask_;
+    struct io_uring_sqe* sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[idx] = idx;
+    sqLocalTail_++;
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    pending_++;
+    return sqe;
+}
+
+int UringPoller::Submit_(unsigned toSubmit, unsigned minComplete, unsigned flags, const struct timespec* ts) {
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(ts);
+    return syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete,
+                        flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+// 立即提交攒下的SQE（持有mtx_时调用）；只扣掉内核实际取走的，失败时全部留给Reactor的下一次Wait
+bool UringPoller::Flush_() {
+    if(pending_ == 0) return true;
+    int ret = Submit_(pending_, 0, 0, nullptr);
+    if(ret < 0) {
+        if(errno != EBUSY && errno != EINTR) {
+            LOG_WARN("io_uring_enter error: %s, %u sqes left for next wait", strerror(errno), pending_);
+        }
+        return false;
+    }
+    pending_ -= std::min(static_cast<unsigned>(ret), pending_);
+    return true;
+}
+
+bool UringPoller::FromLoopThread_() const {
+    return loopThread_ == std::this_thread::get_id();
+}
@@ -0,0 +1,162 @@
+#ifndef URINGPOLLER_H
+#define URINGPOLLER_H
+
+#include <sys/epoll.h>
+#include <sys/mman.h>       // mmap, munmap
+#include <sys/socket.h>     // accept4, sockaddr_storage
+#include <sys/syscall.h>    // __NR_io_uring_setup, __NR_io_uring_enter
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../buffer/buffer.h"
+
+/*
+    基于io_uring的事件后端，对外接口与Epoller一致
+    1. AddFd/ModFd/DelFd 只是往SQ里追加POLL_ADD/POLL_REMOVE，不再各自一次epoll_ctl系统调用，
+       在Reactor线程上调用时攒到下一次Wait，和等待事件合并成一次io_uring_enter
+    2. 非EPOLLONESHOT的fd使用multishot poll，注册一次持续产生事件（边沿触发语义）
+    3. 从工作线程调用时立即提交，避免Reactor阻塞在Wait里而这次重新注册迟迟没有提交
+    4. 监听套接字用multishot accept：内核accept好的连接排在队列里，Accept()直接取，不再每个连接一次accept4
+    5. 连接第一次读到EAGAIN后改用multishot recv：内核把数据收进provided buffer ring，Read()从那里拷进
+       读缓冲区，省掉每个请求的readv和读到EAGAIN的那一次readv；buffer用完时内核结束这次recv，
+       Read()退回readv读到EAGAIN后再重新注册
+    直接使用系统调用，不依赖liburing；内核不支持时Init()返回false，由Epoller退回epoll；
+    不支持provided buffer ring（5.19之前）时4、5都不启用，退回accept4/readv
+*/
+class UringPoller {
+public:
+    explicit UringPoller(unsigned entries = 1024);
+    ~UringPoller();
+
+    bool Init();
+
+    bool AddFd(int fd, uint32_t events, uint64_t data);
+    bool ModFd(int fd, uint32_t events, uint64_t data);
+    // closing：fd接着就要关闭，取消recv并丢掉已经收下但还没读走的数据
+    bool DelFd(int fd, bool closing = false);
+    // 等待事件，结果按epoll_event格式写入events
+    int Wait(struct epoll_event* events, int maxEvents, int timeoutMs);
+
+    bool AddListenFd(int fd, uint32_t events, uint64_t data);
+    // 约定同accept4；multishot accept拿到的连接没有对端地址，addr->ss_family为AF_UNSPEC
+    int Accept(int listenFd, struct sockaddr_storage* addr);
+    // 约定同Buffer::ReadFd
+    ssize_t Read(int fd, Buffer* buff, int* saveErrno);
+
+    static const unsigned RECV_BUFS = 256;          // 2的幂
+    static const size_t RECV_BUF_SIZE = 4096;
+
+private:
+    struct Chunk {
+        uint16_t bid;
+        uint32_t len;
+    };
+
+    struct FdState {
+        uint64_t data = 0;      // 返回给调用者的epoll_event.data
+        uint32_t events = 0;
+        uint32_t seq = 0;       // 每次重新注册加一，旧注册产生的CQE直接丢弃
+        bool armed = false;     // POLL_ADD还在内核里
+        bool multishot = false;
+        bool registered = false;    // 调用者的注册有效；EPOLLONESHOT报告一次后失效
+        bool deferred = false;  // 拿不到SQE，POLL_ADD排在retry_里等下一次Wait
+        uint32_t batch = 0;     // 本轮Wait已经报告过，后面的事件合并到events[eventIdx]
+        int eventIdx = 0;
+
+        uint32_t rseq = 0;      // recv的注册序号，和seq分开：摘下注册时recv保持不动
+        bool recvOn = false;    // 已改用recv，数据只从chunks取，poll不再关心EPOLLIN
+        bool recvArmed = false;
+        bool eof = false;
+        int err = 0;
+        std::vector<Chunk> chunks;
+    };
+
+    struct Acceptor {
+        int fd = -1;
+        uint64_t data = 0;
+        uint32_t seq = 0;
+        bool armed = false;
+        bool registered = false;
+        bool deferred = false;
+        int err = 0;            // multishot accept因错误结束，下一次Accept()交给调用者
+        uint32_t batch = 0;
+        int eventIdx = 0;
+        std::deque<int> accepted;   // 内核已经accept、还没被取走的连接
+    };
+
+    bool Register_(int fd, uint32_t events, uint64_t data);
+    void Arm_(int fd, uint32_t events, uint64_t data);
+    void Disarm_(int fd);
+    void ArmRecv_(int fd);
+    void DropRecv_(int fd);
+    void ArmAccept_(size_t idx);
+    int FindAcceptor_(int fd) const;
+    bool InputPending_(const FdState& st) const;
+    void Cancel_(uint64_t userData);
+    void Nop_();
+    void Retry_();
+    void Recycle_(uint16_t bid);
+    bool InitBufRing_();
+    void OnRecv_(const struct io_uring_cqe* cqe, struct epoll_event* events, int* cnt);
+    void OnAccept_(const struct io_uring_cqe* cqe, struct epoll_event* events, int* cnt);
+    void Report_(int fd, uint32_t ev, struct epoll_event* events, int* cnt);
+    void ReportAccept_(Acceptor& acc, struct epoll_event* events, int* cnt);
+    struct io_uring_sqe* GetSqe_();
+    int Submit_(unsigned toSubmit, unsigned minComplete, unsigned flags, const struct timespec* ts);
+    bool Flush_();
+    bool FromLoopThread_() const;
+
+    static const uint64_t IGNORE_DATA = 1ULL << 63;   // POLL_REMOVE/取消/NOP自身的完成事件
+    static const uint64_t RECV_DATA = 1ULL << 62;
+    static const uint64_t ACCEPT_DATA = 1ULL << 61;
+    static const uint32_t SEQ_MASK = 0x1fffffff;
+    static const uint16_t BUF_GROUP = 0;
+    static const int RETRY_MS = 10;     // 有注册等着补提交时Wait最多阻塞这么久
+
+    int ringFd_;
+    unsigned entries_;
+
+    // SQ
+    void* sqRing_;
+    size_t sqRingSize_;
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned* sqMask_;
+    unsigned* sqArray_;
+    struct io_uring_sqe* sqes_;
+    size_t sqesSize_;
+    unsigned sqLocalTail_;
+    unsigned pending_;          // 已写入SQ但内核还没取走的条目数，按io_uring_enter的返回值扣减
+
+    // CQ
+    void* cqRing_;
+    size_t cqRingSize_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned* cqMask_;
+    struct io_uring_cqe* cqes_;
+
+    // provided buffer ring：前面是ring，后面紧跟RECV_BUFS个缓冲区
+    struct io_uring_buf_ring* bufRing_;
+    char* bufBase_;
+    size_t bufMemSize_;
+    uint16_t bufTail_;
+    bool recvOk_;               // 内核不支持multishot recv（6.0之前）时置false
+
+    std::vector<FdState> fds_;
+    std::vector<Acceptor> acceptors_;   // 下标放在user_data里，不随监听fd号变化
+    std::vector<uint64_t> ready_;       // 重新注册时已经有数据/连接在等，下一次Wait直接报告
+    std::vector<uint64_t> retry_;       // 拿不到SQE的POLL_ADD/ACCEPT，键同ready_，下一次Wait开头补上
+    std::vector<uint64_t> cancels_;     // 拿不到SQE的POLL_REMOVE/取消，按user_data补发取消
+    uint32_t waitGen_;
+    std::mutex mtx_;            // 工作线程也会ModFd/Read，SQ、fds_和buffer ring都需要加锁
+    std::thread::id loopThread_;
+};
+
+#endif //URINGPOLLER_H
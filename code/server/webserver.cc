@@ -2,19 +2,69 @@
 
 using namespace std;
 
+int WebServer::signalWakeFd_ = -1;
+volatile sig_atomic_t WebServer::upgradeSignal_ = 0;
+volatile sig_atomic_t WebServer::quitSignal_ = 0;
+
 WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
+            bool openLog, int logLevel, int logQueSize,
+            const ServerOptions& options):
             port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new RbtreeTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+            options_(options), threadpool_(new ThreadPool(threadNum, CpuAffinity::Parse(options.workerCpus))), users_(new ConnSlab<HttpConn>(MAX_FD)),
+            connMeta_(new ConnMeta[MAX_FD]), inflight_(0), exePath_(HotUpgrade::ExePath()), draining_(false),
+            acceptStopped_(0), listenClosed_(false), upgradePid_(-1), upgradeReadyFd_(-1)
     {
     srcDir_ = getcwd(nullptr, 256);
     // assert(srcDir_);
     strcat(srcDir_, "/resources/");
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
+    HttpRequest::maxBodyBytes = options_.maxBodyBytes;
+    HttpRequest::bodyMemBytes = std::min(options_.bodyMemBytes, options_.maxBodyBytes);
+    HttpRequest::spillDir = options_.bodySpillDir.c_str();
+    HttpConn::enableH2c = options_.h2c;
+    HttpConn::maxRequests = options_.maxKeepAliveRequests;
+    HttpConn::keepAliveTimeoutSec = timeoutMS_ > 0 ? timeoutMS_ / 1000 : 0;
+    FileCache::Instance()->SetCapacity(options_.fileCacheEntries);
+
+    // 每个Reactor独立的Epoller、定时器和连接表
+    if(options_.reactorNum < 1) { options_.reactorNum = 1; }
+    std::vector<int> reactorCpus = CpuAffinity::Parse(options_.reactorCpus);
+    for(int i = 0; i < options_.reactorNum; i++) {
+        std::unique_ptr<Reactor> r(new Reactor);
+        r->id = i;
+        // prefork时各worker进程的Reactor依次往后取CPU，不挤在同一批核上
+        size_t cpuIdx = static_cast<size_t>(options_.workerIndex) * options_.reactorNum + i;
+        r->cpu = reactorCpus.empty() ? -1 : reactorCpus[cpuIdx % reactorCpus.size()];
+        r->node = r->cpu >= 0 ? CpuAffinity::NodeOf(r->cpu) : -1;
+        r->acceptPending = false;
+        r->accepting = true;
+        r->acceptPaused = false;
+        r->epoller.reset(new Epoller(options_.maxEvents, options_.ioBackend));
+        r->timer.reset(new RbtreeTimer());
+        r->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        r->epoller->AddFd(r->wakeFd, EPOLLIN);
+        if(r->epoller->GetBackend() == Epoller::IO_URING) {
+            Epoller* epoller = r->epoller.get();
+            r->readFn = [epoller](int fd, Buffer* buff, int* saveErrno) { return epoller->Read(fd, buff, saveErrno); };
+        }
+        reactors_.push_back(std::move(r));
+    }
+
+    maxConns_ = (options_.maxConns > 0 && options_.maxConns < MAX_FD) ? options_.maxConns : MAX_FD;
+    {
+        const char* body = "<html><title>Error</title><body bgcolor=\"ffffff\">"
+                           "503 : Service Unavailable\n<p>Server busy, retry later</p>"
+                           "<hr><em>TinyWebServer</em></body></html>";
+        busyResponse_ = "HTTP/1.1 503 Service Unavailable\r\n"
+                        "Retry-After: " + std::to_string(options_.retryAfterSec) + "\r\n"
+                        "Connection: close\r\n"
+                        "Content-type: text/html\r\n"
+                        "Content-length: " + std::to_string(strlen(body)) + "\r\n\r\n" + body;
+    }
 
     // 初始化操作
     SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);  // 连接池单例的初始化
@@ -23,6 +73,7 @@ WebServer::WebServer(
     // 是否打开日志标志
     if(openLog) {
         Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
+        Log::Instance()->SetAffinity(CpuAffinity::Parse(options_.logCpus));
         if(isClose_) { LOG_ERROR("========== Server init error!=========="); }
         else {
             LOG_INFO("========== Server init ==========");
@@ -33,14 +84,47 @@ WebServer::WebServer(
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
             LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("Dispatch: %s", options_.dispatch == ServerOptions::DISPATCH_POOL ? "pool" :
+                            (options_.dispatch == ServerOptions::DISPATCH_INLINE ? "inline" : "adaptive"));
+            LOG_INFO("Reactor num: %d, Listen: %s", options_.reactorNum,
+                            IsMultiReactor_() ? (options_.reusePort ? "SO_REUSEPORT" : "EPOLLEXCLUSIVE") : "single");
+            LOG_INFO("IO backend: %s", reactors_[0]->epoller->GetBackend() == Epoller::IO_URING ? "io_uring" : "epoll");
+            LOG_INFO("Header scan: %s", CharScan::LevelName(CharScan::GetLevel()));
+            LOG_INFO("Max body: %zu, in memory up to: %zu, spill dir: %s",
+                            HttpRequest::maxBodyBytes, HttpRequest::bodyMemBytes, HttpRequest::spillDir);
+            LOG_INFO("h2c: %s", HttpConn::enableH2c ? "on" : "off");
+            LOG_INFO("Keep-alive: max %d requests, idle timeout %dms", HttpConn::maxRequests, timeoutMS_);
+            LOG_INFO("File cache: %zu entries", options_.fileCacheEntries);
+            LOG_INFO("Listen backlog: %d, accept budget: %d, defer accept: %ds",
+                            options_.listenBacklog, options_.acceptBudget, options_.deferAcceptSec);
+            LOG_INFO("Max conns: %d, max inflight: %d", maxConns_, options_.maxInflight);
+            LOG_INFO("Max events: %d, spin: %dus, busy poll: %dus", options_.maxEvents, options_.spinUs, options_.busyPollUs);
+            LOG_INFO("CPU affinity: reactor [%s], worker [%s], log [%s], incoming cpu: %s",
+                            options_.reactorCpus.c_str(), options_.workerCpus.c_str(), options_.logCpus.c_str(),
+                            options_.incomingCpu ? "on" : "off");
+            for(const std::string* list: {&options_.reactorCpus, &options_.workerCpus, &options_.logCpus}) {
+                if(!list->empty() && CpuAffinity::Parse(*list).empty()) {
+                    LOG_WARN("Invalid cpu list \"%s\", ignored", list->c_str());
+                }
+            }
+            if(options_.ioBackend == Epoller::IO_URING && reactors_[0]->epoller->GetBackend() != Epoller::IO_URING) {
+                LOG_WARN("io_uring unavailable, fall back to epoll");
+            }
         }
     }
 
     if(!InitSocket_()) { isClose_ = true;}
+    InitSignal_();
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
+    if(!listenClosed_) {
+        for(int fd: ListenFds_()) { close(fd); }
+    }
+    for(auto& r: reactors_) {
+        close(r->wakeFd);
+    }
+    if(signalWakeFd_ == reactors_[0]->wakeFd) { signalWakeFd_ = -1; }
     isClose_ = true;
     free(srcDir_);
     SqlConnPool::Instance()->ClosePool();
@@ -68,130 +152,747 @@ void WebServer::InitEventMode_(int trigMode) {
         connEvent_ |= EPOLLET;
         break;
     }
+    // io_uring的multishot poll是边沿触发语义，监听fd必须一次accept到空
+    if(reactors_[0]->epoller->GetBackend() == Epoller::IO_URING) {
+        listenEvent_ |= EPOLLET;
+        connEvent_ |= EPOLLET;
+    }
+    // 持久注册时EPOLLOUT一直在兴趣集里，必须边沿触发，否则LT下可写事件会被反复报告
+    if(PersistentConn_()) {
+        connEvent_ = EPOLLRDHUP | EPOLLET;
+    }
     HttpConn::isET = (connEvent_ & EPOLLET);
 }
 
 void WebServer::Start() {
+    if(!isClose_) {
+        LOG_INFO("========== Server start ==========");
+        HotUpgrade::NotifyReady();  // 由旧进程平滑升级启动时，通知它可以开始排空了
+    }
+    // Reactor 0 运行在调用线程上，其余每个Reactor一个线程
+    std::vector<std::thread> loops;
+    for(size_t i = 1; i < reactors_.size(); i++) {
+        loops.emplace_back(&WebServer::Loop_, this, reactors_[i].get());
+    }
+    Loop_(reactors_[0].get());
+    for(auto& t: loops) {
+        t.join();
+    }
+}
+
+void WebServer::Loop_(Reactor* r) {
+    if(r->cpu >= 0) {
+        // 先绑核再处理连接，连接对象和缓冲区首次访问都发生在这个CPU所在的NUMA节点上
+        if(CpuAffinity::PinSelf(std::vector<int>(1, r->cpu))) {
+            LOG_INFO("Reactor %d pinned to cpu %d, node %d", r->id, r->cpu, r->node);
+        } else {
+            LOG_WARN("Reactor %d pin to cpu %d error: %s", r->id, r->cpu, strerror(errno));
+        }
+    }
     int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
-    if(!isClose_) { LOG_INFO("========== Server start =========="); }
+    bool logStats = (r->id == 0 && options_.statsIntervalMs > 0);
+    TimeStamp nextStats = Clock::now() + MS(options_.statsIntervalMs);
     while(!isClose_) {
         if(timeoutMS_ > 0) {
-            timeMS = timer_->GetNextTick();     // 获取下一次的超时等待事件(至少这个时间才会有用户过期，每次关闭超时连接则需要有新的请求进来)
+            timeMS = r->timer->GetNextTick();     // 获取下一次的超时等待事件(至少这个时间才会有用户过期，每次关闭超时连接则需要有新的请求进来)
         }
-        int eventCnt = epoller_->Wait(timeMS);
+        if(logStats) {
+            int untilStats = std::max<int>(0, std::chrono::duration_cast<MS>(nextStats - Clock::now()).count());
+            if(timeMS < 0 || untilStats < timeMS) { timeMS = untilStats; }
+        }
+        if(draining_ && (timeMS < 0 || timeMS > DRAIN_SCAN_MS)) { timeMS = DRAIN_SCAN_MS; }  // 排空期间定期扫描空闲连接
+        if(r->acceptPaused && (timeMS < 0 || timeMS > ADMISSION_CHECK_MS)) { timeMS = ADMISSION_CHECK_MS; }
+        if(r->acceptPending) { timeMS = 0; }    // 还有没accept完的连接，不阻塞
+        int eventCnt = WaitEvents_(r, timeMS);
+        bool listenReady = r->acceptPending;
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
-            int fd = epoller_->GetEventFd(i);
-            uint32_t events = epoller_->GetEvents(i);
-            if(fd == listenFd_) {
-                DealListen_();
+            int fd = r->epoller->GetEventFd(i);
+            uint32_t events = r->epoller->GetEvents(i);
+            uint32_t tag = r->epoller->GetEventTag(i);
+            if(tag == 0 && MarkListenReady_(r, fd)) {
+                listenReady = true;     // 先处理已建立连接的读写，新连接放到本轮最后accept
+                continue;
+            }
+            if(fd == r->wakeFd) {
+                DealWakeup_(r);
+                continue;
             }
-            else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                // assert(users_.count(fd) > 0);
-                CloseConn_(&users_[fd]);
+            if(r->id == 0 && fd == upgradeReadyFd_) {
+                OnUpgradeReady_();
+                continue;
+            }
+            HttpConn* client = users_->Get(fd, tag);
+            if(!client) {
+                continue;   // 同一批事件里fd已被关闭并复用，丢弃过期事件
+            }
+            if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                CloseConn_(r, client);
             }
             else if(events & EPOLLIN) {
-                // assert(users_.count(fd) > 0);
-                DealRead_(&users_[fd]);
+                DealRead_(r, client);
             }
             else if(events & EPOLLOUT) {
-                // assert(users_.count(fd) > 0);
-                DealWrite_(&users_[fd]);
+                DealWrite_(r, client);
             } else {
                 LOG_ERROR("Unexpected event");
             }
         }
+        if(r->acceptPaused) {
+            TryResumeAccept_(r);
+        }
+        else if(listenReady && r->accepting) {
+            DealListen_(r);
+        }
+        if(logStats && Clock::now() >= nextStats) {
+            LogStats_();
+            nextStats = Clock::now() + MS(options_.statsIntervalMs);
+        }
+        if(draining_ && Drain_(r)) {
+            break;
+        }
+    }
+    if(logStats && options_.statsSlot) {
+        options_.statsSlot->Publish(GetStats());    // 退出前发布最后一次，master据此累计已退出worker的计数
+    }
+}
+
+// 等待事件；开启spinUs时先以0超时轮询一段时间，期间有事件就不用进入睡眠再被唤醒
+int WebServer::WaitEvents_(Reactor* r, int timeMS) {
+    int eventCnt = 0;
+    if(options_.spinUs > 0 && timeMS != 0) {
+        ServerStats::Add(r->stats.spinWaits);
+        long spinUs = options_.spinUs;
+        if(timeMS > 0 && timeMS * 1000L < spinUs) { spinUs = timeMS * 1000L; }
+        TimeStamp spinEnd = Clock::now() + std::chrono::microseconds(spinUs);
+        do {
+            eventCnt = r->epoller->Wait(0);
+        } while(eventCnt == 0 && Clock::now() < spinEnd);
+        if(eventCnt > 0) {
+            ServerStats::Add(r->stats.spinHits);
+        }
+    }
+    if(eventCnt == 0) {
+        eventCnt = r->epoller->Wait(timeMS);
+    }
+    if(eventCnt > 0) {
+        ServerStats::Add(r->stats.wakeups);
+        ServerStats::Add(r->stats.events, eventCnt);
+        ServerStats::Max(r->stats.eventBatchMax, r->epoller->GetBatch());
+    }
+    return eventCnt;
+}
+
+void WebServer::InitSignal_() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, nullptr);   // 对端已关闭时write返回EPIPE，不能让信号杀掉进程
+
+    signalWakeFd_ = reactors_[0]->wakeFd;
+    sa.sa_handler = &WebServer::OnSignal_;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGQUIT, &sa, nullptr);
+    if(!options_.hotUpgrade) {
+        sa.sa_handler = SIG_IGN;    // 由master统一升级，worker收到也不能被默认动作杀掉
+    }
+    sigaction(SIGUSR2, &sa, nullptr);
+}
+
+// 信号处理函数里只置标志并写eventfd，真正的处理在Reactor 0的循环里
+void WebServer::OnSignal_(int sig) {
+    int savedErrno = errno;
+    if(sig == SIGUSR2) { upgradeSignal_ = 1; }
+    else { quitSignal_ = 1; }
+    uint64_t one = 1;
+    if(signalWakeFd_ >= 0) {
+        ssize_t ret = write(signalWakeFd_, &one, sizeof(one));
+        (void)ret;
+    }
+    errno = savedErrno;
+}
+
+void WebServer::DealWakeup_(Reactor* r) {
+    uint64_t cnt;
+    ssize_t ret = read(r->wakeFd, &cnt, sizeof(cnt));
+    (void)ret;
+    if(r->id != 0) { return; }
+    if(upgradeSignal_) {
+        upgradeSignal_ = 0;
+        StartUpgrade_();
+    }
+    if(quitSignal_) {
+        quitSignal_ = 0;
+        LOG_INFO("Got SIGQUIT, draining connections");
+        StartDrain_();
+    }
+}
+
+// 去重后的监听fd（共享监听fd时所有Reactor是同一个）
+std::vector<int> WebServer::ListenFds_() const {
+    std::vector<int> fds;
+    for(auto& r: reactors_) {
+        for(const Listener& l: r->listeners) {
+            if(std::find(fds.begin(), fds.end(), l.fd) == fds.end()) {
+                fds.push_back(l.fd);
+            }
+        }
     }
+    return fds;
 }
 
-void WebServer::SendError_(int fd, const char*info) {
+// 启动新进程并等它就绪，这段时间本进程照常服务
+void WebServer::StartUpgrade_() {
+    if(draining_ || upgradePid_ > 0) {
+        LOG_WARN("Hot upgrade already in progress");
+        return;
+    }
+    if(exePath_.empty()) {
+        LOG_ERROR("Hot upgrade: executable path unknown");
+        return;
+    }
+    int readyFd = -1;
+    pid_t pid = HotUpgrade::Spawn(exePath_, ListenFds_(), &readyFd);
+    if(pid < 0) {
+        LOG_ERROR("Hot upgrade: spawn %s error: %s", exePath_.c_str(), strerror(errno));
+        return;
+    }
+    upgradePid_ = pid;
+    upgradeReadyFd_ = readyFd;
+    reactors_[0]->epoller->AddFd(upgradeReadyFd_, EPOLLIN);
+    LOG_INFO("Hot upgrade: started %s, pid %d", exePath_.c_str(), pid);
+}
+
+// 就绪管道可读：读到一个字节表示新进程已经在accept，EOF表示新进程启动失败
+void WebServer::OnUpgradeReady_() {
+    char c;
+    ssize_t n = read(upgradeReadyFd_, &c, 1);
+    reactors_[0]->epoller->DelFd(upgradeReadyFd_);
+    close(upgradeReadyFd_);
+    upgradeReadyFd_ = -1;
+    if(n == 1) {
+        LOG_INFO("Hot upgrade: pid %d ready, draining connections", upgradePid_);
+        StartDrain_();
+        return;
+    }
+    int status = 0;
+    waitpid(upgradePid_, &status, 0);
+    LOG_ERROR("Hot upgrade: pid %d failed to start (status %d), keep serving", upgradePid_, status);
+    upgradePid_ = -1;
+}
+
+void WebServer::StartDrain_() {
+    if(draining_) { return; }
+    drainDeadline_ = Clock::now() + MS(options_.drainTimeoutMs);
+    HttpConn::isDraining = true;
+    draining_ = true;
+    for(auto& r: reactors_) {
+        uint64_t one = 1;
+        ssize_t ret = write(r->wakeFd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+// 排空：停止accept；之后的响应都带Connection: close，发完即关闭；一个扫描周期内没有请求的空闲连接直接关闭
+// 本Reactor上没有连接了或者超过drainTimeoutMs时返回true，退出事件循环
+bool WebServer::Drain_(Reactor* r) {
+    if(r->accepting) {
+        r->accepting = false;
+        r->acceptPending = false;
+        for(Listener& l: r->listeners) {
+            // io_uring后端：内核已经替我们accept了、还在队列里的连接接着服务完再排空，队列外的留给新进程
+            if(r->epoller->GetBackend() == Epoller::IO_URING) {
+                AcceptFrom_(r, l);
+            }
+            r->epoller->DelFd(l.fd);
+        }
+        r->nextDrainScan = Clock::now();
+        r->drainScans = 0;
+        // 最后一个停止accept的Reactor关闭监听套接字；平滑升级时新进程还持有它们，套接字本身不会关闭
+        if(acceptStopped_.fetch_add(1) + 1 == reactors_.size()) {
+            for(int fd: ListenFds_()) { close(fd); }
+            listenClosed_ = true;
+        }
+    }
+    // 所有Reactor都停止accept后连接的归属才不再变化
+    if(acceptStopped_ < reactors_.size() || Clock::now() < r->nextDrainScan) {
+        return false;
+    }
+    r->nextDrainScan = Clock::now() + MS(DRAIN_SCAN_MS);
+    int remain = CloseIdle_(r);
+    r->drainScans++;
+    if(remain == 0) {
+        LOG_INFO("Reactor %d drained", r->id);
+        return true;
+    }
+    if(Clock::now() >= drainDeadline_) {
+        LOG_WARN("Reactor %d drain timeout, %d connections left", r->id, remain);
+        return true;
+    }
+    return false;
+}
+
+// 关闭本Reactor上的空闲连接，返回剩余的连接数
+// 刚发完响应、客户端马上要发下一个请求的连接不关，让它拿到Connection: close的响应，避免客户端把请求发到已关闭的连接上
+int WebServer::CloseIdle_(Reactor* r) {
+    int remain = 0;
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lock(r->connMtx);
+        fds = r->conns;     // 关闭连接会改动列表，先拷一份
+    }
+    for(int fd: fds) {
+        ConnMeta& meta = connMeta_[fd];
+        if(meta.reactor.load(std::memory_order_relaxed) != r->id || !users_->Valid(fd)) {
+            continue;
+        }
+        HttpConn* client = users_->Get(fd);
+        if(client->IsClosed()) {
+            continue;
+        }
+        uint32_t requests = meta.requests.load(std::memory_order_relaxed);
+        bool quiet = r->drainScans > 0 && requests == meta.drainSeen;
+        meta.drainSeen = requests;
+        char c;
+        bool idle = quiet && meta.inPool.load(std::memory_order_acquire) == 0 &&
+                    client->ToWriteBytes() == 0 && client->ToReadBytes() == 0 &&
+                    recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0;  // 新请求刚到还没读的不算空闲
+        if(idle) {
+            CloseConn_(r, client);
+        } else {
+            remain++;
+        }
+    }
+    return remain;
+}
+
+StatsSnapshot WebServer::GetStats() const {
+    StatsSnapshot snap;
+    for(auto& r: reactors_) {
+        r->stats.MergeInto(snap);
+    }
+    return snap;
+}
+
+// 汇总计数器写入日志；prefork的worker只发布到共享内存，由master汇总后写日志
+void WebServer::LogStats_() {
+    if(options_.statsSlot) {
+        options_.statsSlot->Publish(GetStats());
+        return;
+    }
+    LogStats(GetStats());
+}
+
+// 计数器写入日志，附带内核统计的全局监听队列溢出数
+void WebServer::LogStats(const StatsSnapshot& snap) {
+    unsigned long long overflows = 0, drops = 0;
+    FILE* fp = fopen("/proc/net/netstat", "r");
+    if(fp) {
+        char names[4096], values[4096];
+        while(fgets(names, sizeof(names), fp) && fgets(values, sizeof(values), fp)) {
+            if(strncmp(names, "TcpExt:", 7) != 0) { continue; }
+            char *nameSave = nullptr, *valueSave = nullptr;
+            char* name = strtok_r(names, " \n", &nameSave);
+            char* value = strtok_r(values, " \n", &valueSave);
+            while(name && value) {
+                if(strcmp(name, "ListenOverflows") == 0) { overflows = strtoull(value, nullptr, 10); }
+                if(strcmp(name, "ListenDrops") == 0) { drops = strtoull(value, nullptr, 10); }
+                name = strtok_r(nullptr, " \n", &nameSave);
+                value = strtok_r(nullptr, " \n", &valueSave);
+            }
+        }
+        fclose(fp);
+    }
+    LOG_INFO("Stats: %s", snap.ToString().c_str());
+    LOG_INFO("Stats: accepts/wakeup=%.2f rearms/request=%.3f requests/batch=%.2f reuse=%.3f requests/conn=%.2f "
+                "events/wakeup=%.2f spinHitRate=%.3f ListenOverflows=%llu ListenDrops=%llu",
+                snap.acceptWakeups ? (double)snap.accepted / snap.acceptWakeups : 0.0,
+                snap.requests ? (double)snap.rearms / snap.requests : 0.0,
+                snap.responseBatches ? (double)snap.requests / snap.responseBatches : 0.0,
+                snap.requests ? (double)snap.reusedRequests / snap.requests : 0.0,
+                snap.accepted ? (double)snap.requests / snap.accepted : 0.0,
+                snap.wakeups ? (double)snap.events / snap.wakeups : 0.0,
+                snap.spinWaits ? (double)snap.spinHits / snap.spinWaits : 0.0, overflows, drops);
+    FileCache* cache = FileCache::Instance();
+    LOG_INFO("Stats: fileCache hits=%zu misses=%zu invalidations=%zu",
+                cache->Hits(), cache->Misses(), cache->Invalidations());
+}
+
+// 新连接直接回503后关闭：非阻塞发送，先半关闭再读掉已到达的请求，避免close时有未读数据而发RST把503冲掉
+void WebServer::SendBusy_(int fd) {
     // assert(fd > 0);
-    int ret = send(fd, info, strlen(info), 0);
+    int ret = send(fd, busyResponse_.data(), busyResponse_.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
     if(ret < 0) {
-        LOG_WARN("send error to client[%d] error!", fd);
+        LOG_DEBUG("send busy to client[%d] error!", fd);
     }
+    shutdown(fd, SHUT_WR);
+    char buf[4096];
+    for(int i = 0; i < 16 && recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0; i++) {}
     close(fd);
 }
 
-void WebServer::CloseConn_(HttpConn* client) {
+// 在途请求超过上限：请求已经读进读缓冲区，直接回503并关闭，不再排队等线程池
+void WebServer::ShedRequest_(Reactor* r, HttpConn* client) {
+    ServerStats::Add(r->stats.shedRequests);
+    // HTTP/2的连接上不能插入HTTP/1.1的503，直接关闭，客户端会在新连接上重试没有完成的流
+    if(!client->IsHttp2()) {
+        send(client->GetFd(), busyResponse_.data(), busyResponse_.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    CloseConn_(r, client);
+}
+
+// 连接数达到上限：监听fd移出Epoller，新连接留在内核accept队列里（队列满后内核丢弃SYN，客户端会重传）
+void WebServer::PauseAccept_(Reactor* r) {
+    if(r->acceptPaused || !r->accepting) { return; }
+    for(Listener& l: r->listeners) {
+        r->epoller->DelFd(l.fd);
+        l.ready = l.pending = false;
+    }
+    r->acceptPaused = true;
+    r->acceptPending = false;
+    r->resumeCheck = Clock::now() + MS(ADMISSION_CHECK_MS);
+    ServerStats::Add(r->stats.acceptPauses);
+    LOG_WARN("Reactor %d pause accept, userCount:%d", r->id, (int)HttpConn::userCount);
+}
+
+// 连接数降到低水位（上限的90%）后重新注册监听fd，ADD时队列里已有连接会立即报告
+void WebServer::TryResumeAccept_(Reactor* r) {
+    if(!r->accepting) {
+        r->acceptPaused = false;    // 已经在排空，不再恢复
+        return;
+    }
+    if(Clock::now() < r->resumeCheck || HttpConn::userCount > maxConns_ / 10 * 9) {
+        return;
+    }
+    for(Listener& l: r->listeners) {
+        r->epoller->AddListenFd(l.fd, l.events);
+    }
+    r->acceptPaused = false;
+    LOG_INFO("Reactor %d resume accept, userCount:%d", r->id, (int)HttpConn::userCount);
+}
+
+void WebServer::CloseConn_(Reactor* r, HttpConn* client) {
     // assert(client);
-    LOG_INFO("Client[%d] quit!", client->GetFd());
-    epoller_->DelFd(client->GetFd());
+    int fd = client->GetFd();
+    LOG_INFO("Client[%d] quit!", fd);
+    {
+        // 和最后一个交换后删掉，O(1)
+        std::lock_guard<std::mutex> lock(r->connMtx);
+        ConnMeta& meta = connMeta_[fd];
+        if(meta.slot >= 0 && size_t(meta.slot) < r->conns.size() && r->conns[meta.slot] == fd) {
+            int last = r->conns.back();
+            r->conns[meta.slot] = last;
+            connMeta_[last].slot = meta.slot;
+            r->conns.pop_back();
+            meta.slot = -1;
+        }
+    }
+    r->epoller->DelFd(fd, true);
     client->Close();
 }
 
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
+// 定时器回调只带fd和代数，连接已关闭且fd被复用时不会误关新连接
+void WebServer::CloseExpired_(Reactor* r, int fd, uint32_t gen) {
+    HttpConn* client = users_->Get(fd, gen);
+    if(client) {
+        ServerStats::Add(r->stats.idleCloses);
+        CloseConn_(r, client);
+    }
+}
+
+bool WebServer::ModConn_(Reactor* r, HttpConn* client, uint32_t events) {
+    int fd = client->GetFd();
+    ServerStats::Add(r->stats.rearms);
+    return r->epoller->ModFd(fd, events, users_->Generation(fd));
+}
+
+// 持久注册的连接交给线程池前先从Epoller摘下，保证同一时刻只有一个线程处理它
+// 任务结束时由Rearm_重新挂回（等价于ONESHOT，但只在交接时才付出epoll_ctl）
+void WebServer::HandOff_(Reactor* r, HttpConn* client, PoolTask task) {
+    int fd = client->GetFd();
+    ServerStats::Add(r->stats.rearms);
+    r->epoller->DelFd(fd);
+    RunInPool_(client, std::bind(task, this, r, client, users_->Generation(fd)));
+}
+
+// 交给线程池执行，任务结束前连接记为忙，排空时不会被当成空闲连接关掉
+void WebServer::RunInPool_(HttpConn* client, std::function<void()> task) {
+    ConnMeta& meta = connMeta_[client->GetFd()];
+    meta.inPool.fetch_add(1, std::memory_order_relaxed);
+    inflight_++;
+    threadpool_->AddTask([this, &meta, task] {
+        task();
+        meta.inPool.fetch_sub(1, std::memory_order_release);
+        inflight_--;
+    });
+}
+
+// EPOLL_CTL_ADD会检查当前就绪状态，摘下期间到达的数据或腾出的发送空间不会丢失
+// 连接在线程池里被关闭时不再挂回；先看关闭标志再看代数，防止fd已被新连接复用
+void WebServer::Rearm_(Reactor* r, HttpConn* client, uint32_t gen) {
+    int fd = client->GetFd();
+    if(client->IsClosed() || users_->Generation(fd) != gen) { return; }
+    ServerStats::Add(r->stats.rearms);
+    r->epoller->AddFd(fd, EPOLLIN | EPOLLOUT | connEvent_, gen);
+}
+
+void WebServer::AddClient_(Reactor* r, int fd, const sockaddr_storage& addr) {
     // assert(fd > 0);
-    users_[fd].init(fd, addr);
+    // fd槽上一次由另一个NUMA节点上的Reactor使用过，重新构造，让缓冲区分配在本节点上
+    ConnMeta& meta = connMeta_[fd];
+    bool rebuild = r->node >= 0 && meta.node.load(std::memory_order_relaxed) != r->node &&
+                    meta.inPool.load(std::memory_order_acquire) == 0 && users_->Generation(fd) != 0;
+    if(rebuild) { ServerStats::Add(r->stats.connRebuilt); }
+    meta.node.store(r->node, std::memory_order_relaxed);
+    uint32_t gen = users_->Acquire(fd, rebuild);
+    HttpConn* client = users_->Get(fd);
+    client->init(fd, addr);
+    if(options_.busyPollUs > 0 && addr.ss_family != AF_UNIX &&
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &options_.busyPollUs, sizeof(options_.busyPollUs)) < 0) {
+        static std::atomic<bool> warned(false);
+        if(!warned.exchange(true)) { LOG_WARN("set SO_BUSY_POLL error: %s", strerror(errno)); }
+    }
+    meta.reactor.store(r->id, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(r->connMtx);
+        meta.slot = r->conns.size();
+        r->conns.push_back(fd);
+    }
     if(timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
-    }
-    epoller_->AddFd(fd, EPOLLIN | connEvent_);
-    SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
-}
-
-// 处理监听套接字，主要逻辑是accept新的套接字，并加入timer和epoller中
-void WebServer::DealListen_() {
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
-    do {
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
-        if(fd <= 0) { return;}
-        else if(HttpConn::userCount >= MAX_FD) {
-            SendError_(fd, "Server busy!");
-            LOG_WARN("Clients is full!");
-            return;
+        r->timer->add(fd, timeoutMS_, std::bind(&WebServer::CloseExpired_, this, r, fd, gen));
+    }
+    r->epoller->AddFd(fd, EPOLLIN | connEvent_ | (PersistentConn_() ? EPOLLOUT : 0), gen);
+    LOG_INFO("Client[%d] in! reactor:%d", fd, r->id);
+}
+
+// 监听fd就绪：只有tag为0的非连接fd才需要查，监听地址一般只有一两个
+bool WebServer::MarkListenReady_(Reactor* r, int fd) {
+    for(Listener& l: r->listeners) {
+        if(l.fd == fd) {
+            l.ready = true;
+            return true;
         }
-        AddClient_(fd, addr);
-    } while(listenEvent_ & EPOLLET);
+    }
+    return false;
+}
+
+// 处理就绪的监听套接字，以及上一轮用完预算还没accept完的
+void WebServer::DealListen_(Reactor* r) {
+    r->acceptPending = false;
+    for(Listener& l: r->listeners) {
+        if(!l.ready && !l.pending) { continue; }
+        l.ready = l.pending = false;
+        AcceptFrom_(r, l);
+        if(r->acceptPaused) { break; }
+        r->acceptPending = r->acceptPending || l.pending;
+    }
 }
 
-// 处理读事件，主要逻辑是将OnRead加入线程池的任务队列中
-void WebServer::DealRead_(HttpConn* client) {
+// accept新的套接字，并加入timer和epoller中
+// 直接拿到非阻塞fd，省掉两次fcntl（epoll后端accept4，io_uring后端从multishot accept的队列里取）；
+// 每个监听套接字每次最多accept acceptBudget个连接
+void WebServer::AcceptFrom_(Reactor* r, Listener& l) {
+    struct sockaddr_storage addr;
+    int cnt = 0;
+    while(cnt < options_.acceptBudget) {
+        int fd = r->epoller->Accept(l.fd, &addr);
+        if(fd < 0) {
+            // 被信号打断、对端在accept前已经断开（RST）：队列里后面的连接还在，ET模式下不会再有通知，接着accept
+            if(errno == EINTR || errno == ECONNABORTED || errno == EPROTO) {
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                ServerStats::Add(r->stats.acceptErrors);
+                LOG_WARN("Accept error: %s", strerror(errno));
+                if(errno == EMFILE || errno == ENFILE) {
+                    PauseAccept_(r);    // fd用完，LT模式下不暂停会一直被唤醒
+                }
+            }
+            break;
+        }
+        cnt++;
+        if(addr.ss_family == AF_UNSPEC && l.isUnix) {
+            addr.ss_family = AF_UNIX;   // 对端地址由HttpConn用到时再取，UNIX域的不用取
+        }
+#ifdef SO_INCOMING_CPU
+        if(options_.incomingCpu && r->cpu >= 0) {
+            int cpu = -1;
+            socklen_t cpuLen = sizeof(cpu);
+            if(getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &cpuLen) == 0 && cpu != r->cpu) {
+                ServerStats::Add(r->stats.incomingCpuMiss);
+            }
+        }
+#endif
+        if(Saturated_() || !users_->Valid(fd)) {
+            // 多个Reactor同时accept时可能略超上限，超出的连接回503
+            ServerStats::Add(r->stats.shedConns);
+            SendBusy_(fd);
+            PauseAccept_(r);
+            break;
+        }
+        AddClient_(r, fd, addr);
+        if(Saturated_()) {
+            PauseAccept_(r);
+            break;
+        }
+    }
+    ServerStats::Add(r->stats.acceptWakeups);
+    ServerStats::Add(r->stats.accepted, cnt);
+    ServerStats::Max(r->stats.acceptMaxBatch, cnt);
+    if(cnt == options_.acceptBudget && !r->acceptPaused) {
+        ServerStats::Add(r->stats.acceptBudgetHits);
+        if(AcceptQueueFull_(l.fd)) {
+            ServerStats::Add(r->stats.acceptQueueFull);
+        }
+        // ET模式不会再有新的通知，本轮事件处理完后继续accept；LT模式epoll会再次报告
+        l.pending = (listenEvent_ & EPOLLET);
+    }
+}
+
+// 监听套接字的TCP_INFO里：tcpi_unacked为当前accept队列长度，tcpi_sacked为backlog上限
+bool WebServer::AcceptQueueFull_(int listenFd) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if(getsockopt(listenFd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return false;
+    }
+    return info.tcpi_unacked >= info.tcpi_sacked;
+}
+
+// 处理读事件
+// POOL：将OnRead加入线程池的任务队列中
+// ADAPTIVE：在Reactor线程上读，请求不需要阻塞操作就直接解析并生成响应，省掉一次跨线程交接
+void WebServer::DealRead_(Reactor* r, HttpConn* client) {
     // assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client)); // 这是一个右值，bind将参数和函数绑定
+    ExtentTime_(r, client);
+    if(options_.dispatch == ServerOptions::DISPATCH_POOL) {
+        if(InflightFull_()) {
+            if(ReadInline_(r, client)) { ShedRequest_(r, client); }
+            return;
+        }
+        ServerStats::Add(r->stats.poolProcess);
+        RunInPool_(client, std::bind(&WebServer::OnRead_, this, r, client)); // 这是一个右值，bind将参数和函数绑定
+        return;
+    }
+    if(!ReadInline_(r, client)) {
+        return;
+    }
+    if(client->ToWriteBytes() > 0) {
+        // 上一个响应还没发完，新请求先留在读缓冲区，发完后再处理
+        DealWrite_(r, client);
+        return;
+    }
+    DealProcess_(r, client);
+}
+
+// 持久注册下读缓冲区里的后续请求不会再有新的边沿通知，一直处理到缓冲区空或响应发不完为止
+// ADAPTIVE：遇到可能阻塞的请求交给线程池
+void WebServer::DealProcess_(Reactor* r, HttpConn* client) {
+    while(client->ToReadBytes() > 0) {
+        if(options_.dispatch == ServerOptions::DISPATCH_ADAPTIVE && client->IsBlocking()) {
+            if(InflightFull_()) {
+                ShedRequest_(r, client);
+                return;
+            }
+            ServerStats::Add(r->stats.poolProcess);
+            HandOff_(r, client, &WebServer::OnPoolProcess_);
+            return;
+        }
+        ServerStats::Add(r->stats.inlineProcess);
+        if(!OnProcess(r, client, options_.dispatch == ServerOptions::DISPATCH_ADAPTIVE)) {
+            return;
+        }
+    }
 }
 
-// 处理写事件，主要逻辑是将OnWrite加入线程池的任务队列中
-void WebServer::DealWrite_(HttpConn* client) {
+// 处理写事件，POOL或者ADAPTIVE下的大响应交给线程池，其余直接在本线程发送
+void WebServer::DealWrite_(Reactor* r, HttpConn* client) {
     // assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    if(PersistentConn_() && client->ToWriteBytes() == 0) {
+        return;     // 持久注册下发送缓冲区腾出空间就会报告EPOLLOUT，没有待发数据直接忽略
+    }
+    ExtentTime_(r, client);
+    if(options_.dispatch == ServerOptions::DISPATCH_POOL) {
+        ServerStats::Add(r->stats.poolWrite);
+        RunInPool_(client, std::bind(&WebServer::OnWrite_, this, r, client));
+        return;
+    }
+    if(options_.dispatch == ServerOptions::DISPATCH_ADAPTIVE &&
+        static_cast<size_t>(client->ToWriteBytes()) >= options_.largeWriteBytes) {
+        ServerStats::Add(r->stats.poolWrite);
+        HandOff_(r, client, &WebServer::OnPoolWrite_);
+        return;
+    }
+    if(OnWrite_(r, client)) {
+        DealProcess_(r, client);
+    }
 }
 
-void WebServer::ExtentTime_(HttpConn* client) {
+// 在Reactor线程上把数据读进读缓冲区，连接出错已关闭时返回false
+bool WebServer::ReadInline_(Reactor* r, HttpConn* client) {
+    int readErrno = 0;
+    ssize_t ret = client->read(&readErrno, r->readFn);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        CloseConn_(r, client);
+        return false;
+    }
+    return true;
+}
+
+void WebServer::ExtentTime_(Reactor* r, HttpConn* client) {
     // assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+    if(timeoutMS_ > 0) { r->timer->adjust(client->GetFd(), timeoutMS_); }
 }
 
-void WebServer::OnRead_(HttpConn* client) {
+void WebServer::OnRead_(Reactor* r, HttpConn* client) {
     // assert(client);
     int ret = -1;
     int readErrno = 0;
-    ret = client->read(&readErrno);         // 读取客户端套接字的数据，读到httpconn的读缓存区
+    ret = client->read(&readErrno, r->readFn);  // 读取客户端套接字的数据，读到httpconn的读缓存区
     if(ret <= 0 && readErrno != EAGAIN) {   // 读异常就关闭客户端
-        CloseConn_(client);
+        CloseConn_(r, client);
         return;
     }
     // 业务逻辑的处理（先读后处理）
-    OnProcess(client);
+    OnProcess(r, client);
 }
 
 /* 处理读（请求）数据的函数 */
-void WebServer::OnProcess(HttpConn* client) {
+// 返回true表示响应已经全部发出且连接保持，持久注册时调用者可以继续处理读缓冲区里的下一个请求
+// 读缓冲区里的流水线请求一次生成一批响应，inlineOnly时批里遇到可能阻塞的请求就停下
+bool WebServer::OnProcess(Reactor* r, HttpConn* client, bool inlineOnly) {
     // 首先调用process()进行逻辑处理
-    if(client->process()) { // 根据返回的信息重新将fd置为EPOLLOUT（写）或EPOLLIN（读）
-    //读完事件就跟内核说可以写了
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);    // 响应成功，修改监听事件为写,等待OnWrite_()发送
-    } else {
-    //写完事件就跟内核说可以读了
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+    int n = client->process(inlineOnly);
+    // HTTP/2没有完成的请求时也可能有要发的帧（SETTINGS确认、PING、WINDOW_UPDATE后的响应体）
+    if(n == 0 && client->ToWriteBytes() == 0) {
+        // HTTP/2的连接上剩下的都是会阻塞的流：让调用者交给线程池
+        if(inlineOnly && client->IsHttp2() && client->IsBlocking()) {
+            return true;
+        }
+        if(!PersistentConn_()) {
+            ModConn_(r, client, connEvent_ | EPOLLIN);
+        }
+        return false;
     }
+    if(n > 0) {
+        ServerStats::Add(r->stats.requests, n);
+        ServerStats::Add(r->stats.responseBatches);
+        connMeta_[client->GetFd()].requests.fetch_add(n, std::memory_order_relaxed);
+        // 连接上的第一个请求不算复用
+        uint32_t total = client->Requests();
+        ServerStats::Add(r->stats.reusedRequests, total > uint32_t(n) ? n : n - 1);
+        uint32_t limit = HttpConn::maxRequests;
+        if(limit > 0 && !client->IsHttp2() && total >= limit && total - n < limit) {
+            ServerStats::Add(r->stats.maxRequestCloses);
+        }
+    }
+    // 生成响应后直接发送（整批一次writev），大多数响应一次就能写完，只有EAGAIN时才需要等EPOLLOUT
+    return OnWrite_(r, client) && PersistentConn_();
 }
 
-void WebServer::OnWrite_(HttpConn* client) {
+// 返回true表示响应已经全部发出且连接保持
+bool WebServer::OnWrite_(Reactor* r, HttpConn* client) {
     // assert(client);
     int ret = -1;
     int writeErrno = 0;
@@ -199,94 +900,242 @@ void WebServer::OnWrite_(HttpConn* client) {
     if(client->ToWriteBytes() == 0) {
         /* 传输完成 */
         if(client->IsKeepAlive()) {
-            // OnProcess(client);
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN); // 回归换成监测读事件
-            return;
+            if(!PersistentConn_()) {
+                // 读缓冲区里还有超出一批的流水线请求：数据已经读出来，不会再有读事件，连接还在本线程手里就接着处理
+                if(client->ToReadBytes() > 0) {
+                    OnProcess(r, client);
+                    return false;   // 之后的注册由OnProcess负责
+                }
+                ModConn_(r, client, connEvent_ | EPOLLIN); // 回归换成监测读事件
+            }
+            return true;
         }
     }
     else if(ret < 0) {
         if(writeErrno == EAGAIN) {  // 缓冲区满了 
-            /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-            return;
+            /* 继续传输，持久注册时等EPOLLOUT边沿即可 */
+            if(!PersistentConn_()) {
+                ModConn_(r, client, connEvent_ | EPOLLOUT);
+            }
+            return false;
         }
     }
-    CloseConn_(client);
+    CloseConn_(r, client);
+    return false;
+}
+
+// 线程池里执行：连接已经由HandOff_从Epoller摘下，处理完读缓冲区里的请求后重新挂回
+void WebServer::OnPoolProcess_(Reactor* r, HttpConn* client, uint32_t gen) {
+    while(client->ToReadBytes() > 0 && OnProcess(r, client)) {}
+    Rearm_(r, client, gen);
+}
+
+void WebServer::OnPoolWrite_(Reactor* r, HttpConn* client, uint32_t gen) {
+    if(OnWrite_(r, client)) {
+        OnPoolProcess_(r, client, gen);
+        return;
+    }
+    Rearm_(r, client, gen);
 }
 
 /* Create listenFd */
+// 每个监听地址一组监听套接字，全部注册到各Reactor的Epoller里
 bool WebServer::InitSocket_() {
-    int ret;
-    struct sockaddr_in addr;
-    if(port_ > 65535 || port_ < 1024) {
+    std::vector<Endpoint> endpoints;
+    if(!Endpoint::ParseList(options_.listen, port_, &endpoints)) {
+        LOG_ERROR("Listen \"%s\" error!", options_.listen.c_str());
+        return false;
+    }
+    if(options_.listen.empty() && (port_ > 65535 || port_ < 1024)) {
         LOG_ERROR("Port:%d error!",  port_);
         return false;
     }
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port_);
+
+    uint32_t listenEvent = listenEvent_ | EPOLLIN;
+    /* 共享监听fd：EPOLLEXCLUSIVE 避免一次连接唤醒所有Reactor（不能与EPOLLRDHUP同用） */
+    uint32_t sharedEvent = (listenEvent & ~EPOLLRDHUP) | EPOLLEXCLUSIVE;
+
+    // 平滑升级/prefork启动：沿用继承来的监听套接字，不重新bind，accept队列里的连接不会丢
+    // 按绑定的地址分组，每组对应一个监听地址
+    std::vector<int> inherited = HotUpgrade::InheritedListenFds();
+    if(!inherited.empty()) {
+        for(auto& group: Endpoint::GroupByAddress(inherited)) {
+            // 不是SO_REUSEPORT的fd可能被多个Reactor或prefork的多个worker进程共享，用EPOLLEXCLUSIVE避免惊群
+            int reuse = 0;
+            socklen_t reuseLen = sizeof(reuse);
+            getsockopt(group[0], SOL_SOCKET, SO_REUSEPORT, &reuse, &reuseLen);
+            uint32_t events = (group.size() < reactors_.size() || !reuse) ? sharedEvent : listenEvent;
+            for(size_t i = 0; i < reactors_.size(); i++) {
+                if(!AddListener_(reactors_[i].get(), group[i % group.size()], events)) { return false; }
+            }
+            for(size_t i = reactors_.size(); i < group.size(); i++) {
+                LOG_WARN("Inherited listen fd %d unused, only %zu reactors", group[i], reactors_.size());
+                close(group[i]);
+            }
+        }
+        LOG_INFO("Server %zu listen fds inherited", inherited.size());
+        return true;
+    }
+
+    bool reusePort = IsMultiReactor_() && options_.reusePort;
+    for(const Endpoint& ep: endpoints) {
+        // UNIX域套接字不支持SO_REUSEPORT，总是共享一个fd
+        bool perReactor = reusePort && !ep.IsUnix();
+        int sharedFd = -1;
+        if(!perReactor) {
+            sharedFd = CreateListenFd(ep, openLinger_, false, options_);
+            if(sharedFd < 0) { return false; }
+        }
+        for(auto& r: reactors_) {
+            int fd = perReactor ? CreateListenFd(ep, openLinger_, true, options_) : sharedFd;
+            if(fd < 0) { return false; }
+#ifdef SO_INCOMING_CPU
+            if(perReactor && options_.incomingCpu && r->cpu >= 0 &&
+                setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &r->cpu, sizeof(r->cpu)) < 0) {
+                LOG_WARN("set SO_INCOMING_CPU error !");
+            }
+#endif
+            if(!AddListener_(r.get(), fd, (perReactor || !IsMultiReactor_()) ? listenEvent : sharedEvent)) {
+                return false;
+            }
+        }
+        LOG_INFO("Server listen on %s", ep.text.c_str());
+    }
+    return true;
+}
+
+bool WebServer::AddListener_(Reactor* r, int fd, uint32_t events) {
+    Listener l;
+    l.fd = fd;
+    l.events = events;
+    l.ready = false;
+    l.pending = false;
+    struct sockaddr_storage local;
+    socklen_t len = sizeof(local);
+    l.isUnix = getsockname(fd, (struct sockaddr *)&local, &len) == 0 && local.ss_family == AF_UNIX;
+    r->listeners.push_back(l);
+    if(!r->epoller->AddListenFd(fd, events)) {    // 将监听套接字加入epoller
+        LOG_ERROR("Add listen error!");
+        return false;
+    }
+    return true;
+}
+
+// 创建监听套接字，prefork模式下由Master调用，所以不依赖成员变量
+int WebServer::CreateListenFd(const Endpoint& ep, bool openLinger, bool reusePort, const ServerOptions& options) {
+    int ret;
+    int listenFd;
 
     // 优雅关闭
     {
     struct linger optLinger = { 0 };
-    if(openLinger_) {
+    if(openLinger) {
         /* 优雅关闭: 直到所剩数据发送完毕或超时 */
         optLinger.l_onoff = 1;
         optLinger.l_linger = 1;
     }
 
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(listenFd_ < 0) {
-        LOG_ERROR("Create socket error!", port_);
-        return false;
+    listenFd = socket(ep.Family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listenFd < 0) {
+        LOG_ERROR("Create socket %s error!", ep.text.c_str());
+        return -1;
     }
 
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
     if(ret < 0) {
-        close(listenFd_);
-        LOG_ERROR("Init linger error!", port_);
-        return false;
+        close(listenFd);
+        LOG_ERROR("Init linger error!");
+        return -1;
     }
     }
 
+    if(ep.IsUnix()) {
+        return ListenUnix_(listenFd, ep, options);
+    }
+
+    /* 双栈：IPv6套接字同时接受IPv4连接（对端地址为::ffff:a.b.c.d） */
+    if(ep.Family() == AF_INET6) {
+        int v6only = 0;
+        if(setsockopt(listenFd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
+            LOG_WARN("set IPV6_V6ONLY error !");
+        }
+    }
+
     int optval = 1;
     /* 端口复用 */
     /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if(ret == -1) {
         LOG_ERROR("set socket setsockopt error !");
-        close(listenFd_);
-        return false;
+        close(listenFd);
+        return -1;
+    }
+
+    /* 多Reactor：每个Reactor绑定同一端口，由内核按四元组哈希分发新连接 */
+    if(reusePort) {
+        ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));
+        if(ret == -1) {
+            LOG_ERROR("set SO_REUSEPORT error !");
+            close(listenFd);
+            return -1;
+        }
     }
 
     // 绑定
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    ret = bind(listenFd, (const struct sockaddr *)&ep.addr, ep.len);
     if(ret < 0) {
-        LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
-        return false;
+        LOG_ERROR("Bind %s error: %s", ep.text.c_str(), strerror(errno));
+        close(listenFd);
+        return -1;
+    }
+
+    /* 三次握手完成后等客户端发来请求数据再放进accept队列 */
+    if(options.deferAcceptSec > 0) {
+        ret = setsockopt(listenFd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                        &options.deferAcceptSec, sizeof(options.deferAcceptSec));
+        if(ret == -1) {
+            LOG_WARN("set TCP_DEFER_ACCEPT error !");
+        }
     }
 
     // 监听
-    ret = listen(listenFd_, 6);
+    ret = listen(listenFd, options.listenBacklog);
     if(ret < 0) {
-        LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
-        return false;
+        LOG_ERROR("Listen %s error!", ep.text.c_str());
+        close(listenFd);
+        return -1;
     }
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);  // 将监听套接字加入epoller
-    if(ret == 0) {
-        LOG_ERROR("Add listen error!");
-        close(listenFd_);
-        return false;
+    SetFdNonblock(listenFd);
+    return listenFd;
+}
+
+// UNIX域套接字：文件路径上残留的套接字文件（上次没有删除）先确认没有进程在监听再删掉
+int WebServer::ListenUnix_(int listenFd, const Endpoint& ep, const ServerOptions& options) {
+    const struct sockaddr_un* un = reinterpret_cast<const struct sockaddr_un*>(&ep.addr);
+    struct stat st;
+    if(un->sun_path[0] != '\0' && stat(un->sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(probe >= 0 && connect(probe, (const struct sockaddr *)&ep.addr, ep.len) < 0 && errno == ECONNREFUSED) {
+            unlink(un->sun_path);
+        }
+        if(probe >= 0) { close(probe); }
     }
-    SetFdNonblock(listenFd_);   
-    LOG_INFO("Server port:%d", port_);
-    return true;
+    if(bind(listenFd, (const struct sockaddr *)&ep.addr, ep.len) < 0) {
+        LOG_ERROR("Bind %s error: %s", ep.text.c_str(), strerror(errno));
+        close(listenFd);
+        return -1;
+    }
+    if(listen(listenFd, options.listenBacklog) < 0) {
+        LOG_ERROR("Listen %s error!", ep.text.c_str());
+        close(listenFd);
+        return -1;
+    }
+    SetFdNonblock(listenFd);
+    return listenFd;
 }
 
 // 设置非阻塞
 int WebServer::SetFdNonblock(int fd) {
     // assert(fd > 0);
-    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
 }
@@ -2,69 +2,248 @@
 #define WEBSERVER_H
 
 #include <unordered_map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_DEFER_ACCEPT, TCP_INFO
 #include <arpa/inet.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
 
 #include "epoller.h"
+#include "serverstats.h"
+#include "hotupgrade.h"
+#include "endpoint.h"
 #include "../timer/rbtreetimer.h"
 
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
+#include "../pool/connslab.h"
+#include "../pool/affinity.h"
 
 #include "../http/httpconn.h"
 
+// 高级选项
+struct ServerOptions {
+    // 请求分发方式
+    // POOL：读-解析-写全部交给线程池（原有方式）
+    // ADAPTIVE：在Reactor线程上读，只有可能阻塞的请求（POST可能查数据库）和大响应的发送交给线程池
+    // INLINE：全部在Reactor线程上处理
+    // ADAPTIVE/INLINE下连接以EPOLLIN|EPOLLOUT|EPOLLET持久注册，keep-alive请求之间不再epoll_ctl
+    enum Dispatch { DISPATCH_POOL, DISPATCH_ADAPTIVE, DISPATCH_INLINE };
+
+    int reactorNum = 1;         // Reactor线程数，>1 时每个线程独立一个Epoller（one loop per thread）
+    bool reusePort = true;      // 多Reactor时：true 每个Reactor独立的SO_REUSEPORT监听套接字，false 共享监听fd + EPOLLEXCLUSIVE
+    Epoller::Backend ioBackend = Epoller::EPOLL;    // 事件后端：epoll / io_uring
+    Dispatch dispatch = DISPATCH_ADAPTIVE;
+    size_t largeWriteBytes = 256 * 1024;    // ADAPTIVE时待发送字节数超过该值的响应交给线程池发送
+    size_t maxBodyBytes = 8 * 1024 * 1024;  // 请求体上限（Content-Length或chunked解码后），超过回413
+    size_t bodyMemBytes = 64 * 1024;        // 请求体超过该值时不再放内存，写到bodySpillDir下的临时文件
+    std::string bodySpillDir = "/tmp";      // 请求体临时文件目录，支持O_TMPFILE时文件不可见且关闭即删除
+    bool h2c = true;            // 接受明文HTTP/2：连接前言（prior knowledge）或Upgrade: h2c
+    int maxKeepAliveRequests = 1000;    // 每个连接最多处理的HTTP/1.x请求数，达到后回Connection: close，0不限
+                                        // 空闲超时就是构造参数timeoutMS，写进响应的Keep-Alive头
+    size_t fileCacheEntries = 1024;     // 静态文件缓存的条目数（映射、长度、类型和响应头），0不缓存
+    int listenBacklog = SOMAXCONN;  // listen()的backlog（内核会再按net.core.somaxconn截断）
+    int acceptBudget = 64;      // 每次监听套接字就绪最多accept的连接数，避免accept风暴饿死已建立的连接
+    int deferAcceptSec = 0;     // >0 开启TCP_DEFER_ACCEPT：客户端发来数据后才唤醒accept
+    int statsIntervalMs = 0;    // >0 时按该间隔把计数器汇总写入日志
+    int maxEvents = 1024;       // 每次Wait最多取回的事件数，实际批大小随负载自动伸缩
+
+    // 低延迟模式：用CPU换延迟
+    int spinUs = 0;             // >0 时阻塞等待前先以0超时轮询这么多微秒
+    int busyPollUs = 0;         // >0 时给新连接设置SO_BUSY_POLL（超过net.core.busy_read需要CAP_NET_ADMIN）
+    int drainTimeoutMs = 30000; // 平滑升级/退出时等待在途请求完成的最长时间
+
+    // 准入控制：超过上限时把监听fd移出Epoller，让内核accept队列吸收突发流量，降到低水位（90%）再恢复
+    int maxConns = 0;           // 最大连接数，0表示只受连接表大小（MAX_FD）限制
+    int maxInflight = 0;        // 交给线程池还没处理完的请求上限，超过直接回503，0不限制
+    int retryAfterSec = 1;      // 503响应里的Retry-After
+
+    // 绑核，CPU列表写法同taskset，例如"0-3,8"，空串不绑
+    std::string reactorCpus;    // Reactor i绑定到列表里第i个CPU（循环使用）
+    std::string workerCpus;     // 线程池工作线程绑定到这组CPU
+    std::string logCpus;        // 异步日志写线程绑定到这组CPU
+    bool incomingCpu = false;   // SO_REUSEPORT多Reactor时给每个监听套接字设置SO_INCOMING_CPU，
+                                // 内核优先把在该CPU上收到的连接交给绑在同一CPU的Reactor
+
+    // 监听地址列表，逗号分隔，写法见endpoint.h，例如"1316,[::]:8080,unix:/run/blog.sock"
+    // 空串时监听构造参数port的IPv4任意地址
+    std::string listen;
+
+    // 多进程（prefork）：>0 时由Master绑定端口并fork这么多个worker进程，每个进程运行一个完整的WebServer，
+    // 进程崩溃只影响它自己的连接，日志、数据库连接池等单例也各进程一份
+    int workerProcesses = 0;
+    bool hotUpgrade = true;     // 响应kill -USR2平滑升级；prefork的worker由Master统一升级，置为false
+
+    // 以下由Master在fork出worker时设置
+    int workerIndex = 0;        // worker序号，Reactor绑核从reactorCpus的第workerIndex * reactorNum个开始
+    StatsSlot* statsSlot = nullptr; // 非空时计数器按statsIntervalMs发布到这个共享内存槽，由Master汇总写日志
+};
+
 class WebServer {
 public:
     WebServer(
-        int port, int trigMode, int timeoutMS, bool OptLinger, 
-        int sqlPort, const char* sqlUser, const  char* sqlPwd, 
+        int port, int trigMode, int timeoutMS, bool OptLinger,
+        int sqlPort, const char* sqlUser, const  char* sqlPwd,
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        const ServerOptions& options = ServerOptions());
 
     ~WebServer();
+    // 运行事件循环，直到排空退出
+    // kill -USR2：启动新的二进制并把监听套接字交给它，新进程就绪后本进程排空连接退出
+    // kill -QUIT：停止accept，排空连接后退出
     void Start();
+    StatsSnapshot GetStats() const;     // 汇总所有Reactor的计数器
+
+    // 以下供prefork的Master使用
+    static int CreateListenFd(const Endpoint& ep, bool openLinger, bool reusePort, const ServerOptions& options);
+    static void LogStats(const StatsSnapshot& snap);
 
 private:
-    bool InitSocket_(); 
+    // 监听套接字：每个监听地址一个，SO_REUSEPORT时各Reactor独立，否则所有Reactor共享同一个fd
+    struct Listener {
+        int fd;
+        uint32_t events;        // 注册的事件，暂停accept后按原样重新注册
+        bool ready;             // 本轮Wait报告了可读
+        bool pending;           // ET模式下用完accept预算，队列里可能还有连接
+        bool isUnix;            // UNIX域监听套接字，io_uring后端accept到的连接不带地址，靠它区分
+    };
+
+    // 每个Reactor线程独立拥有的状态，连接从accept到关闭都留在同一个Reactor上
+    struct Reactor {
+        int id;
+        int cpu;                // 绑定的CPU，-1不绑
+        int node;               // cpu所在的NUMA节点，-1未知
+        std::vector<Listener> listeners;
+        int wakeFd;             // eventfd，信号处理和排空通知用它唤醒阻塞在Wait里的Reactor
+        std::unique_ptr<Epoller> epoller;
+        HttpConn::ReadFn readFn;    // io_uring后端从Epoller取recv收下的数据，epoll后端为空（直接readv）
+        std::unique_ptr<RbtreeTimer> timer;
+        bool acceptPending;     // 有监听套接字用完了accept预算，下一轮不阻塞
+        bool accepting;         // 排空时置false并把监听fd移出Epoller
+        bool acceptPaused;      // 连接数达到上限，监听fd暂时移出Epoller
+        TimeStamp resumeCheck;
+        TimeStamp nextDrainScan;
+        int drainScans;
+        // 本Reactor上打开的连接，排空时只扫描这些；线程池里也会关闭连接，所以加锁
+        std::mutex connMtx;
+        std::vector<int> conns;
+        ServerStats stats;
+    };
+
+    // 连接所属的Reactor和正在执行的线程池任务数，排空时用来找出各Reactor上的空闲连接
+    struct ConnMeta {
+        std::atomic<int> reactor{-1};
+        std::atomic<int> inPool{0};
+        std::atomic<uint32_t> requests{0};
+        std::atomic<int> node{-1};  // 连接对象（含缓冲区）最近一次在哪个NUMA节点上构造
+        uint32_t drainSeen = 0;     // 上一次排空扫描时的requests，只由所属Reactor读写
+        int slot = -1;              // 在所属Reactor的conns里的下标，由connMtx保护
+    };
+
+    bool InitSocket_();
     void InitEventMode_(int trigMode);
-    void AddClient_(int fd, sockaddr_in addr);
-  
-    void DealListen_();
-    void DealWrite_(HttpConn* client);
-    void DealRead_(HttpConn* client);
+    bool AddListener_(Reactor* r, int fd, uint32_t events);
+    static int ListenUnix_(int listenFd, const Endpoint& ep, const ServerOptions& options);
+    void AddClient_(Reactor* r, int fd, const sockaddr_storage& addr);
+
+    void Loop_(Reactor* r);
+    int WaitEvents_(Reactor* r, int timeMS);
+    bool MarkListenReady_(Reactor* r, int fd);
+    void DealListen_(Reactor* r);
+    void AcceptFrom_(Reactor* r, Listener& l);
+    void DealWrite_(Reactor* r, HttpConn* client);
+    void DealRead_(Reactor* r, HttpConn* client);
+    void DealWakeup_(Reactor* r);
+
+    void InitSignal_();
+    static void OnSignal_(int sig);
+    std::vector<int> ListenFds_() const;
+    void StartUpgrade_();
+    void OnUpgradeReady_();
+    void StartDrain_();
+    bool Drain_(Reactor* r);
+    int CloseIdle_(Reactor* r);
+
+    void SendBusy_(int fd);
+    void ShedRequest_(Reactor* r, HttpConn* client);
+    bool Saturated_() const { return HttpConn::userCount >= maxConns_; }
+    bool InflightFull_() const { return options_.maxInflight > 0 && inflight_ >= options_.maxInflight; }
+    void PauseAccept_(Reactor* r);
+    void TryResumeAccept_(Reactor* r);
+    void LogStats_();
+    static bool AcceptQueueFull_(int listenFd);
+    void ExtentTime_(Reactor* r, HttpConn* client);
+    void CloseConn_(Reactor* r, HttpConn* client);
+    void CloseExpired_(Reactor* r, int fd, uint32_t gen);
+    bool ModConn_(Reactor* r, HttpConn* client, uint32_t events);
+
+    typedef void (WebServer::*PoolTask)(Reactor*, HttpConn*, uint32_t);
+    void HandOff_(Reactor* r, HttpConn* client, PoolTask task);
+    void RunInPool_(HttpConn* client, std::function<void()> task);
+    void Rearm_(Reactor* r, HttpConn* client, uint32_t gen);
 
-    void SendError_(int fd, const char*info);
-    void ExtentTime_(HttpConn* client);
-    void CloseConn_(HttpConn* client);
+    void OnRead_(Reactor* r, HttpConn* client);
+    bool OnWrite_(Reactor* r, HttpConn* client);
+    bool OnProcess(Reactor* r, HttpConn* client, bool inlineOnly = false);
+    void DealProcess_(Reactor* r, HttpConn* client);
+    bool ReadInline_(Reactor* r, HttpConn* client);
+    void OnPoolProcess_(Reactor* r, HttpConn* client, uint32_t gen);
+    void OnPoolWrite_(Reactor* r, HttpConn* client, uint32_t gen);
 
-    void OnRead_(HttpConn* client);
-    void OnWrite_(HttpConn* client);
-    void OnProcess(HttpConn* client);
+    bool IsMultiReactor_() const { return reactors_.size() > 1; }
+    // 连接是否持久注册（非ONESHOT）
+    bool PersistentConn_() const { return options_.dispatch != ServerOptions::DISPATCH_POOL; }
 
     static const int MAX_FD = 65536;
+    static const int DRAIN_SCAN_MS = 100;
+    static const int ADMISSION_CHECK_MS = 50;
 
     static int SetFdNonblock(int fd);
 
     int port_;
     bool openLinger_;
     int timeoutMS_;  /* 毫秒MS */
-    bool isClose_;
-    int listenFd_;
+    std::atomic<bool> isClose_;
     char* srcDir_;
-    
+    ServerOptions options_;
+
     uint32_t listenEvent_;  // 监听事件
     uint32_t connEvent_;    // 连接事件
-   
-    std::unique_ptr<RbtreeTimer> timer_;
+
     std::unique_ptr<ThreadPool> threadpool_;
-    std::unique_ptr<Epoller> epoller_;
-    std::unordered_map<int, HttpConn> users_;
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    std::unique_ptr<ConnSlab<HttpConn>> users_;     // 以fd为下标的连接表，所有Reactor共用
+    std::unique_ptr<ConnMeta[]> connMeta_;
+
+    // 准入控制
+    int maxConns_;
+    std::atomic<int> inflight_;         // 线程池里排队或执行中的任务数
+    std::string busyResponse_;          // 预先生成的503响应
+
+    // 平滑升级/排空
+    std::string exePath_;
+    std::atomic<bool> draining_;
+    TimeStamp drainDeadline_;           // 在draining_置位之前写好
+    std::atomic<size_t> acceptStopped_; // 已停止accept的Reactor数
+    std::atomic<bool> listenClosed_;
+    pid_t upgradePid_;
+    int upgradeReadyFd_;                // 只在Reactor 0上注册
+
+    static int signalWakeFd_;
+    static volatile sig_atomic_t upgradeSignal_;
+    static volatile sig_atomic_t quitSignal_;
 };
 
 #endif //WEBSERVER_H
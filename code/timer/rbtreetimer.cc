@@ -14,7 +14,12 @@ void RbtreeTimer::adjust(int id,int newExipires) {
 }
 
 void RbtreeTimer::add(int id, int timeOut, const TimeoutCallBack& cb) {
-    TimerNode node{id, Clock::now() + MS(timeOut),cb};
+    // id（fd）被复用时先删掉旧结点，否则旧结点到期时会把新结点的映射一起删掉
+    auto iter = timermap_.find(id);
+    if(iter != timermap_.end()) {
+        timerset_.erase(iter -> second);
+    }
+    TimerNode node{static_cast<uint64_t>(id), Clock::now() + MS(timeOut),cb};
     timerset_.insert(node);
     timermap_[id] = node;
 }
@@ -0,0 +1,1172 @@
+#include <gtest/gtest.h>
+#include "../code/http/httprequest.h"
+#include "../code/http/httprespon.h"
+#include "../code/http/hpack.h"
+#include "../code/http/http2session.h"
+#include "../code/http/httpconn.h"
+#include <sys/socket.h>
+
+/*
+    HttpRequest解析器的一致性测试
+    编译运行: cd build && make test
+*/
+
+// 统计堆分配次数，验证稳态下处理请求不分配内存
+static size_t g_newCount = 0;
+
+void* operator new(size_t n) {
+    g_newCount++;
+    void* p = malloc(n);
+    if(!p) { throw std::bad_alloc(); }
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+class HttpRequestTest : public ::testing::Test {
+protected:
+    Buffer buffer;
+    HttpRequest request;
+
+    // 上一个请求完成后parse()自动开始下一个，不完整时接着上次的进度
+    HttpRequest::PARSE_RESULT Parse(const std::string& raw) {
+        buffer.Append(raw);
+        return request.parse(buffer);
+    }
+};
+
+TEST_F(HttpRequestTest, SimpleGet) {
+    ASSERT_EQ(Parse("GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.method(), "GET");
+    EXPECT_EQ(request.path(), "/index.html");
+    EXPECT_EQ(request.version(), "1.1");
+    EXPECT_EQ(request.GetHeader("Host"), "localhost");
+    EXPECT_EQ(buffer.ReadableBytes(), 0u);
+}
+
+TEST_F(HttpRequestTest, DefaultPages) {
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.path(), "/index.html");
+    ASSERT_EQ(Parse("GET /login HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.path(), "/login.html");
+    ASSERT_EQ(Parse("GET /login.css HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.path(), "/login.css");
+}
+
+// 路由：字面量优先于参数，参数优先于通配，匹配不到时回退；按方法挑，HEAD可以用GET的路由
+TEST_F(HttpRequestTest, RouteParams) {
+    Router* router = Router::Instance();
+    ASSERT_TRUE(router->Handle("GET", "/post/:id", nullptr));
+    ASSERT_TRUE(router->Handle("GET", "/post/new", nullptr));
+    ASSERT_TRUE(router->Handle("GET", "/post/:id/comment/:cid", nullptr));
+    ASSERT_TRUE(router->Handle("DELETE", "/post/:id", nullptr));
+    ASSERT_TRUE(router->Add("GET", "/static/*file", "/static.html", nullptr));
+    EXPECT_FALSE(router->Handle("GET", "post", nullptr));
+    EXPECT_FALSE(router->Handle("GET", "/a/:", nullptr));
+    EXPECT_FALSE(router->Handle("GET", "/a/*rest/b", nullptr));
+
+    std::string_view values[Router::MAX_PARAMS];
+    size_t count = 0;
+    const Router::Route* route = router->Match("GET", "/post/new", values, &count);
+    ASSERT_NE(route, nullptr);
+    EXPECT_TRUE(route->params.empty());
+    route = router->Match("HEAD", "/post/newer", values, &count);
+    ASSERT_NE(route, nullptr);
+    ASSERT_EQ(count, 1u);
+    EXPECT_EQ(values[0], "newer");
+    route = router->Match("DELETE", "/post/7", values, &count);
+    ASSERT_NE(route, nullptr);
+    EXPECT_EQ(route->method, "DELETE");
+    EXPECT_EQ(router->Match("PUT", "/post/7", values, &count), nullptr);
+    EXPECT_EQ(router->Match("GET", "/post/", values, &count), nullptr);
+    EXPECT_EQ(router->Match("GET", "/post/7/comment", values, &count), nullptr);
+    EXPECT_EQ(router->Match("GET", "/posts", values, &count), nullptr);
+
+    ASSERT_EQ(Parse("GET /post/42/comment/x%20y?sort=new HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    ASSERT_NE(request.GetRoute(), nullptr);
+    EXPECT_EQ(request.Param("id"), "42");
+    EXPECT_EQ(request.Param("cid"), "x%20y");
+    EXPECT_EQ(request.Param("missing"), "");
+    EXPECT_EQ(request.path(), "/post/42/comment/x%20y?sort=new");
+    ASSERT_EQ(Parse("GET /static/css/a.css HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.Param("file"), "css/a.css");      // 参数在改写路径之前拷了出来
+    EXPECT_EQ(request.path(), "/static.html");
+    ASSERT_EQ(Parse("GET /nothing/here HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.GetRoute(), nullptr);
+    EXPECT_EQ(request.path(), "/nothing/here");
+}
+
+TEST_F(HttpRequestTest, HeaderNameCaseAndWhitespace) {
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\nuser-agent:   curl/8.0 \t\r\nX-Empty:\r\nACCEPT: */*\r\n\r\n"),
+                HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.GetHeader("User-Agent"), "curl/8.0");
+    EXPECT_EQ(request.GetHeader("x-empty"), "");
+    EXPECT_EQ(request.GetHeader("Accept"), "*/*");
+    EXPECT_EQ(request.GetHeader("Missing"), "");
+    EXPECT_EQ(request.HeaderCount(), 3u);
+}
+
+TEST_F(HttpRequestTest, BareLineFeedAndLeadingEmptyLines) {
+    ASSERT_EQ(Parse("\r\n\nGET /a HTTP/1.0\nHost: x\n\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.path(), "/a");
+    EXPECT_EQ(request.version(), "1.0");
+    EXPECT_EQ(request.GetHeader("Host"), "x");
+}
+
+TEST_F(HttpRequestTest, KeepAlive) {
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_TRUE(request.IsKeepAlive());
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\nConnection: Keep-Alive\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_TRUE(request.IsKeepAlive());
+    ASSERT_EQ(Parse("GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_TRUE(request.IsKeepAlive());
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\nConnection: close\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_FALSE(request.IsKeepAlive());
+    // HTTP/1.1默认保持连接，HTTP/1.0默认关闭；Connection是选项列表
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_TRUE(request.IsKeepAlive());
+    ASSERT_EQ(Parse("GET / HTTP/1.0\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_FALSE(request.IsKeepAlive());
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\nConnection: Upgrade, Close\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_FALSE(request.IsKeepAlive());
+    ASSERT_EQ(Parse("GET / HTTP/1.0\r\nConnection: TE ,keep-alive\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_TRUE(request.IsKeepAlive());
+}
+
+// 数据一个字节一个字节到达：不完整时缓冲区原样保留、解析进度保留，补齐后解析成功
+TEST_F(HttpRequestTest, Incomplete) {
+    const std::string raw = "GET /picture HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\n";
+    for(size_t i = 0; i < raw.size() - 1; i++) {
+        ASSERT_EQ(Parse(raw.substr(i, 1)), HttpRequest::PARSE_AGAIN) << "at byte " << i;
+        ASSERT_EQ(buffer.ReadableBytes(), i + 1);
+    }
+    ASSERT_EQ(Parse(raw.substr(raw.size() - 1)), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.path(), "/picture.html");
+    EXPECT_EQ(request.GetHeader("Accept"), "*/*");
+    EXPECT_EQ(buffer.ReadableBytes(), 0u);
+}
+
+// 续传过程中缓冲区多次扩容搬家，之前解析出的请求头依然正确
+TEST_F(HttpRequestTest, ResumeAcrossBufferGrowth) {
+    Buffer small(64);
+    std::string raw = "GET /a HTTP/1.1\r\n";
+    for(int i = 0; i < 100; i++) {
+        raw += "X-H" + std::to_string(i) + ": " + std::string(i, 'v') + "\r\n";
+    }
+    raw += "Content-Length: 5\r\n\r\nhello";
+    for(size_t pos = 0; pos < raw.size(); pos += 37) {
+        small.Append(raw.substr(pos, 37));
+        ASSERT_EQ(request.parse(small), pos + 37 >= raw.size() ? HttpRequest::PARSE_OK : HttpRequest::PARSE_AGAIN);
+    }
+    EXPECT_EQ(request.HeaderCount(), 101u);
+    EXPECT_EQ(request.GetHeader("x-h0"), "");
+    EXPECT_EQ(request.GetHeader("X-H99"), std::string(99, 'v'));
+    EXPECT_EQ(request.HeaderAt(0).first, "Content-Length");    // 已知请求头排在前面
+    EXPECT_EQ(request.HeaderAt(1 + 42).first, "X-H42");
+    EXPECT_EQ(request.body(), "hello");
+    EXPECT_EQ(small.ReadableBytes(), 0u);
+}
+
+TEST_F(HttpRequestTest, PostBody) {
+    const std::string head = "POST /form HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                             "Content-Length: 10\r\n\r\n";
+    ASSERT_EQ(Parse(head + "a=1&b=x"), HttpRequest::PARSE_AGAIN);
+    ASSERT_EQ(Parse("+yz"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.body().size(), 10u);
+    EXPECT_EQ(request.GetPost("a"), "1");
+    EXPECT_EQ(request.GetPost("b"), "x yz");
+    EXPECT_EQ(buffer.ReadableBytes(), 0u);
+}
+
+// '+'和%XX解码，不合法的'%'原样保留
+TEST_F(HttpRequestTest, UrlDecode) {
+    const struct {
+        const char* in;
+        const char* out;
+    } corpus[] = {
+        {"plain", "plain"}, {"a+b", "a b"}, {"%41%2b%2B+x", "A++ x"}, {"%e4%B8%AD", "\xe4\xb8\xad"},
+        {"100%", "100%"}, {"%4", "%4"}, {"%zz%4g", "%zz%4g"}, {"%%41", "%A"}, {"", ""},
+    };
+    for(const auto& c: corpus) {
+        std::string buf(c.in);
+        buf.resize(HttpRequest::UrlDecode(buf, &buf[0]));   // 原样解码
+        EXPECT_EQ(buf, c.out) << c.in;
+    }
+    ASSERT_EQ(Parse("POST /form HTTP/1.1\r\ncontent-type: Application/X-WWW-Form-Urlencoded; charset=utf-8\r\n"
+                    "Content-Length: 38\r\n\r\nname=tom&msg=hi%21+there&&flag&a=1&a=2"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.GetPost("name"), "tom");
+    EXPECT_EQ(request.GetPost("msg"), "hi! there");
+    EXPECT_EQ(request.GetPost("flag"), "");
+    EXPECT_EQ(request.GetPost("a"), "2");               // 重复的字段取最后一个
+}
+
+// 记录multipart文件部分的sink
+struct UploadRecorder : MultipartSink {
+    std::vector<std::string> names, filenames, types, data;
+    int ended = 0;
+    bool OnPartBegin(const MultipartPart& part) override {
+        names.emplace_back(part.name);
+        filenames.emplace_back(part.filename);
+        types.emplace_back(part.contentType);
+        data.emplace_back();
+        return true;
+    }
+    bool OnPartData(const char* p, size_t len) override {
+        data.back().append(p, len);
+        return true;
+    }
+    bool OnPartEnd() override {
+        ended++;
+        return true;
+    }
+};
+
+static std::string MultipartRequest(const std::string& body) {
+    return "POST /upload HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=\"XyZ\"\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+// multipart表单按任意切分到达：文本字段进GetPost()，文件部分交给sink，数据里有分隔符的前缀
+TEST_F(HttpRequestTest, MultipartForm) {
+    std::string file = "line1\r\n--Xy\r\r\n--XyY\r";    // 几处差一点就是分隔符
+    for(int i = 0; i < 64; i++) { file += char('a' + i % 26); }
+    const std::string body = "preamble\r\n--XyZ\r\n"
+                             "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+                             "hello world\r\n--XyZ  \r\n"
+                             "content-disposition: form-data; name=\"doc\"; filename=\"a;b.txt\"\r\n"
+                             "Content-Type: text/plain\r\n\r\n" + file + "\r\n--XyZ\r\n"
+                             "Content-Disposition: form-data; name=empty\r\n\r\n"
+                             "\r\n--XyZ--\r\nepilogue";
+    const std::string raw = MultipartRequest(body);
+    const size_t steps[] = {1, 3, 7, 64, raw.size()};
+    for(size_t step: steps) {
+        UploadRecorder sink;
+        request.SetUploadSink(&sink);
+        for(size_t pos = 0; pos < raw.size(); pos += step) {
+            bool last = pos + step >= raw.size();
+            ASSERT_EQ(Parse(raw.substr(pos, step)), last ? HttpRequest::PARSE_OK : HttpRequest::PARSE_AGAIN)
+                << "step " << step << " at byte " << pos;
+        }
+        EXPECT_EQ(request.GetPost("title"), "hello world");
+        EXPECT_EQ(request.GetPost("empty"), "");
+        EXPECT_EQ(request.GetPost("doc"), "");
+        EXPECT_EQ(request.BodyLength(), body.size());
+        EXPECT_TRUE(request.body().empty());            // 交给sink之后不再保存请求体
+        ASSERT_EQ(sink.names.size(), 1u) << "step " << step;
+        EXPECT_EQ(sink.names[0], "doc");
+        EXPECT_EQ(sink.filenames[0], "a;b.txt");
+        EXPECT_EQ(sink.types[0], "text/plain");
+        EXPECT_EQ(sink.data[0], file) << "step " << step;
+        EXPECT_EQ(sink.ended, 1);
+    }
+    // 没有sink时文件部分跳过，请求体原样保留
+    request.SetUploadSink(nullptr);
+    ASSERT_EQ(Parse(raw), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.GetPost("title"), "hello world");
+    EXPECT_EQ(request.body(), body);
+}
+
+TEST_F(HttpRequestTest, MultipartErrors) {
+    const std::string corpus[] = {
+        "--XyZ\r\nContent-Disposition: form-data; name=a\r\n\r\nno closing boundary",
+        "--XyZ\r\nContent-Disposition: form-data; name=a\r\n\r\n1\r\n--XyZ-x",
+        "--XyZ\r\nno colon\r\n\r\n1\r\n--XyZ--",
+        "--XyZx\r\n",
+    };
+    for(const std::string& body: corpus) {
+        buffer.RetrieveAll();
+        EXPECT_EQ(Parse(MultipartRequest(body)), HttpRequest::PARSE_ERROR) << body;
+        EXPECT_EQ(request.ErrorCode(), 400) << body;
+    }
+    buffer.RetrieveAll();
+    EXPECT_EQ(Parse("POST / HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=\r\nContent-Length: 0\r\n\r\n"),
+              HttpRequest::PARSE_ERROR);
+    EXPECT_EQ(request.ErrorCode(), 400);
+}
+
+// chunked请求体一个字节一个字节到达：大小行带扩展、chunk数据里有换行、最后有trailer，后面紧跟下一个请求
+TEST_F(HttpRequestTest, ChunkedBody) {
+    const std::string raw = "POST /post HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: Chunked\r\n\r\n"
+                            "5;name=v\r\nhello\r\n"
+                            "A\r\n\r\nwor\nld!!\r\n"
+                            "0\r\nX-Trailer: t\r\n\r\n";
+    for(size_t i = 0; i < raw.size() - 1; i++) {
+        ASSERT_EQ(Parse(raw.substr(i, 1)), HttpRequest::PARSE_AGAIN) << "at byte " << i;
+    }
+    ASSERT_EQ(Parse(raw.substr(raw.size() - 1) + "GET /next HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.body(), "hello\r\nwor\nld!!");
+    EXPECT_EQ(request.BodyLength(), 15u);
+    EXPECT_EQ(request.GetHeader("Host"), "x");          // 请求头在拷出来的那份上依然有效
+    EXPECT_EQ(request.GetHeader("X-Trailer"), "");      // trailer不并入请求头
+    EXPECT_EQ(request.method(), "POST");
+    ASSERT_EQ(request.parse(buffer), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.path(), "/next");
+}
+
+// 大请求体边收边取走，读缓冲区不会涨到请求体那么大；超过内存上限的写到临时文件
+TEST_F(HttpRequestTest, LargeBodySpillsToFile) {
+    std::string body;
+    for(size_t i = 0; body.size() < HttpRequest::bodyMemBytes * 3; i++) {
+        body += std::to_string(i) + "\n";
+    }
+    const std::string heads[] = {
+        "POST /upload HTTP/1.1\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n",
+        "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+    };
+    for(const std::string& head: heads) {
+        bool chunked = head.find("chunked") != std::string::npos;
+        ASSERT_EQ(Parse(head), HttpRequest::PARSE_AGAIN);
+        for(size_t pos = 0; pos < body.size(); pos += 4000) {
+            std::string piece = body.substr(pos, 4000);
+            if(chunked) {
+                char size[16];
+                snprintf(size, sizeof(size), "%zx\r\n", piece.size());
+                piece = size + piece + "\r\n";
+            }
+            ASSERT_EQ(Parse(piece), chunked || pos + 4000 < body.size() ? HttpRequest::PARSE_AGAIN : HttpRequest::PARSE_OK);
+            ASSERT_EQ(buffer.ReadableBytes(), 0u);
+        }
+        if(chunked) {
+            ASSERT_EQ(Parse("0\r\n\r\n"), HttpRequest::PARSE_OK);
+        }
+        EXPECT_EQ(request.BodyLength(), body.size());
+        EXPECT_TRUE(request.body().empty());
+        ASSERT_GE(request.BodyFd(), 0);
+        std::string stored(body.size(), '\0');
+        ASSERT_EQ(pread(request.BodyFd(), &stored[0], stored.size(), 0), (ssize_t)body.size());
+        EXPECT_EQ(stored, body);
+    }
+    // 下一个请求开始时临时文件关闭
+    int fd = request.BodyFd();
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.BodyFd(), -1);
+    EXPECT_EQ(fcntl(fd, F_GETFD), -1);
+}
+
+// 定界出错时ErrorCode()给出应回的状态码
+TEST_F(HttpRequestTest, BodyFramingErrors) {
+    const struct {
+        const char* raw;
+        int code;
+    } corpus[] = {
+        {"POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n", 400},  // 请求走私
+        {"POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\n", 400},
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n", 501},
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", 400},
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3 x\r\n", 400},
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabcX", 400},      // chunk数据后不是CRLF
+        {"POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nffffffffffffffffffff\r\n", 413},
+        {"POST / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n", 413},
+    };
+    for(const auto& c: corpus) {
+        buffer.RetrieveAll();
+        EXPECT_EQ(Parse(c.raw), HttpRequest::PARSE_ERROR) << c.raw;
+        EXPECT_EQ(request.ErrorCode(), c.code) << c.raw;
+    }
+    // 相同的重复Content-Length可以接受
+    buffer.RetrieveAll();
+    ASSERT_EQ(Parse("POST / HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\nok"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.body(), "ok");
+}
+
+// chunked解码后的请求体超过上限
+TEST_F(HttpRequestTest, ChunkedBodyTooLarge) {
+    size_t saved = HttpRequest::maxBodyBytes;
+    HttpRequest::maxBodyBytes = 8;
+    ASSERT_EQ(Parse("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n"), HttpRequest::PARSE_AGAIN);
+    EXPECT_EQ(Parse("5\r\nworld\r\n"), HttpRequest::PARSE_ERROR);
+    EXPECT_EQ(request.ErrorCode(), 413);
+    HttpRequest::maxBodyBytes = saved;
+}
+
+// 已知请求头放在固定槽位：名字不区分大小写，重复出现时取第一个，遍历时先列出
+TEST_F(HttpRequestTest, KnownHeaderSlots) {
+    for(int id = 0; id < HeaderTable::COUNT; id++) {
+        std::string upper(HeaderTable::NAMES[id]);
+        for(char& ch: upper) { ch = toupper(ch); }
+        EXPECT_EQ(HeaderTable::Lookup(HeaderTable::NAMES[id]), id);
+        EXPECT_EQ(HeaderTable::Lookup(upper), id);
+    }
+    EXPECT_EQ(HeaderTable::Lookup("hos"), HeaderTable::UNKNOWN);
+    EXPECT_EQ(HeaderTable::Lookup("X-Host"), HeaderTable::UNKNOWN);
+    EXPECT_EQ(HeaderTable::Lookup(""), HeaderTable::UNKNOWN);
+
+    ASSERT_EQ(Parse("GET / HTTP/1.1\r\nX-A: 1\r\nhOST: h1\r\nCookie: c=1\r\nHost: h2\r\n"
+                    "If-None-Match: \"e\"\r\n\r\n"), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.GetHeader(HeaderTable::HOST), "h1");
+    EXPECT_EQ(request.GetHeader("host"), "h1");
+    EXPECT_EQ(request.GetHeader(HeaderTable::COOKIE), "c=1");
+    EXPECT_EQ(request.GetHeader(HeaderTable::IF_NONE_MATCH), "\"e\"");
+    EXPECT_EQ(request.GetHeader(HeaderTable::RANGE), "");
+    EXPECT_EQ(request.GetHeader("x-a"), "1");
+    ASSERT_EQ(request.HeaderCount(), 5u);
+    EXPECT_EQ(request.HeaderAt(0), HttpRequest::Header("hOST", "h1"));
+    EXPECT_EQ(request.HeaderAt(1).first, "If-None-Match");
+    EXPECT_EQ(request.HeaderAt(2).first, "Cookie");
+    EXPECT_EQ(request.HeaderAt(3), HttpRequest::Header("X-A", "1"));
+    EXPECT_EQ(request.HeaderAt(4), HttpRequest::Header("Host", "h2"));
+}
+
+// 稳态下解析请求、生成响应都不分配堆内存：临时数据都在连接共用的arena里，arena也不再向malloc要内存
+TEST_F(HttpRequestTest, SteadyStateNoAllocation) {
+    char dir[] = "/tmp/httprequesttestXXXXXX";
+    ASSERT_NE(mkdtemp(dir), nullptr);
+    const std::string srcDir = std::string(dir) + "/";
+    const std::string index = srcDir + "index.html";
+    FILE* f = fopen(index.c_str(), "w");
+    ASSERT_NE(f, nullptr);
+    fputs("<html>hello</html>", f);
+    fclose(f);
+
+    Arena arena;
+    HttpResponse response;
+    request.SetArena(&arena);
+    response.SetArena(&arena);
+    Buffer out;
+    const std::string raw = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+                            "POST /form HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                            "Content-Length: 19\r\n\r\nuser=abc&text=x+y+z"
+                            "GET /missing.png HTTP/1.1\r\n\r\n";
+    int codes[3];
+    auto round = [&]() {
+        buffer.Append(raw);
+        for(int &code: codes) {
+            if(request.parse(buffer) != HttpRequest::PARSE_OK) { return false; }
+            response.Init(srcDir.c_str(), request.path(), request.IsKeepAlive(), 200);
+            response.MakeResponse(out);
+            code = response.Code();
+            out.RetrieveAll();
+        }
+        return true;
+    };
+    for(int i = 0; i < 4; i++) {
+        ASSERT_TRUE(round());    // 预热：缓冲区、请求头数组和arena长到稳定大小
+    }
+    size_t news = g_newCount, blocks = arena.BlockAllocs();
+    bool ok = true;
+    for(int i = 0; i < 100; i++) {
+        ok = round() && ok;
+    }
+    size_t newsPerRound = g_newCount - news;
+    EXPECT_TRUE(ok);
+    EXPECT_EQ(newsPerRound, 0u);
+    EXPECT_EQ(arena.BlockAllocs(), blocks);
+    EXPECT_EQ(codes[0], 200);
+    EXPECT_EQ(codes[2], 404);
+
+    buffer.Append(raw);
+    request.parse(buffer);
+    ASSERT_EQ(request.parse(buffer), HttpRequest::PARSE_OK);
+    EXPECT_EQ(request.GetPost("text"), "x y z");
+    EXPECT_EQ(request.body(), "user=abc&text=x+y+z");    // 表单在arena的副本上解码，请求体保持原样
+    unlink(index.c_str());
+    rmdir(dir);
+}
+
+// 多个请求连在一起（pipelining）：每次只取走一个
+TEST_F(HttpRequestTest, Pipelined) {
+    buffer.Append("GET /a HTTP/1.1\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 3\r\n\r\nxyzGET /c HTTP/1.1\r\n\r\n");
+    const char* paths[] = {"/a", "/b", "/c"};
+    for(const char* path: paths) {
+        ASSERT_EQ(request.parse(buffer), HttpRequest::PARSE_OK);
+        EXPECT_EQ(request.path(), path);
+    }
+    EXPECT_EQ(request.method(), "GET");
+    EXPECT_EQ(buffer.ReadableBytes(), 0u);
+}
+
+// 环形缓冲区回绕：连续的请求流按不对齐的块写入，缓冲区里总留着半个请求，请求会跨过缓冲区末尾
+TEST_F(HttpRequestTest, RingBufferWrap) {
+    Buffer small(64);
+    const std::string raw = "GET /video HTTP/1.1\r\nHost: a\r\n\r\n";
+    std::string stream;
+    for(int i = 0; i < 20; i++) { stream += raw; }
+    int parsed = 0;
+    for(size_t pos = 0; pos < stream.size(); pos += 21) {
+        small.Append(stream.substr(pos, 21));
+        while(true) {
+            HttpRequest::PARSE_RESULT ret = request.parse(small);
+            if(ret == HttpRequest::PARSE_AGAIN) { break; }
+            ASSERT_EQ(ret, HttpRequest::PARSE_OK) << "request " << parsed;
+            EXPECT_EQ(request.path(), "/video.html");
+            EXPECT_EQ(request.GetHeader("Host"), "a");
+            parsed++;
+        }
+    }
+    EXPECT_EQ(parsed, 20);
+    EXPECT_EQ(small.ReadableBytes(), 0u);
+}
+
+// 一致性语料：格式错误的请求都应该返回PARSE_ERROR
+TEST_F(HttpRequestTest, Malformed) {
+    const char* corpus[] = {
+        "GET /\r\n\r\n",                            // 没有版本
+        "GET  / HTTP/1.1\r\n\r\n",                  // 多余空格
+        "GET / HTTP/1.1 \r\n\r\n",
+        " GET / HTTP/1.1\r\n\r\n",
+        "G(T / HTTP/1.1\r\n\r\n",                   // 方法不是token
+        "GET /a\x01 HTTP/1.1\r\n\r\n",              // 请求目标里有控制字符
+        "GET / HTTP/1.x\r\n\r\n",
+        "GET / HTTP/11\r\n\r\n",
+        "GET / FTP/1.1\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost : x\r\n\r\n",       // 冒号前有空白
+        "GET / HTTP/1.1\r\n: x\r\n\r\n",            // 空名字
+        "GET / HTTP/1.1\r\nNoColon\r\n\r\n",
+        "GET / HTTP/1.1\r\nA: b\r\n folded\r\n\r\n", // 折行
+        "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+    };
+    for(const char* raw: corpus) {
+        buffer.RetrieveAll();
+        EXPECT_EQ(Parse(raw), HttpRequest::PARSE_ERROR) << raw;
+    }
+}
+
+TEST_F(HttpRequestTest, HeaderTooLarge) {
+    std::string raw = "GET / HTTP/1.1\r\nX-Big: " + std::string(HttpRequest::MAX_HEADER_BYTES, 'a');
+    EXPECT_EQ(Parse(raw), HttpRequest::PARSE_ERROR);
+}
+
+TEST_F(HttpRequestTest, IsBlocking) {
+    buffer.Append("POST /login HTTP/1.1\r\n");
+    EXPECT_TRUE(HttpRequest::IsBlocking(buffer));
+    buffer.RetrieveAll();
+    buffer.Append("GET /login HTTP/1.1\r\n");
+    EXPECT_FALSE(HttpRequest::IsBlocking(buffer));
+}
+
+// 每种实现在所有起点、长度、命中位置上都和逐字节查找结果一致（覆盖16/32字节块的尾部）
+TEST(CharScanTest, AllLevelsAgree) {
+    std::string data(100, 'a');
+    for(int level = CharScan::SCALAR; level <= CharScan::MaxLevel(); level++) {
+        ASSERT_EQ(CharScan::SetLevel(CharScan::Level(level)), level);
+        for(size_t hit = 0; hit <= data.size(); hit++) {
+            std::string s = data;
+            if(hit < s.size()) { s[hit] = ':'; }
+            for(size_t begin = 0; begin < 40; begin++) {
+                for(size_t len = 0; begin + len <= s.size(); len += 7) {
+                    const char* p = s.data() + begin, *end = p + len;
+                    const char* expect = (hit >= begin && hit < begin + len) ? s.data() + hit : end;
+                    ASSERT_EQ(CharScan::FindEither(p, end, '\n', ':'), expect)
+                        << CharScan::LevelName(CharScan::Level(level)) << " begin " << begin << " len " << len;
+                    ASSERT_EQ(CharScan::Find(p, end, ':'), expect);
+                }
+            }
+        }
+    }
+    CharScan::SetLevel(CharScan::MaxLevel());
+}
+
+TEST_F(HttpRequestTest, ParseWithEveryScanLevel) {
+    const std::string raw = "GET /index.html HTTP/1.1\r\nHost: localhost:1316\r\n"
+                            "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36\r\n"
+                            "Accept: text/html,application/xhtml+xml;q=0.9\r\nX-Colon: a:b:c\r\n\r\n";
+    for(int level = CharScan::SCALAR; level <= CharScan::MaxLevel(); level++) {
+        CharScan::SetLevel(CharScan::Level(level));
+        ASSERT_EQ(Parse(raw), HttpRequest::PARSE_OK);
+        EXPECT_EQ(request.GetHeader("user-agent"), "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36");
+        EXPECT_EQ(request.GetHeader("X-Colon"), "a:b:c");
+        EXPECT_EQ(request.HeaderCount(), 4u);
+    }
+    CharScan::SetLevel(CharScan::MaxLevel());
+}
+
+static std::string Unhex(const char* hex) {
+    std::string out;
+    for(; hex[0] && hex[1]; hex += 2) {
+        if(hex[0] == ' ') { hex--; continue; }
+        out += static_cast<char>(std::stoi(std::string(hex, 2), nullptr, 16));
+    }
+    return out;
+}
+
+static std::vector<std::pair<std::string, std::string>> DecodeBlock(HpackDecoder& decoder, const std::string& block) {
+    std::vector<std::pair<std::string, std::string>> headers;
+    bool ok = decoder.Decode(reinterpret_cast<const uint8_t*>(block.data()), block.size(),
+        [&](std::string_view name, std::string_view value) {
+            headers.emplace_back(std::string(name), std::string(value));
+        });
+    if(!ok) { headers.emplace_back("<error>", ""); }
+    return headers;
+}
+
+// RFC 7541 附录C.3（不用Huffman）和C.4（用Huffman）：同一个连接上的三个请求，动态表跟着更新
+TEST(HpackTest, RfcRequestExamples) {
+    const char* blocks[][3] = {
+        {"828684410f7777772e6578616d706c652e636f6d",
+         "828684be58086e6f2d6361636865",
+         "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565"},
+        {"828684418cf1e3c2e5f23a6ba0ab90f4ff",
+         "828684be5886a8eb10649cbf",
+         "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"},
+    };
+    for(auto& example: blocks) {
+        HpackDecoder decoder;
+        auto h1 = DecodeBlock(decoder, Unhex(example[0]));
+        ASSERT_EQ(h1.size(), 4u);
+        EXPECT_EQ(h1[0], std::make_pair(std::string(":method"), std::string("GET")));
+        EXPECT_EQ(h1[3], std::make_pair(std::string(":authority"), std::string("www.example.com")));
+        EXPECT_EQ(decoder.Table().Size(), 57u);
+
+        auto h2 = DecodeBlock(decoder, Unhex(example[1]));
+        ASSERT_EQ(h2.size(), 5u);
+        EXPECT_EQ(h2[3].second, "www.example.com");     // 动态表索引62
+        EXPECT_EQ(h2[4], std::make_pair(std::string("cache-control"), std::string("no-cache")));
+        EXPECT_EQ(decoder.Table().Size(), 110u);
+
+        auto h3 = DecodeBlock(decoder, Unhex(example[2]));
+        ASSERT_EQ(h3.size(), 5u);
+        EXPECT_EQ(h3[1], std::make_pair(std::string(":scheme"), std::string("https")));
+        EXPECT_EQ(h3[2].second, "/index.html");
+        EXPECT_EQ(h3[4], std::make_pair(std::string("custom-key"), std::string("custom-value")));
+        EXPECT_EQ(decoder.Table().Size(), 164u);
+        EXPECT_EQ(decoder.Table().DynamicCount(), 3u);
+    }
+}
+
+TEST(HpackTest, HuffmanRoundTrip) {
+    std::string all;
+    for(int c = 0; c < 256; c++) { all += static_cast<char>(c); }
+    for(const std::string& s: {std::string(""), std::string("www.example.com"), std::string("text/html; charset=utf-8"), all}) {
+        std::string encoded, decoded;
+        HpackCodec::HuffmanEncode(s, encoded);
+        EXPECT_EQ(encoded.size(), HpackCodec::HuffmanLength(s));
+        ASSERT_TRUE(HpackCodec::HuffmanDecode(reinterpret_cast<const uint8_t*>(encoded.data()), encoded.size(), decoded));
+        EXPECT_EQ(decoded, s);
+    }
+    // 填充不是全1，或者超过7位（一整个字节的EOS前缀）都是错误
+    std::string out;
+    EXPECT_FALSE(HpackCodec::HuffmanDecode(reinterpret_cast<const uint8_t*>("\xf0"), 1, out));
+    EXPECT_FALSE(HpackCodec::HuffmanDecode(reinterpret_cast<const uint8_t*>("\x07\xff"), 2, out));
+}
+
+// 编码器和解码器的动态表同步：重复的头部第二次只用索引
+TEST(HpackTest, EncoderDecoderAgree) {
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    for(int round = 0; round < 3; round++) {
+        std::string block;
+        encoder.Begin(block);
+        encoder.EncodeStatus(round == 2 ? 404 : 200, block);
+        encoder.Encode("content-type", "text/html", true, block);
+        encoder.Encode("content-length", std::to_string(3148 + round), false, block);
+        if(round > 0) {
+            EXPECT_LT(block.size(), 10u);
+        }
+        auto headers = DecodeBlock(decoder, block);
+        ASSERT_EQ(headers.size(), 3u);
+        EXPECT_EQ(headers[0].second, round == 2 ? "404" : "200");
+        EXPECT_EQ(headers[1].second, "text/html");
+        EXPECT_EQ(headers[2].second, std::to_string(3148 + round));
+    }
+    EXPECT_EQ(decoder.Table().Size(), encoder.Table().Size());
+}
+
+// 按行生成的页面，记下被要了几次
+class LinesBody : public StreamBody {
+public:
+    LinesBody(int lines, int* calls) : line_(0), lines_(lines), calls_(calls) {}
+    bool Next(Buffer& chunk, size_t hint) override {
+        (*calls_)++;
+        while(line_ < lines_ && chunk.ReadableBytes() + 64 <= hint) {
+            chunk.Append(Line(line_++));
+        }
+        return line_ < lines_;
+    }
+    static std::string Line(int i) { return "<li>post " + std::to_string(i) + "</li>\n"; }
+    static std::string All(int lines) {
+        std::string all;
+        for(int i = 0; i < lines; i++) { all += Line(i); }
+        return all;
+    }
+private:
+    int line_, lines_;
+    int* calls_;
+};
+
+class Http2SessionTest : public ::testing::Test {
+protected:
+    // 资源目录里只有一个index.html
+    static std::string MakeDir(const std::string& page) {
+        char tmpl[] = "/tmp/h2testXXXXXX";
+        if(!mkdtemp(tmpl)) { return "/nonexistent"; }
+        FILE* fp = fopen((std::string(tmpl) + "/index.html").c_str(), "w");
+        if(fp) {
+            fwrite(page.data(), 1, page.size(), fp);
+            fclose(fp);
+        }
+        return tmpl;
+    }
+    void TearDown() override {
+        unlink((dir + "/index.html").c_str());
+        rmdir(dir.c_str());
+    }
+
+    static std::string Frame(uint8_t type, uint8_t flags, uint32_t id, const std::string& payload) {
+        std::string f;
+        f += static_cast<char>(payload.size() >> 16);
+        f += static_cast<char>(payload.size() >> 8);
+        f += static_cast<char>(payload.size());
+        f += static_cast<char>(type);
+        f += static_cast<char>(flags);
+        for(int shift = 24; shift >= 0; shift -= 8) { f += static_cast<char>(id >> shift); }
+        return f + payload;
+    }
+
+    // 一次Process的输出按顺序展开：输出缓冲区的内容和文件切片交替
+    std::string Run(const std::string& input, int* n) {
+        in.Append(input);
+        OutSegment segs[16];
+        int segCnt = 0;
+        *n = session.Process(in, out, segs, 16, &segCnt, false, false);
+        std::string all(out.Peek(), out.ReadableBytes());
+        std::string flat;
+        size_t begin = 0;
+        for(int i = 0; i < segCnt; i++) {
+            flat += all.substr(begin, segs[i].headerEnd - begin);
+            flat.append(segs[i].data, segs[i].len);
+            begin = segs[i].headerEnd;
+            if(segs[i].file) { FileCache::Release(segs[i].file); }
+        }
+        flat += all.substr(begin);
+        out.RetrieveAll();
+        return flat;
+    }
+
+    struct Frm { uint8_t type, flags; uint32_t id; std::string payload; };
+    static std::vector<Frm> Frames(const std::string& s) {
+        std::vector<Frm> frames;
+        for(size_t pos = 0; pos + 9 <= s.size();) {
+            size_t len = (uint8_t(s[pos]) << 16) | (uint8_t(s[pos + 1]) << 8) | uint8_t(s[pos + 2]);
+            uint32_t id = (uint8_t(s[pos + 5]) << 24) | (uint8_t(s[pos + 6]) << 16) | (uint8_t(s[pos + 7]) << 8) | uint8_t(s[pos + 8]);
+            frames.push_back({uint8_t(s[pos + 3]), uint8_t(s[pos + 4]), id, s.substr(pos + 9, len)});
+            pos += 9 + len;
+        }
+        return frames;
+    }
+
+    std::string page = std::string(40000, 'x');
+    std::string dir = MakeDir(page);
+    HttpRequest request;
+    HttpResponse response;
+    Http2Session session{request, response, dir.c_str()};
+    Buffer in, out;
+};
+
+// prior knowledge：两个并发的GET，文件按DATA帧切片直接引用映射，不超过对端的窗口
+TEST_F(Http2SessionTest, ConcurrentGets) {
+    std::string preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    // :method GET, :scheme http, :path /, :authority www.example.com；第二个请求的authority用动态表索引
+    std::string get = Unhex("828684410f7777772e6578616d706c652e636f6d");
+    int n = 0;
+    EXPECT_EQ(Run(preface.substr(0, 10), &n).size(), 15u);    // 服务器先发SETTINGS
+    EXPECT_EQ(n, 0);
+    std::string output = Run(preface.substr(10) + Frame(Http2Session::SETTINGS, 0, 0, "") +
+                             Frame(Http2Session::HEADERS, 0x5, 1, get) +
+                             Frame(Http2Session::HEADERS, 0x5, 3, Unhex("828684be")), &n);
+    EXPECT_EQ(n, 2);
+    size_t data[4] = {0};
+    bool ended[4] = {false};
+    int statusSeen = 0;
+    HpackDecoder decoder;
+    for(const Frm& f: Frames(output)) {
+        if(f.type == Http2Session::HEADERS) {
+            auto headers = DecodeBlock(decoder, f.payload);
+            ASSERT_FALSE(headers.empty());
+            EXPECT_EQ(headers[0], std::make_pair(std::string(":status"), std::string("200")));
+            statusSeen++;
+        } else if(f.type == Http2Session::DATA) {
+            ASSERT_LE(f.payload.size(), size_t(Http2Session::MAX_FRAME_SIZE));
+            EXPECT_EQ(f.payload, page.substr(data[f.id], f.payload.size()));
+            data[f.id] += f.payload.size();
+            ended[f.id] = f.flags & 0x1;
+        }
+    }
+    EXPECT_EQ(statusSeen, 2);
+    // 连接窗口65535，两个流一共只能发这么多，流之间轮转
+    EXPECT_EQ(data[1] + data[3], size_t(Http2Session::DEFAULT_WINDOW));
+    EXPECT_GT(data[3], 0u);
+    EXPECT_EQ(session.PendingWork(), 0u);    // 连接窗口用完，等WINDOW_UPDATE，不用再调用Process
+
+    // 窗口归还后发完剩下的
+    std::string inc = Unhex("00100000");
+    output = Run(Frame(Http2Session::WINDOW_UPDATE, 0, 0, inc) + Frame(Http2Session::WINDOW_UPDATE, 0, 1, inc) +
+                 Frame(Http2Session::WINDOW_UPDATE, 0, 3, inc), &n);
+    for(const Frm& f: Frames(output)) {
+        if(f.type == Http2Session::DATA) {
+            data[f.id] += f.payload.size();
+            ended[f.id] = f.flags & 0x1;
+        }
+    }
+    EXPECT_EQ(data[1], page.size());
+    EXPECT_EQ(data[3], page.size());
+    EXPECT_TRUE(ended[1] && ended[3]);
+    EXPECT_EQ(session.PendingWork(), 0u);
+    EXPECT_TRUE(session.IsAlive());
+}
+
+// 流式响应体按窗口分成DATA帧，最后一帧带END_STREAM
+TEST_F(Http2SessionTest, StreamingBody) {
+    const int lines = 2000;
+    static int calls;       // 登记的路由在测试结束后还留在表里，不能引用局部变量
+    calls = 0;
+    Router::Instance()->Handle("GET", "/feed2", [](HttpRequest&, HttpResponse& response) {
+        response.SetStream(std::unique_ptr<StreamBody>(new LinesBody(lines, &calls)), "application/rss+xml");
+    });
+    // :method GET, :scheme http, :path /feed2（字面量）, :authority x
+    std::string get = Unhex("82860406") + "/feed2" + Unhex("410178");
+    int n = 0;
+    std::string output = Run(std::string("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") +
+                             Frame(Http2Session::HEADERS, 0x5, 1, get), &n);
+    EXPECT_EQ(n, 1);
+    std::string body;
+    bool ended = false;
+    HpackDecoder decoder;
+    for(const Frm& f: Frames(output)) {
+        if(f.type == Http2Session::HEADERS) {
+            EXPECT_FALSE(f.flags & 0x1);
+            auto headers = DecodeBlock(decoder, f.payload);
+            EXPECT_EQ(headers[0].second, "200");
+            for(auto& h: headers) {
+                EXPECT_NE(h.first, "transfer-encoding");
+                EXPECT_NE(h.first, "content-length");
+            }
+        } else if(f.type == Http2Session::DATA) {
+            EXPECT_FALSE(ended);
+            body += f.payload;
+            ended = f.flags & 0x1;
+        }
+    }
+    EXPECT_TRUE(ended);
+    EXPECT_EQ(body, LinesBody::All(lines));
+    EXPECT_GT(calls, 1);
+}
+
+// 多个流同时上传大请求体：单个流超过bodyMemBytes、或者合计超过MAX_BODY_BUFFER的写临时文件，内存占用有上限
+TEST_F(Http2SessionTest, LargeBodiesOnManyStreams) {
+    static std::vector<std::string> bodies;
+    Router::Instance()->Handle("POST", "/h2upload", [](HttpRequest& request, HttpResponse& response) {
+        std::string body = request.body();
+        if(request.BodyFd() >= 0) {
+            body.resize(request.BodyLength());
+            EXPECT_EQ(pread(request.BodyFd(), &body[0], body.size(), 0), (ssize_t)body.size());
+        }
+        bodies.push_back(body);
+        response.SetPath("/index.html");
+    });
+    // :method POST, :scheme http, :path /h2upload（字面量）, :authority x
+    std::string post = Unhex("83860409") + "/h2upload" + Unhex("410178");
+    const int streams = 6;
+    const size_t frame = 16000, frames = 13;
+    auto byteAt = [](uint32_t id, size_t i) { return char('a' + (i * 7 + id) % 26); };
+    size_t savedMem = HttpRequest::bodyMemBytes;
+    // 第一轮每个流都不超过bodyMemBytes，只靠合计上限；第二轮用默认的bodyMemBytes
+    for(size_t memBytes: {HttpRequest::maxBodyBytes, savedMem}) {
+        HttpRequest::bodyMemBytes = memBytes;
+        bodies.clear();
+        session.Init();
+        int n = 0;
+        std::string input = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        for(int k = 0; k < streams; k++) {
+            input += Frame(Http2Session::HEADERS, 0x4, 1 + 2 * k, post);
+        }
+        Run(input, &n);
+        int done = 0;
+        size_t peak = 0;
+        for(size_t f = 0; f < frames; f++) {
+            input.clear();
+            for(int k = 0; k < streams; k++) {
+                uint32_t id = 1 + 2 * k;
+                std::string payload(frame, 0);
+                for(size_t i = 0; i < frame; i++) { payload[i] = byteAt(id, f * frame + i); }
+                input += Frame(Http2Session::DATA, f + 1 == frames ? 0x1 : 0, id, payload);
+            }
+            Run(input, &n);
+            done += n;
+            EXPECT_LE(session.BufferedBodyBytes(), size_t(Http2Session::MAX_BODY_BUFFER));
+            peak = std::max(peak, session.BufferedBodyBytes());
+        }
+        EXPECT_GT(peak, 0u);
+        EXPECT_EQ(done, streams);
+        EXPECT_EQ(session.BufferedBodyBytes(), 0u);
+        ASSERT_EQ(bodies.size(), size_t(streams));
+        for(const std::string& body: bodies) {
+            ASSERT_EQ(body.size(), frame * frames);
+            uint32_t id = (body[0] - 'a') % 26;
+            bool same = true;
+            for(size_t i = 0; i < body.size() && same; i++) { same = body[i] == byteAt(id, i); }
+            EXPECT_TRUE(same);
+        }
+    }
+    HttpRequest::bodyMemBytes = savedMem;
+}
+
+// 协议错误回GOAWAY并关闭；连接前言不对直接关闭
+TEST_F(Http2SessionTest, ConnectionErrors) {
+    int n = 0;
+    std::string preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    // 流0上的DATA
+    std::string output = Run(preface + Frame(Http2Session::DATA, 0, 0, "abc"), &n);
+    auto frames = Frames(output);
+    ASSERT_EQ(frames.back().type, Http2Session::GOAWAY);
+    EXPECT_EQ(frames.back().payload.substr(4), Unhex("00000001"));
+    EXPECT_FALSE(session.IsAlive());
+    EXPECT_EQ(in.ReadableBytes(), 0u);
+
+    session.Init();
+    output = Run("GET / HTTP/1.1\r\n\r\n", &n);
+    EXPECT_EQ(Frames(output).back().type, Http2Session::GOAWAY);
+    EXPECT_FALSE(session.IsAlive());
+
+    // 头部块解码失败是COMPRESSION_ERROR
+    session.Init();
+    output = Run(preface + Frame(Http2Session::HEADERS, 0x5, 1, Unhex("ff")), &n);
+    EXPECT_EQ(Frames(output).back().payload.substr(4), Unhex("00000009"));
+}
+
+// 读出对端已经发来的全部数据
+static void DrainSocket(int fd, std::string& received) {
+    char buf[65536];
+    ssize_t n;
+    while((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        received.append(buf, n);
+    }
+}
+
+// 解chunked编码的响应体，格式不对返回false
+static bool Unchunk(std::string_view body, std::string& out) {
+    while(true) {
+        size_t eol = body.find("\r\n");
+        if(eol == std::string_view::npos) { return false; }
+        size_t len = std::stoul(std::string(body.substr(0, eol)), nullptr, 16);
+        body.remove_prefix(eol + 2);
+        if(len == 0) { return body == "\r\n"; }
+        if(body.size() < len + 2 || body.substr(len, 2) != "\r\n") { return false; }
+        out.append(body.substr(0, len));
+        body.remove_prefix(len + 2);
+    }
+}
+
+// 流式响应：HTTP/1.1用chunked，生成跟着套接字的可写状态走；HTTP/1.0不带长度，发完关闭
+TEST(StreamBodyTest, ChunkedWithBackPressure) {
+    const int lines = 20000;
+    static int calls;       // 登记的路由在测试结束后还留在表里，不能引用局部变量
+    calls = 0;
+    Router::Instance()->Handle("GET", "/feed", [](HttpRequest&, HttpResponse& response) {
+        response.SetStream(std::unique_ptr<StreamBody>(new LinesBody(lines, &calls)), "text/html");
+    });
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    int sndbuf = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    HttpConn::srcDir = "/nonexistent";
+    HttpConn conn;
+    sockaddr_storage addr = {};
+    addr.ss_family = AF_UNIX;
+    conn.init(fds[0], addr);
+
+    std::string raw = "GET /feed HTTP/1.1\r\nHost: x\r\n\r\nGET /feed HTTP/1.0\r\n\r\n";
+    ASSERT_EQ(send(fds[1], raw.data(), raw.size(), 0), (ssize_t)raw.size());
+    int err = 0;
+    conn.read(&err);
+    ASSERT_EQ(conn.process(false), 1);      // 流式响应结束这一批，第二个请求留在读缓冲区
+    conn.write(&err);
+    ASSERT_GT(conn.ToWriteBytes(), 0u);
+    EXPECT_EQ(err, EAGAIN);
+    EXPECT_LT(calls, 10);                   // 对端没读，只生成了套接字放得下的几段
+    std::string received;
+    while(conn.ToWriteBytes() > 0) {
+        DrainSocket(fds[1], received);
+        conn.write(&err);
+    }
+    DrainSocket(fds[1], received);
+    size_t headEnd = received.find("\r\n\r\n");
+    ASSERT_NE(headEnd, std::string::npos);
+    std::string head = received.substr(0, headEnd);
+    EXPECT_NE(head.find("HTTP/1.1 200 OK"), std::string::npos);
+    EXPECT_NE(head.find("Transfer-Encoding: chunked"), std::string::npos);
+    EXPECT_NE(head.find("text/html"), std::string::npos);
+    std::string body;
+    ASSERT_TRUE(Unchunk(std::string_view(received).substr(headEnd + 4), body));
+    EXPECT_EQ(body, LinesBody::All(lines));
+    EXPECT_TRUE(conn.IsKeepAlive());
+
+    ASSERT_GT(conn.ToReadBytes(), 0u);
+    ASSERT_EQ(conn.process(false), 1);
+    received.clear();
+    do {
+        conn.write(&err);
+        DrainSocket(fds[1], received);
+    } while(conn.ToWriteBytes() > 0);
+    DrainSocket(fds[1], received);
+    headEnd = received.find("\r\n\r\n");
+    ASSERT_NE(headEnd, std::string::npos);
+    EXPECT_EQ(received.find("chunked"), std::string::npos);
+    EXPECT_EQ(received.find("Content-length"), std::string::npos);
+    EXPECT_NE(received.substr(0, headEnd).find("Connection: close"), std::string::npos);
+    EXPECT_EQ(received.substr(headEnd + 4), LinesBody::All(lines));
+    EXPECT_FALSE(conn.IsKeepAlive());
+    conn.Close();
+    close(fds[1]);
+}
+
+// 每个连接的请求数上限：最后一个响应带Connection: close，流水线里之后的请求不再处理
+TEST(HttpConnTest, KeepAliveLimits) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    HttpConn::srcDir = "/nonexistent";
+    HttpConn::maxRequests = 3;
+    HttpConn::keepAliveTimeoutSec = 5;
+    HttpConn conn;
+    sockaddr_storage addr = {};
+    addr.ss_family = AF_UNIX;
+    conn.init(fds[0], addr);
+
+    std::string one = "GET /a HTTP/1.1\r\nHost: x\r\n\r\n";
+    std::string raw = one + one + one + one;
+    ASSERT_EQ(send(fds[1], raw.data(), raw.size(), 0), (ssize_t)raw.size());
+    int err = 0;
+    conn.read(&err);
+    ASSERT_EQ(conn.process(false), 3);
+    conn.write(&err);
+    EXPECT_EQ(conn.ToWriteBytes(), 0u);
+    EXPECT_FALSE(conn.IsKeepAlive());
+    EXPECT_EQ(conn.Requests(), 3u);
+    std::string received;
+    DrainSocket(fds[1], received);
+    std::vector<std::string> heads;
+    for(size_t pos = 0; (pos = received.find("HTTP/1.1 ", pos)) != std::string::npos; pos++) {
+        heads.push_back(received.substr(pos, received.find("\r\n\r\n", pos) - pos));
+    }
+    ASSERT_EQ(heads.size(), 3u);
+    EXPECT_NE(heads[0].find("Connection: keep-alive\r\nKeep-Alive: timeout=5, max=2"), std::string::npos);
+    EXPECT_NE(heads[1].find("Keep-Alive: timeout=5, max=1"), std::string::npos);
+    EXPECT_NE(heads[2].find("Connection: close"), std::string::npos);
+    EXPECT_EQ(heads[2].find("Keep-Alive"), std::string::npos);
+    HttpConn::maxRequests = 0;
+    HttpConn::keepAliveTimeoutSec = 0;
+    conn.Close();
+    close(fds[1]);
+}
+
+// HEAD只回响应头：流水线里紧跟着的GET响应不能被多出来的响应体错位，流式响应也不发chunk
+TEST(HttpConnTest, HeadThenGetPipelined) {
+    char tmpl[] = "/tmp/headtestXXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl));
+    std::string dir = tmpl;
+    std::string page(3000, 'p');
+    FILE* fp = fopen((dir + "/index.html").c_str(), "w");
+    ASSERT_TRUE(fp);
+    fwrite(page.data(), 1, page.size(), fp);
+    fclose(fp);
+    static int calls;
+    calls = 0;
+    Router::Instance()->Handle("GET", "/headfeed", [](HttpRequest&, HttpResponse& response) {
+        response.SetStream(std::unique_ptr<StreamBody>(new LinesBody(10, &calls)), "text/plain");
+    });
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    std::string srcDir = dir;
+    HttpConn::srcDir = srcDir.c_str();
+    HttpConn conn;
+    sockaddr_storage addr = {};
+    addr.ss_family = AF_UNIX;
+    conn.init(fds[0], addr);
+
+    std::string raw = "HEAD /index.html HTTP/1.1\r\nHost: x\r\n\r\n"
+                      "HEAD /nope.html HTTP/1.1\r\nHost: x\r\n\r\n"
+                      "HEAD /headfeed HTTP/1.1\r\nHost: x\r\n\r\n"
+                      "GET /index.html HTTP/1.1\r\nHost: x\r\n\r\n";
+    ASSERT_EQ(send(fds[1], raw.data(), raw.size(), 0), (ssize_t)raw.size());
+    int err = 0;
+    conn.read(&err);
+    ASSERT_EQ(conn.process(false), 4);
+    conn.write(&err);
+    EXPECT_EQ(conn.ToWriteBytes(), 0u);
+    EXPECT_TRUE(conn.IsKeepAlive());
+    EXPECT_EQ(calls, 0);
+    std::string received;
+    DrainSocket(fds[1], received);
+
+    std::vector<std::string> heads;
+    size_t pos = 0;
+    for(int i = 0; i < 4; i++) {
+        ASSERT_EQ(received.compare(pos, 9, "HTTP/1.1 "), 0) << received.substr(pos, 40);
+        size_t end = received.find("\r\n\r\n", pos);
+        ASSERT_NE(end, std::string::npos);
+        heads.push_back(received.substr(pos, end - pos));
+        pos = end + 4;
+    }
+    EXPECT_NE(heads[0].find("200 OK"), std::string::npos);
+    EXPECT_NE(heads[0].find("Content-length: 3000"), std::string::npos);
+    EXPECT_NE(heads[1].find("404 Not Found"), std::string::npos);
+    EXPECT_NE(heads[2].find("Transfer-Encoding: chunked"), std::string::npos);
+    EXPECT_NE(heads[3].find("Content-length: 3000"), std::string::npos);
+    EXPECT_EQ(received.substr(pos), page);
+    conn.Close();
+    close(fds[1]);
+    unlink((dir + "/index.html").c_str());
+    rmdir(dir.c_str());
+}
+
+// 静态文件缓存：命中不再打开文件，文件被替换后重新加载，旧条目在释放前仍然有效
+TEST(FileCacheTest, HitAndInvalidate) {
+    char tmpl[] = "/tmp/fctestXXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl));
+    std::string dir = tmpl;
+    auto writeFile = [](const std::string& path, const std::string& data, mode_t mode) {
+        FILE* fp = fopen(path.c_str(), "w");
+        ASSERT_TRUE(fp);
+        fwrite(data.data(), 1, data.size(), fp);
+        fclose(fp);
+        chmod(path.c_str(), mode);
+    };
+    std::string page = dir + "/a.html";
+    writeFile(page, "hello", 0644);
+    writeFile(dir + "/secret.html", "x", 0600);
+    FileCache* cache = FileCache::Instance();
+    size_t hits = cache->Hits(), misses = cache->Misses(), invalidations = cache->Invalidations();
+
+    const FileCache::Entry* first = nullptr;
+    ASSERT_EQ(cache->Acquire(page.c_str(), "text/html", &first), 200);
+    EXPECT_EQ(std::string(first->data, first->size), "hello");
+    EXPECT_EQ(first->header, "Content-type: text/html\r\nContent-length: 5\r\n\r\n");
+    EXPECT_EQ(first->type, "text/html");
+    const FileCache::Entry* again = nullptr;
+    ASSERT_EQ(cache->Acquire(page.c_str(), "text/html", &again), 200);
+    EXPECT_EQ(again, first);
+    FileCache::Release(again);
+    EXPECT_EQ(cache->Hits(), hits + 1);
+    EXPECT_EQ(cache->Misses(), misses + 1);
+
+    // 写新文件再rename过去，超过重新检查的间隔后换成新内容，还拿着的旧条目不受影响
+    writeFile(page + ".new", "changed!", 0644);
+    ASSERT_EQ(rename((page + ".new").c_str(), page.c_str()), 0);
+    usleep((FileCache::REVALIDATE_MS + 50) * 1000);
+    const FileCache::Entry* fresh = nullptr;
+    ASSERT_EQ(cache->Acquire(page.c_str(), "text/html", &fresh), 200);
+    EXPECT_NE(fresh, first);
+    EXPECT_EQ(std::string(fresh->data, fresh->size), "changed!");
+    EXPECT_EQ(cache->Invalidations(), invalidations + 1);
+    EXPECT_EQ(std::string(first->data, first->size), "hello");
+    FileCache::Release(first);
+    FileCache::Release(fresh);
+
+    const FileCache::Entry* none = nullptr;
+    EXPECT_EQ(cache->Acquire((dir + "/missing.html").c_str(), "text/html", &none), 404);
+    EXPECT_EQ(cache->Acquire(dir.c_str(), "text/plain", &none), 404);
+    EXPECT_EQ(cache->Acquire((dir + "/secret.html").c_str(), "text/html", &none), 403);
+    EXPECT_EQ(none, nullptr);
+
+    cache->Clear();
+    unlink(page.c_str());
+    unlink((dir + "/secret.html").c_str());
+    rmdir(dir.c_str());
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,268 @@
+/*
+    简单的HTTP/1.1压测客户端，用于在同一负载下比较不同的服务器配置（例如epoll与io_uring后端）
+    每个连接保持keep-alive，收到完整响应后立即发下一个请求，服务器关闭连接
+    （响应带Connection: close，例如达到每连接请求数上限）时自动重连
+
+    编译: cd build && make bench
+    用法: ../bin/loadbench [-h host] [-p port] [-s UNIX域套接字] [-c 连接数] [-d 秒数] [-u 路径] [-P 服务器pid]
+                           [-D 流水线深度]
+        -h 可以是IPv6地址；-s 指定时走UNIX域套接字，"@name"为抽象命名空间
+        -P 统计该进程在压测期间消耗的CPU时间（/proc/pid/stat里的utime+stime）
+        -D 每个连接一次连发多个请求（HTTP/1.1 pipelining），全部响应收齐后再发下一批
+
+    对比两种后端:
+        ../bin/server -b epoll &   ../bin/loadbench -c 64 -d 10 -u /index.html
+        ../bin/server -b uring &   ../bin/loadbench -c 64 -d 10 -u /index.html
+
+    流水线深度与单连接吞吐:
+        ../bin/loadbench -c 1 -d 5 -D 1
+        ../bin/loadbench -c 1 -d 5 -D 16
+
+    对比回环TCP与UNIX域套接字:
+        ../bin/server -l 1316,unix:@blog &
+        ../bin/loadbench -c 64 -d 10 -P $(pgrep -n server)
+        ../bin/loadbench -c 64 -d 10 -P $(pgrep -n server) -s @blog
+*/
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Client {
+    int fd = -1;
+    std::string in;
+    size_t parsed = 0;      // in里已经数过的完整响应的字节数
+    int responses = 0;      // 这一批已经收到的响应数
+    bool closing = false;   // 收到了带Connection: close的响应，之后的请求不会再有响应
+    size_t sent = 0;
+    Clock::time_point start;
+};
+
+static const char* host = "127.0.0.1";
+static int port = 1316;
+static const char* unixPath = nullptr;
+static std::string request;
+
+static int Connect() {
+    struct sockaddr_storage addr;
+    socklen_t len;
+    memset(&addr, 0, sizeof(addr));
+    if(unixPath) {
+        struct sockaddr_un* un = (struct sockaddr_un*)&addr;
+        un->sun_family = AF_UNIX;
+        strncpy(un->sun_path, unixPath, sizeof(un->sun_path) - 1);
+        len = sizeof(struct sockaddr_un);
+        if(unixPath[0] == '@') {     // 抽象命名空间
+            un->sun_path[0] = '\0';
+            len = offsetof(struct sockaddr_un, sun_path) + strlen(unixPath);
+        }
+    } else if(strchr(host, ':')) {
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        inet_pton(AF_INET6, host, &in6->sin6_addr);
+        len = sizeof(*in6);
+    } else {
+        struct sockaddr_in* in = (struct sockaddr_in*)&addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        inet_pton(AF_INET, host, &in->sin_addr);
+        len = sizeof(*in);
+    }
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(!unixPath) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    if(connect(fd, (struct sockaddr*)&addr, len) < 0 && errno != EINPROGRESS && errno != EAGAIN) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 进程累计的CPU时间（毫秒），读不到返回-1
+static long CpuMs(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* fp = fopen(path, "r");
+    if(!fp) return -1;
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[n] = '\0';
+    // 进程名里可能有空格，从最后一个')'之后开始数：utime、stime是第14、15个字段
+    char* p = strrchr(buf, ')');
+    if(!p) return -1;
+    unsigned long utime = 0, stime = 0;
+    if(sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+    return (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+}
+
+// 返回从begin开始的完整响应的长度，不完整返回0；响应带Connection: close时置*close
+static size_t ResponseLen(const std::string& in, size_t begin, bool* close) {
+    size_t end = in.find("\r\n\r\n", begin);
+    if(end == std::string::npos) return 0;
+    size_t bodyLen = 0;
+    size_t pos = begin;
+    while(pos < end) {
+        size_t eol = in.find("\r\n", pos);
+        if(eol - pos > 15 && strncasecmp(in.c_str() + pos, "Content-Length:", 15) == 0) {
+            bodyLen = strtoul(in.c_str() + pos + 15, nullptr, 10);
+        }
+        if(eol - pos == 17 && strncasecmp(in.c_str() + pos, "Connection: close", 17) == 0) {
+            *close = true;
+        }
+        pos = eol + 2;
+    }
+    if(in.size() < end + 4 + bodyLen) {
+        *close = false;     // 响应还不完整，等收齐后再数
+        return 0;
+    }
+    return end + 4 + bodyLen - begin;
+}
+
+int main(int argc, char* argv[]) {
+    int conns = 32, seconds = 10, serverPid = 0, depth = 1;
+    const char* path = "/index.html";
+    int opt;
+    while((opt = getopt(argc, argv, "h:p:s:c:d:u:P:D:")) != -1) {
+        switch(opt) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 's': unixPath = optarg; break;
+        case 'P': serverPid = atoi(optarg); break;
+        case 'c': conns = atoi(optarg); break;
+        case 'd': seconds = atoi(optarg); break;
+        case 'u': path = optarg; break;
+        case 'D': depth = std::max(1, atoi(optarg)); break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-s unix socket] [-c conns] [-d seconds] [-u path] [-P server pid] [-D depth]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    std::string one = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: keep-alive\r\n\r\n";
+    for(int i = 0; i < depth; i++) { request += one; }
+
+    int epfd = epoll_create1(0);
+    std::vector<Client> clients(conns);
+    std::vector<uint32_t> latencyUs;
+    latencyUs.reserve(1 << 20);
+    size_t errors = 0, reconnects = 0;
+
+    auto open = [&](int i) {
+        Client& c = clients[i];
+        c.fd = Connect();
+        c.in.clear();
+        c.parsed = 0;
+        c.responses = 0;
+        c.closing = false;
+        c.sent = 0;
+        c.start = Clock::now();
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    };
+    auto reopen = [&](int i) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, clients[i].fd, nullptr);
+        close(clients[i].fd);
+        reconnects++;
+        open(i);
+    };
+    for(int i = 0; i < conns; i++) { open(i); }
+
+    char buf[65536];
+    struct epoll_event events[1024];
+    long cpuBegin = serverPid > 0 ? CpuMs(serverPid) : -1;
+    Clock::time_point begin = Clock::now();
+    Clock::time_point deadline = begin + std::chrono::seconds(seconds);
+    while(Clock::now() < deadline) {
+        int n = epoll_wait(epfd, events, 1024, 100);
+        for(int k = 0; k < n; k++) {
+            int i = events[k].data.u32;
+            Client& c = clients[i];
+            if(events[k].events & EPOLLOUT) {
+                while(c.sent < request.size()) {
+                    ssize_t len = write(c.fd, request.data() + c.sent, request.size() - c.sent);
+                    if(len <= 0) break;
+                    c.sent += len;
+                }
+            }
+            if(events[k].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                bool closed = false;
+                while(true) {
+                    ssize_t len = read(c.fd, buf, sizeof(buf));
+                    if(len > 0) { c.in.append(buf, len); continue; }
+                    if(len == 0 || errno != EAGAIN) { closed = true; }
+                    break;
+                }
+                size_t respLen;
+                bool close = false;
+                while(!c.closing && c.responses < depth && (respLen = ResponseLen(c.in, c.parsed, &close)) > 0) {
+                    latencyUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                                            Clock::now() - c.start).count());
+                    c.parsed += respLen;
+                    c.responses++;
+                    c.closing = close;
+                }
+                if(c.responses == depth || c.closing) {
+                    if(closed || c.closing || c.in.size() > c.parsed) {
+                        reopen(i);
+                        continue;
+                    }
+                    // 下一批请求
+                    c.in.clear();
+                    c.parsed = 0;
+                    c.responses = 0;
+                    c.sent = 0;
+                    c.start = Clock::now();
+                    ssize_t len = write(c.fd, request.data(), request.size());
+                    if(len > 0) c.sent = len;
+                }
+                else if(closed) {
+                    errors++;
+                    reopen(i);
+                }
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+    long cpuEnd = serverPid > 0 ? CpuMs(serverPid) : -1;
+
+    std::sort(latencyUs.begin(), latencyUs.end());
+    auto pct = [&](double p) -> unsigned {
+        if(latencyUs.empty()) return 0;
+        return latencyUs[std::min(latencyUs.size() - 1, static_cast<size_t>(p * latencyUs.size()))];
+    };
+    printf("requests: %zu in %.2fs, %.0f req/s\n", latencyUs.size(), elapsed, latencyUs.size() / elapsed);
+    printf("latency(us): p50 %u  p90 %u  p99 %u  max %u\n",
+            pct(0.50), pct(0.90), pct(0.99), latencyUs.empty() ? 0 : latencyUs.back());
+    printf("errors: %zu  reconnects: %zu\n", errors, reconnects);
+    if(cpuBegin >= 0 && cpuEnd >= 0) {
+        printf("server cpu: %ld ms (%.1f%%), %.2f us/request\n", cpuEnd - cpuBegin,
+                (cpuEnd - cpuBegin) / (elapsed * 10),
+                latencyUs.empty() ? 0.0 : (cpuEnd - cpuBegin) * 1000.0 / latencyUs.size());
+    }
+    for(auto& c: clients) { close(c.fd); }
+    close(epfd);
+    return 0;
+}
@@ -0,0 +1,333 @@
+/*
+    HTTP请求解析的微基准
+    1. 整个请求：对比现在的状态机解析器和原来基于std::regex的逐行解析
+       两边都是先把请求Append进Buffer再解析，统计每个请求的耗时和堆分配次数
+    2. 只切分请求头行：对比原来HttpRequest::search的std::search找CRLF（回绕时拼接两段）
+       和CharScan各级实现（逐字节/SSE2/AVX2），分别测连续和跨环形缓冲区末尾两种情况
+    3. 慢速客户端：请求分成小块陆续到达，每到一块解析一次，对比续传（只扫新字节）
+       和每次从头重新解析（原来process()先Init()的做法）
+    4. urlencoded解码：对比原来逐字节拼std::string的解码和HttpRequest::UrlDecode
+       （CharScan各级实现跳过不需要解码的字节），请求体是一篇大部分不用转义的长文章
+
+    编译: cd build && make parserbench
+    用法: ../bin/parserbench [-n 每种请求的次数]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <regex>
+#include <string>
+#include <unordered_map>
+
+#include "../code/http/httprequest.h"
+
+// 统计堆分配次数
+static std::atomic<size_t> allocs(0);
+
+void* operator new(size_t n) {
+    allocs++;
+    void* p = malloc(n ? n : 1);
+    if(!p) { throw std::bad_alloc(); }
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+// 原来的解析方式：每行拷贝成std::string，请求行和请求头各跑一次regex_match
+class RegexParser {
+public:
+    bool parse(Buffer& buff) {
+        method_ = path_ = version_ = body_ = "";
+        header_.clear();
+        std::string data = buff.RetrieveAllToStr();
+        size_t pos = 0;
+        bool requestLine = true;
+        while(pos < data.size()) {
+            size_t end = data.find("\r\n", pos);
+            if(end == std::string::npos) { end = data.size(); }
+            std::string line = data.substr(pos, end - pos);
+            pos = end + 2;
+            if(requestLine) {
+                std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+                std::smatch subMatch;
+                if(!std::regex_match(line, subMatch, patten)) { return false; }
+                method_ = subMatch[1];
+                path_ = subMatch[2];
+                version_ = subMatch[3];
+                requestLine = false;
+                continue;
+            }
+            std::regex patten("^([^:]*): ?(.*)$");
+            std::smatch subMatch;
+            if(std::regex_match(line, subMatch, patten)) {
+                header_[subMatch[1]] = subMatch[2];
+            } else {
+                body_ = data.substr(pos);
+                break;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::string method_, path_, version_, body_;
+    std::unordered_map<std::string, std::string> header_;
+};
+
+static const char* CASES[][2] = {
+    {"curl", "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:1316\r\nUser-Agent: curl/8.5.0\r\n"
+             "Accept: */*\r\n\r\n"},
+    {"browser", "GET /picture HTTP/1.1\r\nHost: blog.example.com\r\nConnection: keep-alive\r\n"
+                "Cache-Control: max-age=0\r\nUpgrade-Insecure-Requests: 1\r\n"
+                "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+                "Chrome/120.0.0.0 Safari/537.36\r\n"
+                "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+                "Accept-Encoding: gzip, deflate, br\r\nAccept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                "Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+                "Referer: http://blog.example.com/index.html\r\n\r\n"},
+    {"post", "POST /comment HTTP/1.1\r\nHost: blog.example.com\r\nConnection: keep-alive\r\n"
+             "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: 27\r\n\r\n"
+             "name=snowy&text=hello+world"},
+    {"cookie", "GET /images/profile-image.jpg HTTP/1.1\r\nHost: blog.example.com\r\nConnection: keep-alive\r\n"
+               "sec-ch-ua: \"Not_A Brand\";v=\"8\", \"Chromium\";v=\"120\", \"Google Chrome\";v=\"120\"\r\n"
+               "sec-ch-ua-mobile: ?0\r\nsec-ch-ua-platform: \"Linux\"\r\n"
+               "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+               "Chrome/120.0.0.0 Safari/537.36\r\n"
+               "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+               "Sec-Fetch-Site: same-origin\r\nSec-Fetch-Mode: no-cors\r\nSec-Fetch-Dest: image\r\n"
+               "Referer: http://blog.example.com/picture.html\r\n"
+               "Accept-Encoding: gzip, deflate, br\r\nAccept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+               "Cookie: _ga=GA1.1.1234567890.1700000000; _ga_ABCDEFGHIJ=GS1.1.1700000000.1.1.1700000100.0.0.0; "
+               "session=0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef; "
+               "csrftoken=ZYXWVUTSRQPONMLKJIHGFEDCBAzyxwvutsrqponmlkjihgfedcba0123456789; theme=dark; "
+               "lang=zh-CN; tz=Asia%2FShanghai; consent=%7B%22analytics%22%3Atrue%2C%22ads%22%3Afalse%7D; "
+               "recent=%5B%22%2Fpicture%22%2C%22%2Fvideo%22%2C%22%2Findex%22%5D; "
+               "prefs=eyJmb250U2l6ZSI6MTQsImxheW91dCI6IndpZGUiLCJzaWRlYmFyIjp0cnVlLCJub3RpZnkiOmZhbHNlfQ\r\n"
+               "If-None-Match: W/\"b838-18c5d7a1f40\"\r\nIf-Modified-Since: Mon, 11 Dec 2023 08:00:00 GMT\r\n\r\n"},
+};
+
+// 原来HttpRequest::search的做法：std::search找CRLF，行跨过缓冲区末尾时把两段拼成一个std::string
+static std::string SearchLine(Buffer& buff, const char*& line) {
+    const char CRLF[] = "\r\n";
+    if(buff.Asc()) {
+        line = std::search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
+        return std::string(buff.Peek(), line);
+    }
+    line = std::search(buff.Peek(), buff.End(), CRLF, CRLF + 2);
+    if(line == buff.End()) { line = std::search(buff.Begin(), buff.BeginWriteConst(), CRLF, CRLF + 2); }
+    if(line >= buff.Peek()) { return std::string(buff.Peek(), line); }
+    std::string s(buff.Peek(), buff.End());
+    s.append(buff.Begin(), line);
+    return s;
+}
+
+static int SplitSearch(Buffer& buff) {
+    int lines = 0;
+    while(buff.ReadableBytes()) {
+        const char* lineEnd;
+        std::string s = SearchLine(buff, lineEnd);
+        lines++;
+        buff.RetrieveUntil(lineEnd + 2);
+        if(s.empty()) { break; }    // 空行，请求头结束
+    }
+    return lines;
+}
+
+// 现在的做法：回绕时先原地连续化，再每行一次扫描找':'和'\n'
+static int SplitScan(Buffer& buff) {
+    size_t len = buff.ReadableBytes();
+    const char* p = buff.Linearize(), *end = p + len;
+    int lines = 0;
+    while(p < end) {
+        const char* lf = CharScan::FindEither(p, end, ':', '\n');
+        if(lf != end && *lf == ':') { lf = CharScan::Find(lf + 1, end, '\n'); }
+        lines++;
+        bool empty = lf - p <= 1;
+        p = lf + 1;
+        if(empty) { break; }
+    }
+    buff.Retrieve(len);
+    return lines;
+}
+
+// 把raw放进buff；wrap时让raw从中间跨过缓冲区末尾（不拆开CRLF），不用Append垫数据以免计入拷贝
+static void Fill(Buffer& buff, const std::string& raw, bool wrap) {
+    if(wrap) {
+        size_t first = raw.size() / 2;
+        while(raw[first - 1] == '\r' || raw[first] == '\n') { first++; }
+        size_t off = buff.WritableBytes() + 1 - first;
+        buff.HasWritten(off);
+        buff.Retrieve(off - 1);
+        buff.Append(raw);
+        buff.Retrieve(1);
+    } else {
+        buff.Append(raw);
+    }
+}
+
+template<typename Split>
+static void RunScan(const char* name, const char* kind, const std::string& raw, bool wrap, int n, Split split) {
+    Buffer buff(4096);
+    Fill(buff, raw, wrap);
+    Buffer check(4096);
+    Fill(check, raw, false);
+    const int expect = SplitSearch(check);
+    for(int i = 0; i < 1000; i++) {     // 预热
+        split(buff);
+        Fill(buff, raw, wrap);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; i++) {
+        if(i) { Fill(buff, raw, wrap); }
+        if(split(buff) != expect) {
+            fprintf(stderr, "%s %s: line count mismatch\n", kind, name);
+            exit(1);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-8s %-7s %-6s %7.1f ns/req %6.2f GB/s\n", name, wrap ? "wrapped" : "linear", kind, ns / n,
+           raw.size() * n / ns);
+}
+
+template<typename Parse>
+static void Run(const char* name, const char* kind, const std::string& raw, int n, Parse parse) {
+    Buffer buff;
+    for(int i = 0; i < 1000; i++) {     // 预热，让缓冲区和各种容器的容量稳定下来
+        buff.Append(raw);
+        parse(buff);
+    }
+    size_t startAllocs = allocs;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; i++) {
+        buff.Append(raw);
+        if(!parse(buff)) {
+            fprintf(stderr, "%s %s: parse failed\n", kind, name);
+            exit(1);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-8s %-6s %9.1f ns/req %8.1f MB/s %6.2f allocs/req\n", name, kind, ns / n,
+           raw.size() * 1e3 * n / ns, double(allocs - startAllocs) / n);
+}
+
+static void RunTrickle(const std::string& raw, size_t chunk, bool restart, int n) {
+    Buffer buff;
+    HttpRequest request;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; i++) {
+        HttpRequest::PARSE_RESULT ret = HttpRequest::PARSE_AGAIN;
+        for(size_t pos = 0; pos < raw.size(); pos += chunk) {
+            buff.Append(raw.data() + pos, std::min(chunk, raw.size() - pos));
+            if(restart) { request.Init(); }
+            ret = request.parse(buff);
+        }
+        if(ret != HttpRequest::PARSE_OK) {
+            fprintf(stderr, "trickle: parse failed\n");
+            exit(1);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%5zu bytes in %3zu-byte chunks %-8s %9.1f ns/req\n", raw.size(), chunk,
+           restart ? "restart" : "resume", ns / n);
+}
+
+// 原来ParseFromUrlencoded_的解码：逐字节判断，结果逐字节追加（这里改正了%XX的算法以便核对结果）
+static size_t DecodeBytewise(const std::string& in, std::string& out) {
+    out.clear();
+    for(size_t i = 0; i < in.size(); i++) {
+        char ch = in[i];
+        if(ch == '+') {
+            out += ' ';
+        }
+        else if(ch == '%' && i + 2 < in.size() && isxdigit((unsigned char)in[i + 1]) && isxdigit((unsigned char)in[i + 2])) {
+            out += static_cast<char>(std::stoi(in.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        }
+        else {
+            out += ch;
+        }
+    }
+    return out.size();
+}
+
+static void RunDecode(const char* name, const std::string& in, int n, size_t (*decode)(const std::string&, std::string&)) {
+    std::string out;
+    size_t len = decode(in, out);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < n; i++) {
+        if(decode(in, out) != len) {
+            fprintf(stderr, "%s: decode mismatch\n", name);
+            exit(1);
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("urldecode %-8s %6zu bytes %9.1f ns %6.2f GB/s\n", name, in.size(), ns / n, in.size() * n / ns);
+}
+
+int main(int argc, char* argv[]) {
+    int n = 200000;
+    int opt;
+    while((opt = getopt(argc, argv, "n:")) != -1) {
+        if(opt == 'n') { n = atoi(optarg); }
+    }
+
+    HttpRequest request;
+    RegexParser regexParser;
+    for(auto& c: CASES) {
+        std::string raw = c[1];
+        Run(c[0], "fsm", raw, n, [&](Buffer& buff) {
+            request.Init();
+            return request.parse(buff) == HttpRequest::PARSE_OK;
+        });
+        Run(c[0], "regex", raw, n / 20, [&](Buffer& buff) { return regexParser.parse(buff); });
+    }
+
+    printf("\n");
+    std::string big = CASES[3][1];
+    big.insert(big.find("\r\n\r\n") + 2, "X-Padding: " + std::string(8192, 'p') + "\r\n");
+    for(const std::string& raw: {std::string(CASES[3][1]), big}) {
+        for(size_t chunk: {16, 128}) {
+            RunTrickle(raw, chunk, false, n / 100);
+            RunTrickle(raw, chunk, true, n / 100);
+        }
+    }
+
+    printf("\n");
+    for(auto& c: CASES) {
+        std::string raw = c[1];
+        raw.resize(raw.find("\r\n\r\n") + 4);   // 只要请求行和请求头
+        for(bool wrap: {false, true}) {
+            RunScan(c[0], "search", raw, wrap, n, SplitSearch);
+            for(int level = CharScan::SCALAR; level <= CharScan::MaxLevel(); level++) {
+                CharScan::SetLevel(CharScan::Level(level));
+                RunScan(c[0], CharScan::LevelName(CharScan::Level(level)), raw, wrap, n, SplitScan);
+            }
+        }
+    }
+
+    printf("\n");
+    std::string post;
+    while(post.size() < 16 * 1024) {
+        post += "The+quick+brown+fox+jumps+over+the+lazy+dog.+Lorem+ipsum+dolor+sit+amet%2C+consectetur+"
+                "adipiscing+elit%21%0D%0A";
+    }
+    std::string plain = post;
+    std::replace(plain.begin(), plain.end(), '+', '_');     // 只有少数%XX的情况
+    for(const std::string* in: {&post, &plain}) {
+        RunDecode("bytewise", *in, n / 100, DecodeBytewise);
+        for(int level = CharScan::SCALAR; level <= CharScan::MaxLevel(); level++) {
+            CharScan::SetLevel(CharScan::Level(level));
+            RunDecode(CharScan::LevelName(CharScan::Level(level)), *in, n / 100, [](const std::string& s, std::string& out) {
+                out.resize(s.size());
+                return HttpRequest::UrlDecode(s, &out[0]);
+            });
+        }
+    }
+    return 0;
+}